@@ -1,5 +1,6 @@
 
 #include <chrono>
+#include <cstring>
 #include <thread>
 #include <string>
 
@@ -18,6 +19,31 @@
 #include "cold_benchmark.hpp"
 #include "settings.hpp"
 
+// Free cores of the leased executor manager in the directory, -1 when it's not listed.
+int64_t free_cores(rfaas::resource_manager_connection & res_mgr, const rdmalib::LeaseResponse & lease)
+{
+  const rdmalib::Directory & dir = res_mgr.read_directory();
+  for(int i = 0; i < dir.size; ++i)
+    if(dir.entries[i].cores && dir.entries[i].port == lease.port && !strcmp(dir.entries[i].address, lease.address))
+      return dir.entries[i].free_cores;
+  return -1;
+}
+
+// The executor manager returns cores of the executor to the directory once it's released.
+bool released(rfaas::resource_manager_connection & res_mgr, const rdmalib::LeaseResponse & lease, int64_t expected)
+{
+  auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  int64_t cores = -1;
+  while(std::chrono::steady_clock::now() < end) {
+    cores = free_cores(res_mgr, lease);
+    if(cores == -1 || cores >= expected)
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  spdlog::error("Executor was not released, manager has {} free cores instead of {}", cores, expected);
+  return false;
+}
+
 int main(int argc, char ** argv)
 {
   auto opts = cold_benchmarker::opts(argc, argv);
@@ -43,12 +69,6 @@ int main(int argc, char ** argv)
     std::ifstream in_cfg(opts.executors_database);
     rfaas::servers::deserialize(in_cfg);
     in_cfg.close();
-  } else {
-    spdlog::error(
-      "Connection to resource manager is temporarily disabled, use executor database "
-      "option instead!"
-    );
-    return 1;
   }
 
   rfaas::executor executor(
@@ -57,6 +77,16 @@ int main(int argc, char ** argv)
     settings.device->default_receive_buffer_size,
     settings.device->max_inline_data
   );
+  // Without the executor database, executor managers are leased from the resource manager
+  if(opts.executors_database == "" && !executor.connect_resource_manager(
+    settings.resource_manager_address, settings.resource_manager_port
+  )) {
+    spdlog::error("Connection to resource manager failed!");
+    return 1;
+  }
+  // Releases are checked in the directory of the resource manager
+  bool check_release = executor._resource_manager && executor._resource_manager->query_directory();
+  int failed_releases = 0;
   std::vector<rdmalib::Buffer<char>> in;
   std::vector<rdmalib::Buffer<char>> out;
   for(int i = 0; i < opts.cores; ++i) {
@@ -85,7 +115,11 @@ int main(int argc, char ** argv)
       executor.execute(opts.fname, in, out);
       // End of function execution
       benchmarker.end(4);
+      rdmalib::LeaseResponse lease = executor._lease;
+      int64_t allocated = check_release ? free_cores(*executor._resource_manager, lease) : -1;
       executor.deallocate();
+      if(allocated != -1 && !released(*executor._resource_manager, lease, allocated + opts.cores))
+        ++failed_releases;
     } else {
       benchmarker.remove_last();
       spdlog::error("Allocation not succesfull");
@@ -121,5 +155,5 @@ int main(int argc, char ** argv)
     printf("\n");
   }
 
-  return 0;
+  return failed_releases ? 1 : 0;
 }
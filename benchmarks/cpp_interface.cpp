@@ -42,12 +42,6 @@ int main(int argc, char ** argv)
     std::ifstream in_cfg(opts.executors_database);
     rfaas::servers::deserialize(in_cfg);
     in_cfg.close();
-  } else {
-    spdlog::error(
-      "Connection to resource manager is temporarily disabled, use executor database "
-      "option instead!"
-    );
-    return 1;
   }
 
   rfaas::executor executor(
@@ -56,6 +50,13 @@ int main(int argc, char ** argv)
     settings.device->default_receive_buffer_size,
     settings.device->max_inline_data
   );
+  // Without the executor database, executor managers are leased from the resource manager
+  if(opts.executors_database == "" && !executor.connect_resource_manager(
+    settings.resource_manager_address, settings.resource_manager_port
+  )) {
+    spdlog::error("Connection to resource manager failed!");
+    return 1;
+  }
   if(!executor.allocate(
     opts.flib,
     2,
@@ -0,0 +1,182 @@
+
+#include <cstdlib>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <cxxopts.hpp>
+
+#include <rdmalib/rdmalib.hpp>
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/functions.hpp>
+#include <rdmalib/transport.hpp>
+
+#include <rfaas/executor.hpp>
+#include <rfaas/resources.hpp>
+
+#include "invocation_allocations.hpp"
+#include "settings.hpp"
+
+// Counts heap allocations of the invoking thread; operator new allocates through malloc.
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* ptr, size_t size);
+}
+
+static thread_local bool counting = false;
+static thread_local uint64_t allocations = 0;
+
+extern "C" {
+
+  void* malloc(size_t size)
+  {
+    if(counting)
+      ++allocations;
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size)
+  {
+    if(counting)
+      ++allocations;
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* ptr, size_t size)
+  {
+    if(counting)
+      ++allocations;
+    return __libc_realloc(ptr, size);
+  }
+
+}
+
+template<typename F>
+uint64_t count_allocations(F && f)
+{
+  allocations = 0;
+  counting = true;
+  f();
+  counting = false;
+  return allocations;
+}
+
+// Heap allocations on the invocation path of the client.
+// Scatter-gather lists up to the inline capacity must not allocate,
+// and neither should synchronous invocations after the warm-up, prepared or not.
+int main(int argc, char ** argv)
+{
+  auto opts = invocation_allocations::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test invocation allocations!");
+
+  bool correct = true;
+
+  // Software registration is sufficient to build the lists
+  std::vector<rdmalib::Buffer<char>> buffers;
+  for(uint32_t i = 0; i <= rdmalib::ScatterGatherElement::INLINE_ELEMENTS; ++i) {
+    buffers.emplace_back(64);
+    buffers.back().register_memory(nullptr, IBV_ACCESS_LOCAL_WRITE);
+  }
+  for(size_t elements = 1; elements <= buffers.size(); ++elements) {
+    size_t sges = 0;
+    uint64_t count = count_allocations([&]() {
+      rdmalib::ScatterGatherElement sge;
+      for(size_t i = 0; i < elements; ++i)
+        sge.add(buffers[i], 32, 0);
+      rdmalib::ScatterGatherElement moved{std::move(sge)};
+      sges = moved.size();
+    });
+    bool expected = elements <= rdmalib::ScatterGatherElement::INLINE_ELEMENTS ? count == 0 : count > 0;
+    spdlog::info("Scatter-gather list with {} elements: {} allocations", sges, count);
+    correct &= expected;
+  }
+
+  // Read device details
+  std::ifstream in_dev{opts.device_database};
+  rfaas::devices::deserialize(in_dev);
+  in_dev.close();
+
+  // Read benchmark settings
+  std::ifstream benchmark_cfg{opts.json_config};
+  rfaas::benchmark::Settings settings = rfaas::benchmark::Settings::deserialize(benchmark_cfg);
+  benchmark_cfg.close();
+
+  // Read connection details to the executors
+  if(opts.executors_database != "") {
+    std::ifstream in_cfg(opts.executors_database);
+    rfaas::servers::deserialize(in_cfg);
+    in_cfg.close();
+  }
+
+  rfaas::executor executor(
+    settings.device->ip_address,
+    settings.rdma_device_port,
+    settings.device->default_receive_buffer_size,
+    settings.device->max_inline_data
+  );
+  // Without the executor database, executor managers are leased from the resource manager
+  if(opts.executors_database == "" && !executor.connect_resource_manager(
+    settings.resource_manager_address, settings.resource_manager_port
+  )) {
+    spdlog::error("Connection to resource manager failed!");
+    return 1;
+  }
+  if(!executor.allocate(
+    opts.flib,
+    1,
+    opts.input_size,
+    settings.benchmark.hot_timeout,
+    false
+  )) {
+    spdlog::error("Connection to executor and allocation failed!");
+    return 1;
+  }
+
+  // Software transports queue their messages and completions on the heap
+  bool verbs = !rdmalib::software_transport() && !executor._shared_memory;
+  if(!verbs)
+    spdlog::info("Invocations use a software transport, their allocations are not checked");
+
+  rdmalib::Buffer<char> in(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE), out(opts.input_size);
+  in.register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
+  out.register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  memset(in.data(), 1, opts.input_size);
+
+  for(int i = 0; i < settings.benchmark.warmup_repetitions; ++i)
+    executor.execute(opts.fname, in, out);
+
+  int failures = 0;
+  uint64_t count = count_allocations([&]() {
+    for(int i = 0; i < settings.benchmark.repetitions; ++i)
+      failures += !std::get<0>(executor.execute(opts.fname, in, out));
+  });
+  spdlog::info(
+    "Executed {} invocations, {} failed, {} allocations, {} per invocation",
+    settings.benchmark.repetitions, failures, count,
+    static_cast<double>(count) / settings.benchmark.repetitions
+  );
+  correct &= !verbs || count == 0;
+
+  // Prepared invocations only patch the work request
+  rfaas::prepared_invocation invoc = executor.prepare(opts.fname, in, out);
+  failures = 0;
+  count = count_allocations([&]() {
+    for(int i = 0; i < settings.benchmark.repetitions; ++i)
+      failures += !std::get<0>(executor.execute(invoc));
+  });
+  spdlog::info(
+    "Executed {} prepared invocations, {} failed, {} allocations",
+    settings.benchmark.repetitions, failures, count
+  );
+  correct &= !verbs || count == 0;
+  executor.deallocate();
+
+  if(!correct)
+    spdlog::error("Unexpected allocations on the invocation path");
+  return correct ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+#ifndef __TESTS_INVOCATION_ALLOCATIONS_HPP__
+#define __TESTS_INVOCATION_ALLOCATIONS_HPP__
+
+#include <string>
+
+namespace invocation_allocations {
+
+  struct Options {
+
+    std::string json_config;
+    std::string device_database;
+    std::string executors_database;
+    bool verbose;
+    std::string fname;
+    std::string flib;
+    int input_size;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
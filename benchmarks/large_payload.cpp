@@ -0,0 +1,128 @@
+
+#include <chrono>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+#include <cxxopts.hpp>
+
+#include <rdmalib/rdmalib.hpp>
+#include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/benchmarker.hpp>
+#include <rdmalib/functions.hpp>
+
+#include <rfaas/executor.hpp>
+#include <rfaas/resources.hpp>
+
+#include "large_payload.hpp"
+#include "settings.hpp"
+
+// Throughput of invocations with large payloads.
+// Client buffers use the selected pages; pages of executor buffers
+// are selected in the configuration of the executor manager.
+int main(int argc, char ** argv)
+{
+  auto opts = large_payload::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test large payload!");
+
+  // Read device details
+  std::ifstream in_dev{opts.device_database};
+  rfaas::devices::deserialize(in_dev);
+  in_dev.close();
+
+  // Read benchmark settings
+  std::ifstream benchmark_cfg{opts.json_config};
+  rfaas::benchmark::Settings settings = rfaas::benchmark::Settings::deserialize(benchmark_cfg);
+  benchmark_cfg.close();
+
+  // Read connection details to the executors
+  if(opts.executors_database != "") {
+    std::ifstream in_cfg(opts.executors_database);
+    rfaas::servers::deserialize(in_cfg);
+    in_cfg.close();
+  }
+
+  rfaas::executor executor(
+    settings.device->ip_address,
+    settings.rdma_device_port,
+    settings.device->default_receive_buffer_size,
+    settings.device->max_inline_data
+  );
+  // Without the executor database, executor managers are leased from the resource manager
+  if(opts.executors_database == "" && !executor.connect_resource_manager(
+    settings.resource_manager_address, settings.resource_manager_port
+  )) {
+    spdlog::error("Connection to resource manager failed!");
+    return 1;
+  }
+  if(!executor.input_slots(opts.burst))
+    return 1;
+  if(!executor.allocate(
+    opts.flib,
+    1,
+    opts.input_size,
+    settings.benchmark.hot_timeout,
+    false
+  )) {
+    spdlog::error("Connection to executor and allocation failed!");
+    return 1;
+  }
+
+  rdmalib::PageSize page_size = rdmalib::page_size(opts.page_size);
+  std::vector<rdmalib::Buffer<char>> in;
+  std::vector<rdmalib::Buffer<char>> out;
+  for(int i = 0; i < opts.burst; ++i) {
+    in.emplace_back(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE, page_size);
+    in.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    memset(in.back().data(), 1, opts.input_size);
+  }
+  for(int i = 0; i < opts.burst; ++i) {
+    out.emplace_back(opts.input_size, 0, page_size);
+    out.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  }
+  // Huge pages might not be available
+  spdlog::info(
+    "Requested {} pages, allocated {} pages",
+    opts.page_size, rdmalib::page_size(in.front().page_size())
+  );
+
+  std::vector<std::future<int>> futures(opts.burst);
+  rdmalib::Benchmarker<1> benchmarker{settings.benchmark.repetitions};
+
+  auto burst = [&]() {
+    for(int j = 0; j < opts.burst; ++j)
+      futures[j] = executor.async(opts.fname, in[j], out[j]);
+    for(int j = 0; j < opts.burst; ++j)
+      futures[j].get();
+  };
+
+  spdlog::info("Warmups begin");
+  for(int i = 0; i < settings.benchmark.warmup_repetitions; ++i)
+    burst();
+  spdlog::info("Warmups completed");
+
+  for(int i = 0; i < settings.benchmark.repetitions; ++i) {
+    benchmarker.start();
+    burst();
+    benchmarker.end(0);
+  }
+
+  auto [median, avg] = benchmarker.summary();
+  // Bytes per microsecond are megabytes per second
+  double bytes = static_cast<double>(opts.input_size) * opts.burst;
+  spdlog::info(
+    "Executed {} bursts of {} invocations with {} bytes, {} pages, time avg {} usec, median {},"
+    " input throughput avg {} MB/s, median {} MB/s",
+    settings.benchmark.repetitions, opts.burst, opts.input_size, opts.page_size,
+    avg, median, bytes / avg, bytes / median
+  );
+  if(opts.output_stats != "")
+    benchmarker.export_csv(opts.output_stats, {"time"});
+  executor.deallocate();
+
+  return 0;
+}
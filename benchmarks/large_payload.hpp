@@ -0,0 +1,28 @@
+
+#ifndef __TESTS_LARGE_PAYLOAD_HPP__
+#define __TESTS_LARGE_PAYLOAD_HPP__
+
+#include <string>
+
+namespace large_payload {
+
+  struct Options {
+
+    std::string json_config;
+    std::string device_database;
+    std::string executors_database;
+    std::string output_stats;
+    bool verbose;
+    std::string fname;
+    std::string flib;
+    int input_size;
+    int burst;
+    std::string page_size;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+#include <cxxopts.hpp>
+
+#include <rdmalib/rdmalib.hpp>
+#include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/benchmarker.hpp>
+#include <rdmalib/functions.hpp>
+#include <rdmalib/mr_cache.hpp>
+
+#include <rfaas/executor.hpp>
+#include <rfaas/resources.hpp>
+
+#include "on_demand_paging.hpp"
+#include "settings.hpp"
+
+// Latency of zero-copy invocations on user memory.
+// Pinned buffers are registered through the cache, and buffers allocated for each
+// invocation miss it; on-demand paging uses one implicit registration, and the NIC
+// faults in the pages instead. Pages of executor input buffers follow the
+// "on_demand_paging" setting of the executor manager.
+int main(int argc, char ** argv)
+{
+  auto opts = on_demand_paging::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test on-demand paging!");
+
+  if(opts.registration != "pinned" && opts.registration != "odp") {
+    spdlog::error("Unknown registration {}", opts.registration);
+    return 1;
+  }
+
+  // Read device details
+  std::ifstream in_dev{opts.device_database};
+  rfaas::devices::deserialize(in_dev);
+  in_dev.close();
+
+  // Read benchmark settings
+  std::ifstream benchmark_cfg{opts.json_config};
+  rfaas::benchmark::Settings settings = rfaas::benchmark::Settings::deserialize(benchmark_cfg);
+  benchmark_cfg.close();
+
+  // Read connection details to the executors
+  if(opts.executors_database != "") {
+    std::ifstream in_cfg(opts.executors_database);
+    rfaas::servers::deserialize(in_cfg);
+    in_cfg.close();
+  }
+
+  rfaas::executor executor(
+    settings.device->ip_address,
+    settings.rdma_device_port,
+    settings.device->default_receive_buffer_size,
+    settings.device->max_inline_data
+  );
+  // SoftRoCE and older devices have no implicit on-demand paging - nothing to compare.
+  if(opts.registration == "odp" && !executor._registrations->enable_implicit_odp()) {
+    spdlog::warn("Device does not support implicit on-demand paging, skipping the benchmark");
+    return 0;
+  }
+  // Without the executor database, executor managers are leased from the resource manager
+  if(opts.executors_database == "" && !executor.connect_resource_manager(
+    settings.resource_manager_address, settings.resource_manager_port
+  )) {
+    spdlog::error("Connection to resource manager failed!");
+    return 1;
+  }
+  if(!executor.allocate(
+    opts.flib,
+    1,
+    opts.input_size,
+    settings.benchmark.hot_timeout,
+    false
+  )) {
+    spdlog::error("Connection to executor and allocation failed!");
+    return 1;
+  }
+
+  char* in = nullptr;
+  char* out = nullptr;
+  auto allocate = [&]() {
+    in = static_cast<char*>(malloc(opts.input_size));
+    out = static_cast<char*>(malloc(opts.input_size));
+    memset(in, 1, opts.input_size);
+  };
+  auto release = [&]() {
+    // The allocator can return the same addresses for different pages
+    executor.invalidate(in, opts.input_size);
+    executor.invalidate(out, opts.input_size);
+    free(in);
+    free(out);
+  };
+
+  rdmalib::Benchmarker<1> benchmarker{settings.benchmark.repetitions};
+  int failures = 0;
+  auto invoke = [&]() {
+    if(!opts.reuse_buffers)
+      allocate();
+    benchmarker.start();
+    failures += !std::get<0>(executor.execute(opts.fname, in, opts.input_size, out, opts.input_size));
+    benchmarker.end(0);
+    if(!opts.reuse_buffers)
+      release();
+  };
+
+  if(opts.reuse_buffers)
+    allocate();
+  spdlog::info("Warmups begin");
+  for(int i = 0; i < settings.benchmark.warmup_repetitions; ++i)
+    invoke();
+  benchmarker._measurements.clear();
+  spdlog::info("Warmups completed");
+
+  for(int i = 0; i < settings.benchmark.repetitions; ++i)
+    invoke();
+  if(opts.reuse_buffers)
+    release();
+
+  auto [median, avg] = benchmarker.summary();
+  double tail = benchmarker.percentile(0.99);
+  spdlog::info(
+    "Executed {} invocations with {} bytes, {} registration, {} buffers, {} failed,"
+    " pinned {} bytes, time avg {} usec, median {}, p99 {}",
+    settings.benchmark.repetitions, opts.input_size, opts.registration,
+    opts.reuse_buffers ? "reused" : "new", failures,
+    executor._registrations->registered_bytes(), avg, median, tail
+  );
+  if(opts.output_stats != "")
+    benchmarker.export_csv(opts.output_stats, {"time"});
+  executor.deallocate();
+
+  return 0;
+}
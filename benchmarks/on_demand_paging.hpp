@@ -0,0 +1,27 @@
+#ifndef __TESTS_ON_DEMAND_PAGING_HPP__
+#define __TESTS_ON_DEMAND_PAGING_HPP__
+
+#include <string>
+
+namespace on_demand_paging {
+
+  struct Options {
+
+    std::string json_config;
+    std::string device_database;
+    std::string executors_database;
+    std::string output_stats;
+    bool verbose;
+    std::string fname;
+    std::string flib;
+    int input_size;
+    std::string registration;
+    bool reuse_buffers;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
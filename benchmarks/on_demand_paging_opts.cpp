@@ -0,0 +1,48 @@
+
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include "on_demand_paging.hpp"
+
+namespace on_demand_paging {
+
+  Options options(int argc, char ** argv)
+  {
+    cxxopts::Options options("serverless-rdma-client", "Invoke functions");
+    options.add_options()
+      ("c,config", "JSON input config.",  cxxopts::value<std::string>())
+      ("device-database", "JSON configuration of devices.", cxxopts::value<std::string>())
+      ("executors-database", "JSON configuration of executor servers.", cxxopts::value<std::string>()->default_value(""))
+      ("output-stats", "Output file for benchmarking statistics.", cxxopts::value<std::string>()->default_value(""))
+      ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("name", "Function name", cxxopts::value<std::string>())
+      ("functions", "Functions library", cxxopts::value<std::string>())
+      ("s,size", "Packet size", cxxopts::value<int>()->default_value("1048576"))
+      ("registration", "Registration of user buffers: pinned, odp", cxxopts::value<std::string>()->default_value("pinned"))
+      ("reuse-buffers", "Invoke on the same buffers instead of new ones", cxxopts::value<bool>()->default_value("false"))
+      ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
+    ;
+    auto parsed_options = options.parse(argc, argv);
+    if(parsed_options.count("help"))
+    {
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+
+    Options result;
+    result.json_config = parsed_options["config"].as<std::string>();
+    result.device_database = parsed_options["device-database"].as<std::string>();
+    result.verbose = parsed_options["verbose"].as<bool>();
+    result.fname = parsed_options["name"].as<std::string>();
+    result.flib = parsed_options["functions"].as<std::string>();
+    result.input_size = parsed_options["size"].as<int>();
+    result.output_stats = parsed_options["output-stats"].as<std::string>();
+    result.executors_database = parsed_options["executors-database"].as<std::string>();
+    result.registration = parsed_options["registration"].as<std::string>();
+    result.reuse_buffers = parsed_options["reuse-buffers"].as<bool>();
+
+    return result;
+  }
+
+}
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/allocation.hpp>
+
+#include "placement_lookups.hpp"
+#include "../server/resource_manager/db.hpp"
+
+using rfaas::resource_manager::ExecutorDB;
+
+// Every n-th lease is timed
+constexpr int SAMPLING = 64;
+
+std::string executor_address(int idx)
+{
+  return "10.0." + std::to_string(idx / 256) + "." + std::to_string(idx % 256);
+}
+
+int main(int argc, char ** argv)
+{
+  auto opts = placement_lookups::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test placement_lookups!");
+
+  // The writer needs one more entry to add and remove an executor
+  if(opts.executors < 1 || opts.executors >= rdmalib::Directory::CAPACITY || opts.readers < 1 || opts.duration < 1) {
+    spdlog::error("Incorrect number of executors, readers, or duration");
+    return 1;
+  }
+
+  ExecutorDB db;
+  for(int i = 0; i < opts.executors; ++i)
+    db.add(executor_address(i), 10000, opts.cores);
+
+  std::atomic<bool> stop{false};
+  std::vector<uint64_t> lookups(opts.readers, 0);
+  std::vector<uint64_t> failed(opts.readers, 0);
+  std::vector<std::vector<uint64_t>> latencies(opts.readers);
+  uint64_t updates = 0;
+
+  std::vector<std::thread> threads;
+  for(int t = 0; t < opts.readers; ++t)
+    threads.emplace_back([&, t]() {
+      rdmalib::LeaseResponse lease;
+      uint64_t count = 0;
+      while(!stop.load(std::memory_order_relaxed)) {
+        bool sampled = !(count % SAMPLING);
+        auto begin = std::chrono::high_resolution_clock::now();
+        bool leased = db.lease(1, lease);
+        if(sampled) {
+          auto end = std::chrono::high_resolution_clock::now();
+          latencies[t].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+        }
+        if(leased)
+          db.release(lease.address, 1);
+        else
+          ++failed[t];
+        ++count;
+      }
+      lookups[t] = count;
+    });
+
+  // Registers and removes an executor, and sends heartbeats of all others.
+  std::thread writer;
+  if(opts.update_interval >= 0)
+    writer = std::thread([&]() {
+      std::string extra = executor_address(opts.executors);
+      std::vector<std::string> heartbeats;
+      for(int i = 0; i < opts.executors; ++i)
+        heartbeats.push_back(executor_address(i));
+      while(!stop.load(std::memory_order_relaxed)) {
+        if(updates % 2)
+          db.remove(extra);
+        else
+          db.add(extra, 10000, opts.cores);
+        if(!(updates % 64))
+          db.heartbeat(heartbeats);
+        ++updates;
+        if(opts.update_interval)
+          std::this_thread::sleep_for(std::chrono::microseconds(opts.update_interval));
+      }
+    });
+
+  std::this_thread::sleep_for(std::chrono::seconds(opts.duration));
+  stop.store(true);
+  for(auto & thread : threads)
+    thread.join();
+  if(writer.joinable())
+    writer.join();
+
+  uint64_t total = 0, total_failed = 0;
+  std::vector<uint64_t> samples;
+  for(int t = 0; t < opts.readers; ++t) {
+    total += lookups[t];
+    total_failed += failed[t];
+    samples.insert(samples.end(), latencies[t].begin(), latencies[t].end());
+  }
+  std::sort(samples.begin(), samples.end());
+  uint64_t median = samples.empty() ? 0 : samples[samples.size() / 2];
+  uint64_t p99 = samples.empty() ? 0 : samples[samples.size() * 99 / 100];
+  spdlog::info(
+    "{} readers, {} lookups per second, {} failed, median {} ns, 99th percentile {} ns",
+    opts.readers, total / opts.duration, total_failed, median, p99
+  );
+  spdlog::info("{} updates per second", updates / opts.duration);
+
+  if(opts.output_stats != "") {
+    std::ofstream out{opts.output_stats};
+    out << "readers,update_interval,lookups,updates,median,p99" << '\n';
+    out << opts.readers << ',' << opts.update_interval << ',' << total / opts.duration << ','
+      << updates / opts.duration << ',' << median << ',' << p99 << '\n';
+  }
+
+  return 0;
+}
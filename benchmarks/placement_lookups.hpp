@@ -0,0 +1,26 @@
+
+#ifndef __TESTS__PLACEMENT_LOOKUPS_HPP__
+#define __TESTS__PLACEMENT_LOOKUPS_HPP__
+
+#include <string>
+
+namespace placement_lookups {
+
+  struct Options {
+
+    int executors;
+    int cores;
+    int readers;
+    // Microseconds between updates; negative disables updates
+    int update_interval;
+    int duration;
+    std::string output_stats;
+    bool verbose;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
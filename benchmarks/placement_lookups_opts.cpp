@@ -0,0 +1,42 @@
+
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include "placement_lookups.hpp"
+
+namespace placement_lookups {
+
+  Options options(int argc, char ** argv)
+  {
+    cxxopts::Options options("placement-lookups", "Lease executors from the database while it's updated");
+    options.add_options()
+      ("executors", "Registered executors", cxxopts::value<int>()->default_value("64"))
+      ("cores", "Cores of each executor", cxxopts::value<int>()->default_value("32"))
+      ("readers", "Threads leasing and releasing executors", cxxopts::value<int>()->default_value("4"))
+      ("update-interval", "Microseconds between updates, negative disables them", cxxopts::value<int>()->default_value("0"))
+      ("d,duration", "Duration in seconds", cxxopts::value<int>()->default_value("5"))
+      ("output-stats", "Output file for benchmarking statistics.", cxxopts::value<std::string>()->default_value(""))
+      ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
+    ;
+    auto parsed_options = options.parse(argc, argv);
+    if(parsed_options.count("help"))
+    {
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+
+    Options result;
+    result.executors = parsed_options["executors"].as<int>();
+    result.cores = parsed_options["cores"].as<int>();
+    result.readers = parsed_options["readers"].as<int>();
+    result.update_interval = parsed_options["update-interval"].as<int>();
+    result.duration = parsed_options["duration"].as<int>();
+    result.output_stats = parsed_options["output-stats"].as<std::string>();
+    result.verbose = parsed_options["verbose"].as<bool>();
+
+    return result;
+  }
+
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/allocation.hpp>
+
+#include "registration_throughput.hpp"
+
+// Minimal HTTP/1.1 client reusing a single connection for all requests.
+struct HTTPClient {
+  int _fd;
+  std::string _host;
+  std::string _buffer;
+
+  HTTPClient(const std::string & address, int port):
+    _fd(-1),
+    _host(address + ":" + std::to_string(port))
+  {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+      spdlog::error("Incorrect address {}", address);
+      return;
+    }
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(_fd != -1 && connect(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+      spdlog::error("Couldn't connect to {}, reason {}", _host, strerror(errno));
+      close(_fd);
+      _fd = -1;
+    }
+  }
+
+  ~HTTPClient()
+  {
+    if(_fd != -1)
+      close(_fd);
+  }
+
+  bool connected() const
+  {
+    return _fd != -1;
+  }
+
+  // Returns the status code, or -1 when the connection failed.
+  int post(const std::string & resource, const std::string & body)
+  {
+    std::string request = "POST " + resource + " HTTP/1.1\r\nHost: " + _host +
+      "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+      "\r\n\r\n" + body;
+    size_t sent = 0;
+    while(sent < request.size()) {
+      ssize_t ret = send(_fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+      if(ret <= 0)
+        return -1;
+      sent += ret;
+    }
+
+    size_t headers_end;
+    while((headers_end = _buffer.find("\r\n\r\n")) == std::string::npos)
+      if(!receive())
+        return -1;
+    size_t length = 0;
+    size_t pos = _buffer.find("Content-Length:");
+    if(pos != std::string::npos && pos < headers_end)
+      length = std::stoul(_buffer.substr(pos + strlen("Content-Length:")));
+    while(_buffer.size() < headers_end + 4 + length)
+      if(!receive())
+        return -1;
+    // "HTTP/1.1 200 OK"
+    int status = std::stoi(_buffer.substr(_buffer.find(' ') + 1));
+    _buffer.erase(0, headers_end + 4 + length);
+    return status;
+  }
+
+  bool receive()
+  {
+    char data[4096];
+    ssize_t ret = recv(_fd, data, sizeof(data), 0);
+    if(ret <= 0)
+      return false;
+    _buffer.append(data, ret);
+    return true;
+  }
+};
+
+// Each client registers its own range of fake executors.
+std::string executor_address(int thread, int idx)
+{
+  return "10." + std::to_string(thread) + "." + std::to_string(idx / 256) + "." + std::to_string(idx % 256);
+}
+
+std::string addresses(int thread, int begin, int end)
+{
+  std::string body = "{\"executors\": [";
+  for(int i = begin; i < end; ++i)
+    body += (i != begin ? ", \"" : "\"") + executor_address(thread, i) + "\"";
+  return body + "]}";
+}
+
+// Failed requests are counted, and the benchmark continues.
+int register_single(HTTPClient & client, int thread, int executors)
+{
+  int failed = 0;
+  for(int i = 0; i < executors; ++i) {
+    std::string body = "{\"ip_address\": \"" + executor_address(thread, i) +
+      "\", \"port\": 10000, \"cores\": 1}";
+    failed += client.post("/add", body) != 200;
+  }
+  return failed;
+}
+
+int register_batch(HTTPClient & client, int thread, int executors, int batch)
+{
+  int failed = 0;
+  for(int i = 0; i < executors; i += batch) {
+    std::string body = "{\"executors\": [";
+    for(int j = i; j < std::min(i + batch, executors); ++j)
+      body += std::string{j != i ? ", " : ""} + "{\"ip_address\": \"" + executor_address(thread, j) +
+        "\", \"port\": 10000, \"cores\": 1}";
+    failed += client.post("/add_batch", body + "]}") != 200;
+  }
+  return failed;
+}
+
+int send_batch(HTTPClient & client, const std::string & resource, int thread, int executors, int batch)
+{
+  int failed = 0;
+  for(int i = 0; i < executors; i += batch)
+    failed += client.post(resource, addresses(thread, i, std::min(i + batch, executors))) != 200;
+  return failed;
+}
+
+int main(int argc, char ** argv)
+{
+  auto opts = registration_throughput::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test registration_throughput!");
+
+  if(opts.threads > 256 || opts.executors > 65536 || opts.batch < 1) {
+    spdlog::error("Incorrect configuration of threads, executors, or batch size");
+    return 1;
+  }
+  // Executors are removed after each round, and their directory entries are reused.
+  if(opts.threads * opts.executors > rdmalib::Directory::CAPACITY)
+    spdlog::warn(
+      "Resource manager holds only {} executors, {} registrations will fail in each round",
+      rdmalib::Directory::CAPACITY, opts.threads * opts.executors - rdmalib::Directory::CAPACITY
+    );
+
+  std::vector<std::unique_ptr<HTTPClient>> clients;
+  for(int i = 0; i < opts.threads; ++i) {
+    clients.emplace_back(new HTTPClient{opts.address, opts.port});
+    if(!clients.back()->connected())
+      return 1;
+  }
+
+  // Phases run in parallel in all threads; time includes the slowest thread.
+  enum { ADD = 0, ADD_BATCH, HEARTBEAT, REMOVE_BATCH, PHASES };
+  const char* names[PHASES] = {"add", "add_batch", "heartbeat", "remove_batch"};
+  std::vector<std::vector<double>> times(PHASES);
+  std::vector<int> failed(opts.threads);
+  int total_failed = 0;
+
+  auto run = [&](int phase) {
+    std::vector<std::thread> threads;
+    auto begin = std::chrono::high_resolution_clock::now();
+    for(int t = 0; t < opts.threads; ++t)
+      threads.emplace_back([&, t]() {
+        HTTPClient & client = *clients[t];
+        if(phase == ADD)
+          failed[t] = register_single(client, t, opts.executors);
+        else if(phase == ADD_BATCH)
+          failed[t] = register_batch(client, t, opts.executors, opts.batch);
+        else if(phase == HEARTBEAT)
+          failed[t] = send_batch(client, "/heartbeat", t, opts.executors, opts.batch);
+        else
+          failed[t] = send_batch(client, "/remove_batch", t, opts.executors, opts.batch);
+      });
+    for(auto & thread : threads)
+      thread.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    times[phase].push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count());
+    for(int f : failed)
+      total_failed += f;
+  };
+
+  for(int i = 0; i < opts.repetitions; ++i) {
+    run(ADD);
+    // Cleanup is measured as the removal throughput
+    run(REMOVE_BATCH);
+    run(ADD_BATCH);
+    run(HEARTBEAT);
+    run(REMOVE_BATCH);
+  }
+  if(total_failed)
+    spdlog::warn("{} requests failed", total_failed);
+
+  int registrations = opts.threads * opts.executors;
+  for(int phase = 0; phase < PHASES; ++phase) {
+    double sum = 0;
+    for(double time : times[phase])
+      sum += time;
+    double avg = sum / times[phase].size();
+    spdlog::info(
+      "{}: {} executors in {} us on average, {} registrations per second",
+      names[phase], registrations, avg, registrations / avg * 1e6
+    );
+  }
+
+  if(opts.output_stats != "") {
+    std::ofstream out{opts.output_stats};
+    out << "phase,threads,executors,batch,time" << '\n';
+    for(int phase = 0; phase < PHASES; ++phase)
+      for(double time : times[phase])
+        out << names[phase] << ',' << opts.threads << ',' << registrations << ','
+          << (phase == ADD ? 1 : opts.batch) << ',' << time << '\n';
+  }
+
+  return 0;
+}
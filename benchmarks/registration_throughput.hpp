@@ -0,0 +1,26 @@
+
+#ifndef __TESTS__REGISTRATION_THROUGHPUT_HPP__
+#define __TESTS__REGISTRATION_THROUGHPUT_HPP__
+
+#include <string>
+
+namespace registration_throughput {
+
+  struct Options {
+
+    std::string address;
+    int port;
+    int executors;
+    int batch;
+    int threads;
+    int repetitions;
+    std::string output_stats;
+    bool verbose;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
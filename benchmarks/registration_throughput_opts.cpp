@@ -0,0 +1,44 @@
+
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include "registration_throughput.hpp"
+
+namespace registration_throughput {
+
+  Options options(int argc, char ** argv)
+  {
+    cxxopts::Options options("registration-throughput", "Register executors with the resource manager over HTTP");
+    options.add_options()
+      ("a,address", "HTTP address of the resource manager", cxxopts::value<std::string>())
+      ("p,port", "HTTP port of the resource manager", cxxopts::value<int>())
+      ("executors", "Executors registered by each thread", cxxopts::value<int>()->default_value("64"))
+      ("batch", "Executors in a single bulk request", cxxopts::value<int>()->default_value("16"))
+      ("threads", "Concurrent HTTP clients", cxxopts::value<int>()->default_value("1"))
+      ("r,repetitions", "Rounds of registration and removal", cxxopts::value<int>()->default_value("100"))
+      ("output-stats", "Output file for benchmarking statistics.", cxxopts::value<std::string>()->default_value(""))
+      ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
+    ;
+    auto parsed_options = options.parse(argc, argv);
+    if(parsed_options.count("help"))
+    {
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+
+    Options result;
+    result.address = parsed_options["address"].as<std::string>();
+    result.port = parsed_options["port"].as<int>();
+    result.executors = parsed_options["executors"].as<int>();
+    result.batch = parsed_options["batch"].as<int>();
+    result.threads = parsed_options["threads"].as<int>();
+    result.repetitions = parsed_options["repetitions"].as<int>();
+    result.output_stats = parsed_options["output-stats"].as<std::string>();
+    result.verbose = parsed_options["verbose"].as<bool>();
+
+    return result;
+  }
+
+}
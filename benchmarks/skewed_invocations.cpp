@@ -0,0 +1,138 @@
+
+#include <chrono>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+#include <cxxopts.hpp>
+
+#include <rdmalib/rdmalib.hpp>
+#include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/benchmarker.hpp>
+#include <rdmalib/functions.hpp>
+
+#include <rfaas/executor.hpp>
+#include <rfaas/resources.hpp>
+
+#include "skewed_invocations.hpp"
+#include "settings.hpp"
+
+// All asynchronous invocations are submitted to the first executor thread,
+// while the remaining threads of the allocation stay idle.
+// Without work stealing, the burst is serialized on a single core.
+int main(int argc, char ** argv)
+{
+  auto opts = skewed_invocations::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test skewed invocations!");
+
+  // Read device details
+  std::ifstream in_dev{opts.device_database};
+  rfaas::devices::deserialize(in_dev);
+  in_dev.close();
+
+  // Read benchmark settings
+  std::ifstream benchmark_cfg{opts.json_config};
+  rfaas::benchmark::Settings settings = rfaas::benchmark::Settings::deserialize(benchmark_cfg);
+  benchmark_cfg.close();
+
+  // Read connection details to the executors
+  if(opts.executors_database != "") {
+    std::ifstream in_cfg(opts.executors_database);
+    rfaas::servers::deserialize(in_cfg);
+    in_cfg.close();
+  }
+
+  rfaas::executor executor(
+    settings.device->ip_address,
+    settings.rdma_device_port,
+    settings.device->default_receive_buffer_size,
+    settings.device->max_inline_data
+  );
+  // Without the executor database, executor managers are leased from the resource manager
+  if(opts.executors_database == "" && !executor.connect_resource_manager(
+    settings.resource_manager_address, settings.resource_manager_port
+  )) {
+    spdlog::error("Connection to resource manager failed!");
+    return 1;
+  }
+  // Each invocation of the burst needs its own input buffer on the executor.
+  if(!executor.input_slots(opts.burst))
+    return 1;
+  if(!executor.allocate(
+    opts.flib,
+    opts.numcores,
+    opts.input_size,
+    settings.benchmark.hot_timeout,
+    false
+  )) {
+    spdlog::error("Connection to executor and allocation failed!");
+    return 1;
+  }
+
+  std::vector<rdmalib::Buffer<char>> in;
+  std::vector<rdmalib::Buffer<char>> out;
+  for(int i = 0; i < opts.burst; ++i) {
+    in.emplace_back(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE);
+    in.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    memset(in.back().data(), 1, opts.input_size);
+  }
+  for(int i = 0; i < opts.burst; ++i) {
+    out.emplace_back(opts.input_size);
+    out.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  }
+
+  typedef std::chrono::high_resolution_clock clock_t;
+  std::vector<std::future<int>> futures(opts.burst);
+  std::vector<clock_t::time_point> submitted(opts.burst);
+  rdmalib::Benchmarker<1> benchmarker{settings.benchmark.repetitions * opts.burst};
+
+  auto burst = [&](bool measure) {
+    for(int j = 0; j < opts.burst; ++j) {
+      submitted[j] = clock_t::now();
+      futures[j] = executor.async(opts.fname, in[j], out[j]);
+    }
+    // Invocations can finish out of order - check all of them to get completion times.
+    int pending = opts.burst;
+    while(pending) {
+      for(int j = 0; j < opts.burst; ++j) {
+        if(!futures[j].valid() || futures[j].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+          continue;
+        auto end = clock_t::now();
+        futures[j].get();
+        if(measure)
+          benchmarker._measurements.push_back({
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - submitted[j]).count())
+          });
+        --pending;
+      }
+    }
+  };
+
+  spdlog::info("Warmups begin");
+  for(int i = 0; i < settings.benchmark.warmup_repetitions; ++i)
+    burst(false);
+  spdlog::info("Warmups completed");
+
+  auto begin = clock_t::now();
+  for(int i = 0; i < settings.benchmark.repetitions; ++i)
+    burst(true);
+  auto end = clock_t::now();
+
+  double p99 = benchmarker.percentile(0.99);
+  auto [median, avg] = benchmarker.summary();
+  spdlog::info(
+    "Executed {} bursts of {} invocations in {} ms, latency avg {} usec, median {}, p99 {}",
+    settings.benchmark.repetitions, opts.burst,
+    std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count(),
+    avg, median, p99
+  );
+  if(opts.output_stats != "")
+    benchmarker.export_csv(opts.output_stats, {"time"});
+  executor.deallocate();
+
+  return 0;
+}
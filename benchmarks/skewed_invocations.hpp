@@ -0,0 +1,27 @@
+#ifndef __TESTS_SKEWED_INVOCATIONS_HPP__
+#define __TESTS_SKEWED_INVOCATIONS_HPP__
+
+#include <string>
+
+namespace skewed_invocations {
+
+  struct Options {
+
+    std::string json_config;
+    std::string device_database;
+    std::string executors_database;
+    std::string output_stats;
+    bool verbose;
+    std::string fname;
+    std::string flib;
+    int input_size;
+    int numcores;
+    int burst;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
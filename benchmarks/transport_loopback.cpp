@@ -0,0 +1,164 @@
+#include <cstring>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/benchmarker.hpp>
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/shm_transport.hpp>
+#include <rdmalib/tcp_transport.hpp>
+
+#include "transport_loopback.hpp"
+
+// Software registration, the same keys are used by both sides
+constexpr int ACCESS = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+  IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC;
+
+bool wait(rdmalib::Connection & conn, rdmalib::QueueType type)
+{
+  auto wc = std::get<0>(conn.poll_wc(type, true, 1));
+  return wc && wc->status == IBV_WC_SUCCESS;
+}
+
+int main(int argc, char ** argv)
+{
+  auto opts = transport_loopback::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  spdlog::info("Executing serverless-rdma test transport_loopback!");
+
+  if(opts.size < 1 || opts.repetitions < 1 || opts.warmup_iters < 0) {
+    spdlog::error("Incorrect size, repetitions or warmup iterations");
+    return 1;
+  }
+
+  rdmalib::Connection client, server{true};
+  bool one_sided = opts.transport == "tcp";
+  if(opts.transport == "tcp") {
+    // The active side waits until its connection is accepted
+    rdmalib::TCPListener listener;
+    if(!listener.listen(opts.address, opts.port))
+      return 1;
+    std::thread passive([&]() {
+      uint32_t private_data;
+      int fd = listener.accept(private_data);
+      if(fd == -1)
+        return;
+      auto transport = std::unique_ptr<rdmalib::TCPTransport>{new rdmalib::TCPTransport{fd}};
+      if(transport->answer(true))
+        server.initialize(std::move(transport));
+    });
+    auto transport = std::unique_ptr<rdmalib::TCPTransport>{new rdmalib::TCPTransport{}};
+    bool connected = transport->connect(opts.address, opts.port);
+    // Wakes up the passive side when we never reached it
+    if(!connected)
+      shutdown(listener.fd(), SHUT_RDWR);
+    passive.join();
+    if(!connected || !server.transport())
+      return 1;
+    client.initialize(std::move(transport));
+  } else if(opts.transport == "shm") {
+    std::shared_ptr<rdmalib::SharedMemorySegment> segment = rdmalib::SharedMemorySegment::create(
+      "/rfaas-loopback-" + std::to_string(getpid()), 1, 4, opts.size
+    );
+    if(!segment)
+      return 1;
+    auto client_endpoint = std::make_shared<rdmalib::SharedMemoryEndpoint>(segment, nullptr, true);
+    auto server_endpoint = std::make_shared<rdmalib::SharedMemoryEndpoint>(segment, nullptr, false);
+    client.initialize(std::unique_ptr<rdmalib::Transport>{new rdmalib::SharedMemoryTransport{client_endpoint, 0, 1}});
+    server.initialize(std::unique_ptr<rdmalib::Transport>{new rdmalib::SharedMemoryTransport{server_endpoint, 0, 2}});
+  } else {
+    spdlog::error("Unknown transport {}", opts.transport);
+    return 1;
+  }
+
+  rdmalib::Buffer<char> client_buf(opts.size), server_buf(opts.size);
+  rdmalib::Buffer<uint64_t> client_atomic(1), server_atomic(1);
+  client_buf.register_memory(nullptr, ACCESS);
+  server_buf.register_memory(nullptr, ACCESS);
+  client_atomic.register_memory(nullptr, ACCESS);
+  server_atomic.register_memory(nullptr, ACCESS);
+  memset(client_buf.data(), 1, opts.size);
+  rdmalib::RemoteBuffer client_rbuf(client_buf.address(), client_buf.rkey(), client_buf.size());
+  rdmalib::RemoteBuffer server_rbuf(server_buf.address(), server_buf.rkey(), server_buf.size());
+  rdmalib::RemoteBuffer server_rbuf_atomic(server_atomic.address(), server_atomic.rkey(), sizeof(uint64_t));
+
+  int iters = opts.repetitions + opts.warmup_iters;
+  // Echoes sends and writes with immediate; reads and atomics don't involve the server
+  std::thread responder([&]() {
+    for(int i = 0; i < iters; ++i) {
+      server.post_recv(server_buf.sge(opts.size, 0));
+      if(!wait(server, rdmalib::QueueType::RECV))
+        return;
+      server.post_send(server_buf.sge(opts.size, 0));
+      wait(server, rdmalib::QueueType::SEND);
+    }
+    for(int i = 0; i < iters; ++i) {
+      server.post_recv({});
+      if(!wait(server, rdmalib::QueueType::RECV))
+        return;
+      server.post_write(server_buf.sge(opts.size, 0), client_rbuf, static_cast<uint32_t>(i));
+      wait(server, rdmalib::QueueType::SEND);
+    }
+  });
+
+  rdmalib::Benchmarker<4> benchmarker{opts.repetitions};
+  std::vector<std::array<uint64_t, 4>> measurements(iters);
+  for(int i = 0; i < iters; ++i) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    client.post_recv(client_buf.sge(opts.size, 0));
+    client.post_send(client_buf.sge(opts.size, 0));
+    wait(client, rdmalib::QueueType::SEND);
+    wait(client, rdmalib::QueueType::RECV);
+    auto end = std::chrono::high_resolution_clock::now();
+    measurements[i][0] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  }
+  for(int i = 0; i < iters; ++i) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    client.post_recv({});
+    client.post_write(client_buf.sge(opts.size, 0), server_rbuf, static_cast<uint32_t>(i));
+    wait(client, rdmalib::QueueType::SEND);
+    wait(client, rdmalib::QueueType::RECV);
+    auto end = std::chrono::high_resolution_clock::now();
+    measurements[i][1] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  }
+  responder.join();
+  for(int i = 0; one_sided && i < iters; ++i) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    client.post_read(client_buf.sge(opts.size, 0), server_rbuf);
+    wait(client, rdmalib::QueueType::SEND);
+    auto end = std::chrono::high_resolution_clock::now();
+    measurements[i][2] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  }
+  for(int i = 0; one_sided && i < iters; ++i) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    client.post_atomic_fadd(client_atomic.sge(sizeof(uint64_t), 0), server_rbuf_atomic, 1);
+    wait(client, rdmalib::QueueType::SEND);
+    auto end = std::chrono::high_resolution_clock::now();
+    measurements[i][3] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  }
+  if(one_sided && *server_atomic.data() != static_cast<uint64_t>(iters))
+    spdlog::error("Atomic counter is {}, expected {}", *server_atomic.data(), iters);
+
+  benchmarker._measurements.assign(measurements.begin() + opts.warmup_iters, measurements.end());
+  const char* names[] = {"send", "write_imm", "read", "fadd"};
+  for(int i = 0; i < (one_sided ? 4 : 2); ++i) {
+    auto [median, avg] = benchmarker.summary(i);
+    spdlog::info(
+      "{} of {} bytes: median {} us, average {} us, 99th percentile {} us",
+      names[i], opts.size, median, avg, benchmarker.percentile(0.99, i)
+    );
+  }
+
+  if(opts.output_stats != "")
+    benchmarker.export_csv(opts.output_stats, {"send", "write_imm", "read", "fadd"});
+
+  return 0;
+}
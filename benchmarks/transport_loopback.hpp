@@ -0,0 +1,26 @@
+#ifndef __TESTS__TRANSPORT_LOOPBACK_HPP__
+#define __TESTS__TRANSPORT_LOOPBACK_HPP__
+
+#include <string>
+
+namespace transport_loopback {
+
+  struct Options {
+
+    // tcp or shm
+    std::string transport;
+    std::string address;
+    int port;
+    int size;
+    int repetitions;
+    int warmup_iters;
+    std::string output_stats;
+    bool verbose;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include "transport_loopback.hpp"
+
+namespace transport_loopback {
+
+  Options options(int argc, char ** argv)
+  {
+    cxxopts::Options options("transport-loopback", "Latency of operations over software transports on loopback");
+    options.add_options()
+      ("t,transport", "Transport: tcp, shm (shared memory, without reads and atomics)", cxxopts::value<std::string>()->default_value("tcp"))
+      ("a,address", "Listening address", cxxopts::value<std::string>()->default_value("127.0.0.1"))
+      ("p,port", "Listening port", cxxopts::value<int>()->default_value("10010"))
+      ("s,size", "Message size in bytes", cxxopts::value<int>()->default_value("64"))
+      ("r,repetitions", "Repetitions to execute", cxxopts::value<int>()->default_value("1000"))
+      ("warmup-iters", "Number of warm-up iterations", cxxopts::value<int>()->default_value("100"))
+      ("output-stats", "Output file for benchmarking statistics.", cxxopts::value<std::string>()->default_value(""))
+      ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
+    ;
+    auto parsed_options = options.parse(argc, argv);
+    if(parsed_options.count("help"))
+    {
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+
+    Options result;
+    result.transport = parsed_options["transport"].as<std::string>();
+    result.address = parsed_options["address"].as<std::string>();
+    result.port = parsed_options["port"].as<int>();
+    result.size = parsed_options["size"].as<int>();
+    result.repetitions = parsed_options["repetitions"].as<int>();
+    result.warmup_iters = parsed_options["warmup-iters"].as<int>();
+    result.output_stats = parsed_options["output-stats"].as<std::string>();
+    result.verbose = parsed_options["verbose"].as<bool>();
+
+    return result;
+  }
+
+}
@@ -8,7 +8,15 @@ add_executable(warm_benchmarker benchmarks/warm_benchmark.cpp benchmarks/warm_be
 add_executable(parallel_invocations benchmarks/parallel_invocations.cpp benchmarks/parallel_invocations_opts.cpp)
 add_executable(cold_benchmarker benchmarks/cold_benchmark.cpp benchmarks/cold_benchmark_opts.cpp)
 add_executable(cpp_interface benchmarks/cpp_interface.cpp benchmarks/cpp_interface_opts.cpp)
-set(tests_targets "warm_benchmarker" "cold_benchmarker" "parallel_invocations" "cpp_interface")
+add_executable(skewed_invocations benchmarks/skewed_invocations.cpp benchmarks/skewed_invocations_opts.cpp)
+add_executable(large_payload benchmarks/large_payload.cpp benchmarks/large_payload_opts.cpp)
+add_executable(registration_throughput benchmarks/registration_throughput.cpp benchmarks/registration_throughput_opts.cpp)
+# Links the executor database of the resource manager
+add_executable(placement_lookups benchmarks/placement_lookups.cpp benchmarks/placement_lookups_opts.cpp server/resource_manager/db.cpp)
+add_executable(transport_loopback benchmarks/transport_loopback.cpp benchmarks/transport_loopback_opts.cpp)
+add_executable(on_demand_paging benchmarks/on_demand_paging.cpp benchmarks/on_demand_paging_opts.cpp)
+add_executable(invocation_allocations benchmarks/invocation_allocations.cpp benchmarks/invocation_allocations_opts.cpp)
+set(tests_targets "warm_benchmarker" "cold_benchmarker" "parallel_invocations" "cpp_interface" "skewed_invocations" "large_payload" "registration_throughput" "placement_lookups" "transport_loopback" "on_demand_paging" "invocation_allocations")
 foreach(target ${tests_targets})
   add_dependencies(${target} cxxopts::cxxopts)
   add_dependencies(${target} rdmalib)
@@ -9,8 +9,11 @@ namespace rdmalib {
   struct AllocationRequest
   {
     int16_t hot_timeout;
+    // Lease: seconds without invocations before the executor is reclaimed.
+    // 0: default of the manager; the manager can shorten it.
     int16_t timeout;
     // > 0: Number of cores to be allocated
+    // = 0: renewal of the lease; sent by the manager when the lease has expired
     // < 0: client_id with negative sign, deallocation & disconnect request
     int16_t cores;
     int16_t input_buf_count;
@@ -18,6 +21,54 @@ namespace rdmalib {
     uint32_t func_buf_size;
     int32_t listen_port;
     char listen_address[16];
+    // Set when the client runs on the same host: name of the shared memory segment
+    // with a lane for each executor thread. Empty - RDMA only.
+    char shared_memory[32];
+  };
+
+  // Sent by clients to the resource manager.
+  struct LeaseRequest
+  {
+    // > 0: Number of cores on a single executor manager
+    // = 0: release of the lease
+    // < 0: location of the executor directory, replied with DirectoryInformation
+    int16_t cores;
+    uint32_t lease_id;
+  };
+
+  // Executor manager selected by the resource manager.
+  struct LeaseResponse
+  {
+    // Zero when no executor manager has enough free cores
+    uint32_t lease_id;
+    int16_t cores;
+    int32_t port;
+    char address[16];
+  };
+
+  struct DirectoryEntry
+  {
+    // Executor managers change it with RDMA fetch-and-add
+    int64_t free_cores;
+    int32_t port;
+    // Zero marks an unused entry
+    int16_t cores;
+    char address[16];
+  };
+
+  // Executor managers published by the resource manager, read with a single RDMA read.
+  // The resource manager changes the end version first, then entries, and the begin
+  // version last; a snapshot is consistent when both versions are equal.
+  // This relies on the NIC reading the region in the order of addresses.
+  // Free cores are updated atomically and they're not covered by versions.
+  struct Directory
+  {
+    static constexpr int CAPACITY = 256;
+
+    volatile uint64_t version;
+    int32_t size;
+    DirectoryEntry entries[CAPACITY];
+    volatile uint64_t version_end;
   };
 
   struct BufferInformation
@@ -26,6 +77,30 @@ namespace rdmalib {
     uint32_t r_key;
   };
 
+  // Utilization of an executor manager, written periodically with a single RDMA write
+  // into its slot at the resource manager. Slots have the order of directory entries.
+  // Like in the directory, a report is complete when both versions are equal.
+  struct LoadReport
+  {
+    volatile uint64_t version;
+    int32_t clients;
+    int32_t executors;
+    // Including released executors that haven't finished yet
+    int32_t allocated_cores;
+    // Allocation requests received since the previous report
+    int32_t requests;
+    // Billing of connected clients, in nanoseconds
+    uint64_t hot_polling_time;
+    uint64_t execution_time;
+    volatile uint64_t version_end;
+  };
+
+  struct DirectoryInformation
+  {
+    BufferInformation directory;
+    BufferInformation loads;
+  };
+
 }
 
 #endif
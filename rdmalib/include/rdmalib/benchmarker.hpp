@@ -2,6 +2,7 @@
 #ifndef __RDMALIB_BENCHMARKER_HPP__
 #define __RDMALIB_BENCHMARKER_HPP__
 
+#include <algorithm>
 #include <numeric>
 #include <vector>
 #include <string>
@@ -66,6 +67,21 @@ namespace rdmalib {
       return std::make_tuple(static_cast<double>(median) / 1000, avg / 1000);
     }
 
+    // Measurement at the given quantile, e.g., 0.99 for tail latency.
+    double percentile(double quantile, int idx = 0)
+    {
+      size_t pos = std::min(
+        static_cast<size_t>(quantile * _measurements.size()),
+        _measurements.size() - 1
+      );
+      std::nth_element(_measurements.begin(), _measurements.begin() + pos, _measurements.end(),
+        [idx](const std::array<uint64_t, Cols> & x, const std::array<uint64_t, Cols> & y) {
+          return x[idx] < y[idx];
+        }
+      );
+      return static_cast<double>(_measurements[pos][idx]) / 1000;
+    }
+
     void export_csv(std::string fname, const std::array<std::string, Cols> & headers)
     {
       std::ofstream of(fname);
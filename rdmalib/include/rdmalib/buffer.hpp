@@ -3,17 +3,33 @@
 #define __RDMALIB_BUFFER_HPP__
 
 #include <cstdint>
+#include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
-#include <cereal/cereal.hpp>
+#include <infiniband/verbs.h>
 
-struct ibv_pd;
-struct ibv_mr;
-struct ibv_sge;
+#include <cereal/cereal.hpp>
 
 namespace rdmalib {
 
   struct ScatterGatherElement;
+  struct MemoryRegistrationCache;
+
+  // Pages backing the buffer - huge pages reduce NIC translation entries
+  // and IOTLB misses for large buffers.
+  // Explicit huge pages fall back to transparent huge pages when the pool is exhausted.
+  enum class PageSize {
+    DEFAULT = 0,
+    TRANSPARENT_HUGE,
+    HUGE_2MB,
+    HUGE_1GB
+  };
+
+  // Accepts "default", "thp", "2mb" and "1gb".
+  PageSize page_size(const std::string & name);
+  std::string page_size(PageSize size);
 
   namespace impl {
 
@@ -24,13 +40,20 @@ namespace rdmalib {
       uint32_t _header;
       uint32_t _bytes;
       uint32_t _byte_size;
+      // Length of the mapping, rounded up to the page size
+      size_t _alloc_bytes;
+      PageSize _page_size;
       void* _ptr;
       ibv_mr* _mr;
+      // Key of memory registered for software transports, zero otherwise
+      uint32_t _software_key;
+      // Cache holding the registration, released instead of deregistered
+      MemoryRegistrationCache* _cache;
       bool _own_memory;
 
       Buffer();
       Buffer(void* ptr, uint32_t size, uint32_t byte_size);
-      Buffer(uint32_t size, uint32_t byte_size, uint32_t header);
+      Buffer(uint32_t size, uint32_t byte_size, uint32_t header, PageSize page_size);
       Buffer(Buffer &&);
       Buffer & operator=(Buffer && obj);
       ~Buffer();
@@ -41,7 +64,17 @@ namespace rdmalib {
       uint32_t data_size() const;
       uint32_t size() const;
       uint32_t bytes() const;
+      PageSize page_size() const;
+      // Without a PD, memory is registered for software transports.
       void register_memory(ibv_pd *pd, int access);
+      // Shares a registration covering the buffer with other users of the cache.
+      void register_memory(MemoryRegistrationCache & cache);
+      // Memory can be registered again, e.g., with the PD of a new connection.
+      void deregister_memory();
+      // Binds pages to the NUMA node; effective only before the memory is touched or registered.
+      bool bind_numa(int node);
+      // Faults in all pages and keeps them resident.
+      bool lock();
       uint32_t lkey() const;
       uint32_t rkey() const;
       ScatterGatherElement sge(uint32_t size, uint32_t offset) const;
@@ -84,8 +117,8 @@ namespace rdmalib {
       impl::Buffer(ptr, size, sizeof(T))
     {}
 
-    Buffer(size_t size, size_t header = 0):
-      impl::Buffer(size, sizeof(T), header)
+    Buffer(size_t size, size_t header = 0, PageSize page_size = PageSize::DEFAULT):
+      impl::Buffer(size, sizeof(T), header, page_size)
     {}
 
     Buffer<T> & operator=(Buffer<T> && obj)
@@ -104,16 +137,37 @@ namespace rdmalib {
     }
   };
 
+  // Work requests gather from a few elements, stored inline without allocation.
+  // Longer lists move to the heap. Moves copy the inline elements and take over
+  // the heap array, so they never allocate.
   struct ScatterGatherElement {
-    // smallvector in practice
-    mutable std::vector<ibv_sge> _sges;
+    static constexpr uint32_t INLINE_ELEMENTS = 4;
+
+    uint32_t _size;
+    // Capacity of the heap array, zero while the elements are inline
+    uint32_t _capacity;
+    mutable ibv_sge _inline[INLINE_ELEMENTS];
+    // Owns all elements once the inline storage is exceeded
+    ibv_sge* _overflow;
 
     ScatterGatherElement();
+    ScatterGatherElement(const ScatterGatherElement & obj);
+    ScatterGatherElement(ScatterGatherElement && obj) noexcept;
+    ScatterGatherElement & operator=(const ScatterGatherElement & obj);
+    ScatterGatherElement & operator=(ScatterGatherElement && obj) noexcept;
+    ~ScatterGatherElement();
 
     ScatterGatherElement(uint64_t addr, uint32_t bytes, uint32_t lkey);
+    // Copies the list of a work request
+    ScatterGatherElement(const ibv_sge* sges, int count);
+    // Memory of the user, registered on a cache miss.
+    ScatterGatherElement(MemoryRegistrationCache & cache, const void* ptr, uint32_t bytes);
 
     template<typename T>
-    ScatterGatherElement(const Buffer<T> & buf)
+    ScatterGatherElement(const Buffer<T> & buf):
+      _size(0),
+      _capacity(0),
+      _overflow(nullptr)
     {
       add(buf);
     }
@@ -121,20 +175,68 @@ namespace rdmalib {
     template<typename T>
     void add(const Buffer<T> & buf)
     {
-      //emplace_back for structs will be supported in C++20
-      _sges.push_back({buf.address(), buf.bytes(), buf.lkey()});
+      push_back({buf.address(), buf.bytes(), buf.lkey()});
     }
 
     template<typename T>
     void add(const Buffer<T> & buf, uint32_t size, size_t offset = 0)
     {
-      //emplace_back for structs will be supported in C++20
-      _sges.push_back({buf.address() + offset, size, buf.lkey()});
+      push_back({buf.address() + offset, size, buf.lkey()});
+    }
+
+    // Returns false when the memory cannot be registered.
+    bool add(MemoryRegistrationCache & cache, const void* ptr, uint32_t bytes);
+
+    inline void push_back(const ibv_sge & sge)
+    {
+      if(_size < INLINE_ELEMENTS) {
+        _inline[_size++] = sge;
+        return;
+      }
+      if(_size >= _capacity)
+        _grow();
+      _overflow[_size++] = sge;
+    }
+
+    inline ibv_sge * array() const
+    {
+      return _size > INLINE_ELEMENTS ? _overflow : _inline;
     }
 
-    ibv_sge * array() const;
-    size_t size() const;
+    inline size_t size() const
+    {
+      return _size;
+    }
+
+    inline const ibv_sge* begin() const
+    {
+      return array();
+    }
+
+    inline const ibv_sge* end() const
+    {
+      return array() + _size;
+    }
+
+    // Total length of the elements
+    inline uint32_t bytes() const
+    {
+      uint32_t bytes = 0;
+      for(const ibv_sge & sge : *this)
+        bytes += sge.length;
+      return bytes;
+    }
+  private:
+    // Moves the elements to a larger heap array
+    void _grow();
   };
+
+  // The heap array makes the list not trivially movable, but moving it never allocates or throws.
+  static_assert(
+    std::is_nothrow_move_constructible<ScatterGatherElement>::value &&
+    std::is_nothrow_move_assignable<ScatterGatherElement>::value,
+    "Moving scatter-gather lists must not allocate"
+  );
 }
 
 #endif
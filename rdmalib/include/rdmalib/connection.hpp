@@ -4,6 +4,7 @@
 
 #include <cstdint>
 #include <initializer_list>
+#include <memory>
 #include <vector>
 #include <optional>
 
@@ -19,12 +20,19 @@ namespace rdmalib {
     RECV
   };
 
+  struct Transport;
+
   struct ConnectionConfiguration {
     // Configuration of QP
     ibv_qp_init_attr attr;
     rdma_conn_param conn_param;
 
+    // Without other requests, the send queue has room for this many.
+    static constexpr int DEFAULT_SEND_WR = 40;
+
     ConnectionConfiguration();
+    // Queues hold depth requests in flight; the limits of the device apply when the QP is created.
+    void pipeline_depth(int depth);
   };
 
   enum class ConnectionStatus {
@@ -38,6 +46,28 @@ namespace rdmalib {
     DISCONNECTED
   };
 
+  // Write with immediate from a local to a remote buffer, posted repeatedly.
+  // The work request is built once; a post patches only the length, the offsets,
+  // the immediate and the flags. Buffers can be bound again, e.g., when
+  // replies go to a different buffer of the client.
+  struct PreparedWrite {
+    ibv_send_wr _wr;
+    ibv_sge _sge;
+    uintptr_t _local_addr;
+    uint64_t _remote_addr;
+
+    PreparedWrite();
+    PreparedWrite(const impl::Buffer & local, const RemoteBuffer & remote);
+
+    void local(const impl::Buffer & buf);
+    void remote(const RemoteBuffer & buf);
+
+    inline bool bound(const RemoteBuffer & buf) const
+    {
+      return _remote_addr == buf.addr && _wr.wr.rdma.rkey == buf.rkey;
+    }
+  };
+
   // State of a communication:
   // a) communication ID
   // b) Queue Pair
@@ -55,10 +85,14 @@ namespace rdmalib {
     std::array<ibv_wc, _wc_size> _swc; // fast fix for overlapping polling
     std::array<ibv_wc, _wc_size> _rwc;
     std::array<ScatterGatherElement, _wc_size> _rwc_sges;
-    int _send_flags;
+    // Inline data accepted by the QP, queried after its creation
+    uint32_t _max_inline_data;
+    bool _inline;
 
     static const int _rbatch = 32; // 32 for faster division in the code
     struct ibv_recv_wr _batch_wrs[_rbatch]; // preallocated and prefilled batched recv.
+    // Software data path replacing the QP, nullptr for verbs connections
+    std::unique_ptr<Transport> _transport;
 
   public:
     Connection(bool passive = false);
@@ -68,11 +102,20 @@ namespace rdmalib {
     Connection(Connection&&);
 
     void initialize_batched_recv(const rdmalib::impl::Buffer & sge, size_t offset);
+    // Enabled by default: sends up to the inline limit of the QP are inlined.
+    // Otherwise, only forced ones are; larger sends are never inlined.
     void inlining(bool enable);
+    uint32_t max_inline_data() const;
     void initialize(rdma_cm_id* id);
+    // Connection without a QP, e.g., TCPTransport.
+    // FIXME: completion channels are not supported by software transports
+    void initialize(std::unique_ptr<Transport> transport);
+    Transport* transport() const;
     void close();
     rdma_cm_id* id() const;
     ibv_qp* qp() const;
+    // Number of the QP, or of the software transport replacing it.
+    uint32_t qp_num() const;
     ibv_comp_channel* completion_channel() const;
     uint32_t private_data() const;
     ConnectionStatus status() const;
@@ -82,26 +125,40 @@ namespace rdmalib {
     // Blocking, no timeout
     std::tuple<ibv_wc*, int> poll_wc(QueueType, bool blocking = true, int count = -1);
     int32_t post_send(const ScatterGatherElement & elem, int32_t id = -1, bool force_inline = false);
-    int32_t post_recv(ScatterGatherElement && elem, int32_t id = -1, int32_t count = 1);
+    int32_t post_recv(const ScatterGatherElement & elem, int32_t id = -1, int32_t count = 1);
 
     int32_t post_batched_empty_recv(int32_t count = 1);
 
-    int32_t post_write(ScatterGatherElement && elems, const RemoteBuffer & buf, bool force_inline = false);
+    int32_t post_write(const ScatterGatherElement & elems, const RemoteBuffer & buf, bool force_inline = false);
     // Solicited makes sense only for RDMA write with immediate
-    int32_t post_write(ScatterGatherElement && elems, const RemoteBuffer & buf,
+    int32_t post_write(const ScatterGatherElement & elems, const RemoteBuffer & buf,
       uint32_t immediate,
       bool force_inline = false,
       bool solicited = false
     );
-    int32_t post_cas(ScatterGatherElement && elems, const RemoteBuffer & buf, uint64_t compare, uint64_t swap);
-    int32_t post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add);
+    // Sends length bytes at the local offset to the remote offset.
+    int32_t post_write(PreparedWrite & write, uint32_t length, uint32_t immediate,
+      bool force_inline = false,
+      bool solicited = false,
+      uint32_t local_offset = 0,
+      uint64_t remote_offset = 0
+    );
+    int32_t post_read(const ScatterGatherElement & elems, const RemoteBuffer & buf);
+    int32_t post_cas(const ScatterGatherElement & elems, const RemoteBuffer & buf, uint64_t compare, uint64_t swap);
+    int32_t post_atomic_fadd(const ScatterGatherElement & elems, const RemoteBuffer & rbuf, uint64_t add);
 
     // Register to be notified about all events, including unsolicited ones
     void notify_events(bool only_solicited = false);
     ibv_cq* wait_events();
+    // Returns nullptr when no event arrived before the timeout,
+    // or when the wake-up file descriptor became readable first.
+    ibv_cq* wait_events(int timeout_ms, int wake_fd = -1);
     void ack_events(ibv_cq* cq, int len);
   private:
-    int32_t _post_write(ScatterGatherElement && elems, ibv_send_wr wr, bool force_inline, bool force_solicited);
+    int _post_send_wr(ibv_send_wr* wr, ibv_send_wr** bad);
+    int _post_recv_wr(ibv_recv_wr* wr, ibv_recv_wr** bad);
+    int32_t _post_write(const ScatterGatherElement & elems, ibv_send_wr wr, bool force_inline, bool force_solicited);
+    int _send_flags(uint32_t bytes, bool force_inline) const;
   };
 }
 
@@ -0,0 +1,44 @@
+
+#ifndef __RDMALIB_DEVICE_HPP__
+#define __RDMALIB_DEVICE_HPP__
+
+#include <cstdint>
+
+struct ibv_context;
+struct ibv_pd;
+struct ibv_qp_cap;
+
+namespace rdmalib {
+
+  // Limits of the device, used to size queue pairs and completion queues.
+  // Configured sizes are overrides; requests above a limit are reduced to it.
+  namespace device {
+
+    // Requests the largest inline data supported by the device.
+    constexpr uint32_t AUTO_INLINE = UINT32_MAX;
+
+    struct Limits {
+      int max_qp_wr;
+      int max_sge;
+      int max_cqe;
+    };
+
+    // Queried once for each device context.
+    const Limits & limits(ibv_context* ctx);
+    // Not reported by ibv_query_device - probed once for each device context by creating
+    // queue pairs. Executors receive the value probed by their manager.
+    uint32_t max_inline_data(ibv_context* ctx);
+    // Reduces the capabilities to the limits, and replaces AUTO_INLINE with the probed size.
+    void fit(ibv_context* ctx, ibv_qp_cap & cap);
+    // Completion queue with at least the requested entries, when the device allows it.
+    int cq_entries(ibv_context* ctx, int entries);
+    // Shared by active connections of the process and never deallocated, unlike the
+    // default PD of rdmacm. Memory stays registered when all connections are replaced.
+    ibv_pd* protection_domain(ibv_context* ctx);
+
+  }
+
+}
+
+#endif
+
@@ -11,9 +11,19 @@ namespace rdmalib { namespace functions {
     uint64_t r_address;
     uint32_t r_key;
     static constexpr int DATA_HEADER_SIZE = 12;
+    // Invocations queued on an executor thread must fit its deque of pending invocations.
+    static constexpr int MAX_INPUT_SLOTS = 64;
+
+    // Inputs are placed in one of the input slots, selected by
+    // the 16 bits of invocation id transmitted in the immediate.
+    static inline int slot(int invoc_id, int slots)
+    {
+      return (invoc_id & 0xFFFF) % slots;
+    }
   };
 
   constexpr int Submission::DATA_HEADER_SIZE;
+  constexpr int Submission::MAX_INPUT_SLOTS;
 
 
   typedef void (*FuncType)(void*, void*);
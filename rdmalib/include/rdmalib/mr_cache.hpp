@@ -0,0 +1,85 @@
+
+#ifndef __RDMALIB_MR_CACHE_HPP__
+#define __RDMALIB_MR_CACHE_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+
+struct ibv_pd;
+struct ibv_mr;
+
+namespace rdmalib {
+
+  // Registrations of user memory in one protection domain.
+  // A request is served by any registration covering the range; a miss registers the pages
+  // of the range. Registrations without references are evicted in LRU order once
+  // the registered bytes exceed the capacity.
+  // With implicit on-demand paging, one registration serves all requests and nothing is pinned.
+  // Without a protection domain, memory is registered in software, e.g., for TCP connections.
+  struct MemoryRegistrationCache {
+
+    struct Entry {
+      ibv_mr* mr;
+      uintptr_t end;
+      int references;
+      // Position in the LRU list, valid only without references
+      std::list<ibv_mr*>::iterator lru;
+    };
+    typedef std::multimap<uintptr_t, Entry> entries_t;
+
+    ibv_pd* _pd;
+    int _access;
+    size_t _capacity;
+    size_t _registered_bytes;
+    // Length of the longest registration bounds the backward scan of a lookup
+    size_t _longest;
+    // Ordered by the start address
+    entries_t _entries;
+    // Unreferenced registrations, least recently used at the back
+    std::list<ibv_mr*> _lru;
+    // Registration of the address space, nullptr without on-demand paging
+    ibv_mr* _implicit;
+    std::mutex _mutex;
+
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _evictions;
+
+    MemoryRegistrationCache(ibv_pd* pd, int access, size_t capacity);
+    ~MemoryRegistrationCache();
+    MemoryRegistrationCache(const MemoryRegistrationCache&) = delete;
+    MemoryRegistrationCache& operator=(const MemoryRegistrationCache&) = delete;
+
+    // Returns false when the device doesn't support implicit on-demand paging.
+    bool enable_implicit_odp();
+    bool implicit_odp() const;
+
+    // Returns a registration covering the range and holds a reference to it,
+    // or nullptr when the memory cannot be registered.
+    ibv_mr* acquire(const void* ptr, size_t bytes);
+    void release(ibv_mr* mr);
+    // Registration covering the range without holding a reference.
+    // It may be evicted by a later miss; the caller acquires the registration
+    // when the memory is accessed by many operations in flight.
+    ibv_mr* lookup(const void* ptr, size_t bytes);
+    // Memory returned to the system must be removed before its address is reused.
+    // Registrations with references are kept.
+    void invalidate(const void* ptr, size_t bytes);
+
+    size_t registered_bytes() const;
+  private:
+    // Caller holds the lock
+    entries_t::iterator _find(uintptr_t begin, uintptr_t end);
+    entries_t::iterator _register(uintptr_t begin, uintptr_t end);
+    void _erase(entries_t::iterator it);
+    // Makes room for a new registration
+    void _evict(size_t bytes);
+  };
+
+}
+
+#endif
+
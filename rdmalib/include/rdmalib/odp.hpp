@@ -0,0 +1,32 @@
+
+#ifndef __RDMALIB_ODP_HPP__
+#define __RDMALIB_ODP_HPP__
+
+#include <cstdint>
+
+struct ibv_context;
+struct ibv_pd;
+struct ibv_mr;
+
+namespace rdmalib {
+
+  // On-demand paging: the NIC faults in pages on access, and registered memory is not pinned.
+  // The first access to a page not mapped for the NIC stalls the operation until the
+  // fault is resolved; prefetching hides that when the next accessed range is known.
+  // SoftRoCE emulates ODP only on recent kernels, and without implicit registrations.
+  namespace odp {
+
+    // Sends, receives and writes on RC connections; implicit registrations cover the address space.
+    bool supported(ibv_context* ctx, bool implicit = false);
+    // Registration of the whole address space, nullptr when not supported.
+    ibv_mr* register_implicit(ibv_pd* pd, int access);
+    // Asks the NIC to fault in the range ahead of the access, without waiting.
+    // Returns false when the device doesn't accept the hint.
+    bool prefetch(ibv_pd* pd, uint32_t lkey, const void* ptr, uint32_t bytes, bool write);
+
+  }
+
+}
+
+#endif
+
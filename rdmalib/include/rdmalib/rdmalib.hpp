@@ -3,6 +3,8 @@
 #define __RDMALIB_RDMALIB_HPP__
 
 #include <cstdint>
+#include <deque>
+#include <memory>
 #include <string>
 #include <array>
 #include <unordered_map>
@@ -13,13 +15,17 @@
 
 #include <rdmalib/buffer.hpp>
 #include <rdmalib/connection.hpp>
+#include <rdmalib/shared_queues.hpp>
+#include <rdmalib/tcp_transport.hpp>
 
 namespace rdmalib {
 
   // Implemented as IPV4
+  // Addresses of TCP connections are not resolved by rdmacm.
   struct Address {
     rdma_addrinfo *addrinfo;
     rdma_addrinfo hints;
+    std::string _ip;
     uint16_t _port;
 
     Address();
@@ -29,6 +35,8 @@ namespace rdmalib {
     ~Address();
   };
 
+  // With software_transport(), connections are established over TCP and have no QP.
+  // The protection domain is nullptr, and buffers are registered in software.
   struct RDMAActive {
     ConnectionConfiguration _cfg;
     std::unique_ptr<Connection> _conn;
@@ -37,7 +45,8 @@ namespace rdmalib {
     ibv_pd* _pd;
 
     RDMAActive();
-    RDMAActive(const std::string & ip, int port, int recv_buf = 1, int max_inline_data = 0);
+    // Negative max_inline_data selects the limit of the device.
+    RDMAActive(const std::string & ip, int port, int recv_buf = 1, int max_inline_data = -1);
     RDMAActive & operator=(RDMAActive &&);
     ~RDMAActive();
     void allocate();
@@ -48,6 +57,8 @@ namespace rdmalib {
     bool is_connected();
   };
 
+  // With software_transport(), connections are accepted over TCP. A connection is established
+  // when we accept it; disconnections are not reported.
   struct RDMAPassive {
     ConnectionConfiguration _cfg;
     Address _addr;
@@ -56,8 +67,13 @@ namespace rdmalib {
     ibv_pd* _pd;
     // Set of connections that have been
     std::unordered_set<Connection*> _active_connections;
+    // TCP connections: queues shared like CQs and the SRQ, and connections accepted since the last poll
+    std::unique_ptr<TCPListener> _listener;
+    std::shared_ptr<SoftwareCompletionQueue> _software_send_cq, _software_recv_cq;
+    std::shared_ptr<SoftwareReceiveQueue> _software_srq;
+    std::deque<Connection*> _established;
 
-    RDMAPassive(const std::string & ip, int port, int recv_buf = 1, bool initialize = true, int max_inline_data = 0);
+    RDMAPassive(const std::string & ip, int port, int recv_buf = 1, bool initialize = true, int max_inline_data = -1);
     ~RDMAPassive();
     void allocate();
     ibv_pd* pd() const;
@@ -69,8 +85,18 @@ namespace rdmalib {
     // When the status is UNKNOWN, the pointer is null.
     std::tuple<Connection*, ConnectionStatus> poll_events(bool share_cqs = false);
     bool nonblocking_poll_events(int timeout = 100);
+    // QPs created with shared CQs complete into this queue; nullptr makes the next QP create its own.
+    void share_cq(ibv_cq* cq);
+    // QPs created afterwards receive from this queue; nullptr restores own receive queues.
+    void share_srq(ibv_srq* srq);
+    // Shares both queues, also with TCP connections.
+    void share_queues(SharedQueues & queues);
     void accept(Connection* connection);
+    // Deallocates the connection.
+    void reject(Connection* connection);
     void set_nonblocking_poll();
+  private:
+    std::tuple<Connection*, ConnectionStatus> poll_software_events(bool share_cqs);
   };
 }
 
@@ -0,0 +1,41 @@
+#ifndef __RDMALIB_SHARED_QUEUES_HPP__
+#define __RDMALIB_SHARED_QUEUES_HPP__
+
+#include <memory>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/transport.hpp>
+
+namespace rdmalib {
+
+  // Completion queue with a completion channel, and a shared receive queue,
+  // for servers polling all their connections in one thread.
+  // Without a protection domain, both are implemented in software for TCP connections.
+  struct SharedQueues {
+    ibv_comp_channel* _channel;
+    ibv_cq* _cq;
+    ibv_srq* _srq;
+    std::shared_ptr<SoftwareCompletionQueue> _software_cq;
+    std::shared_ptr<SoftwareReceiveQueue> _software_srq;
+
+    // The CQ has room for the given number of completions, the SRQ for receives.
+    SharedQueues(ibv_pd* pd, int completions, int receives);
+    ~SharedQueues();
+    SharedQueues(const SharedQueues&) = delete;
+    SharedQueues& operator=(const SharedQueues&) = delete;
+
+    // Non-blocking, readable once a completion arrives after notify.
+    int fd() const;
+    void notify();
+    // Consumes all notifications.
+    void acknowledge();
+    // Same semantics as ibv_poll_cq and ibv_post_srq_recv.
+    int poll(int count, ibv_wc* wcs);
+    int post_recv(ibv_recv_wr* wr, ibv_recv_wr** bad);
+  };
+
+}
+
+#endif
+
@@ -0,0 +1,134 @@
+
+#ifndef __RDMALIB_SHM_TRANSPORT_HPP__
+#define __RDMALIB_SHM_TRANSPORT_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/transport.hpp>
+
+namespace rdmalib {
+
+  // Segment connecting a client with executor threads on the same host.
+  // Each executor thread has a lane with a ring in each direction. Messages carry
+  // their payload, and the receiver applies writes to its own registered memory.
+  struct SharedMemorySegment {
+
+    static constexpr uint32_t MAGIC = 0x72464153;
+
+    struct Message {
+      uint32_t opcode;
+      uint32_t imm_data;
+      uint32_t length;
+      uint32_t rkey;
+      uint64_t remote_addr;
+    };
+
+    // Futex words of a receiver, shared between processes
+    struct alignas(64) Notification {
+      std::atomic<uint32_t> messages;
+      std::atomic<uint32_t> solicited;
+      std::atomic<uint32_t> waiting;
+    };
+
+    // Single producer, single consumer
+    struct Ring {
+      alignas(64) std::atomic<uint64_t> head;
+      alignas(64) std::atomic<uint64_t> tail;
+    };
+
+    struct Lane {
+      Ring to_executor;
+      Ring to_client;
+      Notification executor;
+    };
+
+    struct Header {
+      uint32_t magic;
+      uint32_t lanes;
+      uint32_t slots;
+      uint32_t slot_size;
+      Notification client;
+    };
+
+    std::string _name;
+    bool _owner;
+    void* _ptr;
+    size_t _bytes;
+    size_t _stride;
+
+    SharedMemorySegment(const std::string & name, bool owner, void* ptr, size_t bytes);
+    ~SharedMemorySegment();
+    SharedMemorySegment(const SharedMemorySegment&) = delete;
+    SharedMemorySegment& operator=(const SharedMemorySegment&) = delete;
+
+    // The creator removes the name when the segment is destroyed.
+    // Both return nullptr on failure.
+    static std::unique_ptr<SharedMemorySegment> create(const std::string & name, int lanes, int slots, uint32_t slot_size);
+    static std::unique_ptr<SharedMemorySegment> open(const std::string & name);
+
+    Header* header() const;
+    Lane* lane(int idx) const;
+    Message* slot(int lane, bool to_client, uint64_t pos) const;
+  };
+
+  // Receiving side of one process: the client consumes all lanes, an executor thread only its own.
+  // Transports of the client share the endpoint, like connections sharing their completion queues.
+  struct SharedMemoryEndpoint {
+
+    struct Receive {
+      uint64_t wr_id;
+      ScatterGatherElement sges;
+    };
+
+    std::shared_ptr<SharedMemorySegment> _segment;
+    // Writes target memory registered with this protection domain
+    ibv_pd* _pd;
+    bool _client;
+    // Consumed lanes with QP numbers reported in their completions
+    std::vector<std::pair<int, uint32_t>> _lanes;
+    std::deque<Receive> _receives;
+    std::deque<ibv_wc> _send_cq, _recv_cq;
+    uint32_t _seen_solicited;
+    std::mutex _mutex;
+
+    SharedMemoryEndpoint(std::shared_ptr<SharedMemorySegment> segment, ibv_pd* pd, bool client);
+
+    void attach(int lane, uint32_t qp_num);
+    int poll(QueueType type, int count, ibv_wc* wcs);
+    bool wait_events(bool only_solicited, int timeout_ms);
+    SharedMemorySegment::Notification & notification() const;
+  private:
+    // Caller holds the lock
+    void drain();
+    bool pending() const;
+  };
+
+  // Supports sends and writes with and without immediate; reads and atomics need
+  // the peer to respond and are not implemented. Payload is limited by the slot size.
+  // Senders wait for a free slot, and a completion is generated once the payload is copied.
+  struct SharedMemoryTransport : Transport {
+
+    std::shared_ptr<SharedMemoryEndpoint> _endpoint;
+    int _lane;
+    uint32_t _qp_num;
+
+    SharedMemoryTransport(std::shared_ptr<SharedMemoryEndpoint> endpoint, int lane, uint32_t qp_num);
+
+    int post_send(ibv_send_wr* wr, ibv_send_wr** bad) override;
+    int post_recv(ibv_recv_wr* wr, ibv_recv_wr** bad) override;
+    int poll(QueueType type, int count, ibv_wc* wcs) override;
+    bool wait_events(bool only_solicited, int timeout_ms) override;
+    uint32_t qp_num() const override;
+  };
+
+}
+
+#endif
+
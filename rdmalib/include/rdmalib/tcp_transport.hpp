@@ -0,0 +1,132 @@
+
+#ifndef __RDMALIB_TCP_TRANSPORT_HPP__
+#define __RDMALIB_TCP_TRANSPORT_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/transport.hpp>
+
+namespace rdmalib {
+
+  // Emulates a reliable connection over TCP, e.g., on loopback of a host without an RDMA NIC.
+  // Each side runs a progress thread that applies one-sided operations of the peer to memory
+  // registered in software, and turns acknowledgments of our operations into completions.
+  // Sends without a posted receive wait at the receiver until one is posted.
+  // Responses are written by a separate thread - a progress thread blocked on a full socket
+  // would stop reading, and peers writing large operations at once would deadlock.
+  // Like QPs, transports can share their completion queues and a receive queue.
+  struct TCPTransport : Transport {
+
+    // Message on the wire, followed by the payload
+    struct Header {
+      uint8_t opcode;
+      uint8_t status;
+      uint8_t flags;
+      uint32_t imm_data;
+      uint32_t rkey;
+      uint32_t length;
+      uint64_t seq;
+      uint64_t remote_addr;
+      uint64_t compare_add;
+      uint64_t swap;
+    };
+
+    // Sent by the active side once connected; the passive side answers with one byte.
+    struct Request {
+      uint32_t magic;
+      uint32_t private_data;
+    };
+
+    // Operation waiting for its acknowledgment
+    struct Pending {
+      uint64_t wr_id;
+      ibv_wc_opcode opcode;
+      bool signaled;
+      std::vector<ibv_sge> sges;
+    };
+
+    // Response waiting for the writer
+    struct Message {
+      Header header;
+      std::vector<char> payload;
+    };
+
+    int _fd;
+    std::thread _progress;
+    // Requests of the owner and responses of the writer share the socket
+    std::mutex _send_mutex;
+    std::thread _writer;
+    std::deque<Message> _responses;
+    bool _closing;
+    std::mutex _responses_mutex;
+    std::condition_variable _responses_cv;
+    uint64_t _seq;
+    std::unordered_map<uint64_t, Pending> _pending;
+    std::shared_ptr<SoftwareCompletionQueue> _send_cq, _recv_cq;
+    std::shared_ptr<SoftwareReceiveQueue> _receives;
+    bool _shared_receives;
+    uint32_t _qp_num;
+    // Guards operations in flight
+    std::mutex _mutex;
+
+    // Takes ownership of a socket returned by TCPListener; the peer waits for our answer.
+    // Without a socket, receives can be posted before connecting.
+    // Missing queues are created for this transport.
+    TCPTransport(int fd = -1,
+      std::shared_ptr<SoftwareCompletionQueue> send_cq = nullptr,
+      std::shared_ptr<SoftwareCompletionQueue> recv_cq = nullptr,
+      std::shared_ptr<SoftwareReceiveQueue> receives = nullptr
+    );
+    ~TCPTransport();
+    TCPTransport(const TCPTransport&) = delete;
+    TCPTransport& operator=(const TCPTransport&) = delete;
+
+    // Blocks until the passive side answers; false when it rejects us.
+    bool connect(const std::string & address, int port, uint32_t private_data = 0);
+    // Tells the active side whether we accept the connection.
+    bool answer(bool accept);
+
+    int post_send(ibv_send_wr* wr, ibv_send_wr** bad) override;
+    int post_recv(ibv_recv_wr* wr, ibv_recv_wr** bad) override;
+    int poll(QueueType type, int count, ibv_wc* wcs) override;
+    bool wait_events(bool only_solicited, int timeout_ms) override;
+    void notify_events(bool only_solicited) override;
+    uint32_t qp_num() const override;
+
+  private:
+    void start();
+    void progress();
+    void write_responses();
+    bool write_message(const Header & header, const ibv_sge* sges, int num_sge, const void* data = nullptr);
+    void deliver(const Header & header, std::vector<char> && payload);
+    void respond(const Header & request, ibv_wc_status status, const void* data = nullptr, uint32_t length = 0);
+    void flush();
+  };
+
+  struct TCPListener {
+    int _fd;
+
+    TCPListener();
+    ~TCPListener();
+
+    bool listen(const std::string & address, int port);
+    int fd() const;
+    // Port of the socket, e.g., after listening on port 0.
+    int port() const;
+    // Blocking; returns the socket and the private data of the active side, or -1 on failure.
+    int accept(uint32_t & private_data);
+  };
+
+}
+
+#endif
+
@@ -0,0 +1,151 @@
+
+#ifndef __RDMALIB_TRANSPORT_HPP__
+#define __RDMALIB_TRANSPORT_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/buffer.hpp>
+
+namespace rdmalib {
+
+  enum class QueueType;
+
+  // True when the environment variable RDMALIB_TRANSPORT is "tcp": RDMAActive and RDMAPassive
+  // connect over TCP without an RDMA device, and memory is registered in software.
+  // Processes spawned by us inherit the setting.
+  bool software_transport();
+
+  // Data path of a connection implemented in software.
+  // Work requests and completions keep the verbs layout, so a connection builds them
+  // in the same way for all transports. Connections without a transport use their QP.
+  struct Transport {
+
+    virtual ~Transport() = default;
+
+    // Same semantics as ibv_post_send and ibv_post_recv, returns zero on success.
+    virtual int post_send(ibv_send_wr* wr, ibv_send_wr** bad) = 0;
+    virtual int post_recv(ibv_recv_wr* wr, ibv_recv_wr** bad) = 0;
+    // Same semantics as ibv_poll_cq; returns the number of completions.
+    virtual int poll(QueueType type, int count, ibv_wc* wcs) = 0;
+    // Replaces the completion channel: blocks until a message, or a solicited one, arrives.
+    // Returns false on timeout. Transports without notifications return immediately.
+    virtual bool wait_events(bool /*only_solicited*/, int /*timeout_ms*/)
+    {
+      return true;
+    }
+    // Replaces ibv_req_notify_cq for transports waiting on a file descriptor.
+    virtual void notify_events(bool /*only_solicited*/)
+    {}
+    // Reported in completions, like the number of a QP.
+    virtual uint32_t qp_num() const = 0;
+  };
+
+  // Completion queue of software transports, shared by connections like a CQ.
+  // The file descriptor works like a completion channel: after notify, the next completion,
+  // or the next solicited one, makes it readable until the event is acknowledged.
+  struct SoftwareCompletionQueue {
+
+    enum class Notify {
+      NONE,
+      ALL,
+      SOLICITED
+    };
+
+    std::mutex _mutex;
+    std::deque<ibv_wc> _wcs;
+    int _event_fd;
+    Notify _notify;
+    uint32_t _solicited;
+    uint32_t _seen_solicited;
+
+    SoftwareCompletionQueue();
+    ~SoftwareCompletionQueue();
+    SoftwareCompletionQueue(const SoftwareCompletionQueue&) = delete;
+    SoftwareCompletionQueue& operator=(const SoftwareCompletionQueue&) = delete;
+
+    void push(const ibv_wc & wc, bool solicited = false);
+    int poll(int count, ibv_wc* wcs);
+    int fd() const;
+    void notify(bool only_solicited);
+    void acknowledge();
+    // Blocks until a completion, or a solicited one, arrived since the last wait.
+    // Returns false on timeout.
+    bool wait(bool only_solicited, int timeout_ms);
+  };
+
+  // Receive queue of software transports, shared by connections like an SRQ.
+  // Messages arriving without a posted receive wait until one is posted.
+  struct SoftwareReceiveQueue {
+
+    struct Receive {
+      uint64_t wr_id;
+      ScatterGatherElement sges;
+    };
+
+    // Completion without the work request ID, and the payload of a send
+    struct Message {
+      ibv_wc wc;
+      bool solicited;
+      std::vector<char> payload;
+      std::shared_ptr<SoftwareCompletionQueue> cq;
+    };
+
+    std::mutex _mutex;
+    std::deque<Receive> _receives;
+    std::deque<Message> _unmatched;
+
+    void post_recv(ibv_recv_wr* wr);
+    void deliver(Message && msg);
+    // Receives complete with an error when the only connection using them is closed.
+    void flush(SoftwareCompletionQueue & cq, uint32_t qp_num);
+  private:
+    static void complete(Message & msg, Receive & receive);
+  };
+
+  // Memory accessed by software transports.
+  // Buffers registered without a protection domain receive a key unique within the process,
+  // and lkey is equal to rkey. Remotely writable verbs registrations are added under
+  // their protection domain and rkey, since rkeys of different devices can collide.
+  struct SoftwareMemory {
+
+    struct Region {
+      uintptr_t addr;
+      size_t bytes;
+      int access;
+    };
+
+    typedef std::pair<const ibv_pd*, uint32_t> Key;
+    struct KeyHash {
+      size_t operator()(const Key & key) const;
+    };
+
+    std::mutex _mutex;
+    std::unordered_map<Key, Region, KeyHash> _regions;
+    uint32_t _next_key;
+
+    SoftwareMemory();
+
+    static SoftwareMemory & instance();
+    // Shared memory only applies remote writes - other verbs registrations are not added.
+    static bool mirrors(int access);
+    uint32_t register_region(void* ptr, size_t bytes, int access);
+    void insert_region(const ibv_pd* pd, uint32_t key, void* ptr, size_t bytes, int access);
+    void deregister_region(const ibv_pd* pd, uint32_t key);
+    // Returns nullptr when the key doesn't allow the access to the whole range.
+    // Keys of software registrations have no protection domain.
+    void* translate(const ibv_pd* pd, uintptr_t addr, uint32_t key, size_t bytes, int access);
+  };
+
+}
+
+#endif
+
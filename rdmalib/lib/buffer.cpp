@@ -1,20 +1,62 @@
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <stdexcept>
+
 // mmap
 #include <sys/mman.h>
+// MAP_HUGE_2MB, MAP_HUGE_1GB
+#include <linux/mman.h>
+// mbind
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <infiniband/verbs.h>
 
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/mr_cache.hpp>
+#include <rdmalib/transport.hpp>
 #include <rdmalib/util.hpp>
 
 namespace rdmalib { namespace impl {
 
+  static constexpr size_t HUGE_2MB = 2 * 1024 * 1024;
+  static constexpr size_t HUGE_1GB = 1024 * 1024 * 1024;
+
+  static size_t round_up(size_t bytes, size_t page)
+  {
+    return (bytes + page - 1) / page * page;
+  }
+
+  // Transparent huge pages need an aligned region - the kernel doesn't align anonymous mappings.
+  static void* map_transparent(size_t bytes)
+  {
+    void* ptr = mmap(nullptr, bytes + HUGE_2MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED)
+      return ptr;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t aligned = round_up(begin, HUGE_2MB);
+    if(aligned != begin)
+      munmap(ptr, aligned - begin);
+    munmap(reinterpret_cast<void*>(aligned + bytes), begin + HUGE_2MB - aligned);
+    if(madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE))
+      spdlog::warn("Transparent huge pages are not available, reason {}", strerror(errno));
+    return reinterpret_cast<void*>(aligned);
+  }
+
   Buffer::Buffer():
     _size(0),
     _header(0),
     _bytes(0),
     _byte_size(0),
+    _alloc_bytes(0),
+    _page_size(PageSize::DEFAULT),
     _ptr(nullptr),
     _mr(nullptr),
+    _software_key(0),
+    _cache(nullptr),
     _own_memory(false)
   {}
 
@@ -23,35 +65,55 @@ namespace rdmalib { namespace impl {
     _header(obj._header),
     _bytes(obj._bytes),
     _byte_size(obj._byte_size),
+    _alloc_bytes(obj._alloc_bytes),
+    _page_size(obj._page_size),
     _ptr(obj._ptr),
     _mr(obj._mr),
+    _software_key(obj._software_key),
+    _cache(obj._cache),
     _own_memory(obj._own_memory)
   {
     obj._size = obj._bytes = obj._header = 0;
+    obj._alloc_bytes = 0;
     obj._ptr = obj._mr = nullptr;
+    obj._software_key = 0;
+    obj._cache = nullptr;
+    obj._own_memory = false;
   }
 
   Buffer & Buffer::operator=(Buffer && obj)
   {
     _size = obj._size;
     _bytes = obj._bytes;
-    _bytes = obj._byte_size;
+    _byte_size = obj._byte_size;
+    _alloc_bytes = obj._alloc_bytes;
+    _page_size = obj._page_size;
     _header = obj._header;
     _ptr = obj._ptr;
     _mr = obj._mr;
+    _software_key = obj._software_key;
+    _cache = obj._cache;
     _own_memory = obj._own_memory;
 
     obj._size = obj._bytes = 0;
+    obj._alloc_bytes = 0;
     obj._ptr = obj._mr = nullptr;
+    obj._software_key = 0;
+    obj._cache = nullptr;
+    obj._own_memory = false;
     return *this;
   }
 
-  Buffer::Buffer(uint32_t size, uint32_t byte_size, uint32_t header):
+  Buffer::Buffer(uint32_t size, uint32_t byte_size, uint32_t header, PageSize page_size):
     _size(size),
     _header(header),
     _bytes(size * byte_size + header),
     _byte_size(byte_size),
+    _alloc_bytes(_bytes),
+    _page_size(page_size),
     _mr(nullptr),
+    _software_key(0),
+    _cache(nullptr),
     _own_memory(true)
   {
     //size_t alloc = _bytes;
@@ -59,11 +121,35 @@ namespace rdmalib { namespace impl {
     //  alloc = 4096;
     //  spdlog::warn("Page too small, allocating {} bytes", alloc);
     //}
-    // page-aligned address for maximum performance
-    _ptr = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+    _ptr = MAP_FAILED;
+    if(page_size == PageSize::HUGE_2MB || page_size == PageSize::HUGE_1GB) {
+      bool large = page_size == PageSize::HUGE_1GB;
+      _alloc_bytes = round_up(_bytes, large ? HUGE_1GB : HUGE_2MB);
+      _ptr = mmap(
+        nullptr, _alloc_bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (large ? MAP_HUGE_1GB : MAP_HUGE_2MB),
+        -1, 0
+      );
+      if(_ptr == MAP_FAILED) {
+        spdlog::warn(
+          "Allocation of {} bytes on {} pages failed, falling back to transparent huge pages, reason {}",
+          _alloc_bytes, rdmalib::page_size(page_size), strerror(errno)
+        );
+        _page_size = PageSize::TRANSPARENT_HUGE;
+      }
+    }
+    if(_ptr == MAP_FAILED && _page_size == PageSize::TRANSPARENT_HUGE) {
+      _alloc_bytes = round_up(_bytes, HUGE_2MB);
+      _ptr = map_transparent(_alloc_bytes);
+    } else if(_ptr == MAP_FAILED) {
+      // page-aligned address for maximum performance
+      _alloc_bytes = _bytes;
+      _ptr = mmap(nullptr, _alloc_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    impl::expect_true(_ptr != MAP_FAILED || !_bytes);
     SPDLOG_DEBUG(
-      "Allocated {} bytes, address {}",
-      _bytes, fmt::ptr(_ptr)
+      "Allocated {} bytes, address {}, pages {}",
+      _bytes, fmt::ptr(_ptr), rdmalib::page_size(_page_size)
     );
   }
 
@@ -72,8 +158,12 @@ namespace rdmalib { namespace impl {
     _header(0),
     _bytes(size * byte_size),
     _byte_size(byte_size),
+    _alloc_bytes(_bytes),
+    _page_size(PageSize::DEFAULT),
     _ptr(ptr),
     _mr(nullptr),
+    _software_key(0),
+    _cache(nullptr),
     _own_memory(false)
   {
     SPDLOG_DEBUG(
@@ -88,22 +178,88 @@ namespace rdmalib { namespace impl {
       "Deallocate {} bytes, mr {}, ptr {}",
       _bytes, fmt::ptr(_mr), fmt::ptr(_ptr)
     );
-    if(_mr)
-      ibv_dereg_mr(_mr);
-    if(_own_memory)
-      munmap(_ptr, _bytes);
+    deregister_memory();
+    if(_own_memory && _ptr)
+      munmap(_ptr, _alloc_bytes);
   }
 
   void Buffer::register_memory(ibv_pd* pd, int access)
   {
+    if(!pd) {
+      _software_key = SoftwareMemory::instance().register_region(_ptr, _bytes, access);
+      SPDLOG_DEBUG(
+        "Registered {} bytes in software, address {}, key {}",
+        _bytes, fmt::ptr(_ptr), _software_key
+      );
+      return;
+    }
     _mr = ibv_reg_mr(pd, _ptr, _bytes, access);
     impl::expect_nonnull(_mr);
+    // Shared memory transports apply remote writes in software
+    if(SoftwareMemory::mirrors(access))
+      SoftwareMemory::instance().insert_region(pd, _mr->rkey, _ptr, _bytes, access);
     SPDLOG_DEBUG(
       "Registered {} bytes, mr {}, address {}, lkey {}, rkey {}",
       _bytes, fmt::ptr(_mr), fmt::ptr(_mr->addr), _mr->lkey, _mr->rkey
     );
   }
 
+  void Buffer::register_memory(MemoryRegistrationCache & cache)
+  {
+    _mr = cache.acquire(_ptr, _bytes);
+    impl::expect_nonnull(_mr);
+    _cache = &cache;
+    SPDLOG_DEBUG(
+      "Registered {} bytes through the cache, address {}, lkey {}, rkey {}",
+      _bytes, fmt::ptr(_ptr), _mr->lkey, _mr->rkey
+    );
+  }
+
+  void Buffer::deregister_memory()
+  {
+    if(_mr && _cache) {
+      _cache->release(_mr);
+      _cache = nullptr;
+      _mr = nullptr;
+    } else if(_mr) {
+      SoftwareMemory::instance().deregister_region(_mr->pd, _mr->rkey);
+      ibv_dereg_mr(_mr);
+      _mr = nullptr;
+    }
+    if(_software_key) {
+      SoftwareMemory::instance().deregister_region(nullptr, _software_key);
+      _software_key = 0;
+    }
+  }
+
+  bool Buffer::bind_numa(int node)
+  {
+    constexpr int MAX_NODES = 1024;
+    constexpr int BITS = 8 * sizeof(unsigned long);
+    if(node < 0 || node >= MAX_NODES || !_own_memory)
+      return false;
+    // Avoid the dependency on libnuma
+    unsigned long mask[MAX_NODES / BITS] = {};
+    mask[node / BITS] = 1UL << (node % BITS);
+    long ret = syscall(SYS_mbind, _ptr, _alloc_bytes, MPOL_BIND, mask, node + 2, 0);
+    if(ret) {
+      spdlog::warn("Binding {} bytes to NUMA node {} failed, reason {}", _bytes, node, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  bool Buffer::lock()
+  {
+    if(!_ptr || !_alloc_bytes)
+      return false;
+    if(mlock(_ptr, _alloc_bytes)) {
+      spdlog::warn("Locking {} bytes failed, reason {}", _alloc_bytes, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
   ibv_mr* Buffer::mr() const
   {
     return this->_mr;
@@ -124,23 +280,28 @@ namespace rdmalib { namespace impl {
     return this->_bytes;
   }
 
+  PageSize Buffer::page_size() const
+  {
+    return this->_page_size;
+  }
+
   uint32_t Buffer::lkey() const
   {
-    assert(this->_mr);
+    assert(this->_mr || this->_software_key);
     // Apparently it's not needed and better to skip that check.
-    return this->_mr->lkey;
+    return this->_mr ? this->_mr->lkey : this->_software_key;
     //return 0;
   }
 
   uint32_t Buffer::rkey() const
   {
-    assert(this->_mr);
-    return this->_mr->rkey;
+    assert(this->_mr || this->_software_key);
+    return this->_mr ? this->_mr->rkey : this->_software_key;
   }
 
   uintptr_t Buffer::address() const
   {
-    assert(this->_mr);
+    assert(this->_mr || this->_software_key);
     return reinterpret_cast<uint64_t>(this->_ptr);
   }
 
@@ -158,23 +319,132 @@ namespace rdmalib { namespace impl {
 
 namespace rdmalib {
 
-  ScatterGatherElement::ScatterGatherElement()
+  PageSize page_size(const std::string & name)
+  {
+    if(name == "thp")
+      return PageSize::TRANSPARENT_HUGE;
+    else if(name == "2mb")
+      return PageSize::HUGE_2MB;
+    else if(name == "1gb")
+      return PageSize::HUGE_1GB;
+    else if(name == "default")
+      return PageSize::DEFAULT;
+    throw std::runtime_error("Unrecognized page size: " + name);
+  }
+
+  std::string page_size(PageSize size)
+  {
+    switch(size) {
+      case PageSize::TRANSPARENT_HUGE:
+        return "thp";
+      case PageSize::HUGE_2MB:
+        return "2mb";
+      case PageSize::HUGE_1GB:
+        return "1gb";
+      default:
+        return "default";
+    }
+  }
+
+  constexpr uint32_t ScatterGatherElement::INLINE_ELEMENTS;
+
+  ScatterGatherElement::ScatterGatherElement():
+    _size(0),
+    _capacity(0),
+    _overflow(nullptr)
+  {
+  }
+
+  ScatterGatherElement::ScatterGatherElement(const ScatterGatherElement & obj):
+    ScatterGatherElement()
+  {
+    for(const ibv_sge & sge : obj)
+      push_back(sge);
+  }
+
+  ScatterGatherElement::ScatterGatherElement(ScatterGatherElement && obj) noexcept:
+    _size(obj._size),
+    _capacity(obj._capacity),
+    _overflow(obj._overflow)
+  {
+    if(_size <= INLINE_ELEMENTS)
+      std::copy(obj._inline, obj._inline + _size, _inline);
+    obj._size = 0;
+    obj._capacity = 0;
+    obj._overflow = nullptr;
+  }
+
+  ScatterGatherElement & ScatterGatherElement::operator=(const ScatterGatherElement & obj)
+  {
+    if(this != &obj) {
+      // Elements beyond the inline storage must stay in the heap array
+      delete[] _overflow;
+      _overflow = nullptr;
+      _capacity = 0;
+      _size = 0;
+      for(const ibv_sge & sge : obj)
+        push_back(sge);
+    }
+    return *this;
+  }
+
+  ScatterGatherElement & ScatterGatherElement::operator=(ScatterGatherElement && obj) noexcept
+  {
+    if(this != &obj) {
+      delete[] _overflow;
+      _size = obj._size;
+      _capacity = obj._capacity;
+      _overflow = obj._overflow;
+      if(_size <= INLINE_ELEMENTS)
+        std::copy(obj._inline, obj._inline + _size, _inline);
+      obj._size = 0;
+      obj._capacity = 0;
+      obj._overflow = nullptr;
+    }
+    return *this;
+  }
+
+  ScatterGatherElement::~ScatterGatherElement()
+  {
+    delete[] _overflow;
+  }
+
+  ScatterGatherElement::ScatterGatherElement(uint64_t addr, uint32_t bytes, uint32_t lkey):
+    ScatterGatherElement()
+  {
+    push_back({addr, bytes, lkey});
+  }
+
+  ScatterGatherElement::ScatterGatherElement(const ibv_sge* sges, int count):
+    ScatterGatherElement()
   {
+    for(int i = 0; i < count; ++i)
+      push_back(sges[i]);
   }
 
-  ibv_sge * ScatterGatherElement::array() const
+  ScatterGatherElement::ScatterGatherElement(MemoryRegistrationCache & cache, const void* ptr, uint32_t bytes):
+    ScatterGatherElement()
   {
-    return _sges.data();
+    add(cache, ptr, bytes);
   }
 
-  size_t ScatterGatherElement::size() const
+  void ScatterGatherElement::_grow()
   {
-    return _sges.size();
+    uint32_t capacity = std::max(2 * INLINE_ELEMENTS, 2 * _capacity);
+    ibv_sge* overflow = new ibv_sge[capacity];
+    std::copy(begin(), end(), overflow);
+    delete[] _overflow;
+    _overflow = overflow;
+    _capacity = capacity;
   }
 
-  ScatterGatherElement::ScatterGatherElement(uint64_t addr, uint32_t bytes, uint32_t lkey)
+  bool ScatterGatherElement::add(MemoryRegistrationCache & cache, const void* ptr, uint32_t bytes)
   {
-    _sges.push_back({addr, bytes, lkey});
+    ibv_mr* mr = cache.lookup(ptr, bytes);
+    if(!mr)
+      return false;
+    push_back({reinterpret_cast<uint64_t>(ptr), bytes, mr->lkey});
+    return true;
   }
 
   RemoteBuffer::RemoteBuffer():
@@ -1,9 +1,13 @@
 
+#include <algorithm>
 #include <chrono>
 #include <spdlog/spdlog.h>
 #include <thread>
 
+#include <poll.h>
+
 #include <rdmalib/connection.hpp>
+#include <rdmalib/transport.hpp>
 #include <rdmalib/util.hpp>
 
 namespace rdmalib {
@@ -14,6 +18,40 @@ namespace rdmalib {
     memset(&conn_param, 0 , sizeof(conn_param));
   }
 
+  void ConnectionConfiguration::pipeline_depth(int depth)
+  {
+    attr.cap.max_send_wr = std::max(depth, DEFAULT_SEND_WR);
+    attr.cap.max_recv_wr = depth;
+  }
+
+  PreparedWrite::PreparedWrite():
+    _local_addr(0),
+    _remote_addr(0)
+  {
+    memset(&_wr, 0, sizeof(_wr));
+    memset(&_sge, 0, sizeof(_sge));
+    _wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+  }
+
+  PreparedWrite::PreparedWrite(const impl::Buffer & local, const RemoteBuffer & remote):
+    PreparedWrite()
+  {
+    this->local(local);
+    this->remote(remote);
+  }
+
+  void PreparedWrite::local(const impl::Buffer & buf)
+  {
+    _local_addr = buf.address();
+    _sge.lkey = buf.lkey();
+  }
+
+  void PreparedWrite::remote(const RemoteBuffer & buf)
+  {
+    _remote_addr = buf.addr;
+    _wr.wr.rdma.rkey = buf.rkey;
+  }
+
   Connection::Connection(bool passive):
     _id(nullptr),
     _qp(nullptr),
@@ -21,9 +59,10 @@ namespace rdmalib {
     _req_count(0),
     _private_data(0),
     _passive(passive),
-    _status(ConnectionStatus::UNKNOWN)
+    _status(ConnectionStatus::UNKNOWN),
+    _max_inline_data(0)
   {
-    inlining(false);
+    inlining(true);
 
     for(int i=0; i < _rbatch; i++){
       _batch_wrs[i].wr_id = i;
@@ -49,7 +88,9 @@ namespace rdmalib {
     _private_data(obj._private_data),
     _passive(obj._passive),
     _status(obj._status),
-    _send_flags(obj._send_flags)
+    _max_inline_data(obj._max_inline_data),
+    _inline(obj._inline),
+    _transport(std::move(obj._transport))
   {
     obj._id = nullptr;
     obj._qp = nullptr;
@@ -80,15 +121,63 @@ namespace rdmalib {
     this->_id = id;
     this->_channel = _id->recv_cq_channel;
     this->_qp = this->_id->qp;
-    SPDLOG_DEBUG("Initialize a connection with id {}", fmt::ptr(_id));
+    // Providers can accept more than requested
+    ibv_qp_attr attr;
+    ibv_qp_init_attr init_attr;
+    if(ibv_query_qp(_qp, &attr, IBV_QP_CAP, &init_attr)) {
+      spdlog::warn("Querying the QP failed, disabling inlining, reason {}", strerror(errno));
+      this->_max_inline_data = 0;
+    } else
+      this->_max_inline_data = attr.cap.max_inline_data;
+    SPDLOG_DEBUG(
+      "Initialize a connection with id {}, max inline data {}",
+      fmt::ptr(_id), _max_inline_data
+    );
+  }
+
+  void Connection::initialize(std::unique_ptr<Transport> transport)
+  {
+    // The transport is connected already
+    this->_transport = std::move(transport);
+    this->_status = ConnectionStatus::ESTABLISHED;
+    SPDLOG_DEBUG("Initialize a connection with a software transport {}", fmt::ptr(_transport.get()));
+  }
+
+  Transport* Connection::transport() const
+  {
+    return this->_transport.get();
+  }
+
+  int Connection::_post_send_wr(ibv_send_wr* wr, ibv_send_wr** bad)
+  {
+    if(_transport)
+      return _transport->post_send(wr, bad);
+    return ibv_post_send(_qp, wr, bad);
+  }
+
+  int Connection::_post_recv_wr(ibv_recv_wr* wr, ibv_recv_wr** bad)
+  {
+    if(_transport)
+      return _transport->post_recv(wr, bad);
+    return ibv_post_recv(_qp, wr, bad);
   }
 
   void Connection::inlining(bool enable)
   {
-    if(enable)
-      _send_flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE;
-    else
-      _send_flags = IBV_SEND_SIGNALED;
+    _inline = enable;
+  }
+
+  uint32_t Connection::max_inline_data() const
+  {
+    return this->_max_inline_data;
+  }
+
+  int Connection::_send_flags(uint32_t bytes, bool force_inline) const
+  {
+    // Posting fails above the limit.
+    if(bytes > _max_inline_data || !(force_inline || _inline))
+      return IBV_SEND_SIGNALED;
+    return IBV_SEND_SIGNALED | IBV_SEND_INLINE;
   }
 
   void Connection::close()
@@ -113,6 +202,10 @@ namespace rdmalib {
       _id = nullptr;
       _status = ConnectionStatus::DISCONNECTED;
     }
+    if(_transport) {
+      _transport.reset();
+      _status = ConnectionStatus::DISCONNECTED;
+    }
   }
 
   rdma_cm_id* Connection::id() const
@@ -125,6 +218,11 @@ namespace rdmalib {
     return this->_qp;
   }
 
+  uint32_t Connection::qp_num() const
+  {
+    return _transport ? _transport->qp_num() : _qp->qp_num;
+  }
+
   ibv_comp_channel* Connection::completion_channel() const
   {
     return this->_channel;
@@ -159,9 +257,9 @@ namespace rdmalib {
     wr.sg_list = elems.array();
     wr.num_sge = elems.size();
     wr.opcode = IBV_WR_SEND;
-    wr.send_flags = force_inline ? IBV_SEND_SIGNALED | IBV_SEND_INLINE : _send_flags;
-    SPDLOG_DEBUG("Post send to local Local QPN {}",_qp->qp_num);
-    int ret = ibv_post_send(_qp, &wr, &bad);
+    wr.send_flags = _send_flags(elems.bytes(), force_inline);
+    SPDLOG_DEBUG("Post send to local Local QPN {}",_qp ? _qp->qp_num : 0);
+    int ret = _post_send_wr(&wr, &bad);
     if(ret) {
       spdlog::error("Post send unsuccesful, reason {} {}, sges_count {}, wr_id {}, wr.send_flags {}",
         errno, strerror(errno), wr.num_sge, wr.wr_id, wr.send_flags
@@ -172,7 +270,7 @@ namespace rdmalib {
       "Post send succesfull, sges_count {}, sge[0].addr {}, sge[0].size {}, wr_id {}, wr.send_flags {}",
       wr.num_sge, wr.sg_list[0].addr, wr.sg_list[0].length, wr.wr_id, wr.send_flags
     );
-    return _req_count - 1;
+    return wr.wr_id;
   }
 
   int32_t Connection::post_batched_empty_recv(int count)
@@ -180,7 +278,7 @@ namespace rdmalib {
     struct ibv_recv_wr* bad = nullptr;
     int loops = count / _rbatch;
     int reminder = count % _rbatch;
-    SPDLOG_DEBUG("Batch {} {} to local QPN {}", loops, reminder, _qp->qp_num);
+    SPDLOG_DEBUG("Batch {} {} to local QPN {}", loops, reminder, _qp ? _qp->qp_num : 0);
 
     int ret = 0;
     for(int i = 0; i < loops; ++i) {
@@ -192,7 +290,7 @@ namespace rdmalib {
           SPDLOG_DEBUG("Batched receive num_sge {}", begin->num_sge);
         begin = begin->next;
       }
-      ret = ibv_post_recv(_qp, &_batch_wrs[0], &bad);
+      ret = _post_recv_wr(&_batch_wrs[0], &bad);
       if(ret)
         break;
     }
@@ -208,7 +306,7 @@ namespace rdmalib {
 	      }
         begin = begin->next;
       }
-      ret = ibv_post_recv(_qp, _batch_wrs, &bad);
+      ret = _post_recv_wr(_batch_wrs, &bad);
       _batch_wrs[reminder-1].next= &(_batch_wrs[reminder]);
     }
 
@@ -221,7 +319,7 @@ namespace rdmalib {
     return count;
   }
 
-  int32_t Connection::post_recv(ScatterGatherElement && elem, int32_t id, int count)
+  int32_t Connection::post_recv(const ScatterGatherElement & elem, int32_t id, int count)
   {
     // FIXME: extend with multiple sges
 
@@ -230,11 +328,11 @@ namespace rdmalib {
     wr.next = nullptr;
     wr.sg_list = elem.array();
     wr.num_sge = elem.size();
-    SPDLOG_DEBUG("post recv to local Local QPN {}",_qp->qp_num);
+    SPDLOG_DEBUG("post recv to local Local QPN {}",_qp ? _qp->qp_num : 0);
 
     int ret;
     for(int i = 0; i < count; ++i) {
-      ret = ibv_post_recv(_qp, &wr, &bad);
+      ret = _post_recv_wr(&wr, &bad);
       if(ret)
         break;
     }
@@ -252,28 +350,24 @@ namespace rdmalib {
     return wr.wr_id;
   }
 
-  int32_t Connection::_post_write(ScatterGatherElement && elems, ibv_send_wr wr, bool force_inline, bool force_solicited)
+  int32_t Connection::_post_write(const ScatterGatherElement & elems, ibv_send_wr wr, bool force_inline, bool force_solicited)
   {
     ibv_send_wr* bad;
     wr.wr_id = _req_count++;
     wr.next = nullptr;
     wr.sg_list = elems.array();
     wr.num_sge = elems.size();
-    wr.send_flags = force_inline ? IBV_SEND_SIGNALED | IBV_SEND_INLINE : _send_flags;
+    wr.send_flags = _send_flags(elems.bytes(), force_inline);
     wr.send_flags = force_solicited ? IBV_SEND_SOLICITED | wr.send_flags : wr.send_flags;
 
     if(wr.num_sge == 1 && wr.sg_list[0].length == 0)
       wr.num_sge = 0;
 
-    int ret = ibv_post_send(_qp, &wr, &bad);
+    int ret = _post_send_wr(&wr, &bad);
     if(ret) {
       spdlog::error("Post write unsuccesful, reason {} {}, sges_count {}, wr_id {}, remote addr {}, remote rkey {}, imm data {}",
         ret, strerror(ret), wr.num_sge, wr.wr_id,  wr.wr.rdma.remote_addr, wr.wr.rdma.rkey, ntohl(wr.imm_data)
       );
-      if(IBV_SEND_INLINE & wr.send_flags)
-        spdlog::error("The write of size {} was inlined, is it supported by the device?",
-          wr.sg_list[0].length
-        );
       return -1;
     }
     if(wr.num_sge > 0)
@@ -289,17 +383,17 @@ namespace rdmalib {
 
   }
 
-  int32_t Connection::post_write(ScatterGatherElement && elems, const RemoteBuffer & rbuf, bool force_inline)
+  int32_t Connection::post_write(const ScatterGatherElement & elems, const RemoteBuffer & rbuf, bool force_inline)
   {
     ibv_send_wr wr;
     memset(&wr, 0, sizeof(wr));
     wr.opcode = IBV_WR_RDMA_WRITE;
     wr.wr.rdma.remote_addr = rbuf.addr;
     wr.wr.rdma.rkey = rbuf.rkey;
-    return _post_write(std::forward<ScatterGatherElement>(elems), wr, force_inline, false);
+    return _post_write(elems, wr, force_inline, false);
   }
 
-  int32_t Connection::post_write(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint32_t immediate, bool force_inline, bool force_solicited)
+  int32_t Connection::post_write(const ScatterGatherElement & elems, const RemoteBuffer & rbuf, uint32_t immediate, bool force_inline, bool force_solicited)
   {
     ibv_send_wr wr;
     memset(&wr, 0, sizeof(wr));
@@ -307,10 +401,63 @@ namespace rdmalib {
     wr.imm_data = htonl(immediate);
     wr.wr.rdma.remote_addr = rbuf.addr;
     wr.wr.rdma.rkey = rbuf.rkey;
-    return _post_write(std::forward<ScatterGatherElement>(elems), wr, force_inline, force_solicited);
+    return _post_write(elems, wr, force_inline, force_solicited);
   }
 
-  int32_t Connection::post_cas(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t compare, uint64_t swap)
+  int32_t Connection::post_write(PreparedWrite & write, uint32_t length, uint32_t immediate,
+      bool force_inline, bool solicited, uint32_t local_offset, uint64_t remote_offset)
+  {
+    ibv_send_wr* bad;
+    ibv_send_wr & wr = write._wr;
+    wr.wr_id = _req_count++;
+    // Not set in the constructor - copies of the write would point to the original
+    wr.sg_list = &write._sge;
+    wr.num_sge = length ? 1 : 0;
+    write._sge.addr = write._local_addr + local_offset;
+    write._sge.length = length;
+    wr.imm_data = htonl(immediate);
+    wr.wr.rdma.remote_addr = write._remote_addr + remote_offset;
+    wr.send_flags = _send_flags(length, force_inline);
+    if(solicited)
+      wr.send_flags |= IBV_SEND_SOLICITED;
+
+    int ret = _post_send_wr(&wr, &bad);
+    if(ret) {
+      spdlog::error("Post prepared write unsuccesful, reason {} {}, length {}, wr_id {}, remote addr {}, remote rkey {}, imm data {}",
+        ret, strerror(ret), length, wr.wr_id, wr.wr.rdma.remote_addr, wr.wr.rdma.rkey, immediate
+      );
+      return -1;
+    }
+    SPDLOG_DEBUG(
+      "Post prepared write succesfull id: {}, length {}, lkey {}, remote addr {}, remote rkey {}, imm data {}",
+      wr.wr_id, length, write._sge.lkey, wr.wr.rdma.remote_addr, wr.wr.rdma.rkey, immediate
+    );
+    return wr.wr_id;
+  }
+
+  int32_t Connection::post_read(const ScatterGatherElement & elems, const RemoteBuffer & rbuf)
+  {
+    ibv_send_wr wr, *bad;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = _req_count++;
+    wr.next = nullptr;
+    wr.sg_list = elems.array();
+    wr.num_sge = elems.size();
+    wr.opcode = IBV_WR_RDMA_READ;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = rbuf.addr;
+    wr.wr.rdma.rkey = rbuf.rkey;
+
+    int ret = _post_send_wr(&wr, &bad);
+    if(ret) {
+      spdlog::error("Post read unsuccesful, reason {} {}", errno, strerror(errno));
+      return -1;
+    }
+    SPDLOG_DEBUG("Post read succesfull id: {}, remote addr {}, remote rkey {}", wr.wr_id, rbuf.addr, rbuf.rkey);
+    return _req_count - 1;
+  }
+
+  int32_t Connection::post_cas(const ScatterGatherElement & elems, const RemoteBuffer & rbuf, uint64_t compare, uint64_t swap)
   {
     ibv_send_wr wr, *bad;
     memset(&wr, 0, sizeof(wr));
@@ -325,7 +472,7 @@ namespace rdmalib {
     wr.wr.atomic.compare_add = compare;
     wr.wr.atomic.swap = swap;
 
-    int ret = ibv_post_send(_qp, &wr, &bad);
+    int ret = _post_send_wr(&wr, &bad);
     if(ret) {
       spdlog::error("Post write unsuccesful, reason {} {}", errno, strerror(errno));
       return -1;
@@ -334,7 +481,7 @@ namespace rdmalib {
     return _req_count - 1;
   }
 
-  int32_t Connection::post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add)
+  int32_t Connection::post_atomic_fadd(const ScatterGatherElement & elems, const RemoteBuffer & rbuf, uint64_t add)
   {
     ibv_send_wr wr, *bad;
     memset(&wr, 0, sizeof(wr));
@@ -348,7 +495,7 @@ namespace rdmalib {
     wr.wr.atomic.rkey = rbuf.rkey;
     wr.wr.atomic.compare_add = add;
 
-    int ret = ibv_post_send(_qp, &wr, &bad);
+    int ret = _post_send_wr(&wr, &bad);
     if(ret) {
       spdlog::error("Post write unsuccesful, reason {} {}", errno, strerror(errno));
       return -1;
@@ -366,11 +513,14 @@ namespace rdmalib {
 
     //spdlog::error("{} {} {}", fmt::ptr(_qp), fmt::ptr(_qp->recv_cq), fmt::ptr(wcs));
     do {
-      ret = ibv_poll_cq(
-        type == QueueType::RECV ? _qp->recv_cq : _qp->send_cq,
-        count == -1 ? _wc_size : count,
-        wcs
-      );
+      if(_transport)
+        ret = _transport->poll(type, count == -1 ? _wc_size : count, wcs);
+      else
+        ret = ibv_poll_cq(
+          type == QueueType::RECV ? _qp->recv_cq : _qp->send_cq,
+          count == -1 ? _wc_size : count,
+          wcs
+        );
     } while(blocking && ret == 0);
 
     if(ret < 0) {
@@ -393,7 +543,10 @@ namespace rdmalib {
 
   void Connection::notify_events(bool only_solicited)
   {
-    impl::expect_zero(ibv_req_notify_cq(_qp->recv_cq, only_solicited));
+    if(_transport)
+      _transport->notify_events(only_solicited);
+    else
+      impl::expect_zero(ibv_req_notify_cq(_qp->recv_cq, only_solicited));
   }
 
   ibv_cq* Connection::wait_events()
@@ -404,6 +557,20 @@ namespace rdmalib {
     return ev_cq;
   }
 
+  ibv_cq* Connection::wait_events(int timeout_ms, int wake_fd)
+  {
+    pollfd fds[2] = {{_channel->fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    int ret = poll(fds, wake_fd != -1 ? 2 : 1, timeout_ms);
+    if(ret <= 0) {
+      if(ret < 0 && errno != EINTR)
+        spdlog::error("Polling the completion channel failed, reason {}", strerror(errno));
+      return nullptr;
+    }
+    if(!(fds[0].revents & POLLIN))
+      return nullptr;
+    return wait_events();
+  }
+
   void Connection::ack_events(ibv_cq* cq, int len)
   {
     ibv_ack_cq_events(cq, len);
@@ -0,0 +1,141 @@
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#include <infiniband/verbs.h>
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/device.hpp>
+
+namespace rdmalib { namespace device {
+
+  // Larger than the inline limits of current devices.
+  static constexpr uint32_t MAX_PROBED_INLINE = 4096;
+
+  static bool accepts_inline(ibv_pd* pd, ibv_cq* cq, uint32_t & inline_data)
+  {
+    ibv_qp_init_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.send_cq = attr.recv_cq = cq;
+    attr.qp_type = IBV_QPT_RC;
+    attr.cap.max_send_wr = attr.cap.max_recv_wr = 1;
+    attr.cap.max_send_sge = attr.cap.max_recv_sge = 1;
+    attr.cap.max_inline_data = inline_data;
+    ibv_qp* qp = ibv_create_qp(pd, &attr);
+    if(!qp)
+      return false;
+    // Providers round the inline data up to the size of their work queue entries.
+    inline_data = std::max(inline_data, attr.cap.max_inline_data);
+    ibv_destroy_qp(qp);
+    return true;
+  }
+
+  static uint32_t probe_inline(ibv_context* ctx)
+  {
+    ibv_pd* pd = ibv_alloc_pd(ctx);
+    ibv_cq* cq = pd ? ibv_create_cq(ctx, 1, nullptr, nullptr, 0) : nullptr;
+    if(!cq) {
+      spdlog::warn("Probing inline data failed, disabling inlining, reason {}", strerror(errno));
+      if(pd)
+        ibv_dealloc_pd(pd);
+      return 0;
+    }
+    // Largest accepted size, found with a binary search.
+    uint32_t low = 0, high = MAX_PROBED_INLINE;
+    while(low < high) {
+      uint32_t size = (low + high + 1) / 2;
+      if(accepts_inline(pd, cq, size))
+        low = std::min(size, MAX_PROBED_INLINE);
+      else
+        high = size - 1;
+    }
+    ibv_destroy_cq(cq);
+    ibv_dealloc_pd(pd);
+    return low;
+  }
+
+  const Limits & limits(ibv_context* ctx)
+  {
+    static std::mutex mutex;
+    static std::unordered_map<ibv_context*, Limits> devices;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = devices.find(ctx);
+    if(it != devices.end())
+      return it->second;
+
+    ibv_device_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    if(ibv_query_device(ctx, &attr))
+      spdlog::warn("Querying the device failed, reason {}", strerror(errno));
+    Limits limits{attr.max_qp_wr, attr.max_sge, attr.max_cqe};
+    spdlog::debug(
+      "Device {} limits: {} work requests, {} scatter-gather elements, {} completions",
+      ibv_get_device_name(ctx->device), limits.max_qp_wr, limits.max_sge, limits.max_cqe
+    );
+    return devices.emplace(ctx, limits).first->second;
+  }
+
+  uint32_t max_inline_data(ibv_context* ctx)
+  {
+    static std::mutex mutex;
+    static std::unordered_map<ibv_context*, uint32_t> devices;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = devices.find(ctx);
+    if(it != devices.end())
+      return it->second;
+
+    uint32_t inline_data = probe_inline(ctx);
+    spdlog::debug(
+      "Device {} supports {} bytes of inline data", ibv_get_device_name(ctx->device), inline_data
+    );
+    return devices.emplace(ctx, inline_data).first->second;
+  }
+
+  void fit(ibv_context* ctx, ibv_qp_cap & cap)
+  {
+    const Limits & dev = limits(ctx);
+    // Zero when the query failed.
+    auto reduce = [&](uint32_t & value, uint32_t limit, const char* name) {
+      if(!limit || value <= limit)
+        return;
+      spdlog::warn("Requested {} {} exceeds the device limit {}", value, name, limit);
+      value = limit;
+    };
+    reduce(cap.max_send_wr, dev.max_qp_wr, "send work requests");
+    reduce(cap.max_recv_wr, dev.max_qp_wr, "receive work requests");
+    reduce(cap.max_send_sge, dev.max_sge, "send scatter-gather elements");
+    reduce(cap.max_recv_sge, dev.max_sge, "receive scatter-gather elements");
+    // Configured sizes are not verified - probing costs a dozen queue pairs.
+    if(cap.max_inline_data == AUTO_INLINE)
+      cap.max_inline_data = max_inline_data(ctx);
+  }
+
+  ibv_pd* protection_domain(ibv_context* ctx)
+  {
+    static std::mutex mutex;
+    static std::unordered_map<ibv_context*, ibv_pd*> pds;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    ibv_pd* & pd = pds[ctx];
+    if(!pd && !(pd = ibv_alloc_pd(ctx)))
+      spdlog::error("Allocating a protection domain failed, reason {}", strerror(errno));
+    return pd;
+  }
+
+  int cq_entries(ibv_context* ctx, int entries)
+  {
+    const Limits & dev = limits(ctx);
+    if(dev.max_cqe > 0 && entries > dev.max_cqe) {
+      spdlog::warn("Requested {} completions exceed the device limit {}", entries, dev.max_cqe);
+      return dev.max_cqe;
+    }
+    return entries;
+  }
+
+}}
+
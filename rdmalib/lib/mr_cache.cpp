@@ -0,0 +1,240 @@
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+
+#include <unistd.h>
+#include <infiniband/verbs.h>
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/mr_cache.hpp>
+#include <rdmalib/odp.hpp>
+#include <rdmalib/transport.hpp>
+
+namespace rdmalib {
+
+  MemoryRegistrationCache::MemoryRegistrationCache(ibv_pd* pd, int access, size_t capacity):
+    _pd(pd),
+    _access(access),
+    _capacity(capacity),
+    _registered_bytes(0),
+    _longest(0),
+    _implicit(nullptr),
+    _hits(0),
+    _misses(0),
+    _evictions(0)
+  {}
+
+  MemoryRegistrationCache::~MemoryRegistrationCache()
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    SPDLOG_DEBUG(
+      "Registration cache: {} hits, {} misses, {} evictions",
+      _hits, _misses, _evictions
+    );
+    while(!_entries.empty()) {
+      if(_entries.begin()->second.references)
+        spdlog::warn(
+          "Deregistering memory at {} with {} references",
+          fmt::ptr(_entries.begin()->second.mr->addr), _entries.begin()->second.references
+        );
+      _erase(_entries.begin());
+    }
+    if(_implicit) {
+      if(SoftwareMemory::mirrors(_access))
+        SoftwareMemory::instance().deregister_region(_pd, _implicit->rkey);
+      ibv_dereg_mr(_implicit);
+    }
+  }
+
+  bool MemoryRegistrationCache::enable_implicit_odp()
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(_implicit)
+      return true;
+    _implicit = odp::register_implicit(_pd, _access);
+    if(!_implicit)
+      return false;
+    if(SoftwareMemory::mirrors(_access))
+      SoftwareMemory::instance().insert_region(_pd, _implicit->rkey, nullptr, SIZE_MAX, _access);
+    // Pinned registrations are no longer needed for new requests
+    for(auto it = _entries.begin(); it != _entries.end();) {
+      auto cur = it++;
+      if(!cur->second.references)
+        _erase(cur);
+    }
+    return true;
+  }
+
+  bool MemoryRegistrationCache::implicit_odp() const
+  {
+    return _implicit != nullptr;
+  }
+
+  ibv_mr* MemoryRegistrationCache::acquire(const void* ptr, size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(_implicit)
+      return _implicit;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    auto it = _find(begin, begin + bytes);
+    if(it == _entries.end()) {
+      it = _register(begin, begin + bytes);
+      if(it == _entries.end())
+        return nullptr;
+    } else if(!it->second.references) {
+      _lru.erase(it->second.lru);
+    }
+    it->second.references++;
+    return it->second.mr;
+  }
+
+  void MemoryRegistrationCache::release(ibv_mr* mr)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(mr == _implicit)
+      return;
+    auto range = _entries.equal_range(reinterpret_cast<uintptr_t>(mr->addr));
+    auto it = std::find_if(range.first, range.second,
+      [mr](const entries_t::value_type & entry) { return entry.second.mr == mr; }
+    );
+    if(it == range.second || !it->second.references) {
+      spdlog::error("Releasing memory registration {} that is not referenced", fmt::ptr(mr));
+      return;
+    }
+    if(!--it->second.references)
+      it->second.lru = _lru.insert(_lru.begin(), mr);
+  }
+
+  ibv_mr* MemoryRegistrationCache::lookup(const void* ptr, size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(_implicit)
+      return _implicit;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    auto it = _find(begin, begin + bytes);
+    if(it == _entries.end()) {
+      it = _register(begin, begin + bytes);
+      if(it == _entries.end())
+        return nullptr;
+      it->second.lru = _lru.insert(_lru.begin(), it->second.mr);
+    } else if(!it->second.references) {
+      _lru.splice(_lru.begin(), _lru, it->second.lru);
+    }
+    return it->second.mr;
+  }
+
+  void MemoryRegistrationCache::invalidate(const void* ptr, size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t end = begin + bytes;
+    auto it = _entries.lower_bound(begin > _longest ? begin - _longest : 0);
+    while(it != _entries.end() && it->first < end) {
+      auto cur = it++;
+      if(cur->second.end <= begin)
+        continue;
+      // FIXME: operations in flight might still access the old pages
+      if(cur->second.references) {
+        spdlog::warn(
+          "Invalidated memory at {} is still referenced, keeping the registration",
+          fmt::ptr(cur->second.mr->addr)
+        );
+        continue;
+      }
+      _erase(cur);
+    }
+  }
+
+  size_t MemoryRegistrationCache::registered_bytes() const
+  {
+    return _registered_bytes;
+  }
+
+  MemoryRegistrationCache::entries_t::iterator MemoryRegistrationCache::_find(uintptr_t begin, uintptr_t end)
+  {
+    // Registrations starting before begin - _longest cannot cover the range
+    auto it = _entries.upper_bound(begin);
+    while(it != _entries.begin()) {
+      --it;
+      if(it->first + _longest < begin)
+        break;
+      if(it->second.end >= end) {
+        _hits++;
+        return it;
+      }
+    }
+    _misses++;
+    return _entries.end();
+  }
+
+  MemoryRegistrationCache::entries_t::iterator MemoryRegistrationCache::_register(uintptr_t begin, uintptr_t end)
+  {
+    // Pages of the range are mapped, and registering them allows neighbouring requests to hit.
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    begin = begin / page * page;
+    end = (end + page - 1) / page * page;
+    size_t bytes = end - begin;
+
+    _evict(bytes);
+    ibv_mr* mr = nullptr;
+    if(!_pd) {
+      mr = new ibv_mr{};
+      mr->addr = reinterpret_cast<void*>(begin);
+      mr->length = bytes;
+      mr->lkey = mr->rkey = SoftwareMemory::instance().register_region(mr->addr, bytes, _access);
+      _registered_bytes += bytes;
+      _longest = std::max(_longest, bytes);
+      return _entries.emplace(begin, Entry{mr, end, 0, _lru.end()});
+    }
+    mr = ibv_reg_mr(_pd, reinterpret_cast<void*>(begin), bytes, _access);
+    if(!mr) {
+      spdlog::error(
+        "Registration of {} bytes at {} failed, reason {}",
+        bytes, fmt::ptr(reinterpret_cast<void*>(begin)), strerror(errno)
+      );
+      return _entries.end();
+    }
+    // Shared memory transports apply remote writes in software
+    if(SoftwareMemory::mirrors(_access))
+      SoftwareMemory::instance().insert_region(_pd, mr->rkey, mr->addr, bytes, _access);
+    _registered_bytes += bytes;
+    _longest = std::max(_longest, bytes);
+    SPDLOG_DEBUG(
+      "Registered {} bytes in the cache, address {}, lkey {}, rkey {}",
+      bytes, fmt::ptr(mr->addr), mr->lkey, mr->rkey
+    );
+    return _entries.emplace(begin, Entry{mr, end, 0, _lru.end()});
+  }
+
+  void MemoryRegistrationCache::_erase(entries_t::iterator it)
+  {
+    Entry & entry = it->second;
+    if(!entry.references)
+      _lru.erase(entry.lru);
+    _registered_bytes -= entry.end - it->first;
+    // Software registrations have no protection domain
+    if(!_pd || SoftwareMemory::mirrors(_access))
+      SoftwareMemory::instance().deregister_region(_pd, entry.mr->rkey);
+    if(_pd)
+      ibv_dereg_mr(entry.mr);
+    else
+      delete entry.mr;
+    _entries.erase(it);
+  }
+
+  void MemoryRegistrationCache::_evict(size_t bytes)
+  {
+    while(_registered_bytes + bytes > _capacity && !_lru.empty()) {
+      ibv_mr* mr = _lru.back();
+      auto range = _entries.equal_range(reinterpret_cast<uintptr_t>(mr->addr));
+      auto it = std::find_if(range.first, range.second,
+        [mr](const entries_t::value_type & entry) { return entry.second.mr == mr; }
+      );
+      _erase(it);
+      _evictions++;
+    }
+  }
+
+}
+
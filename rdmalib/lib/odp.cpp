@@ -0,0 +1,59 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <infiniband/verbs.h>
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/odp.hpp>
+
+namespace rdmalib { namespace odp {
+
+  bool supported(ibv_context* ctx, bool implicit)
+  {
+    ibv_device_attr_ex attr;
+    memset(&attr, 0, sizeof(attr));
+    if(ibv_query_device_ex(ctx, nullptr, &attr)) {
+      spdlog::warn("Querying the device failed, assuming no on-demand paging, reason {}", strerror(errno));
+      return false;
+    }
+    const ibv_odp_caps & caps = attr.odp_caps;
+    uint32_t required = IBV_ODP_SUPPORT_SEND | IBV_ODP_SUPPORT_RECV | IBV_ODP_SUPPORT_WRITE;
+    SPDLOG_DEBUG(
+      "On-demand paging caps: general {:#x}, rc {:#x}",
+      caps.general_caps, caps.per_transport_caps.rc_odp_caps
+    );
+    if(!(caps.general_caps & IBV_ODP_SUPPORT))
+      return false;
+    if(implicit && !(caps.general_caps & IBV_ODP_SUPPORT_IMPLICIT))
+      return false;
+    return (caps.per_transport_caps.rc_odp_caps & required) == required;
+  }
+
+  ibv_mr* register_implicit(ibv_pd* pd, int access)
+  {
+    // Not available for memory registered in software
+    if(!pd || !supported(pd->context, true))
+      return nullptr;
+    ibv_mr* mr = ibv_reg_mr(pd, nullptr, SIZE_MAX, access | IBV_ACCESS_ON_DEMAND);
+    if(!mr) {
+      spdlog::warn("Implicit on-demand paging registration failed, reason {}", strerror(errno));
+      return nullptr;
+    }
+    SPDLOG_DEBUG("Registered the address space on demand, lkey {}, rkey {}", mr->lkey, mr->rkey);
+    return mr;
+  }
+
+  bool prefetch(ibv_pd* pd, uint32_t lkey, const void* ptr, uint32_t bytes, bool write)
+  {
+    ibv_sge sge{reinterpret_cast<uint64_t>(ptr), bytes, lkey};
+    int ret = ibv_advise_mr(
+      pd,
+      write ? IBV_ADVISE_MR_ADVICE_PREFETCH_WRITE : IBV_ADVISE_MR_ADVICE_PREFETCH,
+      0, &sge, 1
+    );
+    return ret == 0;
+  }
+
+}}
+
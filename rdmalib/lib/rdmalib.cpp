@@ -13,6 +13,8 @@
 #include <spdlog/fmt/bundled/format.h>
 
 #include <rdmalib/rdmalib.hpp>
+#include <rdmalib/device.hpp>
+#include <rdmalib/transport.hpp>
 #include <rdmalib/util.hpp>
 #include <stdexcept>
 
@@ -30,15 +32,20 @@ namespace rdmalib {
     impl::expect_false(ip.empty(), false, "Expected non-empty IP address!");
 
     memset(&hints, 0, sizeof hints);
+    addrinfo = nullptr;
+    this->_ip = ip;
+    this->_port = port;
+    if(software_transport())
+      return;
     hints.ai_port_space = RDMA_PS_TCP;
     if(passive)
       hints.ai_flags = RAI_PASSIVE;
 
     impl::expect_zero(rdma_getaddrinfo(ip.c_str(), std::to_string(port).c_str(), &hints, &addrinfo));
-    this->_port = port;
   }
 
-  Address::Address(const std::string & sip,  const std::string & dip, int port)
+  Address::Address(const std::string & sip,  const std::string & dip, int port):
+    _ip(dip)
   {
     struct sockaddr_in server_in, local_in;
     memset(&server_in, 0, sizeof(server_in));
@@ -84,17 +91,14 @@ namespace rdmalib {
     _pd(nullptr)
   {
     // Size of Queue Pair
-    // Maximum requests in send queue
-    // FIXME: configurable -> parallel workers
-    _cfg.attr.cap.max_send_wr = 40;
-    // Maximum requests in receive queue
-    _cfg.attr.cap.max_recv_wr = recv_buf;
+    // Maximum requests in send and receive queue
+    _cfg.pipeline_depth(recv_buf);
     // Maximal number of scatter-gather requests in a work request in send queue
     _cfg.attr.cap.max_send_sge = 5;
     // Maximal number of scatter-gather requests in a work request in receive queue
     _cfg.attr.cap.max_recv_sge = 5;
-    // Max inlined message size
-    _cfg.attr.cap.max_inline_data = max_inline_data;
+    // Max inlined message size, negative selects the limit of the device
+    _cfg.attr.cap.max_inline_data = max_inline_data < 0 ? device::AUTO_INLINE : max_inline_data;
     // Reliable connection
     _cfg.attr.qp_type = IBV_QPT_RC;
     _cfg.attr.sq_sig_all = 1;
@@ -128,11 +132,19 @@ namespace rdmalib {
   {
     if(!_conn) {
       _conn = std::unique_ptr<Connection>(new Connection());
+      // Receives can be posted before connecting, like to a QP
+      if(software_transport()) {
+        _conn->initialize(std::unique_ptr<Transport>{new TCPTransport{}});
+        return;
+      }
       rdma_cm_id* id;
       impl::expect_zero(rdma_create_ep(&id, _addr.addrinfo, nullptr, nullptr));
-      impl::expect_zero(rdma_create_qp(id, _pd, &_cfg.attr));
+      ibv_qp_init_attr attr = _cfg.attr;
+      device::fit(id->verbs, attr.cap);
+      if(!_pd)
+        impl::expect_nonnull(_pd = device::protection_domain(id->verbs));
+      impl::expect_zero(rdma_create_qp(id, _pd, &attr));
       _conn->initialize(id);
-      _pd = _conn->id()->pd;
 
       //struct ibv_qp_attr attr;
       //struct ibv_qp_init_attr init_attr;
@@ -187,6 +199,14 @@ namespace rdmalib {
   bool RDMAActive::connect(uint32_t secret)
   {
     allocate();
+    if(software_transport()) {
+      if(!static_cast<TCPTransport*>(_conn->transport())->connect(_addr._ip, _addr._port, secret)) {
+        _conn.reset();
+        return false;
+      }
+      spdlog::debug("[RDMAActive] Connection succesful to {}:{} over TCP", _addr._ip, _addr._port);
+      return true;
+    }
     if(secret) {
       _cfg.conn_param.private_data = &secret;
       _cfg.conn_param.private_data_len = sizeof(uint32_t);
@@ -215,7 +235,9 @@ namespace rdmalib {
   void RDMAActive::disconnect()
   {
     spdlog::debug("[RDMAActive] Disonnecting connection with id {}", fmt::ptr(_conn->id()));
-    impl::expect_zero(rdma_disconnect(_conn->id()));
+    // TCP connections are closed with their transport
+    if(!software_transport())
+      impl::expect_zero(rdma_disconnect(_conn->id()));
     _conn.reset();
     _pd = nullptr;
   }
@@ -242,12 +264,10 @@ namespace rdmalib {
     _pd(nullptr)
   {
     // Size of Queue Pair
-    // FIXME: configurable -> parallel workers
-    _cfg.attr.cap.max_send_wr = 40;
-    _cfg.attr.cap.max_recv_wr = recv_buf;
+    _cfg.pipeline_depth(recv_buf);
     _cfg.attr.cap.max_send_sge = 5;
     _cfg.attr.cap.max_recv_sge = 5;
-    _cfg.attr.cap.max_inline_data = max_inline_data;
+    _cfg.attr.cap.max_inline_data = max_inline_data < 0 ? device::AUTO_INLINE : max_inline_data;
     _cfg.attr.qp_type = IBV_QPT_RC;
     _cfg.attr.sq_sig_all = 1;
 
@@ -263,12 +283,21 @@ namespace rdmalib {
 
   RDMAPassive::~RDMAPassive()
   {
-    rdma_destroy_id(this->_listen_id);
-    rdma_destroy_event_channel(this->_ec);
+    if(this->_listen_id)
+      rdma_destroy_id(this->_listen_id);
+    if(this->_ec)
+      rdma_destroy_event_channel(this->_ec);
   }
 
   void RDMAPassive::allocate()
   {
+    if(software_transport()) {
+      _listener.reset(new TCPListener);
+      impl::expect_true(_listener->listen(_addr._ip, _addr._port), false);
+      this->_addr._port = _listener->port();
+      spdlog::info("Listening over TCP at {}:{}", _addr._ip, _addr._port);
+      return;
+    }
     // Start listening
     impl::expect_nonzero(this->_ec = rdma_create_event_channel());
     impl::expect_zero(rdma_create_id(this->_ec, &this->_listen_id, NULL, RDMA_PS_TCP));
@@ -293,6 +322,9 @@ namespace rdmalib {
 
   void RDMAPassive::set_nonblocking_poll()
   {
+    // Accepting a TCP connection blocks only when polling has not found one
+    if(_listener)
+      return;
     int fd = this->_ec->fd;
     int flags = fcntl(fd, F_GETFL);
     int rc = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
@@ -304,8 +336,10 @@ namespace rdmalib {
 
   bool RDMAPassive::nonblocking_poll_events(int timeout)
   {
+    if(!_established.empty())
+      return true;
     pollfd my_pollfd;
-    my_pollfd.fd      = this->_ec->fd;
+    my_pollfd.fd      = _listener ? _listener->fd() : this->_ec->fd;
     my_pollfd.events  = POLLIN;
     my_pollfd.revents = 0;
     int rc = poll(&my_pollfd, 1, timeout);
@@ -316,8 +350,64 @@ namespace rdmalib {
     return rc > 0;
   }
 
+  void RDMAPassive::share_cq(ibv_cq* cq)
+  {
+    _cfg.attr.send_cq = _cfg.attr.recv_cq = cq;
+    if(!cq)
+      _software_send_cq = _software_recv_cq = nullptr;
+  }
+
+  void RDMAPassive::share_srq(ibv_srq* srq)
+  {
+    _cfg.attr.srq = srq;
+    if(!srq)
+      _software_srq = nullptr;
+  }
+
+  void RDMAPassive::share_queues(SharedQueues & queues)
+  {
+    _cfg.attr.send_cq = _cfg.attr.recv_cq = queues._cq;
+    _cfg.attr.srq = queues._srq;
+    _software_send_cq = _software_recv_cq = queues._software_cq;
+    _software_srq = queues._software_srq;
+  }
+
+  std::tuple<Connection*, ConnectionStatus> RDMAPassive::poll_software_events(bool share_cqs)
+  {
+    if(!_established.empty()) {
+      Connection* connection = _established.front();
+      _established.pop_front();
+      return std::make_tuple(connection, ConnectionStatus::ESTABLISHED);
+    }
+
+    uint32_t data = 0;
+    int fd = _listener->accept(data);
+    if(fd == -1)
+      return std::make_tuple(nullptr, ConnectionStatus::UNKNOWN);
+    Connection* connection = new Connection{true};
+    if(data)
+      connection->set_private_data(data);
+    SPDLOG_DEBUG("[RDMAPassive] TCP connection request with private data {}", data);
+
+    // Like CQs created by rdmacm, the next connections share these queues
+    if(!share_cqs)
+      _software_send_cq = _software_recv_cq = nullptr;
+    if(!_software_send_cq)
+      _software_send_cq = std::make_shared<SoftwareCompletionQueue>();
+    if(!_software_recv_cq)
+      _software_recv_cq = std::make_shared<SoftwareCompletionQueue>();
+    connection->initialize(std::unique_ptr<Transport>{
+      new TCPTransport{fd, _software_send_cq, _software_recv_cq, _software_srq}
+    });
+    _active_connections.insert(connection);
+    return std::make_tuple(connection, ConnectionStatus::REQUESTED);
+  }
+
   std::tuple<Connection*, ConnectionStatus> RDMAPassive::poll_events(bool share_cqs)
   {
+    if(_listener)
+      return poll_software_events(share_cqs);
+
     rdma_cm_event* event = nullptr;
 		Connection* connection = nullptr;
     ConnectionStatus status = ConnectionStatus::UNKNOWN;
@@ -359,7 +449,14 @@ namespace rdmalib {
         );
 
         // Alocate queue pair for the new connection
-        impl::expect_zero(rdma_create_qp(event->id, _pd, &_cfg.attr));
+        {
+          ibv_qp_init_attr attr = _cfg.attr;
+          device::fit(event->id->verbs, attr.cap);
+          impl::expect_zero(rdma_create_qp(event->id, _pd, &attr));
+          // rdmacm returns the CQs it created, and the next QPs share them
+          _cfg.attr.send_cq = attr.send_cq;
+          _cfg.attr.recv_cq = attr.recv_cq;
+        }
         connection->initialize(event->id);
         SPDLOG_DEBUG(
           "[RDMAPassive] Created connection id {} qpnum {} qp {} send {} recv {}",
@@ -413,10 +510,27 @@ namespace rdmalib {
   }
 
   void RDMAPassive::accept(Connection* connection) {
+    if(_listener) {
+      // Reported by the next poll, like the event of rdmacm
+      if(static_cast<TCPTransport*>(connection->transport())->answer(true))
+        _established.push_back(connection);
+      else
+        spdlog::error("Conection accept unsuccesful, reason {} {}", errno, strerror(errno));
+      return;
+    }
     if(rdma_accept(connection->id(), &_cfg.conn_param)) {
       spdlog::error("Conection accept unsuccesful, reason {} {}", errno, strerror(errno));
       connection = nullptr;
     }
     SPDLOG_DEBUG("[RDMAPassive] Connection accepted at QP {}", fmt::ptr(connection->qp()));
   }
+
+  void RDMAPassive::reject(Connection* connection) {
+    if(_listener)
+      static_cast<TCPTransport*>(connection->transport())->answer(false);
+    else if(rdma_reject(connection->id(), nullptr, 0))
+      spdlog::error("Connection reject unsuccesful, reason {} {}", errno, strerror(errno));
+    _active_connections.erase(connection);
+    delete connection;
+  }
 }
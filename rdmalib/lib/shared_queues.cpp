@@ -0,0 +1,85 @@
+
+#include <fcntl.h>
+
+#include <rdmalib/device.hpp>
+#include <rdmalib/shared_queues.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib {
+
+  SharedQueues::SharedQueues(ibv_pd* pd, int completions, int receives):
+    _channel(nullptr),
+    _cq(nullptr),
+    _srq(nullptr)
+  {
+    if(!pd) {
+      _software_cq = std::make_shared<SoftwareCompletionQueue>();
+      _software_srq = std::make_shared<SoftwareReceiveQueue>();
+      return;
+    }
+    ibv_context* context = pd->context;
+    impl::expect_nonzero(_channel = ibv_create_comp_channel(context));
+    impl::expect_nonzero(_cq = ibv_create_cq(context, device::cq_entries(context, completions), nullptr, _channel, 0));
+    // We drain the channel after each wake up
+    int flags = fcntl(_channel->fd, F_GETFL);
+    impl::expect_zero(fcntl(_channel->fd, F_SETFL, flags | O_NONBLOCK));
+
+    ibv_srq_init_attr srq_attr{};
+    srq_attr.attr.max_wr = receives;
+    srq_attr.attr.max_sge = 1;
+    impl::expect_nonzero(_srq = ibv_create_srq(pd, &srq_attr));
+  }
+
+  SharedQueues::~SharedQueues()
+  {
+    // FIXME: fails while connections still use the queues
+    if(_srq)
+      ibv_destroy_srq(_srq);
+    if(_cq)
+      ibv_destroy_cq(_cq);
+    if(_channel)
+      ibv_destroy_comp_channel(_channel);
+  }
+
+  int SharedQueues::fd() const
+  {
+    return _channel ? _channel->fd : _software_cq->fd();
+  }
+
+  void SharedQueues::notify()
+  {
+    if(_cq)
+      impl::expect_zero(ibv_req_notify_cq(_cq, 0));
+    else
+      _software_cq->notify(false);
+  }
+
+  void SharedQueues::acknowledge()
+  {
+    if(!_channel)
+      return _software_cq->acknowledge();
+    ibv_cq* cq = nullptr;
+    void* context = nullptr;
+    int events = 0;
+    while(!ibv_get_cq_event(_channel, &cq, &context))
+      ++events;
+    if(events)
+      ibv_ack_cq_events(_cq, events);
+  }
+
+  int SharedQueues::poll(int count, ibv_wc* wcs)
+  {
+    if(_cq)
+      return ibv_poll_cq(_cq, count, wcs);
+    return _software_cq->poll(count, wcs);
+  }
+
+  int SharedQueues::post_recv(ibv_recv_wr* wr, ibv_recv_wr** bad)
+  {
+    if(_srq)
+      return ibv_post_srq_recv(_srq, wr, bad);
+    _software_srq->post_recv(wr);
+    return 0;
+  }
+
+}
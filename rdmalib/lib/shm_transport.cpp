@@ -0,0 +1,340 @@
+
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/connection.hpp>
+#include <rdmalib/shm_transport.hpp>
+
+namespace rdmalib {
+
+  static size_t round_up(size_t bytes, size_t alignment)
+  {
+    return (bytes + alignment - 1) / alignment * alignment;
+  }
+
+  // Not private - the words are shared between processes
+  static long futex(std::atomic<uint32_t> & word, int op, uint32_t val, const timespec* timeout = nullptr)
+  {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, val, timeout, nullptr, 0);
+  }
+
+  SharedMemorySegment::SharedMemorySegment(const std::string & name, bool owner, void* ptr, size_t bytes):
+    _name(name),
+    _owner(owner),
+    _ptr(ptr),
+    _bytes(bytes)
+  {
+    _stride = round_up(sizeof(Message) + header()->slot_size, 64);
+  }
+
+  SharedMemorySegment::~SharedMemorySegment()
+  {
+    munmap(_ptr, _bytes);
+    if(_owner)
+      shm_unlink(_name.c_str());
+  }
+
+  std::unique_ptr<SharedMemorySegment> SharedMemorySegment::create(
+    const std::string & name, int lanes, int slots, uint32_t slot_size
+  )
+  {
+    size_t stride = round_up(sizeof(Message) + slot_size, 64);
+    size_t bytes = round_up(sizeof(Header), 64) + lanes * sizeof(Lane) + 2UL * lanes * slots * stride;
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if(fd == -1) {
+      spdlog::error("Couldn't create shared memory {}, reason {}", name, strerror(errno));
+      return nullptr;
+    }
+    // Pages are allocated when slots are used for the first time
+    void* ptr = MAP_FAILED;
+    if(!ftruncate(fd, bytes))
+      ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED) {
+      spdlog::error("Couldn't map {} bytes of shared memory {}, reason {}", bytes, name, strerror(errno));
+      shm_unlink(name.c_str());
+      return nullptr;
+    }
+
+    Header* header = static_cast<Header*>(ptr);
+    header->lanes = lanes;
+    header->slots = slots;
+    header->slot_size = slot_size;
+    reinterpret_cast<std::atomic<uint32_t>*>(&header->magic)->store(MAGIC, std::memory_order_release);
+    return std::unique_ptr<SharedMemorySegment>{new SharedMemorySegment{name, true, ptr, bytes}};
+  }
+
+  std::unique_ptr<SharedMemorySegment> SharedMemorySegment::open(const std::string & name)
+  {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if(fd == -1) {
+      spdlog::error("Couldn't open shared memory {}, reason {}", name, strerror(errno));
+      return nullptr;
+    }
+    struct stat st;
+    void* ptr = MAP_FAILED;
+    if(!fstat(fd, &st) && static_cast<size_t>(st.st_size) >= sizeof(Header))
+      ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED) {
+      spdlog::error("Couldn't map shared memory {}, reason {}", name, strerror(errno));
+      return nullptr;
+    }
+    if(reinterpret_cast<std::atomic<uint32_t>*>(ptr)->load(std::memory_order_acquire) != MAGIC) {
+      spdlog::error("Shared memory {} is not initialized", name);
+      munmap(ptr, st.st_size);
+      return nullptr;
+    }
+    return std::unique_ptr<SharedMemorySegment>{new SharedMemorySegment{name, false, ptr, static_cast<size_t>(st.st_size)}};
+  }
+
+  SharedMemorySegment::Header* SharedMemorySegment::header() const
+  {
+    return static_cast<Header*>(_ptr);
+  }
+
+  SharedMemorySegment::Lane* SharedMemorySegment::lane(int idx) const
+  {
+    return reinterpret_cast<Lane*>(static_cast<char*>(_ptr) + round_up(sizeof(Header), 64)) + idx;
+  }
+
+  SharedMemorySegment::Message* SharedMemorySegment::slot(int lane, bool to_client, uint64_t pos) const
+  {
+    const Header* hdr = header();
+    char* data = reinterpret_cast<char*>(this->lane(hdr->lanes));
+    size_t ring = 2 * lane + to_client;
+    return reinterpret_cast<Message*>(data + (ring * hdr->slots + pos % hdr->slots) * _stride);
+  }
+
+  SharedMemoryEndpoint::SharedMemoryEndpoint(std::shared_ptr<SharedMemorySegment> segment, ibv_pd* pd, bool client):
+    _segment(std::move(segment)),
+    _pd(pd),
+    _client(client),
+    _seen_solicited(0)
+  {
+    _seen_solicited = notification().solicited.load();
+  }
+
+  void SharedMemoryEndpoint::attach(int lane, uint32_t qp_num)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _lanes.emplace_back(lane, qp_num);
+  }
+
+  SharedMemorySegment::Notification & SharedMemoryEndpoint::notification() const
+  {
+    if(_client || _lanes.empty())
+      return _segment->header()->client;
+    return _segment->lane(_lanes[0].first)->executor;
+  }
+
+  bool SharedMemoryEndpoint::pending() const
+  {
+    for(auto & lane : _lanes) {
+      auto & ring = _client ? _segment->lane(lane.first)->to_client : _segment->lane(lane.first)->to_executor;
+      if(ring.head.load(std::memory_order_relaxed) != ring.tail.load(std::memory_order_relaxed))
+        return true;
+    }
+    return false;
+  }
+
+  void SharedMemoryEndpoint::drain()
+  {
+    for(auto & lane : _lanes) {
+      auto & ring = _client ? _segment->lane(lane.first)->to_client : _segment->lane(lane.first)->to_executor;
+      uint64_t head = ring.head.load(std::memory_order_relaxed);
+      uint64_t tail = ring.tail.load(std::memory_order_acquire);
+      for(; head != tail; ++head) {
+        SharedMemorySegment::Message* msg = _segment->slot(lane.first, _client, head);
+        const char* payload = reinterpret_cast<const char*>(msg + 1);
+        // Like a receiver not ready - the message stays until a receive is posted
+        if(msg->opcode != IBV_WR_RDMA_WRITE && _receives.empty())
+          break;
+
+        ibv_wc wc{};
+        wc.status = IBV_WC_SUCCESS;
+        wc.qp_num = lane.second;
+        wc.byte_len = msg->length;
+        if(msg->opcode != IBV_WR_SEND && msg->length) {
+          void* dest = SoftwareMemory::instance().translate(
+            _pd, msg->remote_addr, msg->rkey, msg->length, IBV_ACCESS_REMOTE_WRITE
+          );
+          if(dest)
+            memcpy(dest, payload, msg->length);
+          else {
+            spdlog::error(
+              "Shared memory write of {} bytes to {} with rkey {} is not allowed",
+              msg->length, msg->remote_addr, msg->rkey
+            );
+            wc.status = IBV_WC_REM_ACCESS_ERR;
+          }
+        }
+        if(msg->opcode == IBV_WR_RDMA_WRITE)
+          continue;
+
+        Receive & receive = _receives.front();
+        wc.wr_id = receive.wr_id;
+        if(msg->opcode == IBV_WR_SEND) {
+          wc.opcode = IBV_WC_RECV;
+          size_t offset = 0;
+          for(const ibv_sge & sge : receive.sges) {
+            size_t len = std::min<size_t>(sge.length, msg->length - offset);
+            memcpy(reinterpret_cast<void*>(sge.addr), payload + offset, len);
+            offset += len;
+          }
+          if(offset < msg->length)
+            wc.status = IBV_WC_LOC_LEN_ERR;
+        } else {
+          wc.opcode = IBV_WC_RECV_RDMA_WITH_IMM;
+          wc.wc_flags = IBV_WC_WITH_IMM;
+          wc.imm_data = msg->imm_data;
+        }
+        _recv_cq.push_back(wc);
+        _receives.pop_front();
+      }
+      ring.head.store(head, std::memory_order_release);
+    }
+  }
+
+  int SharedMemoryEndpoint::poll(QueueType type, int count, ibv_wc* wcs)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(type == QueueType::RECV)
+      drain();
+    std::deque<ibv_wc> & cq = type == QueueType::RECV ? _recv_cq : _send_cq;
+    int ret = 0;
+    while(ret < count && !cq.empty()) {
+      wcs[ret++] = cq.front();
+      cq.pop_front();
+    }
+    return ret;
+  }
+
+  bool SharedMemoryEndpoint::wait_events(bool only_solicited, int timeout_ms)
+  {
+    SharedMemorySegment::Notification & notify = notification();
+    std::atomic<uint32_t> & word = only_solicited ? notify.solicited : notify.messages;
+    // The sender checks for waiters after publishing, so we can't miss its wake-up.
+    notify.waiting.fetch_add(1);
+    uint32_t value = word.load();
+    bool ready = only_solicited ? value != _seen_solicited : pending();
+    if(!ready) {
+      timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+      futex(word, FUTEX_WAIT, value, timeout_ms >= 0 ? &timeout : nullptr);
+      value = word.load();
+      ready = only_solicited ? value != _seen_solicited : pending();
+    }
+    notify.waiting.fetch_sub(1);
+    if(only_solicited)
+      _seen_solicited = value;
+    return ready;
+  }
+
+  SharedMemoryTransport::SharedMemoryTransport(std::shared_ptr<SharedMemoryEndpoint> endpoint, int lane, uint32_t qp_num):
+    _endpoint(std::move(endpoint)),
+    _lane(lane),
+    _qp_num(qp_num)
+  {
+    _endpoint->attach(lane, qp_num);
+  }
+
+  int SharedMemoryTransport::post_send(ibv_send_wr* wr, ibv_send_wr** bad)
+  {
+    SharedMemorySegment & segment = *_endpoint->_segment;
+    SharedMemorySegment::Header* header = segment.header();
+    SharedMemorySegment::Lane* lane = segment.lane(_lane);
+    bool client = _endpoint->_client;
+    auto & ring = client ? lane->to_executor : lane->to_client;
+    auto & peer = client ? lane->executor : header->client;
+
+    for(; wr; wr = wr->next) {
+      if(wr->opcode != IBV_WR_SEND && wr->opcode != IBV_WR_RDMA_WRITE && wr->opcode != IBV_WR_RDMA_WRITE_WITH_IMM) {
+        spdlog::error("Operation {} is not supported by the shared memory transport", wr->opcode);
+        *bad = wr;
+        return EINVAL;
+      }
+      uint32_t length = 0;
+      for(int i = 0; i < wr->num_sge; ++i)
+        length += wr->sg_list[i].length;
+      if(length > header->slot_size) {
+        spdlog::error("Message of {} bytes exceeds the shared memory slot of {} bytes", length, header->slot_size);
+        *bad = wr;
+        return EMSGSIZE;
+      }
+
+      // Wait until the receiver frees a slot
+      uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+      while(tail - ring.head.load(std::memory_order_acquire) >= header->slots)
+        std::this_thread::yield();
+
+      SharedMemorySegment::Message* msg = segment.slot(_lane, !client, tail);
+      msg->opcode = wr->opcode;
+      msg->imm_data = wr->imm_data;
+      msg->length = length;
+      msg->rkey = wr->wr.rdma.rkey;
+      msg->remote_addr = wr->wr.rdma.remote_addr;
+      char* payload = reinterpret_cast<char*>(msg + 1);
+      for(int i = 0; i < wr->num_sge; ++i) {
+        memcpy(payload, reinterpret_cast<void*>(wr->sg_list[i].addr), wr->sg_list[i].length);
+        payload += wr->sg_list[i].length;
+      }
+      ring.tail.store(tail + 1, std::memory_order_release);
+
+      peer.messages.fetch_add(1);
+      if(wr->send_flags & IBV_SEND_SOLICITED)
+        peer.solicited.fetch_add(1);
+      if(peer.waiting.load()) {
+        futex(peer.messages, FUTEX_WAKE, INT_MAX);
+        futex(peer.solicited, FUTEX_WAKE, INT_MAX);
+      }
+
+      // The payload has been copied, the buffer can be reused
+      if(wr->send_flags & IBV_SEND_SIGNALED) {
+        ibv_wc wc{};
+        wc.wr_id = wr->wr_id;
+        wc.status = IBV_WC_SUCCESS;
+        wc.opcode = wr->opcode == IBV_WR_SEND ? IBV_WC_SEND : IBV_WC_RDMA_WRITE;
+        wc.qp_num = _qp_num;
+        wc.byte_len = length;
+        std::lock_guard<std::mutex> lock{_endpoint->_mutex};
+        _endpoint->_send_cq.push_back(wc);
+      }
+    }
+    return 0;
+  }
+
+  int SharedMemoryTransport::post_recv(ibv_recv_wr* wr, ibv_recv_wr**)
+  {
+    std::lock_guard<std::mutex> lock{_endpoint->_mutex};
+    for(; wr; wr = wr->next)
+      _endpoint->_receives.push_back({wr->wr_id, {wr->sg_list, wr->num_sge}});
+    return 0;
+  }
+
+  int SharedMemoryTransport::poll(QueueType type, int count, ibv_wc* wcs)
+  {
+    return _endpoint->poll(type, count, wcs);
+  }
+
+  bool SharedMemoryTransport::wait_events(bool only_solicited, int timeout_ms)
+  {
+    return _endpoint->wait_events(only_solicited, timeout_ms);
+  }
+
+  uint32_t SharedMemoryTransport::qp_num() const
+  {
+    return _qp_num;
+  }
+
+}
+
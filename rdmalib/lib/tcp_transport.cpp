@@ -0,0 +1,509 @@
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/connection.hpp>
+#include <rdmalib/tcp_transport.hpp>
+
+namespace rdmalib {
+
+  // Acknowledgment of an operation, with the data of reads and atomics
+  static constexpr uint8_t RESPONSE = 0xFF;
+  static constexpr uint8_t SOLICITED = 1;
+  // Identifies connection requests
+  static constexpr uint32_t MAGIC = 0x72646d61;
+  // Emulated connections are numbered like QPs
+  static std::atomic<uint32_t> qp_numbers{1};
+
+  static bool write_all(int fd, iovec* iov, int count)
+  {
+    // A closed peer is reported as an error instead of SIGPIPE
+    msghdr msg{};
+    while(count) {
+      msg.msg_iov = iov;
+      msg.msg_iovlen = count;
+      ssize_t ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+      if(ret < 0 && errno == EINTR)
+        continue;
+      if(ret <= 0)
+        return false;
+      size_t written = ret;
+      while(count && written >= iov->iov_len) {
+        written -= iov->iov_len;
+        ++iov;
+        --count;
+      }
+      if(count) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
+    }
+    return true;
+  }
+
+  static bool read_all(int fd, void* data, size_t length)
+  {
+    char* ptr = static_cast<char*>(data);
+    while(length) {
+      ssize_t ret = read(fd, ptr, length);
+      if(ret < 0 && errno == EINTR)
+        continue;
+      if(ret <= 0)
+        return false;
+      ptr += ret;
+      length -= ret;
+    }
+    return true;
+  }
+
+  static void configure(int fd)
+  {
+    // Small messages are latency-sensitive
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+
+  static sockaddr_in socket_address(const std::string & address, int port, bool & valid)
+  {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    valid = inet_pton(AF_INET, address.c_str(), &addr.sin_addr) == 1;
+    return addr;
+  }
+
+  TCPTransport::TCPTransport(int fd,
+    std::shared_ptr<SoftwareCompletionQueue> send_cq,
+    std::shared_ptr<SoftwareCompletionQueue> recv_cq,
+    std::shared_ptr<SoftwareReceiveQueue> receives
+  ):
+    _fd(fd),
+    _closing(false),
+    _seq(0),
+    _send_cq(send_cq ? send_cq : std::make_shared<SoftwareCompletionQueue>()),
+    _recv_cq(recv_cq ? recv_cq : std::make_shared<SoftwareCompletionQueue>()),
+    _receives(receives ? receives : std::make_shared<SoftwareReceiveQueue>()),
+    _shared_receives(receives != nullptr),
+    _qp_num(qp_numbers++)
+  {
+    if(_fd != -1)
+      start();
+  }
+
+  TCPTransport::~TCPTransport()
+  {
+    if(_fd == -1)
+      return;
+    // The peer waits for responses to operations we have already completed
+    {
+      std::lock_guard<std::mutex> lock{_responses_mutex};
+      _closing = true;
+    }
+    _responses_cv.notify_one();
+    if(_writer.joinable())
+      _writer.join();
+    // The progress thread finds the socket closed
+    shutdown(_fd, SHUT_RDWR);
+    if(_progress.joinable())
+      _progress.join();
+    close(_fd);
+  }
+
+  void TCPTransport::start()
+  {
+    configure(_fd);
+    _writer = std::thread(&TCPTransport::write_responses, this);
+    _progress = std::thread(&TCPTransport::progress, this);
+  }
+
+  bool TCPTransport::connect(const std::string & address, int port, uint32_t private_data)
+  {
+    bool valid;
+    sockaddr_in addr = socket_address(address, port, valid);
+    if(!valid) {
+      spdlog::error("Incorrect address {}", address);
+      return false;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+      spdlog::error("Couldn't connect to {}:{}, reason {}", address, port, strerror(errno));
+      if(fd != -1)
+        close(fd);
+      return false;
+    }
+    Request request{MAGIC, private_data};
+    iovec iov{&request, sizeof(request)};
+    uint8_t accepted = 0;
+    if(!write_all(fd, &iov, 1) || !read_all(fd, &accepted, sizeof(accepted)) || !accepted) {
+      spdlog::error("Connection to {}:{} was not accepted", address, port);
+      close(fd);
+      return false;
+    }
+    _fd = fd;
+    start();
+    return true;
+  }
+
+  bool TCPTransport::answer(bool accept)
+  {
+    uint8_t accepted = accept;
+    iovec iov{&accepted, sizeof(accepted)};
+    std::lock_guard<std::mutex> lock{_send_mutex};
+    return write_all(_fd, &iov, 1);
+  }
+
+  bool TCPTransport::write_message(const Header & header, const ibv_sge* sges, int num_sge, const void* data)
+  {
+    // Header, payload of a response, and the gathered elements
+    iovec inline_iov[ScatterGatherElement::INLINE_ELEMENTS + 2];
+    std::vector<iovec> heap_iov;
+    iovec* iov = inline_iov;
+    if(num_sge > static_cast<int>(ScatterGatherElement::INLINE_ELEMENTS)) {
+      heap_iov.resize(num_sge + 2);
+      iov = heap_iov.data();
+    }
+    int count = 0;
+    iov[count++] = iovec{const_cast<Header*>(&header), sizeof(Header)};
+    if(data && header.length)
+      iov[count++] = iovec{const_cast<void*>(data), header.length};
+    for(int i = 0; i < num_sge; ++i)
+      if(sges[i].length)
+        iov[count++] = iovec{reinterpret_cast<void*>(sges[i].addr), sges[i].length};
+    std::lock_guard<std::mutex> lock{_send_mutex};
+    return write_all(_fd, iov, count);
+  }
+
+  int TCPTransport::post_send(ibv_send_wr* wr, ibv_send_wr** bad)
+  {
+    if(_fd == -1) {
+      *bad = wr;
+      return ENOTCONN;
+    }
+    for(; wr; wr = wr->next) {
+      Header header{};
+      header.opcode = wr->opcode;
+      if(wr->send_flags & IBV_SEND_SOLICITED)
+        header.flags |= SOLICITED;
+      uint32_t length = 0;
+      for(int i = 0; i < wr->num_sge; ++i)
+        length += wr->sg_list[i].length;
+      header.length = length;
+
+      Pending pending{wr->wr_id, IBV_WC_SEND, static_cast<bool>(wr->send_flags & IBV_SEND_SIGNALED), {}};
+      bool payload = false;
+      switch(wr->opcode) {
+        case IBV_WR_SEND:
+          payload = true;
+          break;
+        case IBV_WR_RDMA_WRITE_WITH_IMM:
+          header.imm_data = wr->imm_data;
+          // fallthrough
+        case IBV_WR_RDMA_WRITE:
+          pending.opcode = IBV_WC_RDMA_WRITE;
+          header.remote_addr = wr->wr.rdma.remote_addr;
+          header.rkey = wr->wr.rdma.rkey;
+          payload = true;
+          break;
+        case IBV_WR_RDMA_READ:
+          pending.opcode = IBV_WC_RDMA_READ;
+          header.remote_addr = wr->wr.rdma.remote_addr;
+          header.rkey = wr->wr.rdma.rkey;
+          pending.sges.assign(wr->sg_list, wr->sg_list + wr->num_sge);
+          break;
+        case IBV_WR_ATOMIC_FETCH_AND_ADD:
+        case IBV_WR_ATOMIC_CMP_AND_SWP:
+          pending.opcode = wr->opcode == IBV_WR_ATOMIC_CMP_AND_SWP ? IBV_WC_COMP_SWAP : IBV_WC_FETCH_ADD;
+          header.remote_addr = wr->wr.atomic.remote_addr;
+          header.rkey = wr->wr.atomic.rkey;
+          header.compare_add = wr->wr.atomic.compare_add;
+          header.swap = wr->wr.atomic.swap;
+          header.length = sizeof(uint64_t);
+          pending.sges.assign(wr->sg_list, wr->sg_list + wr->num_sge);
+          break;
+        default:
+          spdlog::error("Operation {} is not supported by the TCP transport", wr->opcode);
+          *bad = wr;
+          return EINVAL;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        header.seq = _seq++;
+        _pending.emplace(header.seq, std::move(pending));
+      }
+      // Payload is copied to the socket right away, like an inlined send
+      if(!write_message(header, payload ? wr->sg_list : nullptr, payload ? wr->num_sge : 0)) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _pending.erase(header.seq);
+        *bad = wr;
+        return ECONNRESET;
+      }
+    }
+    return 0;
+  }
+
+  int TCPTransport::post_recv(ibv_recv_wr* wr, ibv_recv_wr**)
+  {
+    _receives->post_recv(wr);
+    return 0;
+  }
+
+  int TCPTransport::poll(QueueType type, int count, ibv_wc* wcs)
+  {
+    return (type == QueueType::RECV ? _recv_cq : _send_cq)->poll(count, wcs);
+  }
+
+  bool TCPTransport::wait_events(bool only_solicited, int timeout_ms)
+  {
+    return _recv_cq->wait(only_solicited, timeout_ms);
+  }
+
+  void TCPTransport::notify_events(bool only_solicited)
+  {
+    _recv_cq->notify(only_solicited);
+  }
+
+  uint32_t TCPTransport::qp_num() const
+  {
+    return _qp_num;
+  }
+
+  void TCPTransport::deliver(const Header & header, std::vector<char> && payload)
+  {
+    SoftwareReceiveQueue::Message msg{ibv_wc{}, static_cast<bool>(header.flags & SOLICITED), std::move(payload), _recv_cq};
+    ibv_wc & wc = msg.wc;
+    wc.status = IBV_WC_SUCCESS;
+    wc.qp_num = _qp_num;
+    wc.byte_len = header.length;
+    if(header.opcode == IBV_WR_RDMA_WRITE_WITH_IMM) {
+      wc.opcode = IBV_WC_RECV_RDMA_WITH_IMM;
+      wc.wc_flags = IBV_WC_WITH_IMM;
+      wc.imm_data = header.imm_data;
+    } else
+      wc.opcode = IBV_WC_RECV;
+    _receives->deliver(std::move(msg));
+  }
+
+  void TCPTransport::respond(const Header & request, ibv_wc_status status, const void* data, uint32_t length)
+  {
+    Header header{};
+    header.opcode = RESPONSE;
+    header.status = status;
+    header.seq = request.seq;
+    header.length = length;
+    // Data is copied - the memory can be written or deregistered before the writer sends it
+    Message response{header, std::vector<char>(length)};
+    if(length)
+      memcpy(response.payload.data(), data, length);
+    {
+      std::lock_guard<std::mutex> lock{_responses_mutex};
+      _responses.push_back(std::move(response));
+    }
+    _responses_cv.notify_one();
+  }
+
+  void TCPTransport::write_responses()
+  {
+    std::unique_lock<std::mutex> lock{_responses_mutex};
+    while(true) {
+      _responses_cv.wait(lock, [this]() { return _closing || !_responses.empty(); });
+      if(_responses.empty())
+        return;
+      Message response = std::move(_responses.front());
+      _responses.pop_front();
+      lock.unlock();
+      // Failures are found by the progress thread
+      write_message(response.header, nullptr, 0, response.payload.data());
+      lock.lock();
+    }
+  }
+
+  void TCPTransport::progress()
+  {
+    Header header;
+    std::vector<char> payload;
+    while(read_all(_fd, &header, sizeof(header))) {
+
+      if(header.opcode == RESPONSE) {
+        payload.resize(header.length);
+        if(!read_all(_fd, payload.data(), header.length))
+          break;
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto it = _pending.find(header.seq);
+        if(it == _pending.end())
+          continue;
+        Pending & pending = it->second;
+        size_t offset = 0;
+        for(const ibv_sge & sge : pending.sges) {
+          size_t len = std::min<size_t>(sge.length, payload.size() - offset);
+          memcpy(reinterpret_cast<void*>(sge.addr), payload.data() + offset, len);
+          offset += len;
+        }
+        if(pending.signaled || header.status != IBV_WC_SUCCESS) {
+          ibv_wc wc{};
+          wc.wr_id = pending.wr_id;
+          wc.status = static_cast<ibv_wc_status>(header.status);
+          wc.opcode = pending.opcode;
+          wc.qp_num = _qp_num;
+          wc.byte_len = header.length;
+          _send_cq->push(wc);
+        }
+        _pending.erase(it);
+        continue;
+      }
+
+      switch(header.opcode) {
+        case IBV_WR_SEND: {
+          std::vector<char> data(header.length);
+          if(!read_all(_fd, data.data(), header.length))
+            return flush();
+          // Acknowledged before the receiver can see the message and close the connection
+          respond(header, IBV_WC_SUCCESS);
+          deliver(header, std::move(data));
+          break;
+        }
+        case IBV_WR_RDMA_WRITE:
+        case IBV_WR_RDMA_WRITE_WITH_IMM: {
+          void* dest = SoftwareMemory::instance().translate(
+            nullptr, header.remote_addr, header.rkey, header.length, IBV_ACCESS_REMOTE_WRITE
+          );
+          if(!dest) {
+            payload.resize(header.length);
+            dest = payload.data();
+          }
+          if(!read_all(_fd, dest, header.length))
+            return flush();
+          if(dest == payload.data()) {
+            respond(header, IBV_WC_REM_ACCESS_ERR);
+            break;
+          }
+          respond(header, IBV_WC_SUCCESS);
+          if(header.opcode == IBV_WR_RDMA_WRITE_WITH_IMM)
+            deliver(header, {});
+          break;
+        }
+        case IBV_WR_RDMA_READ: {
+          void* src = SoftwareMemory::instance().translate(
+            nullptr, header.remote_addr, header.rkey, header.length, IBV_ACCESS_REMOTE_READ
+          );
+          if(src)
+            respond(header, IBV_WC_SUCCESS, src, header.length);
+          else
+            respond(header, IBV_WC_REM_ACCESS_ERR);
+          break;
+        }
+        case IBV_WR_ATOMIC_FETCH_AND_ADD:
+        case IBV_WR_ATOMIC_CMP_AND_SWP: {
+          void* ptr = SoftwareMemory::instance().translate(
+            nullptr, header.remote_addr, header.rkey, sizeof(uint64_t), IBV_ACCESS_REMOTE_ATOMIC
+          );
+          if(!ptr || header.remote_addr % sizeof(uint64_t)) {
+            respond(header, IBV_WC_REM_ACCESS_ERR);
+            break;
+          }
+          uint64_t* value = static_cast<uint64_t*>(ptr);
+          uint64_t original;
+          if(header.opcode == IBV_WR_ATOMIC_FETCH_AND_ADD)
+            original = __atomic_fetch_add(value, header.compare_add, __ATOMIC_SEQ_CST);
+          else {
+            original = header.compare_add;
+            __atomic_compare_exchange_n(value, &original, header.swap, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+          }
+          respond(header, IBV_WC_SUCCESS, &original, sizeof(original));
+          break;
+        }
+        default:
+          spdlog::error("TCP transport received unknown operation {}", header.opcode);
+          return flush();
+      }
+    }
+    flush();
+  }
+
+  void TCPTransport::flush()
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for(auto & pending : _pending) {
+      ibv_wc wc{};
+      wc.wr_id = pending.second.wr_id;
+      wc.status = IBV_WC_WR_FLUSH_ERR;
+      wc.qp_num = _qp_num;
+      _send_cq->push(wc);
+    }
+    _pending.clear();
+    // Other connections keep receiving from a shared queue
+    if(!_shared_receives)
+      _receives->flush(*_recv_cq, _qp_num);
+  }
+
+  TCPListener::TCPListener():
+    _fd(-1)
+  {}
+
+  TCPListener::~TCPListener()
+  {
+    if(_fd != -1)
+      close(_fd);
+  }
+
+  bool TCPListener::listen(const std::string & address, int port)
+  {
+    bool valid;
+    sockaddr_in addr = socket_address(address, port, valid);
+    if(!valid) {
+      spdlog::error("Incorrect address {}", address);
+      return false;
+    }
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int flag = 1;
+    if(_fd == -1 || setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) ||
+        bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || ::listen(_fd, 16)) {
+      spdlog::error("Couldn't listen at {}:{}, reason {}", address, port, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  int TCPListener::fd() const
+  {
+    return _fd;
+  }
+
+  int TCPListener::port() const
+  {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    if(getsockname(_fd, reinterpret_cast<sockaddr*>(&addr), &len))
+      return -1;
+    return ntohs(addr.sin_port);
+  }
+
+  int TCPListener::accept(uint32_t & private_data)
+  {
+    int fd = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd == -1) {
+      spdlog::error("Couldn't accept a connection, reason {}", strerror(errno));
+      return -1;
+    }
+    // FIXME: a peer that never sends its request blocks the listener
+    TCPTransport::Request request;
+    if(!read_all(fd, &request, sizeof(request)) || request.magic != MAGIC) {
+      spdlog::error("Connection without a correct request, closing it");
+      close(fd);
+      return -1;
+    }
+    private_data = request.private_data;
+    return fd;
+  }
+
+}
@@ -0,0 +1,211 @@
+
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/transport.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib {
+
+  bool software_transport()
+  {
+    static bool enabled = [](){
+      const char* name = getenv("RDMALIB_TRANSPORT");
+      return name && !strcmp(name, "tcp");
+    }();
+    return enabled;
+  }
+
+  SoftwareMemory::SoftwareMemory():
+    _next_key(1)
+  {}
+
+  SoftwareMemory & SoftwareMemory::instance()
+  {
+    // Never destroyed - buffers with static lifetime deregister at exit
+    static SoftwareMemory* memory = new SoftwareMemory;
+    return *memory;
+  }
+
+  size_t SoftwareMemory::KeyHash::operator()(const Key & key) const
+  {
+    return std::hash<const ibv_pd*>{}(key.first) ^ (static_cast<size_t>(key.second) << 1);
+  }
+
+  bool SoftwareMemory::mirrors(int access)
+  {
+    return access & IBV_ACCESS_REMOTE_WRITE;
+  }
+
+  uint32_t SoftwareMemory::register_region(void* ptr, size_t bytes, int access)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    uint32_t key;
+    do {
+      key = _next_key++;
+    } while(!key || _regions.count(Key{nullptr, key}));
+    _regions[Key{nullptr, key}] = Region{reinterpret_cast<uintptr_t>(ptr), bytes, access};
+    return key;
+  }
+
+  void SoftwareMemory::insert_region(const ibv_pd* pd, uint32_t key, void* ptr, size_t bytes, int access)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(_regions.count(Key{pd, key}))
+      spdlog::warn("Memory key {} is registered already, replacing the region", key);
+    _regions[Key{pd, key}] = Region{reinterpret_cast<uintptr_t>(ptr), bytes, access};
+  }
+
+  void SoftwareMemory::deregister_region(const ibv_pd* pd, uint32_t key)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _regions.erase(Key{pd, key});
+  }
+
+  void* SoftwareMemory::translate(const ibv_pd* pd, uintptr_t addr, uint32_t key, size_t bytes, int access)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto it = _regions.find(Key{pd, key});
+    if(it == _regions.end())
+      return nullptr;
+    const Region & region = it->second;
+    if(addr < region.addr || addr + bytes > region.addr + region.bytes || (region.access & access) != access)
+      return nullptr;
+    return reinterpret_cast<void*>(addr);
+  }
+
+  SoftwareCompletionQueue::SoftwareCompletionQueue():
+    _event_fd(-1),
+    _notify(Notify::NONE),
+    _solicited(0),
+    _seen_solicited(0)
+  {
+    impl::expect_nonnegative(_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+  }
+
+  SoftwareCompletionQueue::~SoftwareCompletionQueue()
+  {
+    if(_event_fd != -1)
+      close(_event_fd);
+  }
+
+  void SoftwareCompletionQueue::push(const ibv_wc & wc, bool solicited)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _wcs.push_back(wc);
+    if(solicited)
+      ++_solicited;
+    if(_notify == Notify::ALL || (_notify == Notify::SOLICITED && solicited)) {
+      // One event for each notification request, like a completion channel
+      _notify = Notify::NONE;
+      uint64_t value = 1;
+      [[maybe_unused]] ssize_t ret = write(_event_fd, &value, sizeof(value));
+    }
+  }
+
+  int SoftwareCompletionQueue::poll(int count, ibv_wc* wcs)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    int ret = 0;
+    while(ret < count && !_wcs.empty()) {
+      wcs[ret++] = _wcs.front();
+      _wcs.pop_front();
+    }
+    return ret;
+  }
+
+  int SoftwareCompletionQueue::fd() const
+  {
+    return _event_fd;
+  }
+
+  void SoftwareCompletionQueue::notify(bool only_solicited)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _notify = only_solicited ? Notify::SOLICITED : Notify::ALL;
+  }
+
+  void SoftwareCompletionQueue::acknowledge()
+  {
+    uint64_t value;
+    [[maybe_unused]] ssize_t ret = read(_event_fd, &value, sizeof(value));
+  }
+
+  bool SoftwareCompletionQueue::wait(bool only_solicited, int timeout_ms)
+  {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      bool ready = only_solicited ? _solicited != _seen_solicited : !_wcs.empty();
+      _seen_solicited = _solicited;
+      if(ready)
+        return true;
+      _notify = only_solicited ? Notify::SOLICITED : Notify::ALL;
+    }
+    pollfd fd{_event_fd, POLLIN, 0};
+    bool ready = ::poll(&fd, 1, timeout_ms) > 0;
+    acknowledge();
+    std::lock_guard<std::mutex> lock{_mutex};
+    _seen_solicited = _solicited;
+    return ready;
+  }
+
+  void SoftwareReceiveQueue::post_recv(ibv_recv_wr* wr)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for(; wr; wr = wr->next) {
+      Receive receive{wr->wr_id, {wr->sg_list, wr->num_sge}};
+      if(!_unmatched.empty()) {
+        complete(_unmatched.front(), receive);
+        _unmatched.pop_front();
+      } else
+        _receives.push_back(std::move(receive));
+    }
+  }
+
+  void SoftwareReceiveQueue::deliver(Message && msg)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(!_receives.empty()) {
+      complete(msg, _receives.front());
+      _receives.pop_front();
+    } else
+      _unmatched.push_back(std::move(msg));
+  }
+
+  void SoftwareReceiveQueue::flush(SoftwareCompletionQueue & cq, uint32_t qp_num)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for(auto & receive : _receives) {
+      ibv_wc wc{};
+      wc.wr_id = receive.wr_id;
+      wc.status = IBV_WC_WR_FLUSH_ERR;
+      wc.qp_num = qp_num;
+      cq.push(wc);
+    }
+    _receives.clear();
+  }
+
+  void SoftwareReceiveQueue::complete(Message & msg, Receive & receive)
+  {
+    ibv_wc & wc = msg.wc;
+    wc.wr_id = receive.wr_id;
+    if(wc.opcode == IBV_WC_RECV) {
+      size_t offset = 0;
+      for(const ibv_sge & sge : receive.sges) {
+        size_t len = std::min<size_t>(sge.length, msg.payload.size() - offset);
+        memcpy(reinterpret_cast<void*>(sge.addr), msg.payload.data() + offset, len);
+        offset += len;
+      }
+      if(offset < msg.payload.size())
+        wc.status = IBV_WC_LOC_LEN_ERR;
+    }
+    msg.cq->push(wc, msg.solicited);
+  }
+
+}
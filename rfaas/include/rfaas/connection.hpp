@@ -29,6 +29,47 @@ namespace rfaas {
     bool connect();
     void disconnect();
     bool submit();
+    // Sends a request with zero cores.
+    bool renew();
+    // Non-blocking check for the expiry notification of the manager.
+    bool lease_expired();
+  };
+
+  // Leases executor managers from the resource manager.
+  struct resource_manager_connection {
+    std::string _address;
+    int _port;
+    rdmalib::RDMAActive _active;
+    rdmalib::Buffer<rdmalib::LeaseRequest> _request;
+    rdmalib::Buffer<rdmalib::LeaseResponse> _response;
+    rdmalib::Buffer<rdmalib::DirectoryInformation> _directory_info;
+    // Local snapshot of the executor directory
+    rdmalib::Buffer<rdmalib::Directory> _directory;
+    // Previous values returned by atomics
+    rdmalib::Buffer<uint64_t> _fetched;
+    rdmalib::Buffer<rdmalib::LoadReport> _load;
+    rdmalib::RemoteBuffer _remote_directory;
+    rdmalib::RemoteBuffer _remote_loads;
+
+    resource_manager_connection(std::string address, int port);
+
+    // Executor managers authenticate with their secret.
+    bool connect(uint32_t secret = 0);
+    void disconnect();
+    // Single round trip; the lease has zero cores when no executor manager has enough.
+    bool lease(int cores, rdmalib::LeaseResponse & lease);
+    void release(uint32_t lease_id);
+
+    // Asks for the location of the directory; required before accessing it.
+    bool query_directory();
+    // Consistent snapshot with one-sided reads, no CPU of the resource manager is involved.
+    const rdmalib::Directory & read_directory();
+    // Index of the entry with most free cores in the last snapshot, or -1.
+    int select(int cores) const;
+    // Non-blocking; completions of previous updates are reaped by the next one.
+    void add_free_cores(int entry, int cores);
+    // Non-blocking; overwrites the load slot of the entry.
+    void report_load(int entry, const rdmalib::LoadReport & report);
   };
 
 }
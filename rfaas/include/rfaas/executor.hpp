@@ -11,6 +11,7 @@
 #include <rdmalib/connection.hpp>
 #include <rdmalib/recv_buffer.hpp>
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/functions.hpp>
 #include <rdmalib/rdmalib.hpp>
 
 #include <rfaas/connection.hpp>
@@ -18,6 +19,11 @@
 
 #include <spdlog/spdlog.h>
 
+namespace rdmalib {
+  struct SharedMemorySegment;
+  struct MemoryRegistrationCache;
+}
+
 namespace rfaas {
 
   struct servers;
@@ -41,6 +47,15 @@ namespace rfaas {
     operator int() const;
   };
 
+  // Invocation of one function on the same buffers, repeated without building new requests.
+  // The submission header is written once, when the invocation is prepared.
+  struct prepared_invocation {
+    // -1 when the function is not deployed
+    int func_idx;
+    uint32_t in_bytes;
+    rdmalib::PreparedWrite write;
+  };
+
   struct executor_state {
     std::unique_ptr<rdmalib::Connection> conn;
     rdmalib::RemoteBuffer remote_input;
@@ -50,10 +65,16 @@ namespace rfaas {
 
   struct executor {
     static constexpr int MAX_REMOTE_WORKERS = 64;
+    // Pinned memory of cached registrations of user buffers
+    static constexpr size_t REGISTRATION_CACHE_BYTES = 256 * 1024 * 1024;
     // FIXME: 
     rdmalib::RDMAPassive _state;
     rdmalib::RecvBuffer _rcv_buffer;
     rdmalib::Buffer<rdmalib::BufferInformation> _execs_buf;
+    // Registrations of user memory passed to invocations without a copy
+    std::unique_ptr<rdmalib::MemoryRegistrationCache> _registrations;
+    // Submission header sent before the user input
+    rdmalib::Buffer<char> _header;
     std::string _address;
     int _port;
     int _rcv_buf_size;
@@ -61,8 +82,25 @@ namespace rfaas {
     int _invoc_id;
     // FIXME: global settings
     size_t _max_inlined_msg;
+    uint32_t _input_slot_size;
+    // Seconds without invocations before the manager reclaims the executor,
+    // 0 uses the default of the manager. Must be set before allocation.
+    int _lease_timeout;
+    // Executors on the same host receive invocations over shared memory.
+    // Must be set before allocation.
+    bool _use_shared_memory;
+    // Parameters of the last allocation, repeated when the lease has expired
+    std::string _functions_path;
+    int _numcores;
+    int _max_input_size;
+    int _hot_timeout;
     std::vector<executor_state> _connections;
+    // Segment shared with co-located executor threads, nullptr when we use RDMA
+    std::shared_ptr<rdmalib::SharedMemorySegment> _shared_memory;
     std::unique_ptr<manager_connection> _exec_manager;
+    // Without the resource manager, executor managers come from the executor database
+    std::unique_ptr<resource_manager_connection> _resource_manager;
+    rdmalib::LeaseResponse _lease;
     std::vector<std::string> _func_names;
 
     // manage async executions
@@ -77,17 +115,69 @@ namespace rfaas {
     executor(device_data & dev);
     ~executor();
 
+    bool connect_resource_manager(std::string address, int port);
+    // Number of input buffers on each executor thread, 1 by default; must be set before allocation.
+    // Invocations select the slot by their id, and the number of invocations in flight
+    // on one executor thread must not exceed it. Work stealing needs more than one slot
+    // to queue invocations. Returns false when it exceeds the executor's queue of invocations.
+    bool input_slots(int slots);
+
     // Skipping managers is useful for benchmarking
     bool allocate(std::string functions_path, int numcores, int max_input_size, int hot_timeout,
         bool skip_manager = false, rdmalib::Benchmarker<5> * benchmarker = nullptr);
     void deallocate();
+    // Keeps the executor while we don't submit invocations.
+    bool renew_lease();
+    // Allocates again when the manager reclaimed our executor; false if that failed.
+    bool _check_lease();
     rdmalib::Buffer<char> load_library(std::string path);
     void poll_queue();
+    void _account_reply(const ibv_wc & wc);
+    // Switches all connections to shared memory once executor threads have sent their buffers.
+    bool _attach_shared_memory();
+    // Polls until the result of a synchronous invocation arrives, completing futures on the way.
+    std::tuple<bool, int> _wait_result(int invoc_id);
+
+    inline rdmalib::RemoteBuffer _input(int conn, int invoc_id) const
+    {
+      const rdmalib::RemoteBuffer & input = _connections[conn].remote_input;
+      return rdmalib::RemoteBuffer(
+        input.addr + rdmalib::functions::Submission::slot(invoc_id, _input_slots) * _input_slot_size,
+        input.rkey
+      );
+    }
 
+    // Invocations are submitted on the first connection.
     template<typename T, typename U>
-    std::future<int> async(std::string fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out, int64_t size = -1)
+    prepared_invocation prepare(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out)
     {
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
+      if(it == _func_names.end()) {
+        spdlog::error("Function {} not found in the deployed library!", fname);
+        return prepared_invocation{-1, 0, {}};
+      }
+      char* data = static_cast<char*>(in.ptr());
+      *reinterpret_cast<uint64_t*>(data) = out.address();
+      *reinterpret_cast<uint32_t*>(data + 8) = out.rkey();
+      return prepared_invocation{
+        static_cast<int>(std::distance(_func_names.begin(), it)),
+        in.bytes(),
+        rdmalib::PreparedWrite{in, _connections[0].remote_input}
+      };
+    }
+
+    // Size includes the submission header; -1 sends the entire input buffer.
+    std::tuple<bool, int> execute(prepared_invocation & invoc, int64_t size = -1);
+    std::future<int> async(prepared_invocation & invoc, int64_t size = -1);
+    // Patches the prepared request and posts it; returns the invocation id, -1 on failure.
+    int _submit(prepared_invocation & invoc, int64_t size, bool async);
+
+    template<typename T, typename U>
+    std::future<int> async(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out, int64_t size = -1)
+    {
+      if(!_check_lease())
+        return std::future<int>{};
+      auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
         return std::future<int>{};
@@ -113,7 +203,7 @@ namespace rfaas {
         sge.add(in, size, 0);
         _connections[0].conn->post_write(
           std::move(sge),
-          _connections[0].remote_input,
+          _input(0, invoc_id),
           submission_id,
           size <= _max_inlined_msg,
           true
@@ -121,19 +211,23 @@ namespace rfaas {
       } else {
         _connections[0].conn->post_write(
           in,
-          _connections[0].remote_input,
+          _input(0, invoc_id),
           submission_id,
           in.bytes() <= _max_inlined_msg,
           true
         );
       }
-      _connections[0]._rcv_buffer.refill();
+      // Replies can arrive at any connection
+      for(auto & conn : _connections)
+        conn._rcv_buffer.refill();
       return std::get<1>(_futures[invoc_id]).get_future();
     }
 
     template<typename T,typename U>
-    std::future<int> async(std::string fname, const std::vector<rdmalib::Buffer<T>> & in, std::vector<rdmalib::Buffer<U>> & out)
+    std::future<int> async(const std::string & fname, const std::vector<rdmalib::Buffer<T>> & in, std::vector<rdmalib::Buffer<U>> & out)
     {
+      if(!_check_lease())
+        return std::future<int>{};
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
@@ -156,7 +250,7 @@ namespace rfaas {
         SPDLOG_DEBUG("Invoke function {} with invocation id {}", func_idx, _invoc_id);
         _connections[i].conn->post_write(
           in[i],
-          _connections[i].remote_input,
+          _input(i, invoc_id),
           submission_id,
           in[i].bytes() <= _max_inlined_msg,
           true
@@ -174,6 +268,7 @@ namespace rfaas {
       _connections[0].conn->poll_wc(rdmalib::QueueType::SEND, true);
 
       auto wc = _connections[0]._rcv_buffer.poll(true);
+      _account_reply(std::get<0>(wc)[0]);
       uint32_t val = ntohl(std::get<0>(wc)[0].imm_data);
       int return_val = val & 0x0000FFFF;
       int finished_invoc_id = val >> 16;
@@ -194,8 +289,10 @@ namespace rfaas {
     //template<class... Args>
     //void execute(int numcores, std::string fname, Args &&... args)
     template<typename T, typename U>
-    std::tuple<bool, int> execute(std::string fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out)
+    std::tuple<bool, int> execute(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out)
     {
+      if(!_check_lease())
+        return std::make_tuple(false, 0);
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
@@ -216,73 +313,28 @@ namespace rfaas {
       );
       _connections[0].conn->post_write(
         in,
-        _connections[0].remote_input,
+        _input(0, invoc_id),
         (invoc_id << 16) | func_idx,
         in.bytes() <= _max_inlined_msg
       );
-      _active_polling = true;
-      _connections[0]._rcv_buffer.refill();
-
-      bool found_result = false;
-      int return_value = 0;
-      int out_size = 0;
-      while(!found_result) {
-        auto wc = _connections[0]._rcv_buffer.poll(true);
-        for(int i = 0; i < std::get<1>(wc); ++i) {
-          uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
-          int return_val = val & 0x0000FFFF;
-          int finished_invoc_id = val >> 16;
-
-          if(finished_invoc_id == invoc_id) {
-            found_result = true;
-            return_value = return_val;
-            out_size = std::get<0>(wc)[i].byte_len;
-            //spdlog::info("Result for id {}", finished_invoc_id);
-          } else {
-            auto it = _futures.find(finished_invoc_id);
-            //spdlog::info("Poll Future for id {}", finished_invoc_id);
-            // if it == end -> we have a bug, should never appear
-            //(*it).second.set_value(return_val);
-            if(!--std::get<0>(it->second))
-              std::get<1>(it->second).set_value(return_val);
-          }
-        }
-        if(found_result) {
-          _active_polling = false;
-          auto wc = _connections[0]._rcv_buffer.poll(false);
-          // Catch very unlikely interleaving
-          // Event arrives after we poll while the background thread is skipping
-          // because we still hold the atomic
-          // Thus, we later unset the variable since we're done
-          for(int i = 0; i < std::get<1>(wc); ++i) {
-            uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
-            int return_val = val & 0x0000FFFF;
-            int finished_invoc_id = val >> 16;
-            auto it = _futures.find(finished_invoc_id);
-            //spdlog::info("Poll Future for id {}", finished_invoc_id);
-            // if it == end -> we have a bug, should never appear
-            //(*it).second.set_value(return_val);
-            if(!--std::get<0>(it->second))
-              std::get<1>(it->second).set_value(return_val);
-          }
-        }
-      }
-      _connections[0].conn->poll_wc(rdmalib::QueueType::SEND, false);
-      if(return_value == 0) {
-        SPDLOG_DEBUG("Finished invocation {} succesfully", invoc_id);
-        return std::make_tuple(true, out_size);
-      } else {
-        if(return_value == 1)
-          spdlog::error("Invocation: {}, Thread busy, cannot post work", invoc_id);
-        else
-          spdlog::error("Invocation: {}, Unknown error {}", invoc_id, return_value);
-        return std::make_tuple(false, 0);
-      }
+      return _wait_result(invoc_id);
     }
 
+    // Zero-copy invocation on memory of the user, registered through the cache.
+    // The input doesn't need space for the submission header, and it can't exceed
+    // the input size of the allocation.
+    // Registrations are found by address and pin the old pages: memory must be invalidated
+    // before it's returned to the system, e.g., with free or munmap, because a new
+    // allocation can reuse the address. Implicit on-demand paging has no such requirement.
+    std::tuple<bool, int> execute(const std::string & fname, const void* in, uint32_t in_size, void* out, uint32_t out_size);
+    // Drops cached registrations of the range; call before the memory is released.
+    void invalidate(const void* ptr, size_t bytes);
+
     template<typename T>
-    bool execute(std::string fname, const std::vector<rdmalib::Buffer<T>> & in, std::vector<rdmalib::Buffer<T>> & out)
+    bool execute(const std::string & fname, const std::vector<rdmalib::Buffer<T>> & in, std::vector<rdmalib::Buffer<T>> & out)
     {
+      if(!_check_lease())
+        return false;
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
@@ -298,11 +350,12 @@ namespace rfaas {
         *reinterpret_cast<uint64_t*>(data) = out[i].address();
         *reinterpret_cast<uint32_t*>(data + 8) = out[i].rkey();
 
-        SPDLOG_DEBUG("Invoke function {} with invocation id {}", func_idx, _invoc_id);
+        int invoc_id = _invoc_id++;
+        SPDLOG_DEBUG("Invoke function {} with invocation id {}", func_idx, invoc_id);
         _connections[i].conn->post_write(
           in[i],
-          _connections[i].remote_input,
-          (_invoc_id++ << 16) | func_idx,
+          _input(i, invoc_id),
+          (invoc_id << 16) | func_idx,
           in[i].bytes() <= _max_inlined_msg
         );
       }
@@ -323,6 +376,7 @@ namespace rfaas {
         auto wc = _connections[0]._rcv_buffer.poll(true);
         expected -= std::get<1>(wc);
         for(int i = 0; i < std::get<1>(wc); ++i) {
+          _account_reply(std::get<0>(wc)[i]);
           uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
           int return_val = val & 0x0000FFFF;
           int finished_invoc_id = val >> 16;
@@ -339,11 +393,11 @@ namespace rfaas {
       }
       _active_polling = false;
 
-      _connections[0]._rcv_buffer._requests += numcores - 1;
-      for(int i = 1; i < numcores; ++i)
-        _connections[i]._rcv_buffer._requests--;
       return correct;
     }
+
+  private:
+    int _input_slots;
   };
 
 }
@@ -1,4 +1,6 @@
 
+#include <cstddef>
+
 #include <infiniband/verbs.h>
 
 #include <rdmalib/buffer.hpp>
@@ -29,10 +31,10 @@ namespace rfaas {
       spdlog::error("Couldn't connect to manager at {}:{}", _address, _port);
       return false;
     }
-    _rcv_buffer.connect(&_active.connection());
     _allocation_buffer.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE); 
-    // Initialize batch receive WCs
+    // Initialize batch receive WCs before posting receives - the manager sends lease notifications
     _active.connection().initialize_batched_recv(_allocation_buffer, sizeof(rdmalib::AllocationRequest));
+    _rcv_buffer.connect(&_active.connection());
     return ret;
   }
 
@@ -41,7 +43,8 @@ namespace rfaas {
     SPDLOG_DEBUG("Disconnecting from manager at {}:{}", _address, _port);
     // Send deallocation request only if we're connected
     if(_active.is_connected()) {
-      request() = (rdmalib::AllocationRequest) {-1, 0, 0, 0, 0, 0, 0, ""};
+      // Zero cores would renew the lease
+      request() = (rdmalib::AllocationRequest) {-1, 0, -1, 0, 0, 0, 0, "", ""};
       rdmalib::ScatterGatherElement sge;
       size_t obj_size = sizeof(rdmalib::AllocationRequest);
       sge.add(_allocation_buffer, obj_size, obj_size*_rcv_buffer._rcv_buf_size);
@@ -72,5 +75,156 @@ namespace rfaas {
     return true;
   }
 
+  resource_manager_connection::resource_manager_connection(std::string address, int port):
+    _address(address),
+    _port(port),
+    _active(_address, _port, 1),
+    _request(1),
+    _response(1),
+    _directory_info(1),
+    _directory(1),
+    _fetched(1),
+    _load(1)
+  {
+    _active.allocate();
+  }
+
+  bool resource_manager_connection::connect(uint32_t secret)
+  {
+    SPDLOG_DEBUG("Connecting to resource manager at {}:{}", _address, _port);
+    if(!_active.connect(secret)) {
+      spdlog::error("Couldn't connect to resource manager at {}:{}", _address, _port);
+      return false;
+    }
+    _request.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _response.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _directory_info.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _directory.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _fetched.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _load.register_memory(_active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    return true;
+  }
+
+  void resource_manager_connection::disconnect()
+  {
+    SPDLOG_DEBUG("Disconnecting from resource manager at {}:{}", _address, _port);
+    if(_active.is_connected())
+      _active.disconnect();
+  }
+
+  bool resource_manager_connection::lease(int cores, rdmalib::LeaseResponse & lease)
+  {
+    // The response can arrive right after our request
+    _active.connection().post_recv(_response.sge(sizeof(rdmalib::LeaseResponse), 0));
+    *_request.data() = rdmalib::LeaseRequest{static_cast<int16_t>(cores), 0};
+    _active.connection().post_send(_request);
+    _active.connection().poll_wc(rdmalib::QueueType::SEND, true);
+    auto wcs = _active.connection().poll_wc(rdmalib::QueueType::RECV, true);
+    if(std::get<0>(wcs)[0].status != IBV_WC_SUCCESS)
+      return false;
+    lease = *_response.data();
+    return true;
+  }
+
+  void resource_manager_connection::release(uint32_t lease_id)
+  {
+    *_request.data() = rdmalib::LeaseRequest{0, lease_id};
+    _active.connection().post_send(_request);
+    _active.connection().poll_wc(rdmalib::QueueType::SEND, true);
+  }
+
+  bool resource_manager_connection::query_directory()
+  {
+    _active.connection().post_recv(_directory_info.sge(sizeof(rdmalib::DirectoryInformation), 0));
+    *_request.data() = rdmalib::LeaseRequest{-1, 0};
+    _active.connection().post_send(_request);
+    _active.connection().poll_wc(rdmalib::QueueType::SEND, true);
+    auto wcs = _active.connection().poll_wc(rdmalib::QueueType::RECV, true);
+    if(std::get<0>(wcs)[0].status != IBV_WC_SUCCESS)
+      return false;
+    const rdmalib::DirectoryInformation & info = *_directory_info.data();
+    _remote_directory = rdmalib::RemoteBuffer(
+      info.directory.r_addr, info.directory.r_key, sizeof(rdmalib::Directory)
+    );
+    _remote_loads = rdmalib::RemoteBuffer(
+      info.loads.r_addr, info.loads.r_key, sizeof(rdmalib::LoadReport) * rdmalib::Directory::CAPACITY
+    );
+    return true;
+  }
+
+  const rdmalib::Directory & resource_manager_connection::read_directory()
+  {
+    const rdmalib::Directory & dir = *_directory.data();
+    do {
+      int id = _active.connection().post_read(_directory.sge(sizeof(rdmalib::Directory), 0), _remote_directory);
+      // Completions of free core updates can arrive first
+      bool finished = false;
+      while(!finished) {
+        auto wcs = _active.connection().poll_wc(rdmalib::QueueType::SEND, true);
+        for(int i = 0; i < std::get<1>(wcs); ++i)
+          finished |= std::get<0>(wcs)[i].wr_id == static_cast<uint64_t>(id);
+      }
+    } while(dir.version != dir.version_end);
+    return dir;
+  }
+
+  int resource_manager_connection::select(int cores) const
+  {
+    const rdmalib::Directory & dir = *_directory.data();
+    int selected = -1;
+    for(int i = 0; i < dir.size; ++i)
+      if(dir.entries[i].cores && dir.entries[i].free_cores >= cores &&
+          (selected == -1 || dir.entries[i].free_cores > dir.entries[selected].free_cores))
+        selected = i;
+    return selected;
+  }
+
+  void resource_manager_connection::add_free_cores(int entry, int cores)
+  {
+    _active.connection().poll_wc(rdmalib::QueueType::SEND, false);
+    rdmalib::RemoteBuffer remote(
+      _remote_directory.addr + offsetof(rdmalib::Directory, entries)
+        + entry * sizeof(rdmalib::DirectoryEntry) + offsetof(rdmalib::DirectoryEntry, free_cores),
+      _remote_directory.rkey
+    );
+    _active.connection().post_atomic_fadd(
+      _fetched.sge(sizeof(uint64_t), 0), remote, static_cast<uint64_t>(static_cast<int64_t>(cores))
+    );
+  }
+
+  void resource_manager_connection::report_load(int entry, const rdmalib::LoadReport & report)
+  {
+    // Reports are rare - the previous write has finished long ago
+    _active.connection().poll_wc(rdmalib::QueueType::SEND, false);
+    rdmalib::LoadReport & local = *_load.data();
+    uint64_t version = local.version_end + 1;
+    local = report;
+    local.version = local.version_end = version;
+    rdmalib::RemoteBuffer remote(
+      _remote_loads.addr + entry * sizeof(rdmalib::LoadReport), _remote_loads.rkey, sizeof(rdmalib::LoadReport)
+    );
+    _active.connection().post_write(_load.sge(sizeof(rdmalib::LoadReport), 0), remote);
+  }
+
+  bool manager_connection::renew()
+  {
+    request() = (rdmalib::AllocationRequest) {0, 0, 0, 0, 0, 0, 0, "", ""};
+    return submit();
+  }
+
+  bool manager_connection::lease_expired()
+  {
+    auto wcs = _rcv_buffer.poll(false);
+    bool expired = false;
+    for(int i = 0; i < std::get<1>(wcs); ++i) {
+      ibv_wc & wc = std::get<0>(wcs)[i];
+      if(wc.status == IBV_WC_SUCCESS && _allocation_buffer.data()[wc.wr_id].cores == 0)
+        expired = true;
+    }
+    if(std::get<1>(wcs))
+      _rcv_buffer.refill();
+    return expired;
+  }
+
 }
 
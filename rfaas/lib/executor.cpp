@@ -2,9 +2,13 @@
 #include "rdmalib/rdmalib.hpp"
 #include <spdlog/spdlog.h>
 
+#include <cstring>
+
 #include <rdmalib/allocation.hpp>
 #include <rdmalib/connection.hpp>
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/mr_cache.hpp>
+#include <rdmalib/shm_transport.hpp>
 #include <rdmalib/util.hpp>
 
 #include <rfaas/connection.hpp>
@@ -17,6 +21,7 @@
 #include <elf.h>
 #include <link.h>
 #include <poll.h>
+#include <unistd.h>
 
 namespace rfaas {
 
@@ -32,6 +37,9 @@ namespace rfaas {
     return _timeout;
   }
 
+  // Names of shared memory segments are unique within the process
+  static std::atomic<int> segments{0};
+
   executor_state::executor_state(rdmalib::Connection* conn, int rcv_buf_size):
     conn(conn),
     _rcv_buffer(rcv_buf_size)
@@ -42,14 +50,27 @@ namespace rfaas {
     _state(address, port, rcv_buf_size + 1),
     _rcv_buffer(rcv_buf_size),
     _execs_buf(MAX_REMOTE_WORKERS),
+    _header(rdmalib::functions::Submission::DATA_HEADER_SIZE),
     _address(address),
     _port(port),
     _rcv_buf_size(rcv_buf_size),
     _executions(0),
     _invoc_id(0),
-    _max_inlined_msg(max_inlined_msg)
+    _max_inlined_msg(max_inlined_msg),
+    _input_slot_size(0),
+    _lease_timeout(0),
+    _use_shared_memory(true),
+    _numcores(0),
+    _max_input_size(0),
+    _hot_timeout(0),
+    _lease{},
+    _input_slots(1)
   {
     _execs_buf.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    _header.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _registrations.reset(new rdmalib::MemoryRegistrationCache{
+      _state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE, REGISTRATION_CACHE_BYTES
+    });
     events = 0;
     _active_polling = false;
     _end_requested = false;
@@ -62,6 +83,18 @@ namespace rfaas {
   executor::~executor()
   {
     this->deallocate();
+    if(_resource_manager)
+      _resource_manager->disconnect();
+  }
+
+  bool executor::connect_resource_manager(std::string address, int port)
+  {
+    _resource_manager.reset(new resource_manager_connection{address, port});
+    if(!_resource_manager->connect()) {
+      _resource_manager.reset();
+      return false;
+    }
+    return true;
   }
 
   rdmalib::Buffer<char> executor::load_library(std::string path)
@@ -136,47 +169,95 @@ namespace rfaas {
       }
       _exec_manager->disconnect();
       _exec_manager.reset(nullptr);
-      _state._cfg.attr.send_cq = _state._cfg.attr.recv_cq = 0;
+      if(_resource_manager && _lease.lease_id) {
+        _resource_manager->release(_lease.lease_id);
+        _lease.lease_id = 0;
+      }
+      _state.share_cq(nullptr);
 
       // Clear up old connections
       _connections.clear();
+      _shared_memory.reset();
     }
   }
 
+  bool executor::input_slots(int slots)
+  {
+    if(slots < 1 || slots > rdmalib::functions::Submission::MAX_INPUT_SLOTS) {
+      spdlog::error(
+        "Executor threads support between 1 and {} input slots, requested {}",
+        rdmalib::functions::Submission::MAX_INPUT_SLOTS, slots
+      );
+      return false;
+    }
+    _input_slots = slots;
+    return true;
+  }
+
+  bool executor::renew_lease()
+  {
+    if(!_exec_manager)
+      return false;
+    return _exec_manager->renew();
+  }
+
+  bool executor::_check_lease()
+  {
+    if(!_exec_manager || !_exec_manager->lease_expired())
+      return true;
+    // FIXME: pending futures are lost
+    spdlog::info("Lease of our executor has expired, allocating again");
+    deallocate();
+    return allocate(_functions_path, _numcores, _max_input_size, _hot_timeout);
+  }
+
   void executor::poll_queue()
   {
     // FIXME: hide the details in rdmalib
     spdlog::info("Background thread starts waiting for events");
-    _connections[0].conn->notify_events(true);
-    int flags = fcntl(_connections[0].conn->completion_channel()->fd, F_GETFL);
-    int rc = fcntl(_connections[0].conn->completion_channel()->fd, F_SETFL, flags | O_NONBLOCK);
-    if (rc < 0) {
-      fprintf(stderr, "Failed to change file descriptor of completion event channel\n");
-      return;
+    // Shared memory notifies about solicited replies without a completion channel
+    rdmalib::Transport* transport = _connections[0].conn->transport();
+    int rc;
+    if(!transport) {
+      _connections[0].conn->notify_events(true);
+      int flags = fcntl(_connections[0].conn->completion_channel()->fd, F_GETFL);
+      rc = fcntl(_connections[0].conn->completion_channel()->fd, F_SETFL, flags | O_NONBLOCK);
+      if (rc < 0) {
+        fprintf(stderr, "Failed to change file descriptor of completion event channel\n");
+        return;
+      }
     }
 
     while(!_end_requested && _connections.size()) {
-      pollfd my_pollfd;
-      my_pollfd.fd      = _connections[0].conn->completion_channel()->fd;
-      my_pollfd.events  = POLLIN;
-      my_pollfd.revents = 0;
-      do {
-        rc = poll(&my_pollfd, 1, 100);
-        if(_end_requested) {
-          spdlog::info("Background thread stops waiting for events");
+      if(transport) {
+        if(!transport->wait_events(true, 100))
+          continue;
+      } else {
+        pollfd my_pollfd;
+        my_pollfd.fd      = _connections[0].conn->completion_channel()->fd;
+        my_pollfd.events  = POLLIN;
+        my_pollfd.revents = 0;
+        do {
+          rc = poll(&my_pollfd, 1, 100);
+          if(_end_requested) {
+            spdlog::info("Background thread stops waiting for events");
+            return;
+          }
+        } while (rc == 0);
+        if (rc < 0) {
+          fprintf(stderr, "poll failed\n");
           return;
         }
-      } while (rc == 0);
-      if (rc < 0) {
-        fprintf(stderr, "poll failed\n");
-        return;
       }
       if(!_end_requested) {
-        auto cq = _connections[0].conn->wait_events();
-        _connections[0].conn->notify_events(true);
-        _connections[0].conn->ack_events(cq, 1);
+        if(!transport) {
+          auto cq = _connections[0].conn->wait_events();
+          _connections[0].conn->notify_events(true);
+          _connections[0].conn->ack_events(cq, 1);
+        }
         auto wc = _connections[0]._rcv_buffer.poll(false);
         for(int i = 0; i < std::get<1>(wc); ++i) {
+          _account_reply(std::get<0>(wc)[i]);
           uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
           int return_val = val & 0x0000FFFF;
           int finished_invoc_id = val >> 16;
@@ -185,14 +266,8 @@ namespace rfaas {
           //spdlog::info("Future for id {}", finished_invoc_id);
           //(*it).second.set_value(return_val);
           // FIXME: handle error
-          if(!--std::get<0>(it->second)) {
+          if(!--std::get<0>(it->second))
             std::get<1>(it->second).set_value(return_val);
-            // FIXME
-            //
-            _connections[0]._rcv_buffer._requests += _connections.size() - 1;
-            for(size_t i = 1; i < _connections.size(); ++i)
-              _connections[i]._rcv_buffer._requests--;
-          }
         }
         // Poll completions from past sends
         for(auto & conn : _connections)
@@ -236,19 +311,246 @@ namespace rfaas {
     //spdlog::info("Background thread stops waiting for events");
   }
 
+  void executor::_account_reply(const ibv_wc & wc)
+  {
+    // All connections share the receive CQ, and we always poll through the first one.
+    // However, the receive was consumed at the connection used by the executor thread,
+    // which is not the one we submitted to when the invocation has been stolen.
+    for(size_t i = 1; i < _connections.size(); ++i) {
+      if(_connections[i].conn->qp_num() == wc.qp_num) {
+        _connections[0]._rcv_buffer._requests++;
+        _connections[i]._rcv_buffer._requests--;
+        return;
+      }
+    }
+  }
+
+  bool executor::_attach_shared_memory()
+  {
+    // Replies are polled from the first connection - either all connections switch, or none.
+    for(auto & conn : _connections) {
+      uint32_t lane = conn.conn->private_data();
+      if(!lane || lane > _shared_memory->header()->lanes) {
+        spdlog::warn("Executor thread did not attach to shared memory, invocations use RDMA");
+        _shared_memory.reset();
+        return false;
+      }
+    }
+    auto endpoint = std::make_shared<rdmalib::SharedMemoryEndpoint>(_shared_memory, _state.pd(), true);
+    for(auto & conn : _connections) {
+      conn.conn->initialize(std::unique_ptr<rdmalib::Transport>{
+        new rdmalib::SharedMemoryTransport{endpoint, static_cast<int>(conn.conn->private_data() - 1), conn.conn->qp_num()}
+      });
+      conn._rcv_buffer.connect(conn.conn.get());
+    }
+    spdlog::info("Executor runs on our host, invocations use shared memory {}", _shared_memory->_name);
+    return true;
+  }
+
+  std::tuple<bool, int> executor::_wait_result(int invoc_id)
+  {
+    _active_polling = true;
+    for(auto & conn : _connections)
+      conn._rcv_buffer.refill();
+
+    bool found_result = false;
+    int return_value = 0;
+    int out_size = 0;
+    while(!found_result) {
+      auto wc = _connections[0]._rcv_buffer.poll(true);
+      for(int i = 0; i < std::get<1>(wc); ++i) {
+        _account_reply(std::get<0>(wc)[i]);
+        uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
+        int return_val = val & 0x0000FFFF;
+        int finished_invoc_id = val >> 16;
+
+        if(finished_invoc_id == invoc_id) {
+          found_result = true;
+          return_value = return_val;
+          out_size = std::get<0>(wc)[i].byte_len;
+          //spdlog::info("Result for id {}", finished_invoc_id);
+        } else {
+          auto it = _futures.find(finished_invoc_id);
+          //spdlog::info("Poll Future for id {}", finished_invoc_id);
+          // if it == end -> we have a bug, should never appear
+          //(*it).second.set_value(return_val);
+          if(!--std::get<0>(it->second))
+            std::get<1>(it->second).set_value(return_val);
+        }
+      }
+      if(found_result) {
+        _active_polling = false;
+        auto wc = _connections[0]._rcv_buffer.poll(false);
+        // Catch very unlikely interleaving
+        // Event arrives after we poll while the background thread is skipping
+        // because we still hold the atomic
+        // Thus, we later unset the variable since we're done
+        for(int i = 0; i < std::get<1>(wc); ++i) {
+          _account_reply(std::get<0>(wc)[i]);
+          uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
+          int return_val = val & 0x0000FFFF;
+          int finished_invoc_id = val >> 16;
+          auto it = _futures.find(finished_invoc_id);
+          //spdlog::info("Poll Future for id {}", finished_invoc_id);
+          // if it == end -> we have a bug, should never appear
+          //(*it).second.set_value(return_val);
+          if(!--std::get<0>(it->second))
+            std::get<1>(it->second).set_value(return_val);
+        }
+      }
+    }
+    _connections[0].conn->poll_wc(rdmalib::QueueType::SEND, false);
+    if(return_value == 0) {
+      SPDLOG_DEBUG("Finished invocation {} succesfully", invoc_id);
+      return std::make_tuple(true, out_size);
+    } else {
+      if(return_value == 1)
+        spdlog::error("Invocation: {}, Thread busy, cannot post work", invoc_id);
+      else
+        spdlog::error("Invocation: {}, Unknown error {}", invoc_id, return_value);
+      return std::make_tuple(false, 0);
+    }
+  }
+
+  std::tuple<bool, int> executor::execute(const std::string & fname, const void* in, uint32_t in_size, void* out, uint32_t out_size)
+  {
+    if(!_check_lease())
+      return std::make_tuple(false, 0);
+    // Larger input would overwrite the next slot of the executor
+    if(in_size > static_cast<uint32_t>(_max_input_size)) {
+      spdlog::error("Input of {} bytes exceeds the allocated size {}", in_size, _max_input_size);
+      return std::make_tuple(false, 0);
+    }
+    auto it = std::find(_func_names.begin(), _func_names.end(), fname);
+    if(it == _func_names.end()) {
+      spdlog::error("Function {} not found in the deployed library!", fname);
+      return std::make_tuple(false, 0);
+    }
+    int func_idx = std::distance(_func_names.begin(), it);
+
+    // Both registrations must stay until the invocation completes
+    ibv_mr* out_mr = _registrations->acquire(out, out_size);
+    if(!out_mr)
+      return std::make_tuple(false, 0);
+    ibv_mr* in_mr = _registrations->acquire(in, in_size);
+    if(!in_mr) {
+      _registrations->release(out_mr);
+      return std::make_tuple(false, 0);
+    }
+
+    char* data = _header.data();
+    *reinterpret_cast<uint64_t*>(data) = reinterpret_cast<uint64_t>(out);
+    *reinterpret_cast<uint32_t*>(data + 8) = out_mr->rkey;
+    rdmalib::ScatterGatherElement sge;
+    sge.add(_header);
+    sge.add(*_registrations, in, in_size);
+
+    int invoc_id = this->_invoc_id++;
+    SPDLOG_DEBUG(
+      "Invoke function {} on user memory with invocation id {}, submission id {}",
+      func_idx, invoc_id, (invoc_id << 16) | func_idx
+    );
+    _connections[0].conn->post_write(
+      std::move(sge),
+      _input(0, invoc_id),
+      static_cast<uint32_t>((invoc_id << 16) | func_idx),
+      _header.bytes() + in_size <= _max_inlined_msg
+    );
+    auto result = _wait_result(invoc_id);
+    _registrations->release(in_mr);
+    _registrations->release(out_mr);
+    return result;
+  }
+
+  void executor::invalidate(const void* ptr, size_t bytes)
+  {
+    _registrations->invalidate(ptr, bytes);
+  }
+
+  int executor::_submit(prepared_invocation & invoc, int64_t size, bool async)
+  {
+    if(!_check_lease() || invoc.func_idx < 0)
+      return -1;
+    // Input buffers change when we had to allocate again
+    const rdmalib::RemoteBuffer & input = _connections[0].remote_input;
+    if(!invoc.write.bound(input))
+      invoc.write.remote(input);
+
+    int invoc_id = this->_invoc_id++;
+    uint32_t submission_id = (invoc_id << 16) | invoc.func_idx;
+    if(async) {
+      _futures[invoc_id] = std::make_tuple(1, std::promise<int>{});
+      submission_id |= 1 << 15;
+    }
+    uint32_t bytes = size == -1 ? invoc.in_bytes : size;
+    SPDLOG_DEBUG(
+      "Invoke prepared function {} with invocation id {}, submission id {}",
+      invoc.func_idx, invoc_id, submission_id
+    );
+    _connections[0].conn->post_write(
+      invoc.write,
+      bytes,
+      submission_id,
+      bytes <= _max_inlined_msg,
+      async,
+      0,
+      rdmalib::functions::Submission::slot(invoc_id, _input_slots) * _input_slot_size
+    );
+    return invoc_id;
+  }
+
+  std::tuple<bool, int> executor::execute(prepared_invocation & invoc, int64_t size)
+  {
+    int invoc_id = _submit(invoc, size, false);
+    if(invoc_id == -1)
+      return std::make_tuple(false, 0);
+    return _wait_result(invoc_id);
+  }
+
+  std::future<int> executor::async(prepared_invocation & invoc, int64_t size)
+  {
+    int invoc_id = _submit(invoc, size, true);
+    if(invoc_id == -1)
+      return std::future<int>{};
+    // Replies can arrive at any connection
+    for(auto & conn : _connections)
+      conn._rcv_buffer.refill();
+    return std::get<1>(_futures[invoc_id]).get_future();
+  }
+
   bool executor::allocate(std::string functions_path, int numcores, int max_input_size,
       int hot_timeout, bool skip_manager, rdmalib::Benchmarker<5> * benchmarker)
   {
+    _functions_path = functions_path;
+    _numcores = numcores;
+    _max_input_size = max_input_size;
+    _hot_timeout = hot_timeout;
     rdmalib::Buffer<char> functions = load_library(functions_path);
+    _input_slot_size = max_input_size + rdmalib::functions::Submission::DATA_HEADER_SIZE;
     if(!skip_manager) {
       // FIXME: handle more than one manager
-      servers & instance = servers::instance();
-      auto selected_servers = instance.select(numcores);
+      std::string address;
+      int port;
+      if(_resource_manager) {
+        if(!_resource_manager->lease(numcores, _lease))
+          return false;
+        if(!_lease.cores) {
+          spdlog::error("No executor manager has {} free cores", numcores);
+          return false;
+        }
+        address = std::string{_lease.address, strnlen(_lease.address, sizeof(_lease.address))};
+        port = _lease.port;
+      } else {
+        servers & instance = servers::instance();
+        auto selected_servers = instance.select(numcores);
+        address = instance.server(selected_servers[0]).address;
+        port = instance.server(selected_servers[0]).port;
+      }
 
       _exec_manager.reset(
         new manager_connection(
-          instance.server(selected_servers[0]).address,
-          instance.server(selected_servers[0]).port,
+          address,
+          port,
           _rcv_buf_size,
           _max_inlined_msg
         )
@@ -266,17 +568,25 @@ namespace rfaas {
 
       _exec_manager->request() = (rdmalib::AllocationRequest) {
         static_cast<int16_t>(hot_timeout),
-        // FIXME: timeout
-        5,
+        static_cast<int16_t>(_lease_timeout),
         static_cast<int16_t>(numcores),
-        // FIXME: variable number of inputs
-        1,
+        static_cast<int16_t>(_input_slots),
         max_input_size,
         functions.data_size(),
         _port,
+        "",
         ""
       };
       strcpy(_exec_manager->request().listen_address, _address.c_str());
+      // Our listen address is the address of the manager - executors run on this host.
+      if(_use_shared_memory && address == _address) {
+        std::string name = "/rfaas-" + std::to_string(getpid()) + "-" + std::to_string(segments++);
+        _shared_memory = rdmalib::SharedMemorySegment::create(
+          name, numcores, std::max(_rcv_buf_size, _input_slots), _input_slot_size
+        );
+        if(_shared_memory)
+          strncpy(_exec_manager->request().shared_memory, name.c_str(), sizeof(rdmalib::AllocationRequest::shared_memory) - 1);
+      }
       _exec_manager->submit();
       // Measure submission time
       if(benchmarker) {
@@ -292,6 +602,8 @@ namespace rfaas {
     // Accept connect requests, fill receive buffers and accept them.
     // When the connection is established, then send data.
     this->_connections.reserve(numcores);
+    // Queues hold a burst of invocations filling all input slots
+    _state._cfg.pipeline_depth(std::max(_rcv_buf_size, _input_slots) + 1);
     int requested = 0, established = 0;
     while(established < numcores) {
 
@@ -321,6 +633,10 @@ namespace rfaas {
         SPDLOG_DEBUG("Connected thread {}/{} and submitted function code.", established + 1, numcores);
         ++established;
       }
+      // Threads of an expired executor disconnect
+      else if(conn_status == rdmalib::ConnectionStatus::DISCONNECTED) {
+        SPDLOG_DEBUG("[Executor] Disconnected previous executor, connection {}", fmt::ptr(conn));
+      }
       // FIXME: fix handling of disconnection
       else {
         spdlog::error("Unhandled connection event {} in executor allocation", conn_status);
@@ -351,11 +667,20 @@ namespace rfaas {
       received += std::get<1>(wcs);
     }
 
+    // Code submissions complete at the RDMA queue, before we switch to shared memory.
     received = 0;
+    while(received < numcores) {
+      auto wcs = this->_connections[0].conn->poll_wc(rdmalib::QueueType::SEND, true);
+      received += std::get<1>(wcs);
+    }
+    if(_shared_memory)
+      _attach_shared_memory();
+
     _active_polling = false;
     // Ensure that we are able to process asynchronous replies
     // before we start any submissionk.
-    _connections[0].conn->notify_events(true);
+    if(!_connections[0].conn->transport())
+      _connections[0].conn->notify_events(true);
     // FIXME: extend to multiple connections
     _background_thread.reset(
       new std::thread{
@@ -363,10 +688,6 @@ namespace rfaas {
         this
       }
     );
-    while(received < numcores) {
-      auto wcs = this->_connections[0].conn->poll_wc(rdmalib::QueueType::SEND, true);
-      received += std::get<1>(wcs);
-    }
     // Measure initial configuration submission
     if(benchmarker) {
       benchmarker->end(3);
@@ -15,6 +15,25 @@ namespace executor {
     uint32_t r_key;
   };
 
+  // Billing record of an executor process, stored at the manager.
+  // The executor overwrites the entire record with a single RDMA write
+  // of cumulative counters, and both versions carry the same value.
+  // The manager reads the end version first and the begin version last;
+  // a torn read is detected by a version mismatch.
+  struct AccountingRecord {
+    volatile uint64_t version;
+    volatile uint64_t hot_polling_time;
+    volatile uint64_t execution_time;
+    volatile uint64_t version_end;
+  };
+
+  // Control socket of an executor started as a zygote.
+  // The manager sends the command line of an allocation with a 32-bit length;
+  // an empty message releases the executor from its allocation. After an allocation,
+  // the executor replies with a single byte and waits for the next one.
+  constexpr uint32_t RELEASE_EXECUTOR = 0;
+  constexpr char EXECUTOR_IDLE = 'I';
+
 }
 
 #endif
@@ -0,0 +1,48 @@
+
+#ifndef __SERVER_COMMON_CPULIST__
+#define __SERVER_COMMON_CPULIST__
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+namespace executor {
+
+  // Parses the kernel cpulist format, e.g., "0-3,8,10-11".
+  // Negative or malformed entries produce an empty list.
+  inline std::vector<int> parse_cpulist(const std::string & list)
+  {
+    std::vector<int> cpus;
+    std::stringstream stream{list};
+    std::string range;
+    while(std::getline(stream, range, ',')) {
+      if(range.empty() || range[0] == '-')
+        return {};
+      try {
+        size_t dash = range.find('-');
+        int begin = std::stoi(range.substr(0, dash));
+        int end = dash == std::string::npos ? begin : std::stoi(range.substr(dash + 1));
+        for(int cpu = begin; cpu <= end; ++cpu)
+          cpus.push_back(cpu);
+      } catch(const std::exception &) {
+        return {};
+      }
+    }
+    return cpus;
+  }
+
+  inline std::string format_cpulist(const std::vector<int> & cpus)
+  {
+    std::string list;
+    for(size_t i = 0; i < cpus.size(); ++i) {
+      if(i)
+        list += ',';
+      list += std::to_string(cpus[i]);
+    }
+    return list;
+  }
+
+}
+
+#endif
+
@@ -3,9 +3,11 @@
 #include <stdexcept>
 #include <thread>
 #include <climits>
+#include <memory>
 #include <sys/time.h>
 
 #include <signal.h>
+#include <unistd.h>
 #include <cxxopts.hpp>
 #include <spdlog/spdlog.h>
 
@@ -14,52 +16,121 @@
 #include "rdmalib/connection.hpp"
 #include "server.hpp"
 #include "fast_executor.hpp"
+#include "zygote.hpp"
+#include "../common/cpulist.hpp"
+
+// Threads and buffers of the previous allocation are kept when they have the same shape.
+static bool same_resources(const server::Options & a, const server::Options & b)
+{
+  return a.fast_executors == b.fast_executors && a.func_size == b.func_size &&
+    a.msg_size == b.msg_size && a.input_slots == b.input_slots &&
+    a.recv_buffer_size == b.recv_buffer_size && a.max_inline_data == b.max_inline_data &&
+    a.numa_node == b.numa_node && a.page_size == b.page_size &&
+    a.on_demand_paging == b.on_demand_paging &&
+    a.work_stealing == b.work_stealing && a.polling_manager == b.polling_manager &&
+    a.pollers == b.pollers;
+}
 
 int main(int argc, char ** argv)
 {
   //server::SignalHandler sighandler;
-  auto opts = server::opts(argc, argv);
-  if(opts.verbose)
-    spdlog::set_level(spdlog::level::debug);
-  else
-    spdlog::set_level(spdlog::level::info);
-  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
-  spdlog::info(
-    "Executing serverless-rdma executor with {} cores! Waiting for client at {}:{}",
-    opts.fast_executors, opts.address, opts.port
-  );
-  spdlog::info(
-    "Configuration options: expecting function size {}, function payloads {},"
-    " receive WCs buffer size {}, max inline data {}, hot polling timeout {}",
-    opts.func_size, opts.msg_size, opts.recv_buffer_size, opts.max_inline_data,
-    opts.timeout
-  );
-  spdlog::info(
-    "My manager runs at {}:{}, its secret is {}, the accounting buffer is at {} with rkey {}",
-    opts.mgr_address, opts.mgr_port, opts.mgr_secret,
-    opts.accounting_buffer_addr, opts.accounting_buffer_rkey
-  );
+  server::Zygote zygote;
+  int zygote_fd = server::Zygote::descriptor(argc, argv);
+  if(zygote_fd != -1) {
+    spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+    zygote.prepare();
+    if(!zygote.wait(zygote_fd)) {
+      spdlog::info("Zygote {} closed by the manager", getpid());
+      return 0;
+    }
+    argc = zygote.argc();
+    argv = zygote.argv();
+  }
+
+  std::unique_ptr<server::FastExecutors> executors;
+  server::Options previous{};
+  while(true) {
+    auto opts = server::opts(argc, argv);
+    if(opts.verbose)
+      spdlog::set_level(spdlog::level::debug);
+    else
+      spdlog::set_level(spdlog::level::info);
+    spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+    spdlog::info(
+      "Executing serverless-rdma executor with {} cores! Waiting for client at {}:{}",
+      opts.fast_executors, opts.address, opts.port
+    );
+    spdlog::info(
+      "Configuration options: expecting function size {}, function payloads {},"
+      " input slots {}, receive WCs buffer size {}, max inline data {}, hot polling timeout {},"
+      " work stealing {}, pinned cores {}, NUMA node {}, pages {}, on-demand paging {}",
+      opts.func_size, opts.msg_size, opts.input_slots, opts.recv_buffer_size, opts.max_inline_data,
+      opts.timeout, opts.work_stealing, executor::format_cpulist(opts.pin_threads), opts.numa_node,
+      rdmalib::page_size(opts.page_size), opts.on_demand_paging
+    );
+    spdlog::info(
+      "My manager runs at {}:{}, its secret is {}, the accounting buffer is at {} with rkey {},"
+      " billing interval {} ms",
+      opts.mgr_address, opts.mgr_port, opts.mgr_secret,
+      opts.accounting_buffer_addr, opts.accounting_buffer_rkey,
+      opts.billing_interval
+    );
 
-  executor::ManagerConnection mgr{
-    opts.mgr_address,
-    opts.mgr_port,
-    opts.mgr_secret,
-    opts.accounting_buffer_addr,
-    opts.accounting_buffer_rkey
-  };
-  server::FastExecutors executor(
-    opts.address, opts.port,
-    opts.func_size,
-    opts.fast_executors,
-    opts.msg_size,
-    opts.recv_buffer_size,
-    opts.max_inline_data,
-    opts.pin_threads,
-    mgr
-  );
+    executor::ManagerConnection mgr{
+      opts.mgr_address,
+      opts.mgr_port,
+      opts.mgr_secret,
+      opts.accounting_buffer_addr,
+      opts.accounting_buffer_rkey
+    };
+    // Fast executors support dedicated pollers and self-polling threads.
+    int pollers = 0;
+    if(opts.polling_manager == server::Options::PollingMgr::SERVER) {
+      pollers = opts.pollers;
+    } else if(opts.polling_manager == server::Options::PollingMgr::SERVER_NOTIFY) {
+      spdlog::error("Polling manager server-notify is not supported, using thread polling.");
+    }
+    if(executors && same_resources(previous, opts)) {
+      spdlog::info("Reusing threads and buffers of the previous allocation");
+      executors->reset(opts.address, opts.port, opts.shared_memory, opts.pin_threads, opts.billing_interval, mgr);
+    } else {
+      // Release the memory of the previous allocation first
+      executors.reset();
+      executors.reset(new server::FastExecutors(
+        opts.address, opts.port,
+        opts.shared_memory,
+        opts.func_size,
+        opts.fast_executors,
+        opts.msg_size,
+        opts.input_slots,
+        opts.recv_buffer_size,
+        opts.max_inline_data,
+        opts.pin_threads,
+        opts.numa_node,
+        opts.page_size,
+        opts.on_demand_paging,
+        opts.work_stealing,
+        pollers,
+        opts.billing_interval,
+        mgr
+      ));
+    }
 
-  executor.allocate_threads(opts.timeout, opts.repetitions + opts.warmup_iters);
+    executors->allocate_threads(opts.timeout, opts.repetitions, opts.warmup_iters);
+    if(zygote_fd != -1)
+      executors->wait(zygote_fd);
+    executors->close();
+    if(zygote_fd == -1)
+      break;
 
-  executor.close();
+    // Return to the pool of the manager.
+    if(!zygote.idle(zygote_fd) || !zygote.wait(zygote_fd)) {
+      spdlog::info("Executor {} is not reused by the manager", getpid());
+      break;
+    }
+    argc = zygote.argc();
+    argv = zygote.argv();
+    previous = std::move(opts);
+  }
   return 0;
 }
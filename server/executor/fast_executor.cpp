@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <cstring>
 #include <chrono>
 #include <atomic>
 #include <ostream>
@@ -10,7 +12,9 @@
 
 #include <rdmalib/allocation.hpp>
 #include <rdmalib/benchmarker.hpp>
+#include <rdmalib/odp.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/shm_transport.hpp>
 #include <rdmalib/util.hpp>
 #include "rdmalib/buffer.hpp"
 #include "rdmalib/connection.hpp"
@@ -20,42 +24,214 @@
 #include "server.hpp"
 #include "fast_executor.hpp"
 
+#include <poll.h>
 #include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 namespace server {
 
-  Accounting::timepoint_t Thread::work(int invoc_id, int func_id, bool solicited, uint32_t in_size)
+  static inline long futex(std::atomic<int> & word, int op, int val)
   {
+    return syscall(SYS_futex, reinterpret_cast<int*>(&word), op, val, nullptr, nullptr, 0);
+  }
+
+  WorkerQueue::WorkerQueue(int size):
+    queue(size),
+    sleeping(0),
+    ready(false)
+  {}
+
+  void WorkerQueue::sleep()
+  {
+    sleeping.store(1);
+    // The poller might have enqueued before it noticed that we are going to sleep.
+    if(!queue.peek())
+      futex(sleeping, FUTEX_WAIT_PRIVATE, 1);
+    sleeping.store(0);
+  }
+
+  void WorkerQueue::wake()
+  {
+    if(sleeping.exchange(0))
+      futex(sleeping, FUTEX_WAKE_PRIVATE, 1);
+  }
+
+  StealWakeup::StealWakeup():
+    fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    waiting(0)
+  {
+    rdmalib::impl::expect_nonnegative(fd);
+  }
+
+  StealWakeup::~StealWakeup()
+  {
+    close(fd);
+  }
+
+  bool StealWakeup::wake()
+  {
+    if(!waiting.exchange(0))
+      return false;
+    uint64_t value = 1;
+    if(write(fd, &value, sizeof(value)) != sizeof(value))
+      spdlog::error("Waking up a thread failed, reason {}", strerror(errno));
+    return true;
+  }
+
+  void StealWakeup::drain()
+  {
+    uint64_t value;
+    while(read(fd, &value, sizeof(value)) > 0);
+  }
+
+  void Thread::reap_sends(bool all)
+  {
+    // Writes complete in order, so each completion releases the oldest slot.
+    do {
+      auto wcs = conn->poll_wc(rdmalib::QueueType::SEND, true);
+      if(std::get<1>(wcs) > 0)
+        _sends_in_flight -= std::get<1>(wcs);
+    } while(all && _sends_in_flight > 0);
+  }
+
+  int Thread::send_slot()
+  {
+    if(_sends_in_flight == SEND_RING_SIZE)
+      reap_sends(false);
+    int slot = _send_head;
+    _send_head = (_send_head + 1) % SEND_RING_SIZE;
+    return slot;
+  }
+
+  Accounting::timepoint_t Thread::work(int invoc_id, int func_id, bool solicited, uint32_t in_size, Thread* owner)
+  {
+    // Stolen invocations have the input in the receive buffer of the owner
+    char* input = (owner ? owner : this)->input(invoc_id);
     // FIXME: load func ptr
-    rdmalib::functions::Submission* header = reinterpret_cast<rdmalib::functions::Submission*>(rcv.ptr());
+    rdmalib::functions::Submission* header = reinterpret_cast<rdmalib::functions::Submission*>(input);
     auto ptr = _functions.function(func_id);
 
     SPDLOG_DEBUG("Thread {} begins work! Executing function {} with size {}, invoc id {}, solicited reply? {}",
       id, _functions._names[func_id], in_size, invoc_id, solicited
     );
+    uint32_t out_offset = send_slot() * send_slot_size;
     auto start = std::chrono::high_resolution_clock::now();
     // Data to ignore header passed in the buffer
-    uint32_t out_size = (*ptr)(rcv.data(), in_size, send.ptr());
+    uint32_t out_size = (*ptr)(
+      input + rdmalib::functions::Submission::DATA_HEADER_SIZE, in_size,
+      static_cast<char*>(send.ptr()) + out_offset
+    );
     SPDLOG_DEBUG("Thread {} finished work!", id);
 
     // Send back: the value of immediate write
     // first 16 bytes - invocation id
     // second 16 bytes - return value (0 on no error)
+    // The header tells us where the result goes, so we can reply over our own connection.
+    // Clients usually reuse their output buffer, and then the reply needs no new binding.
+    // We do not wait for the write to complete.
+    rdmalib::RemoteBuffer result{header->r_address, header->r_key};
+    if(!_reply.bound(result))
+      _reply.remote(result);
     conn->post_write(
-      send.sge(out_size, 0),
-      {header->r_address, header->r_key},
+      _reply,
+      out_size,
       (invoc_id << 16) | 0,
       out_size <= max_inline_data,
-      solicited
+      solicited,
+      out_offset
     );
+    _sends_in_flight += 1;
+    // Invocations fill the slots in order; fault in the next one before the client writes it.
+    if(on_demand_paging && input_slots > 1 && !owner)
+      rdmalib::odp::prefetch(conn->qp()->pd, rcv.lkey(), this->input(invoc_id + 1), slot_size, true);
     auto end = std::chrono::high_resolution_clock::now();
     _accounting.update_execution_time(start, end);
-    _accounting.send_updated_execution(_mgr_connection, _accounting_buf, _mgr_conn);
     //int cpu = sched_getcpu();
     //spdlog::info("Execution + sent took {} us on {} CPU", std::chrono::duration_cast<std::chrono::microseconds>(end-start).count(), cpu);
     return end;
   }
 
+  bool Thread::steal(Invocation & invoc)
+  {
+    int threads = _siblings->size();
+    for(int i = 1; i < threads; ++i) {
+      Thread & victim = (*_siblings)[(id + i) % threads];
+      if(victim._pending->steal(invoc)) {
+        SPDLOG_DEBUG("Thread {} stole invocation {} from thread {}", id, invoc.invoc_id, victim.id);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Thread::wake_siblings(int published)
+  {
+    // We execute one invocation ourselves
+    int threads = _siblings->size();
+    for(int i = 1; i < threads && published > 1; ++i)
+      if((*_siblings)[(id + i) % threads]._wakeup->wake())
+        --published;
+  }
+
+  void Thread::wait_warm()
+  {
+    if(_wakeup) {
+      _wakeup->waiting.store(1);
+      // A sibling might have published before it noticed that we are going to block.
+      auto now = std::chrono::high_resolution_clock::now();
+      if(run_pending(now) != now) {
+        _wakeup->waiting.store(0);
+        return;
+      }
+    }
+    if(conn->transport()) {
+      // Software transports can't wait on our wake-up descriptor, e.g., shared memory
+      // waits on a futex. We wait in short slices to notice that a sibling woke us up.
+      if(_wakeup) {
+        for(int waited = 0; waited < RELEASE_CHECK_MS && _wakeup->waiting.load(); waited += STEAL_CHECK_MS)
+          if(conn->transport()->wait_events(false, STEAL_CHECK_MS))
+            break;
+      } else
+        conn->transport()->wait_events(false, RELEASE_CHECK_MS);
+    } else {
+      auto cq = conn->wait_events(RELEASE_CHECK_MS, _wakeup ? _wakeup->fd : -1);
+      if(cq) {
+        conn->ack_events(cq, 1);
+        conn->notify_events();
+      }
+    }
+    if(_wakeup) {
+      _wakeup->waiting.store(0);
+      _wakeup->drain();
+      run_pending(std::chrono::high_resolution_clock::now());
+    }
+  }
+
+  Accounting::timepoint_t Thread::run_pending(Accounting::timepoint_t start)
+  {
+    // Execute our own invocations first; once we have none left,
+    // help one sibling and return to polling our connection.
+    Invocation invoc;
+    bool own;
+    while((own = _pending->pop(invoc)) || steal(invoc)) {
+
+      // Measure hot polling time until we started execution
+      auto now = std::chrono::high_resolution_clock::now();
+      auto func_end = work(invoc.invoc_id, invoc.func_id, invoc.solicited, invoc.in_size, invoc.owner);
+      _accounting.update_polling_time(start, now);
+      start = func_end;
+
+      if(!own) {
+        stolen += 1;
+        break;
+      }
+    }
+    return start;
+  }
+
   void Thread::hot(uint32_t timeout)
   {
     //rdmalib::Benchmarker<1> server_processing_times{max_repetitions};
@@ -63,15 +239,16 @@ namespace server {
 
     auto start = std::chrono::high_resolution_clock::now();
     int i = 0;
-    while(repetitions < max_repetitions) {
+    while(running()) {
 
       // if we block, we never handle the interruption
       auto wcs = wc_buffer.poll();
       if(std::get<1>(wcs)) {
-        for(int i = 0; i < std::get<1>(wcs); ++i) {
+        int published = 0;
+        for(int j = 0; j < std::get<1>(wcs); ++j) {
 
           //server_processing_times.start();
-          ibv_wc* wc = &std::get<0>(wcs)[i];
+          ibv_wc* wc = &std::get<0>(wcs)[j];
           if(wc->status) {
             spdlog::error("Failed work completion! Reason: {}", ibv_wc_status_str(wc->status));
             continue;
@@ -80,25 +257,38 @@ namespace server {
           int func_id = info & invocation_mask;
           int invoc_id = info >> 16;
           bool solicited = info & solicited_mask;
+          uint32_t in_size = wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE;
           SPDLOG_DEBUG(
             "Thread {} Invoc id {} Execute func {} Repetition {}",
             id, invoc_id, func_id, repetitions
           );
+          repetitions += 1;
+
+          // Publish the invocation - idle siblings can steal it before we get to it.
+          if(_pending && _pending->push({invoc_id, func_id, solicited, in_size, this})) {
+            ++published;
+            continue;
+          }
 
           // Measure hot polling time until we started execution
           auto now = std::chrono::high_resolution_clock::now();
-          auto func_end = work(invoc_id, func_id, solicited,
-              wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE
-          );
+          auto func_end = work(invoc_id, func_id, solicited, in_size);
           _accounting.update_polling_time(start, now);
           i = 0;
           start = func_end;
-
           //sum += server_processing_times.end();
-          conn->poll_wc(rdmalib::QueueType::SEND, true);
-          repetitions += 1;
         }
         wc_buffer.refill();
+        if(_wakeup)
+          wake_siblings(published);
+      }
+
+      if(_pending) {
+        auto end = run_pending(start);
+        if(end != start) {
+          i = 0;
+          start = end;
+        }
       }
       ++i;
 
@@ -106,7 +296,6 @@ namespace server {
       if(i == HOT_POLLING_VERIFICATION_PERIOD) {
         auto now = std::chrono::high_resolution_clock::now();
         auto time_passed = _accounting.update_polling_time(start, now);
-        _accounting.send_updated_polling(_mgr_connection, _accounting_buf, _mgr_conn);
         start = now;
 
         if(_polling_state != PollingState::HOT_ALWAYS && time_passed >= timeout) {
@@ -127,11 +316,12 @@ namespace server {
     // FIXME: this should be automatic
     SPDLOG_DEBUG("Thread {} Begins warm polling", id);
 
-    while(repetitions < max_repetitions) {
+    while(running()) {
 
       // if we block, we never handle the interruption
       auto wcs = wc_buffer.poll();
       if(std::get<1>(wcs)) {
+        int published = 0;
         for(int i = 0; i < std::get<1>(wcs); ++i) {
 
           //server_processing_times.start();
@@ -144,18 +334,26 @@ namespace server {
           int func_id = info & invocation_mask;
           bool solicited = info & solicited_mask;
           int invoc_id = info >> 16;
+          uint32_t in_size = wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE;
           SPDLOG_DEBUG(
             "Thread {} Invoc id {} Execute func {} Repetition {}",
             id, invoc_id, func_id, repetitions
           );
+          repetitions += 1;
 
-          work(invoc_id, func_id, solicited, wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE);
+          if(_pending && _pending->push({invoc_id, func_id, solicited, in_size, this})) {
+            ++published;
+            continue;
+          }
 
+          work(invoc_id, func_id, solicited, in_size);
           //sum += server_processing_times.end();
-          conn->poll_wc(rdmalib::QueueType::SEND, true);
-          repetitions += 1;
         }
         wc_buffer.refill();
+        if(_wakeup)
+          wake_siblings(published);
+        if(_pending)
+          run_pending(std::chrono::high_resolution_clock::now());
         if(_polling_state != PollingState::WARM_ALWAYS) {
           SPDLOG_DEBUG("Switching to hot polling after invocation!");
           _polling_state = PollingState::HOT;
@@ -165,27 +363,86 @@ namespace server {
 
       // Do waiting after a single polling - avoid missing an events that
       // arrived before we called notify_events
-      if(repetitions < max_repetitions) {
-        auto cq = conn->wait_events();
-        conn->ack_events(cq, 1);
-        conn->notify_events();
-      }
+      if(running())
+        wait_warm();
     }
     SPDLOG_DEBUG("Thread {} Stopped warm polling", id);
   }
 
-  void Thread::thread_work(int timeout)
+  void Thread::worker()
   {
-    rdmalib::RDMAActive mgr_connection(_mgr_conn.addr, _mgr_conn.port, wc_buffer._rcv_buf_size, max_inline_data);
-    mgr_connection.allocate();
-    this->_mgr_connection = &mgr_connection.connection();
-    _accounting_buf.register_memory(mgr_connection.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
-    if(!mgr_connection.connect(_mgr_conn.secret))
-      return;
-    spdlog::info("Thread {} Established connection to the manager!", id);
+    SPDLOG_DEBUG("Thread {} Begins processing invocations from its poller", id);
+
+    Dispatch item;
+    while(true) {
+
+      if(!_worker->queue.try_dequeue(item)) {
+        _worker->sleep();
+        continue;
+      }
+
+      _accounting.update_polling_time(item.polling_time);
+      if(item.invoc.func_id < 0)
+        break;
+
+      work(item.invoc.invoc_id, item.invoc.func_id, item.invoc.solicited, item.invoc.in_size, item.invoc.owner);
+    }
+    SPDLOG_DEBUG("Thread {} Stopped processing invocations", id);
+  }
+
+  void Thread::warmup()
+  {
+    auto begin = std::chrono::high_resolution_clock::now();
+    // Registration has pinned the pages for the NIC; keep them resident for the CPU as well.
+    send.lock();
+    // Input pages are faulted in by the NIC when invocations arrive
+    if(!on_demand_paging)
+      rcv.lock();
+    size_t pages = _functions.prefault();
+
+    auto func = _functions.warmup_function();
+    if(func) {
+      for(int i = 0; i < warmup_iters; ++i)
+        (*func)(input(0) + rdmalib::functions::Submission::DATA_HEADER_SIZE, 0, send.ptr());
+    } else if(warmup_iters > 0) {
+      spdlog::warn("Thread {} Library does not export {}, skipping warm-up calls", id, Functions::WARMUP_FUNCTION);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    spdlog::info(
+      "Thread {} Warm-up took {} us, prefaulted {} library pages, {} warm-up calls",
+      id, std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count(),
+      pages, func ? warmup_iters : 0
+    );
+  }
 
+  void Thread::reset(std::string addr, int port, std::string shared_memory)
+  {
+    this->addr = addr;
+    this->port = port;
+    this->shared_memory = shared_memory;
+    repetitions = 0;
+    stolen = 0;
+    sum = 0;
+    conn = nullptr;
+    _accounting.total_hot_polling_time = 0;
+    _accounting.total_execution_time = 0;
+    _send_head = 0;
+    _sends_in_flight = 0;
+    if(_worker)
+      _worker->ready.store(false);
+    _functions.reset();
+    // The next allocation can belong to another client; inputs and results must not leak to it.
+    memset(send.ptr(), 0, send.bytes());
+    memset(rcv.ptr(), 0, rcv.bytes());
+    // Registrations are kept - connections of the process share the protection domain.
+  }
+
+  void Thread::thread_work(int timeout)
+  {
     // FIXME: why rdmaactive needs rcv_buf_size?
     rdmalib::RDMAActive active(addr, port, wc_buffer._rcv_buf_size, max_inline_data);
+    // Each input slot can have its reply in flight
+    active._cfg.pipeline_depth(std::max(wc_buffer._rcv_buf_size, input_slots));
     rdmalib::Buffer<char> func_buffer(_functions.memory(), _functions.size());
 
     active.allocate();
@@ -207,15 +464,52 @@ namespace server {
     if(_polling_state == PollingState::WARM_ALWAYS || _polling_state == PollingState::WARM)
       conn->notify_events();
 
-    if(!active.connect())
+    // The lane is announced with the connection; without it, the client keeps using RDMA.
+    std::shared_ptr<rdmalib::SharedMemorySegment> segment;
+    if(!shared_memory.empty()) {
+      segment = rdmalib::SharedMemorySegment::open(shared_memory);
+      if(segment && segment->header()->lanes <= static_cast<uint32_t>(id)) {
+        spdlog::error("Thread {} has no lane in shared memory {}", id, shared_memory);
+        segment.reset();
+      }
+    }
+    if(!active.connect(segment ? id + 1 : 0))
       return;
 
     // Now generic receives for function invocations
-    send.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE);
-    rcv.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    // A reused executor registered the buffers in a previous allocation.
+    if(!send.mr() || send.mr()->pd != active.pd()) {
+      send.deregister_memory();
+      send.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    }
+    _reply.local(send);
+    // Connections over TCP register memory in software
+    if(on_demand_paging && (!active.pd() || !rdmalib::odp::supported(active.pd()->context))) {
+      spdlog::warn("Thread {} Device does not support on-demand paging, pinning input buffers", id);
+      on_demand_paging = false;
+    }
+    if(!rcv.mr() || rcv.mr()->pd != active.pd()) {
+      rcv.deregister_memory();
+      rcv.register_memory(
+        active.pd(),
+        IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | (on_demand_paging ? IBV_ACCESS_ON_DEMAND : 0)
+      );
+    }
+    if(on_demand_paging)
+      rdmalib::odp::prefetch(active.pd(), rcv.lkey(), input(0), slot_size, true);
     this->wc_buffer.connect(this->conn);
     spdlog::info("Thread {} Established connection to client!", id);
 
+    // We should have received functions data - just one message
+    auto wcs = this->conn->poll_wc(rdmalib::QueueType::RECV, true, 1);
+    if(std::get<1>(wcs) != 1 || std::get<0>(wcs)[0].status != IBV_WC_SUCCESS) {
+      spdlog::error("Thread {} did not receive the function library", id);
+      return;
+    }
+    _functions.process_library();
+    // The client can submit only after receiving our buffer details.
+    warmup();
+
     // Send to the client information about thread buffer
     rdmalib::Buffer<rdmalib::BufferInformation> buf(1);
     buf.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE);
@@ -226,54 +520,242 @@ namespace server {
     this->conn->poll_wc(rdmalib::QueueType::SEND, true, 1);
     SPDLOG_DEBUG("Thread {} Sent buffer details to client!", id);
 
-    // We should have received functions data - just one message
-    this->conn->poll_wc(rdmalib::QueueType::RECV, true, 1);
-    _functions.process_library();
+    // The client switches to shared memory once it has our buffer details.
+    if(segment) {
+      auto endpoint = std::make_shared<rdmalib::SharedMemoryEndpoint>(segment, active.pd(), false);
+      this->conn->initialize(std::unique_ptr<rdmalib::Transport>{
+        new rdmalib::SharedMemoryTransport{endpoint, id, this->conn->qp_num()}
+      });
+      this->wc_buffer.connect(this->conn);
+      spdlog::info("Thread {} Receives invocations over shared memory {}", id, shared_memory);
+    }
 
     spdlog::info("Thread {} begins work with timeout {}", id, timeout);
 
     // FIXME: catch interrupt handler here
-    while(repetitions < max_repetitions) {
-      if(_polling_state == PollingState::HOT || _polling_state == PollingState::HOT_ALWAYS)
-        hot(timeout);
-      else
-        warm();
+    if(_worker) {
+      // From now on, only the poller touches our receive queue.
+      _worker->ready.store(true, std::memory_order_release);
+      worker();
+    } else {
+      while(running()) {
+        if(_polling_state == PollingState::HOT || _polling_state == PollingState::HOT_ALWAYS)
+          hot(timeout);
+        else
+          warm();
+      }
     }
+    // Invocations received in the last batch might still wait for us.
+    if(_pending)
+      run_pending(std::chrono::high_resolution_clock::now());
+    // Results must be delivered before we close the connection.
+    if(_sends_in_flight)
+      reap_sends(true);
 
-    // Submit final accounting information
-    _accounting.send_updated_execution(_mgr_connection, _accounting_buf, _mgr_conn, true, false);
-    _accounting.send_updated_polling(_mgr_connection, _accounting_buf, _mgr_conn, true, false);
-    mgr_connection.connection().poll_wc(rdmalib::QueueType::SEND, true, 2);
     spdlog::info(
-      "Thread {} finished work, spent {} ns hot polling and {} ns computation, {} executions.",
-      id, _accounting.total_hot_polling_time , _accounting.total_execution_time, repetitions
+      "Thread {} finished work, spent {} ns hot polling and {} ns computation, {} executions, {} stolen.",
+      id, _accounting.total_hot_polling_time , _accounting.total_execution_time, repetitions, stolen
     );
+  }
+
+  AccountingFlusher::AccountingFlusher(
+    const executor::ManagerConnection & mgr_conn,
+    int threads, int interval,
+    int recv_buf_size, int max_inline_data
+  ):
+    _mgr_conn(mgr_conn),
+    _interval(interval),
+    _recv_buf_size(recv_buf_size),
+    _max_inline_data(max_inline_data),
+    _threads(threads),
+    _counters(new BillingCounters[threads]),
+    _record(1),
+    _version(0),
+    _in_flight(false),
+    _closing(false)
+  {
+    for(int i = 0; i < threads; ++i) {
+      _counters[i].hot_polling_time.store(0);
+      _counters[i].execution_time.store(0);
+    }
+    memset(_record.data(), 0, sizeof(executor::AccountingRecord));
+  }
+
+  AccountingFlusher::~AccountingFlusher()
+  {
+    stop();
+  }
+
+  BillingCounters* AccountingFlusher::counters(int thread_id)
+  {
+    return &_counters[thread_id];
+  }
+
+  void AccountingFlusher::reset(const executor::ManagerConnection & mgr_conn, int interval)
+  {
+    _mgr_conn = mgr_conn;
+    _interval = std::chrono::milliseconds{interval};
+    _in_flight = false;
+    _closing = false;
+    for(int i = 0; i < _threads; ++i) {
+      _counters[i].hot_polling_time.store(0);
+      _counters[i].execution_time.store(0);
+    }
+    memset(_record.data(), 0, sizeof(executor::AccountingRecord));
+  }
+
+  void AccountingFlusher::start()
+  {
+    _thread = std::thread(&AccountingFlusher::run, this);
+  }
+
+  void AccountingFlusher::stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closing = true;
+    }
+    _cv.notify_one();
+    if(_thread.joinable())
+      _thread.join();
+  }
+
+  void AccountingFlusher::run()
+  {
+    rdmalib::RDMAActive mgr_connection(_mgr_conn.addr, _mgr_conn.port, _recv_buf_size, _max_inline_data);
+    mgr_connection.allocate();
+    if(!_record.mr() || _record.mr()->pd != mgr_connection.pd()) {
+      _record.deregister_memory();
+      _record.register_memory(mgr_connection.pd(), IBV_ACCESS_LOCAL_WRITE);
+    }
+    if(!mgr_connection.connect(_mgr_conn.secret))
+      return;
+    spdlog::info("Established connection to the manager, billing interval {} ms", _interval.count());
+    rdmalib::Connection & conn = mgr_connection.connection();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(!_closing) {
+      if(_interval.count() > 0)
+        _cv.wait_for(lock, _interval, [this]() { return _closing; });
+      else
+        _cv.wait(lock, [this]() { return _closing; });
+      if(!_closing)
+        flush(conn, false);
+    }
+    lock.unlock();
+
+    // The manager collects billing when we exit - the last write must have arrived.
+    flush(conn, true);
     // FIXME: revert after manager starts to detect disconnection events
     //mgr_connection.disconnect();
   }
 
+  void AccountingFlusher::flush(rdmalib::Connection & conn, bool wait)
+  {
+    // Never modify the record while the NIC might still read it.
+    if(_in_flight) {
+      auto wcs = conn.poll_wc(rdmalib::QueueType::SEND, wait);
+      if(!std::get<1>(wcs))
+        return;
+      _in_flight = false;
+    }
+
+    uint64_t hot_polling_time = 0, execution_time = 0;
+    for(int i = 0; i < _threads; ++i) {
+      hot_polling_time += _counters[i].hot_polling_time.load(std::memory_order_relaxed);
+      execution_time += _counters[i].execution_time.load(std::memory_order_relaxed);
+    }
+
+    executor::AccountingRecord & record = _record.data()[0];
+    if(record.hot_polling_time == hot_polling_time && record.execution_time == execution_time)
+      return;
+
+    ++_version;
+    record.version = _version;
+    record.hot_polling_time = hot_polling_time;
+    record.execution_time = execution_time;
+    record.version_end = _version;
+    conn.post_write(
+      _record,
+      {_mgr_conn.r_addr, _mgr_conn.r_key},
+      _record.bytes() <= static_cast<uint32_t>(_max_inline_data)
+    );
+    _in_flight = true;
+    SPDLOG_DEBUG("Billing update {}: polling {} ns, execution {} ns", _version, hot_polling_time, execution_time);
+
+    if(wait) {
+      conn.poll_wc(rdmalib::QueueType::SEND, true, 1);
+      _in_flight = false;
+    }
+  }
+
   FastExecutors::FastExecutors(std::string client_addr, int port,
+      std::string shared_memory,
       int func_size,
       int numcores,
       int msg_size,
+      int input_slots,
       int recv_buf_size,
       int max_inline_data,
-      int pin_threads,
+      const std::vector<int> & pin_threads,
+      int numa_node,
+      rdmalib::PageSize page_size,
+      bool on_demand_paging,
+      bool work_stealing,
+      int pollers,
+      int billing_interval,
       const executor::ManagerConnection & mgr_conn
   ):
     _closing(false),
     _numcores(numcores),
     _max_repetitions(0),
-    _pin_threads(pin_threads)
-    //_mgr_conn(mgr_conn)
+    _warmup_iters(0),
+    _pin_threads(pin_threads),
+    _work_stealing(work_stealing),
+    _pollers_count(std::min(pollers, numcores)),
+    _released(false),
+    _active_threads(0),
+    _flusher(mgr_conn, numcores, billing_interval, recv_buf_size, max_inline_data)
   {
     // Reserve place to ensure that no reallocations happen
     _threads_data.reserve(numcores);
     for(int i = 0; i < numcores; ++i)
       _threads_data.emplace_back(
-        client_addr, port, i, func_size, msg_size,
-        recv_buf_size, max_inline_data, mgr_conn
+        client_addr, port, shared_memory, i, func_size, msg_size, input_slots,
+        recv_buf_size, max_inline_data, page_size, on_demand_paging, _flusher.counters(i)
       );
+
+    // Pages are not touched until registration - the NIC should DMA from local memory.
+    if(numa_node >= 0) {
+      for(auto & thread : _threads_data) {
+        thread.send.bind_numa(numa_node);
+        thread.rcv.bind_numa(numa_node);
+      }
+    }
+
+    for(auto & thread : _threads_data)
+      thread._released = &_released;
+
+    // Threads are not started yet, and the vector is never reallocated.
+    if(_work_stealing) {
+      for(auto & thread : _threads_data) {
+        thread._pending.reset(new Thread::deque_t{});
+        thread._wakeup.reset(new StealWakeup{});
+        thread._siblings = &_threads_data;
+      }
+    }
+
+    // Pollers hand over invocations - stealing between workers is not needed.
+    if(_pollers_count > 0) {
+      if(_work_stealing)
+        spdlog::warn("Work stealing is not used with dedicated poller threads.");
+      for(auto & thread : _threads_data) {
+        thread._pending.reset();
+        thread._wakeup.reset();
+        // Receive queue size bounds the number of pending invocations, +1 for termination
+        thread._worker.reset(new WorkerQueue{recv_buf_size + 2});
+      }
+    }
   }
 
   FastExecutors::~FastExecutors()
@@ -299,211 +781,177 @@ namespace server {
       // Might have been closed earlier
       if(thread.joinable())
         thread.join();
+    for(auto & thread : _pollers)
+      if(thread.joinable())
+        thread.join();
+    _flusher.stop();
     SPDLOG_DEBUG("Finished wait on {} threads", _threads.size());
 
     for(auto & thread : _threads_data)
-      spdlog::info("Thread {} Repetitions {} Avg time {} ms",
+      spdlog::info("Thread {} Repetitions {} Stolen {} Avg time {} ms",
         thread.id,
         thread.repetitions,
+        thread.stolen,
         static_cast<double>(thread._accounting.total_execution_time) / thread.repetitions / 1000.0
       );
     _closing = true;
   }
 
-  void FastExecutors::allocate_threads(int timeout, int iterations)
+  void FastExecutors::reset(
+    std::string client_addr, int port,
+    std::string shared_memory,
+    const std::vector<int> & pin_threads,
+    int billing_interval,
+    const executor::ManagerConnection & mgr_conn
+  )
+  {
+    _threads.clear();
+    _pollers.clear();
+    for(auto & thread : _threads_data)
+      thread.reset(client_addr, port, shared_memory);
+    _pin_threads = pin_threads;
+    _flusher.reset(mgr_conn, billing_interval);
+    _released.store(false);
+    _closing = false;
+  }
+
+  void FastExecutors::wait(int control_fd)
   {
-    int pin_threads = _pin_threads;
+    pollfd fd{control_fd, POLLIN, 0};
+    while(_active_threads.load() > 0) {
+
+      if(poll(&fd, 1, Thread::RELEASE_CHECK_MS) <= 0)
+        continue;
+      uint32_t len = 0;
+      ssize_t ret = read(control_fd, &len, sizeof(len));
+      // The manager does not reuse us - it kills the process when the client leaves.
+      if(ret <= 0) {
+        fd.fd = -1;
+        continue;
+      }
+      if(ret == sizeof(len) && len == executor::RELEASE_EXECUTOR) {
+        spdlog::info("Executor released by the manager, stopping threads");
+        _released.store(true);
+        return;
+      }
+      spdlog::error("Unexpected control message from the manager, length {}", len);
+    }
+  }
+
+  void FastExecutors::pin(std::thread & thread, int idx)
+  {
+    if(_pin_threads.empty())
+      return;
+    int core = _pin_threads.size() == 1 ? _pin_threads[0] + idx : _pin_threads[idx % _pin_threads.size()];
+    if(_pin_threads.size() > 1 && idx >= static_cast<int>(_pin_threads.size()))
+      spdlog::warn("Not enough cores for all threads, core {} is shared", core);
+    spdlog::info("Pin thread to core {}", core);
+    // FIXME: make sure that native handle is actually from pthreads
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+    rdmalib::impl::expect_zero(pthread_setaffinity_np(
+      thread.native_handle(),
+      sizeof(cpu_set_t), &cpuset
+    ));
+  }
+
+  void FastExecutors::allocate_threads(int timeout, int iterations, int warmup_iters)
+  {
+    _max_repetitions = iterations;
+    _warmup_iters = warmup_iters;
+    _flusher.start();
+    _active_threads.store(_numcores);
     for(int i = 0; i < _numcores; ++i) {
       _threads_data[i].max_repetitions = iterations;
+      _threads_data[i].warmup_iters = warmup_iters;
       _threads.emplace_back(
-        &Thread::thread_work,
-        &_threads_data[i],
-        timeout
+        [this, i, timeout]() {
+          _threads_data[i].thread_work(timeout);
+          _active_threads.fetch_sub(1);
+        }
       );
-      // FIXME: make sure that native handle is actually from pthreads
-      if(pin_threads != -1) {
-        spdlog::info("Pin thread to core {}", pin_threads);
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(pin_threads++, &cpuset);
-        rdmalib::impl::expect_zero(pthread_setaffinity_np(
-          _threads[i].native_handle(),
-          sizeof(cpu_set_t), &cpuset
-        ));
-      }
+      pin(_threads[i], i);
+    }
+
+    // Pollers take the cores after workers
+    for(int i = 0; i < _pollers_count; ++i) {
+      _pollers.emplace_back(&FastExecutors::poll_threads, this, i);
+      pin(_pollers[i], _numcores + i);
     }
   }
 
-  //void FastExecutors::serial_thread_poll_func(int)
-  //{
-  //  uint64_t sum = 0;
-  //  int repetitions = 0;
-  //  int total_iters = _max_repetitions + _warmup_iters;
-  //  constexpr int cores_mask = 0x3F;
-  //  rdmalib::Benchmarker<2> server_processing_times{total_iters};
-
-  //  // FIXME: disable signal handling
-  //  //while(!server::SignalHandler::closing && repetitions < total_iters) {
-  //  while(repetitions < total_iters) {
-
-  //    // if we block, we never handle the interruption
-  //    auto wcs = _wc_buffer->poll();
-  //    if(std::get<1>(wcs)) {
-  //      for(int i = 0; i < std::get<1>(wcs); ++i) {
-
-  //        server_processing_times.start();
-  //        ibv_wc* wc = &std::get<0>(wcs)[i];
-  //        if(wc->status) {
-  //          spdlog::error("Failed work completion! Reason: {}", ibv_wc_status_str(wc->status));
-  //          continue;
-  //        }
-  //        int info = ntohl(wc->imm_data);
-  //        int func_id = info >> 6;
-  //        int core = info & cores_mask;
-  //        // FIXME: verify function data - valid ID
-  //        SPDLOG_DEBUG("Execute func {} at core {}", func_id, core);
-
-  //        SPDLOG_DEBUG("Wake-up fast thread {}", core);
-  //        work(core, func_id);
-
-  //        // clean send queue
-  //        // FIXME: this should be option - in reality, we don't want to wait for the transfer to end
-  //        sum += server_processing_times.end();
-  //        _conn->poll_wc(rdmalib::QueueType::SEND, true);
-  //        repetitions += 1;
-  //      }
-  //      _wc_buffer->refill();
-  //    }
-  //  }
-  //  server_processing_times.export_csv("server.csv", {"process", "send"});
+  void FastExecutors::poll_threads(int poller_id)
+  {
+    // Poller serves every n-th thread
+    std::vector<Thread*> threads;
+    for(int i = poller_id; i < _numcores; i += _pollers_count)
+      threads.push_back(&_threads_data[i]);
+    std::vector<bool> finished(threads.size(), false);
+    size_t active = threads.size();
+    spdlog::info("Poller {} begins polling for {} threads", poller_id, active);
 
-  //  _time_sum.fetch_add(sum / 1000.0);
-  //  _repetitions.fetch_add(repetitions);
-  //}
+    auto start = std::chrono::high_resolution_clock::now();
+    while(active) {
 
-  //void FastExecutors::thread_poll_func(int id)
-  //{
-  //  uint64_t sum = 0;
-  //  int total_iters = _max_repetitions + _warmup_iters;
-  //  constexpr int cores_mask = 0x3F;
-  //  rdmalib::Benchmarker<1> server_processing_times{total_iters};
-
-  //  int64_t _poller_empty = -1;
-  //  bool i_am_poller = false;
-  //  //while(_iterations < total_iters) {
-  //  while(true) {
+      // Workers finish invocations that have already been dispatched.
+      if(_released.load(std::memory_order_relaxed)) {
+        for(size_t k = 0; k < threads.size(); ++k) {
+          if(finished[k])
+            continue;
+          threads[k]->_worker->queue.enqueue({{0, -1, false, 0, threads[k]}, 0});
+          threads[k]->_worker->wake();
+        }
+        break;
+      }
 
-  //    int64_t cur_poller = _cur_poller.load();
-  //    if(cur_poller == _poller_empty) {
-  //      i_am_poller = _cur_poller.compare_exchange_strong(
-  //          _poller_empty, id, std::memory_order_release, std::memory_order_relaxed
-  //      );
-  //      SPDLOG_DEBUG("Thread {} Attempted to become a poller, result {}", id, i_am_poller);
-  //    } else {
-  //      i_am_poller = cur_poller == id;
-  //    }
+      for(size_t k = 0; k < threads.size(); ++k) {
 
-  //    // Now wait for assignment or perform polling
-  //    if(i_am_poller) {
-  //      SPDLOG_DEBUG("Thread {} Performs polling", id);
-  //      while(i_am_poller && _iterations < total_iters) {
-  //        // if we block, we never handle the interruption
-  //        auto wcs = _wc_buffer->poll();
-  //        if(std::get<1>(wcs)) {
-  //          SPDLOG_DEBUG("Thread {} Polled {} wcs", id, std::get<1>(wcs));
-
-  //          int work_myself = 0;
-  //          for(int i = 0; i < std::get<1>(wcs); ++i) {
-
-  //            server_processing_times.start();
-  //            ibv_wc* wc = &std::get<0>(wcs)[i];
-  //            if(wc->status) {
-  //              spdlog::error("Failed work completion! Reason: {}", ibv_wc_status_str(wc->status));
-  //              continue;
-  //            }
-  //            int info = ntohl(wc->imm_data);
-  //            int func_id = info >> 6;
-  //            int core = info & cores_mask;
-  //            // FIXME: verify function data - valid ID
-  //            SPDLOG_DEBUG("Execute func {} at core {}", func_id, core);
-
-  //            if(core != id) {
-  //              if(this->_thread_status[core].load() == 0) {
-  //                SPDLOG_DEBUG("Wake-up fast thread {} by thread {}", core, id);
-  //                // No need to release - we only pass an atomic to other thread
-  //                this->_thread_status[core].store(func_id);
-  //                _iterations += 1;
-  //              }
-  //              // In benchmarking, this should only happen in debug mode 
-  //              else {
-  //                SPDLOG_DEBUG("Thread {} busy, send error to client", core);
-  //                // Send an error message "1" - thread busy
-  //                char* data = static_cast<char*>(_rcv[core].ptr());
-  //                uint64_t r_addr = *reinterpret_cast<uint64_t*>(data);
-  //                uint32_t r_key = *reinterpret_cast<uint32_t*>(data + 8);
-  //                _conn->post_write(
-  //                  {},
-  //                  {r_addr, r_key},
-  //                  (core & cores_mask) | (1 << 6)
-  //                );
-  //              }
-  //              sum += server_processing_times.end();
-  //            } else {
-  //              work_myself = func_id;
-  //            }
-  //          }
-  //          if(work_myself) {
-  //            SPDLOG_DEBUG("Wake-up myself {}", id);
-  //            _iterations += 1;
-  //            // Release is needed to make sure that `iterations` have been updated
-  //            _cur_poller.store(_poller_empty, std::memory_order_release);
-  //            i_am_poller = false;
-  //            this->_thread_status[id].store(1);
-  //            work(id, work_myself);
-  //            //_conn->poll_wc(rdmalib::QueueType::SEND, false);
-  //          }
-  //          SPDLOG_DEBUG("Thread {} Refill");
-  //          _wc_buffer->refill();
-  //          _conn->poll_wc(rdmalib::QueueType::SEND, false);
-  //          SPDLOG_DEBUG("Thread {} Refilled");
-  //        }
-  //      }
-  //      // we finished iterations
-  //      if(i_am_poller) {
-  //        // Wait for others to finish
-  //        int64_t expected = 0;
-  //        for(int i = 0; i < _numcores; ++i) {
-  //          while(!_thread_status[i].compare_exchange_strong(
-  //            expected, -1, std::memory_order_release, std::memory_order_relaxed
-  //          ));
-  //        }
-  //        break;
-  //      }
-  //    } else {
-  //      SPDLOG_DEBUG("Thread {} Waits for work", id);
-  //      int64_t status = 0;
-  //      do {
-  //        status = this->_thread_status[id].load();
-  //        cur_poller = _cur_poller.load();
-  //      } while(status == 0 && cur_poller != -1);
-  //      if(status > 0) {
-  //        SPDLOG_DEBUG("Thread {} Got work!", id);
-  //        work(id, status);
-  //        // clean send queue
-  //        // FIXME: this should be option - in reality, we don't want to wait for the transfer to end
-  //        //_conn->poll_wc(rdmalib::QueueType::SEND, false);
-  //        SPDLOG_DEBUG("Thread {} Finished work!", id);
-  //      } else {
-  //        break;
-  //      }
-  //    }
-  //  }
-  //  server_processing_times.export_csv("server.csv", {"process"});
+        Thread & thread = *threads[k];
+        if(finished[k] || !thread._worker->ready.load(std::memory_order_acquire))
+          continue;
 
-  //  _time_sum.fetch_add(sum / 1000.0);
-  //  _repetitions.fetch_add(_iterations);
-  //  spdlog::info("Thread {} Finished!", id);
-  //}
+        auto wcs = thread.wc_buffer.poll();
+        if(!std::get<1>(wcs))
+          continue;
+
+        // Polling time since the last dispatch is billed to the first invocation.
+        auto now = std::chrono::high_resolution_clock::now();
+        uint64_t polling_time = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+        start = now;
+        for(int j = 0; j < std::get<1>(wcs); ++j) {
+
+          ibv_wc* wc = &std::get<0>(wcs)[j];
+          if(wc->status) {
+            spdlog::error("Failed work completion! Reason: {}", ibv_wc_status_str(wc->status));
+            continue;
+          }
+          int info = ntohl(wc->imm_data);
+          int func_id = info & Thread::invocation_mask;
+          int invoc_id = info >> 16;
+          bool solicited = info & Thread::solicited_mask;
+          uint32_t in_size = wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE;
+          SPDLOG_DEBUG(
+            "Poller {} Invoc id {} Dispatch func {} to thread {}",
+            poller_id, invoc_id, func_id, thread.id
+          );
+          thread._worker->queue.enqueue({{invoc_id, func_id, solicited, in_size, &thread}, polling_time});
+          polling_time = 0;
+          thread.repetitions += 1;
+        }
+        thread._worker->wake();
+        thread.wc_buffer.refill();
+
+        if(thread.repetitions >= thread.max_repetitions) {
+          thread._worker->queue.enqueue({{0, -1, false, 0, &thread}, 0});
+          thread._worker->wake();
+          finished[k] = true;
+          --active;
+        }
+      }
+    }
+    spdlog::info("Poller {} finished polling", poller_id);
+  }
 
   //void FastExecutors::cv_thread_func(int id)
   //{
@@ -4,9 +4,11 @@
 
 #include "rdmalib/rdmalib.hpp"
 #include <chrono>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <condition_variable>
 
 #include <rdmalib/buffer.hpp>
@@ -16,6 +18,8 @@
 
 #include "functions.hpp"
 #include "common.hpp"
+#include "work_stealing.hpp"
+#include "../common/readerwriterqueue.h"
 #include <spdlog/spdlog.h>
 
 using namespace std::chrono_literals;
@@ -26,76 +30,76 @@ namespace rdmalib {
 
 namespace server {
 
+  // Cumulative billing of a single thread, read by the accounting flusher.
+  struct alignas(64) BillingCounters {
+    std::atomic<uint64_t> hot_polling_time;
+    std::atomic<uint64_t> execution_time;
+  };
+
   struct Accounting {
     typedef std::chrono::high_resolution_clock clock_t;
     typedef std::chrono::time_point<std::chrono::high_resolution_clock> timepoint_t;
-    static constexpr long int BILLING_GRANULARITY = std::chrono::duration_cast<std::chrono::nanoseconds>(1s).count();
 
     uint64_t total_hot_polling_time;
     uint64_t total_execution_time; 
-    uint64_t hot_polling_time;
-    uint64_t execution_time; 
+    // Only the owner thread writes to its counters
+    BillingCounters* counters;
 
     inline void update_execution_time(timepoint_t start, timepoint_t end)
     {
       auto diff = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-      execution_time += diff;
       total_execution_time += diff;
+      counters->execution_time.store(total_execution_time, std::memory_order_relaxed);
     }
 
-    inline void send_updated_execution(
-      rdmalib::Connection* mgr_connection, rdmalib::Buffer<uint64_t> & _accounting_buf,
-      const executor::ManagerConnection & _mgr_conn,
-      bool force = false,
-      bool wait = true
-    )
+    inline void update_polling_time(uint64_t time_passed)
     {
-      if(force || execution_time > BILLING_GRANULARITY) {
-        mgr_connection->post_atomic_fadd(
-          _accounting_buf,
-          { _mgr_conn.r_addr + 8, _mgr_conn.r_key},
-          execution_time
-        ); 
-        //spdlog::error("Send exec {}", execution_time);
-        if(wait)
-          mgr_connection->poll_wc(rdmalib::QueueType::SEND, true);
-        //spdlog::error("Send exec {} done", execution_time);
-        execution_time = 0;
-      }
+      total_hot_polling_time += time_passed;
+      counters->hot_polling_time.store(total_hot_polling_time, std::memory_order_relaxed);
     }
 
     inline uint32_t update_polling_time(timepoint_t start, timepoint_t end)
     {
       uint32_t time_passed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-      hot_polling_time += time_passed;
-      total_hot_polling_time += time_passed;
-
+      update_polling_time(time_passed);
       return time_passed;
     }
+  };
 
-    inline void send_updated_polling(
-      rdmalib::Connection* mgr_connection, rdmalib::Buffer<uint64_t> & _accounting_buf,
-      const executor::ManagerConnection & _mgr_conn,
-      bool force = false,
-      bool wait = true
-    )
-    {
-      if(force || hot_polling_time > BILLING_GRANULARITY) {
-        // Can happen when we didn't got into polling and were stopped right after execution
-        if(hot_polling_time == 0)
-          return;
-        mgr_connection->post_atomic_fadd(
-          _accounting_buf,
-          { _mgr_conn.r_addr, _mgr_conn.r_key},
-          hot_polling_time
-        ); 
-        //spdlog::error("Send poll {}", hot_polling_time);
-        if(wait)
-          mgr_connection->poll_wc(rdmalib::QueueType::SEND, true);
-        //spdlog::error("Send poll {} done", hot_polling_time);
-        hot_polling_time = 0;
-      }
-    }
+  // Publishes billing of all threads to the executor manager.
+  // Threads never talk to the manager - the flusher sums their counters at a fixed
+  // interval and overwrites the record at the manager with a single RDMA write.
+  struct AccountingFlusher {
+    executor::ManagerConnection _mgr_conn;
+    // Non-positive interval sends only the final billing
+    std::chrono::milliseconds _interval;
+    int _recv_buf_size;
+    int _max_inline_data;
+    int _threads;
+    std::unique_ptr<BillingCounters[]> _counters;
+    rdmalib::Buffer<executor::AccountingRecord> _record;
+    uint64_t _version;
+    bool _in_flight;
+    bool _closing;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::thread _thread;
+
+    AccountingFlusher(
+      const executor::ManagerConnection & mgr_conn,
+      int threads, int interval,
+      int recv_buf_size, int max_inline_data
+    );
+    ~AccountingFlusher();
+
+    BillingCounters* counters(int thread_id);
+    // Billing of the next allocation goes to another record; call after stop.
+    void reset(const executor::ManagerConnection & mgr_conn, int interval);
+    void start();
+    // Sends the final billing; call after all threads have finished.
+    void stop();
+    void run();
+    void flush(rdmalib::Connection & conn, bool wait);
   };
 
   enum class PollingState {
@@ -105,55 +109,170 @@ namespace server {
     WARM_ALWAYS
   };
 
+  struct Thread;
+
+  // Invocation received by the owner thread but not yet executed.
+  // The input remains in the owner's receive buffer.
+  struct Invocation {
+    int invoc_id;
+    int func_id;
+    bool solicited;
+    uint32_t in_size;
+    Thread* owner;
+  };
+
+  // Invocation handed over by a poller thread, with the polling time billed to the worker.
+  // Negative function id terminates the worker.
+  struct Dispatch {
+    Invocation invoc;
+    uint64_t polling_time;
+  };
+
+  // Single poller produces, a single worker consumes.
+  struct WorkerQueue {
+    moodycamel::ReaderWriterQueue<Dispatch> queue;
+    // Futex word - non-zero while the worker sleeps.
+    std::atomic<int> sleeping;
+    // The poller takes over the receive queue once the worker is connected.
+    std::atomic<bool> ready;
+
+    WorkerQueue(int size);
+    // Worker only
+    void sleep();
+    // Poller only
+    void wake();
+  };
+
+  // Wakes a thread blocked in warm polling when a sibling publishes invocations.
+  struct StealWakeup {
+    // eventfd polled together with the completion channel
+    int fd;
+    // Non-zero while the thread is going to block
+    std::atomic<int> waiting;
+
+    StealWakeup();
+    ~StealWakeup();
+    // Returns false when the thread doesn't wait.
+    bool wake();
+    void drain();
+  };
+
   // FIXME: is not movable or copyable at the moment
   struct Thread {
 
 
     constexpr static int invocation_mask = 0x00007FFF;
     constexpr static int solicited_mask = 0x00008000;
+    // Must hold the largest batch of polled work completions
+    constexpr static int PENDING_INVOCATIONS = 64;
+    static_assert(
+      PENDING_INVOCATIONS >= rdmalib::functions::Submission::MAX_INPUT_SLOTS,
+      "Deque must hold invocations of all input slots"
+    );
+    typedef WorkStealingDeque<Invocation, PENDING_INVOCATIONS> deque_t;
+    // Results are written from a ring of send buffers, and a slot is reused
+    // only after its previous write has completed.
+    constexpr static int SEND_RING_SIZE = 4;
+    // Warm threads wake up periodically to notice a release
+    constexpr static int RELEASE_CHECK_MS = 100;
+    // Threads on software transports check this often if a sibling woke them up
+    constexpr static int STEAL_CHECK_MS = 1;
     Functions _functions;
     std::string addr;
     int port;
+    // Segment of a co-located client, empty when invocations use RDMA only
+    std::string shared_memory;
     uint32_t  max_inline_data;
     int id, repetitions;
     int max_repetitions;
+    int warmup_iters;
+    int stolen;
     uint64_t sum;
+    // Each input slot begins with the submission header
+    int input_slots;
+    uint32_t slot_size;
+    uint32_t send_slot_size;
+    // Requested by the manager; cleared when the device doesn't support it
+    bool on_demand_paging;
     rdmalib::Buffer<char> send, rcv;
+    // Replies are written from the send buffer
+    rdmalib::PreparedWrite _reply;
     rdmalib::RecvBuffer wc_buffer;
     rdmalib::Connection* conn;
-    rdmalib::Connection* _mgr_connection;
-    const executor::ManagerConnection & _mgr_conn;
     Accounting _accounting;
-    rdmalib::Buffer<uint64_t> _accounting_buf;
     // FIXME: Adjust to billing granularity
     constexpr static int HOT_POLLING_VERIFICATION_PERIOD = 10000;
     PollingState _polling_state;
+    // Work stealing - nullptr when disabled
+    std::unique_ptr<deque_t> _pending;
+    std::unique_ptr<StealWakeup> _wakeup;
+    std::vector<Thread>* _siblings;
+    // Dedicated pollers - nullptr when the thread polls itself
+    std::unique_ptr<WorkerQueue> _worker;
+    int _send_head;
+    int _sends_in_flight;
+    // Set when the manager takes us away from the client
+    const std::atomic<bool>* _released;
 
-    Thread(std::string addr, int port, int id, int functions_size,
-        int buf_size, int recv_buffer_size, int max_inline_data,
-        const executor::ManagerConnection & mgr_conn):
+    Thread(std::string addr, int port, std::string shared_memory, int id, int functions_size,
+        int buf_size, int input_slots, int recv_buffer_size, int max_inline_data,
+        rdmalib::PageSize page_size, bool on_demand_paging, BillingCounters* counters):
       _functions(functions_size),
       addr(addr),
       port(port),
+      shared_memory(shared_memory),
       max_inline_data(max_inline_data),
       id(id),
       repetitions(0),
       max_repetitions(0),
+      warmup_iters(0),
+      stolen(0),
       sum(0),
-      send(buf_size),
-      rcv(buf_size, rdmalib::functions::Submission::DATA_HEADER_SIZE),
+      input_slots(input_slots),
+      slot_size(buf_size + rdmalib::functions::Submission::DATA_HEADER_SIZE),
+      send_slot_size(buf_size),
+      on_demand_paging(on_demand_paging),
+      send(SEND_RING_SIZE * buf_size, 0, page_size),
+      rcv(input_slots * slot_size, 0, page_size),
       // +1 to handle batching of functions work completions + initial code submission
       wc_buffer(recv_buffer_size + 1),
       conn(nullptr),
-      _mgr_conn(mgr_conn),
-      _accounting({0,0,0,0}),
-      _accounting_buf(1)
+      _accounting({0, 0, counters}),
+      _siblings(nullptr),
+      _send_head(0),
+      _sends_in_flight(0),
+      _released(nullptr)
+    {
+    }
+
+    inline bool running() const
+    {
+      return repetitions < max_repetitions && !_released->load(std::memory_order_relaxed);
+    }
+
+    inline char* input(int invoc_id) const
     {
+      return static_cast<char*>(rcv.ptr())
+        + rdmalib::functions::Submission::slot(invoc_id, input_slots) * slot_size;
     }
 
-    Accounting::timepoint_t work(int invoc_id, int func_id, bool solicited, uint32_t in_size);
+    // Owner defaults to this thread; stolen invocations read input of their owner.
+    Accounting::timepoint_t work(int invoc_id, int func_id, bool solicited, uint32_t in_size, Thread* owner = nullptr);
+    Accounting::timepoint_t run_pending(Accounting::timepoint_t start);
+    int send_slot();
+    void reap_sends(bool all);
+    bool steal(Invocation & invoc);
+    // Published invocations beyond the first one can be taken by blocked siblings.
+    void wake_siblings(int published);
+    // Blocks until an invocation, a published one of a sibling, or the release check.
+    void wait_warm();
+    // Runs before the client learns about our buffers and can submit.
+    void warmup();
+    // Drops the connection and library of the previous allocation; buffers are kept and cleared.
+    void reset(std::string addr, int port, std::string shared_memory);
     void hot(uint32_t hot_timeout);
     void warm();
+    void worker();
     void thread_work(int timeout);
   };
 
@@ -161,27 +280,54 @@ namespace server {
 
     std::vector<Thread> _threads_data;
     std::vector<std::thread> _threads;
+    std::vector<std::thread> _pollers;
     bool _closing;
     int _numcores;
     int _max_repetitions;
     int _warmup_iters;
-    int _pin_threads;
-    //const ManagerConnection & _mgr_conn;
+    // A single core is the beginning of a consecutive range
+    std::vector<int> _pin_threads;
+    bool _work_stealing;
+    int _pollers_count;
+    std::atomic<bool> _released;
+    std::atomic<int> _active_threads;
+    AccountingFlusher _flusher;
 
     FastExecutors(
       std::string client_addr, int port,
+      std::string shared_memory,
       int function_size,
       int numcores,
       int msg_size,
+      int input_slots,
       int recv_buf_size,
       int max_inline_data,
-      int pin_threads,
+      const std::vector<int> & pin_threads,
+      int numa_node,
+      rdmalib::PageSize page_size,
+      bool on_demand_paging,
+      bool work_stealing,
+      int pollers,
+      int billing_interval,
       const executor::ManagerConnection & mgr_conn
     );
     ~FastExecutors();
 
     void close();
-    void allocate_threads(int, int);
+    // Prepares threads and buffers for an allocation of the same shape; call after close.
+    void reset(
+      std::string client_addr, int port,
+      std::string shared_memory,
+      const std::vector<int> & pin_threads,
+      int billing_interval,
+      const executor::ManagerConnection & mgr_conn
+    );
+    void allocate_threads(int timeout, int iterations, int warmup_iters);
+    // Returns when all threads have finished, or when the manager released the executor
+    // over the control socket.
+    void wait(int control_fd);
+    void pin(std::thread & thread, int idx);
+    void poll_threads(int poller_id);
   };
 
 }
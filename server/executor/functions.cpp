@@ -54,6 +54,31 @@ namespace server {
     std::sort(names.begin(), names.end());
   }
 
+  struct PrefaultedLibrary {
+    ElfW(Addr) base;
+    size_t pages;
+  };
+
+  static int prefault_segments(dl_phdr_info* info, size_t, void* data)
+  {
+    PrefaultedLibrary* library = static_cast<PrefaultedLibrary*>(data);
+    if(info->dlpi_addr != library->base)
+      return 0;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    for(int i = 0; i < info->dlpi_phnum; ++i) {
+      const ElfW(Phdr) & phdr = info->dlpi_phdr[i];
+      if(phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_R))
+        continue;
+      uintptr_t begin = (info->dlpi_addr + phdr.p_vaddr) & ~(page - 1);
+      uintptr_t end = info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz;
+      for(uintptr_t ptr = begin; ptr < end; ptr += page) {
+        *reinterpret_cast<volatile char*>(ptr);
+        ++library->pages;
+      }
+    }
+    return 1;
+  }
+
   Functions::Functions(size_t size):
     _size(size),
     _library_handle(nullptr)
@@ -70,10 +95,29 @@ namespace server {
   Functions::~Functions()
   {
     munmap(_memory_handle, _size);
+    close(_fd);
     if(_library_handle)
       dlclose(_library_handle);
   }
 
+  void Functions::reset()
+  {
+    if(_library_handle) {
+      dlclose(_library_handle);
+      _library_handle = nullptr;
+    }
+    _names.clear();
+    _functions.clear();
+
+    munmap(_memory_handle, _size);
+    close(_fd);
+    rdmalib::impl::expect_nonnegative(_fd = memfd_create("libfunction", 0));
+    rdmalib::impl::expect_zero(ftruncate(_fd, _size));
+    rdmalib::impl::expect_nonnull(
+      _memory_handle = mmap(NULL, _size, PROT_WRITE, MAP_SHARED, _fd, 0)
+    );
+  }
+
   void Functions::process_library()
   {
     //FILE* pFile = fopen("examples/libfunctions.so" , "rb");
@@ -109,5 +153,25 @@ namespace server {
     }
     return reinterpret_cast<FuncType>(_functions[idx]);
   }
+
+  Functions::FuncType Functions::warmup_function()
+  {
+    auto it = std::lower_bound(_names.begin(), _names.end(), WARMUP_FUNCTION);
+    if(it == _names.end() || *it != WARMUP_FUNCTION)
+      return nullptr;
+    return function(std::distance(_names.begin(), it));
+  }
+
+  size_t Functions::prefault()
+  {
+    for(size_t i = 0; i < _names.size(); ++i)
+      function(i);
+
+    struct link_map * map = nullptr;
+    dlinfo(_library_handle, RTLD_DI_LINKMAP, &map);
+    PrefaultedLibrary library{map->l_addr, 0};
+    dl_iterate_phdr(prefault_segments, &library);
+    return library.pages;
+  }
 }
 
@@ -22,14 +22,22 @@ namespace server {
     std::vector<void*> _functions;
 
     typedef uint32_t (*FuncType)(void*, uint32_t, void*);
+    // Optional entry point called by the executor before accepting invocations.
+    static constexpr const char* WARMUP_FUNCTION = "rfaas_warmup";
 
     Functions(size_t size);
     ~Functions();
 
     void process_library();
+    // Unloads the library before the next allocation. The code is written to a new file,
+    // since the dynamic loader could return a library still loaded from the same inode.
+    void reset();
     size_t size() const;
     void* memory() const;
     FuncType function(int idx);
+    FuncType warmup_function();
+    // Resolves all functions and faults in pages of the library; returns the number of pages.
+    size_t prefault();
   };
 
 }
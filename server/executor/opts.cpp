@@ -1,7 +1,12 @@
 
+#include <algorithm>
+
 #include <cxxopts.hpp>
 
+#include <rdmalib/functions.hpp>
+
 #include "server.hpp"
+#include "../common/cpulist.hpp"
 
 namespace server {
 
@@ -13,18 +18,26 @@ namespace server {
       ("p,port", "Use selected port", cxxopts::value<int>()->default_value("0"))
       ("cheap", "Number of cheap executors", cxxopts::value<int>()->default_value("0"))
       ("fast", "Number of fast executors", cxxopts::value<int>()->default_value("1"))
-      ("polling-mgr", "Polling manager: server, thread, server-notify", cxxopts::value<std::string>()->default_value("server"))
+      ("polling-mgr", "Polling manager: server (dedicated pollers), thread, server-notify", cxxopts::value<std::string>()->default_value("thread"))
+      ("pollers", "Number of dedicated poller threads with the server polling manager", cxxopts::value<int>()->default_value("1"))
+      ("billing-interval", "Interval of billing updates sent to the manager, in ms; 0 sends only the final one", cxxopts::value<int>()->default_value("100"))
       ("polling-type", "Polling type: wc (work completions), dram", cxxopts::value<std::string>()->default_value("wc"))
-      ("warmup-iters", "Number of warm-up iterations", cxxopts::value<int>()->default_value("1"))
-      ("pin-threads", "Pin worker threads to CPU cores", cxxopts::value<int>()->default_value("-1"))
-      ("max-inline-data", "Maximum size of inlined message", cxxopts::value<int>()->default_value("0"))
+      ("warmup-iters", "Number of calls to the warm-up function of the library before accepting invocations", cxxopts::value<int>()->default_value("1"))
+      ("pin-threads", "Pin worker threads to CPU cores: list of cores, or the first core of a consecutive range; -1 disables pinning", cxxopts::value<std::string>()->default_value("-1"))
+      ("page-size", "Pages of thread buffers: default, thp, 2mb, 1gb", cxxopts::value<std::string>()->default_value("default"))
+      ("on-demand-paging", "Input buffers of threads are paged on demand instead of pinned, when the device supports it", cxxopts::value<bool>()->default_value("false"))
+      ("numa-node", "Bind thread buffers to the memory of NUMA node; -1 disables binding", cxxopts::value<int>()->default_value("-1"))
+      ("max-inline-data", "Maximum size of inlined message, -1 selects the device limit", cxxopts::value<int>()->default_value("-1"))
       ("x,requests", "Size of recv buffer", cxxopts::value<int>()->default_value("32"))
       ("func-size", "Size of functions library", cxxopts::value<int>())
       ("timeout", "Timeout for switching hot to warm polling; -1 always hot, 0 always warm", cxxopts::value<int>())
       ("s,size", "Packet size", cxxopts::value<int>()->default_value("1"))
+      ("input-slots", "Number of input buffers per thread", cxxopts::value<int>()->default_value("1"))
+      ("work-stealing", "Idle threads execute invocations received by other threads", cxxopts::value<bool>()->default_value("false"))
       ("r,repetitions", "Repetitions to execute", cxxopts::value<int>()->default_value("1"))
       ("f,file", "Output server status.", cxxopts::value<std::string>())
       ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("shared-memory", "Shared memory segment of a client on the same host", cxxopts::value<std::string>()->default_value(""))
       ("mgr-address", "Use selected address to executor manager", cxxopts::value<std::string>())
       ("mgr-port", "Use selected port to executor manager", cxxopts::value<int>())
       ("mgr-secret", "Use selected secret", cxxopts::value<int>())
@@ -40,13 +53,24 @@ namespace server {
     result.fast_executors = parsed_options["fast"].as<int>();
     result.recv_buffer_size = parsed_options["requests"].as<int>();
     result.msg_size = parsed_options["size"].as<int>();
+    result.input_slots = std::min(
+      std::max(parsed_options["input-slots"].as<int>(), 1),
+      rdmalib::functions::Submission::MAX_INPUT_SLOTS
+    );
+    result.work_stealing = parsed_options["work-stealing"].as<bool>();
+    result.pollers = std::max(parsed_options["pollers"].as<int>(), 1);
+    result.billing_interval = parsed_options["billing-interval"].as<int>();
     result.repetitions = parsed_options["repetitions"].as<int>();
     result.warmup_iters = parsed_options["warmup-iters"].as<int>();
     result.verbose = parsed_options["verbose"].as<bool>();
-    result.pin_threads = parsed_options["pin-threads"].as<int>();
+    result.pin_threads = executor::parse_cpulist(parsed_options["pin-threads"].as<std::string>());
+    result.numa_node = parsed_options["numa-node"].as<int>();
+    result.page_size = rdmalib::page_size(parsed_options["page-size"].as<std::string>());
+    result.on_demand_paging = parsed_options["on-demand-paging"].as<bool>();
     result.max_inline_data = parsed_options["max-inline-data"].as<int>();
     result.func_size = parsed_options["func-size"].as<int>();
     result.timeout = parsed_options["timeout"].as<int>();
+    result.shared_memory = parsed_options["shared-memory"].as<std::string>();
 
     result.mgr_address = parsed_options["mgr-address"].as<std::string>();
     result.mgr_port = parsed_options["mgr-port"].as<int>();
@@ -43,14 +43,24 @@ namespace server {
     int cheap_executors, fast_executors;
     int recv_buffer_size;
     int msg_size;
+    int input_slots;
     int repetitions;
     int warmup_iters;
-    int pin_threads;
+    // Empty - threads are not pinned
+    std::vector<int> pin_threads;
+    int numa_node;
+    rdmalib::PageSize page_size;
+    bool on_demand_paging;
+    bool work_stealing;
     int max_inline_data;
     int func_size;
     int timeout;
+    // Empty - invocations use RDMA only
+    std::string shared_memory;
     bool verbose;
     PollingMgr polling_manager;
+    int pollers;
+    int billing_interval;
     PollingType polling_type;
 
     std::string mgr_address;
@@ -0,0 +1,91 @@
+
+#ifndef __SERVER_WORK_STEALING_HPP__
+#define __SERVER_WORK_STEALING_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace server {
+
+  // Bounded Chase-Lev deque.
+  // The owner pushes and pops at the bottom, other threads steal from the top.
+  // The capacity is fixed - we never hold more than one batch of received
+  // invocations, and the owner executes the invocation when the deque is full.
+  template<typename T, int Capacity>
+  struct WorkStealingDeque {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static constexpr int64_t MASK = Capacity - 1;
+
+    alignas(64) std::atomic<int64_t> _top;
+    alignas(64) std::atomic<int64_t> _bottom;
+    std::array<T, Capacity> _items;
+
+    WorkStealingDeque():
+      _top(0),
+      _bottom(0)
+    {}
+
+    // Owner only
+    bool push(const T & item)
+    {
+      int64_t bottom = _bottom.load(std::memory_order_relaxed);
+      int64_t top = _top.load(std::memory_order_acquire);
+      if(bottom - top >= Capacity)
+        return false;
+      _items[bottom & MASK] = item;
+      std::atomic_thread_fence(std::memory_order_release);
+      _bottom.store(bottom + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // Owner only
+    bool pop(T & item)
+    {
+      int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+      _bottom.store(bottom, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t top = _top.load(std::memory_order_relaxed);
+
+      if(top > bottom) {
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+      }
+
+      item = _items[bottom & MASK];
+      if(top == bottom) {
+        // Last element - race against thieves.
+        bool won = _top.compare_exchange_strong(
+          top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed
+        );
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+      }
+      return true;
+    }
+
+    // Any thread
+    bool steal(T & item)
+    {
+      int64_t top = _top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t bottom = _bottom.load(std::memory_order_acquire);
+      if(top >= bottom)
+        return false;
+
+      item = _items[top & MASK];
+      return _top.compare_exchange_strong(
+        top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed
+      );
+    }
+
+    bool empty() const
+    {
+      return _top.load(std::memory_order_relaxed) >= _bottom.load(std::memory_order_relaxed);
+    }
+  };
+
+}
+
+#endif
+
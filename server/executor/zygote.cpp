@@ -0,0 +1,94 @@
+
+#include <cstring>
+#include <cstdint>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <rdma/rdma_cma.h>
+#include <spdlog/spdlog.h>
+
+#include "zygote.hpp"
+#include "../common.hpp"
+
+namespace server {
+
+  static bool read_all(int fd, char* data, size_t len)
+  {
+    while(len > 0) {
+      ssize_t ret = read(fd, data, len);
+      if(ret <= 0) {
+        if(ret < 0 && errno == EINTR)
+          continue;
+        return false;
+      }
+      data += ret;
+      len -= ret;
+    }
+    return true;
+  }
+
+  int Zygote::descriptor(int argc, char ** argv)
+  {
+    if(argc == 3 && !strcmp(argv[1], "--zygote"))
+      return atoi(argv[2]);
+    return -1;
+  }
+
+  void Zygote::prepare()
+  {
+    // We learn about a closed descriptor from the failed write.
+    signal(SIGPIPE, SIG_IGN);
+    // librdmacm opens verbs contexts of all devices on first use, and keeps them
+    // for the entire process - the allocation only creates QPs.
+    int devices = 0;
+    ibv_context** contexts = rdma_get_devices(&devices);
+    if(contexts)
+      rdma_free_devices(contexts);
+    spdlog::info("Zygote {} initialized {} RDMA devices", getpid(), devices);
+  }
+
+  bool Zygote::wait(int fd)
+  {
+    uint32_t len = executor::RELEASE_EXECUTOR;
+    // Release might arrive after we have finished the allocation on our own.
+    while(len == executor::RELEASE_EXECUTOR)
+      if(!read_all(fd, reinterpret_cast<char*>(&len), sizeof(len)))
+        return false;
+    std::string data(len, '\0');
+    if(!read_all(fd, data.data(), len))
+      return false;
+
+    _args.clear();
+    _args.emplace_back("executor");
+    for(size_t pos = 0; pos < data.size(); ) {
+      size_t end = data.find('\0', pos);
+      if(end == std::string::npos)
+        end = data.size();
+      _args.emplace_back(data.substr(pos, end - pos));
+      pos = end + 1;
+    }
+    _argv.clear();
+    for(auto & arg : _args)
+      _argv.push_back(arg.data());
+    _argv.push_back(nullptr);
+    return true;
+  }
+
+  bool Zygote::idle(int fd)
+  {
+    char status = executor::EXECUTOR_IDLE;
+    return write(fd, &status, sizeof(status)) == sizeof(status);
+  }
+
+  int Zygote::argc()
+  {
+    return _args.size();
+  }
+
+  char** Zygote::argv()
+  {
+    return _argv.data();
+  }
+
+}
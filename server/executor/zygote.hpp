@@ -0,0 +1,32 @@
+
+#ifndef __SERVER_ZYGOTE_HPP__
+#define __SERVER_ZYGOTE_HPP__
+
+#include <string>
+#include <vector>
+
+namespace server {
+
+  // Executor started ahead of an allocation by the manager.
+  // It initializes the process and RDMA devices, and blocks until the manager
+  // writes the command line of the allocation to the zygote file descriptor.
+  // After an allocation, the process reports that it is idle and waits for the next one;
+  // the manager closes the descriptor when it does not reuse the executor.
+  struct Zygote {
+    std::vector<std::string> _args;
+    std::vector<char*> _argv;
+
+    // Returns the descriptor of zygote mode (--zygote <fd>), or -1.
+    static int descriptor(int argc, char ** argv);
+    void prepare();
+    // Message is a 32-bit length followed by NUL-separated arguments.
+    // Returns false when the manager closed the pool.
+    bool wait(int fd);
+    bool idle(int fd);
+    int argc();
+    char** argv();
+  };
+
+}
+
+#endif
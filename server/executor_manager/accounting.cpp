@@ -0,0 +1,57 @@
+
+#include <cstring>
+
+#include <infiniband/verbs.h>
+
+#include "accounting.hpp"
+
+namespace rfaas::executor_manager {
+
+  AccountingTable::AccountingTable(int size):
+    _records(size)
+  {
+    memset(_records.data(), 0, sizeof(executor::AccountingRecord) * size);
+    // Lowest indices are taken first
+    for(int i = size - 1; i >= 0; --i)
+      _free.push_back(i);
+  }
+
+  void AccountingTable::register_memory(ibv_pd* pd)
+  {
+    _records.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  }
+
+  int AccountingTable::allocate()
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(_free.empty())
+      return -1;
+    int idx = _free.back();
+    _free.pop_back();
+    memset(record(idx), 0, sizeof(executor::AccountingRecord));
+    return idx;
+  }
+
+  void AccountingTable::release(int idx)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _free.push_back(idx);
+  }
+
+  executor::AccountingRecord* AccountingTable::record(int idx)
+  {
+    return _records.data() + idx;
+  }
+
+  uint64_t AccountingTable::address(int idx) const
+  {
+    return _records.address() + sizeof(executor::AccountingRecord) * idx;
+  }
+
+  uint32_t AccountingTable::rkey() const
+  {
+    return _records.rkey();
+  }
+
+}
+
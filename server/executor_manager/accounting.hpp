@@ -2,14 +2,69 @@
 #ifndef __SERVER_EXECUTOR_MANAGER_ACCOUNTING_HPP__
 #define __SERVER_EXECUTOR_MANAGER_ACCOUNTING_HPP__
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <rdmalib/buffer.hpp>
+
+#include "../common.hpp"
+
+struct ibv_pd;
 
 namespace rfaas::executor_manager {
 
   // FIXME: Memory accounting for all clients?
   struct Accounting {
-    volatile uint64_t hot_polling_time;
-    volatile uint64_t execution_time; 
+    uint64_t hot_polling_time;
+    uint64_t execution_time;
+
+    // A write cut off by a killed executor leaves the record torn for good.
+    static constexpr int READ_ATTEMPTS = 1024;
+
+    // Consistent snapshot of a record that the executor might be overwriting right now.
+    // Returns false and keeps the previous snapshot when the record stays torn.
+    static bool read(const executor::AccountingRecord & record, Accounting & snapshot)
+    {
+      for(int i = 0; i < READ_ATTEMPTS; ++i) {
+        uint64_t version_end = record.version_end;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        Accounting current{record.hot_polling_time, record.execution_time};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(record.version == version_end) {
+          snapshot = current;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    Accounting & operator+=(const Accounting & other)
+    {
+      hot_polling_time += other.hot_polling_time;
+      execution_time += other.execution_time;
+      return *this;
+    }
+  };
+
+  // Accounting records of all clients in a single memory region, registered once.
+  // A client holds its record for the lifetime of its connection.
+  struct AccountingTable {
+    rdmalib::Buffer<executor::AccountingRecord> _records;
+    std::vector<int> _free;
+    std::mutex _mutex;
+
+    AccountingTable(int size);
+
+    // Executors write their records remotely
+    void register_memory(ibv_pd* pd);
+    // Returns a cleared record, or -1 when all are taken.
+    int allocate();
+    void release(int idx);
+    executor::AccountingRecord* record(int idx);
+    uint64_t address(int idx) const;
+    uint32_t rkey() const;
   };
 
 }
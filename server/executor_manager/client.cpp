@@ -1,52 +1,39 @@
 
 #include <chrono>
+#include <cstring>
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <spdlog/spdlog.h>
+
 #include <rdmalib/allocation.hpp>
 
 #include "client.hpp"
 
 namespace rfaas::executor_manager {
 
-  Client::Client(rdmalib::Connection* conn, ibv_pd* pd): //, Accounting & _acc):
+  Client::Client(rdmalib::Connection* conn, int accounting_slot, executor::AccountingRecord* accounting):
     connection(conn),
-    allocation_requests(RECV_BUF_SIZE),
-    rcv_buffer(RECV_BUF_SIZE),
-    accounting(1),
-    //accounting(_acc),
+    accounting_slot(accounting_slot),
+    accounting(accounting),
+    billed{0, 0},
+    current{0, 0},
     allocation_time(0),
+    lease_timeout(0),
+    last_execution_time(0),
+    reclaimed(false),
     _active(false)
   {
-    // Make the buffer accessible to clients
-    memset(accounting.data(), 0, accounting.data_size());
-    accounting.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
-    // Make the buffer accessible to clients
-    allocation_requests.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
-    // Initialize batch receive WCs
-    connection->initialize_batched_recv(allocation_requests, sizeof(rdmalib::AllocationRequest));
-    rcv_buffer.connect(connection);
-  }
-
-  //void Client::reinitialize(rdmalib::Connection* conn)
-  //{
-  //  connection = conn;
-  //  // Initialize batch receive WCs
-  //  connection->initialize_batched_recv(allocation_requests, sizeof(rdmalib::AllocationRequest));
-  //  rcv_buffer.connect(conn);
-  //}
-
-  void Client::reload_queue()
-  {
-    rcv_buffer.refill();
   }
 
   void Client::disable(int id)
   {
-    rdma_disconnect(connection->id());
+    // Connections over TCP are disconnected when closed
+    if(connection->id())
+      rdma_disconnect(connection->id());
     SPDLOG_DEBUG(
       "[Client] Disconnect client with connection {} id {}",
       fmt::ptr(connection), fmt::ptr(connection->id())
@@ -61,12 +48,13 @@ namespace rfaas::executor_manager {
       spdlog::info("Waited for child {} ms", std::chrono::duration_cast<std::chrono::milliseconds>(e-b).count());
 
       executor.reset();
+      collect_billing();
     }
     spdlog::info(
       "Client {} exited, time allocated {} us, polling {} us, execution {} us",
       id, allocation_time,
-      accounting.data()[0].hot_polling_time,
-      accounting.data()[0].execution_time
+      billed.hot_polling_time,
+      billed.execution_time
     );
     //acc.hot_polling_time = acc.execution_time = 0;
     // SEGFAULT?
@@ -77,6 +65,47 @@ namespace rfaas::executor_manager {
     _active=false;
   }
 
+  Accounting Client::billing()
+  {
+    Accounting total = billed;
+    total += read_billing();
+    return total;
+  }
+
+  const Accounting & Client::read_billing()
+  {
+    if(!Accounting::read(*accounting, current))
+      spdlog::warn("Billing record {} stays torn, using its last consistent snapshot", accounting_slot);
+    return current;
+  }
+
+  void Client::collect_billing()
+  {
+    billed += read_billing();
+    memset(accounting, 0, sizeof(executor::AccountingRecord));
+    current = Accounting{0, 0};
+  }
+
+  void Client::renew_lease()
+  {
+    last_activity = std::chrono::steady_clock::now();
+    last_execution_time = read_billing().execution_time;
+    reclaimed = false;
+  }
+
+  bool Client::lease_expired(std::chrono::steady_clock::time_point now)
+  {
+    if(!executor || reclaimed || pending_request || !lease_timeout.count())
+      return false;
+    uint64_t execution_time = read_billing().execution_time;
+    if(execution_time != last_execution_time) {
+      last_execution_time = execution_time;
+      last_activity = now;
+      return false;
+    }
+    return now - last_activity >= lease_timeout;
+  }
+
   bool Client::active()
   {
     // Compiler complains for some reason
@@ -3,36 +3,57 @@
 #define __SERVER_EXECUTOR_MANAGER_CLIENT_HPP__
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <optional>
 
+#include <rdmalib/allocation.hpp>
 #include <rdmalib/connection.hpp>
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/buffer.hpp>
-#include <rdmalib/recv_buffer.hpp>
 
 #include "accounting.hpp"
 #include "executor_process.hpp"
 
-namespace rdmalib {
-  struct AllocationRequest;
-}
-
 namespace rfaas::executor_manager {
 
   struct Client
   {
-    static constexpr int RECV_BUF_SIZE = 8;
     rdmalib::Connection* connection;
-    rdmalib::Buffer<rdmalib::AllocationRequest> allocation_requests;
-    rdmalib::RecvBuffer rcv_buffer;
     std::unique_ptr<ActiveExecutor> executor;
-    rdmalib::Buffer<Accounting> accounting; // Timing data
+    // Timing data of the current executor, written by the executor to our record
+    // in the accounting table
+    int accounting_slot;
+    executor::AccountingRecord* accounting;
+    // Timing data of executors that already finished
+    Accounting billed;
+    // Last consistent snapshot of the record of the current executor
+    Accounting current;
     uint32_t allocation_time;
+    // The executor is reclaimed after this time without finished invocations; 0 disables it.
+    std::chrono::seconds lease_timeout;
+    std::chrono::steady_clock::time_point last_activity;
+    // Execution time of the current executor at the last lease check
+    uint64_t last_execution_time;
+    // The executor is being reclaimed and the client has been notified
+    bool reclaimed;
+    // Allocation waiting for the current executor to leave
+    std::optional<rdmalib::AllocationRequest> pending_request;
     bool _active;
 
-    Client(rdmalib::Connection* conn, ibv_pd* pd);
-    void reload_queue();
+    // Requests arrive through the shared receive queue of the poller.
+    Client(rdmalib::Connection* conn, int accounting_slot, executor::AccountingRecord* accounting);
     void disable(int);
+    // Billing of all executors, including the running one.
+    Accounting billing();
+    // Snapshot of the record of the current executor; the last one when the record is torn.
+    const Accounting & read_billing();
+    // The executor has finished - move its billing and clear the record for the next one.
+    void collect_billing();
+    // Starts the lease of the current executor again.
+    void renew_lease();
+    // New invocations are detected from the execution time billed by the executor.
+    bool lease_expired(std::chrono::steady_clock::time_point now);
     bool active();
   };
 
@@ -0,0 +1,205 @@
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <spdlog/spdlog.h>
+
+#include "container_pool.hpp"
+#include "settings.hpp"
+#include "zygote.hpp"
+
+namespace rfaas::executor_manager {
+
+  constexpr int ContainerPool::LIFECYCLE_PERIOD_MS;
+  constexpr int ContainerPool::RESTART_DELAY_MS;
+
+  ContainerPool::ContainerPool(const DockerSettings & settings):
+    _settings(settings),
+    _closing(false)
+  {
+    auto now = std::chrono::steady_clock::now();
+    if(_settings.use_docker) {
+      for(auto & ip : _settings.pool_ips)
+        _containers.push_back({ip, State::STOPPED, -1, -1, now});
+    }
+  }
+
+  ContainerPool::~ContainerPool()
+  {
+    close();
+  }
+
+  bool ContainerPool::enabled() const
+  {
+    return !_containers.empty();
+  }
+
+  void ContainerPool::start()
+  {
+    if(!enabled())
+      return;
+    spdlog::info("Starting pool of {} executor containers", _containers.size());
+    _thread = std::thread(&ContainerPool::lifecycle, this);
+  }
+
+  void ContainerPool::close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closing = true;
+    }
+    _cv.notify_one();
+    if(_thread.joinable())
+      _thread.join();
+  }
+
+  void ContainerPool::start_container(Container & container)
+  {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+      spdlog::error("Container socket creation failed, reason {}", strerror(errno));
+      return;
+    }
+    // Executors started later must not inherit our end.
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    std::string ip_arg = "--ip=" + container.ip;
+    std::string volume_arg = _settings.volume + ":/opt";
+    std::string net_arg = "--net=" + _settings.network;
+    std::string registry_port = std::to_string(_settings.registry_port);
+    std::string docker_image = _settings.registry_ip + ":" + registry_port
+        + "/" + _settings.image;
+    const char * argv[] = {
+      "docker_rdma_sriov", "run",
+      "--rm", "-i",
+      net_arg.c_str(),
+      ip_arg.c_str(),
+      "--volume", volume_arg.c_str(),
+      docker_image.c_str(),
+      "/opt/bin/executor",
+      "--zygote", "0",
+      nullptr
+    };
+
+    pid_t pid = fork();
+    if(pid < 0) {
+      spdlog::error("Fork failed! {}", pid);
+      ::close(fds[0]);
+      ::close(fds[1]);
+      return;
+    }
+
+    if(pid == 0) {
+      auto out_file = ("executor_" + std::to_string(getpid()));
+      int fd = open(out_file.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+      dup2(fds[0], 0);
+      dup2(fd, 1);
+      dup2(fd, 2);
+      int ret = execvp(argv[0], const_cast<char**>(&argv[0]));
+      if(ret == -1) {
+        spdlog::error("Executor process failed {}, reason {}", errno, strerror(errno));
+        ::close(fd);
+        exit(1);
+      }
+      exit(0);
+    }
+
+    ::close(fds[0]);
+    container.pid = pid;
+    container.fd = fds[1];
+    container.state = State::IDLE;
+    SPDLOG_DEBUG("Started executor container {} with IP {}", pid, container.ip);
+  }
+
+  void ContainerPool::lifecycle()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(!_closing) {
+
+      auto now = std::chrono::steady_clock::now();
+      for(auto & container : _containers) {
+
+        if(container.state == State::STOPPED && container.restart <= now) {
+          start_container(container);
+          if(container.state == State::STOPPED)
+            container.restart = now + std::chrono::milliseconds(RESTART_DELAY_MS);
+        } else if(container.state == State::IDLE && waitpid(container.pid, nullptr, WNOHANG) != 0) {
+          // Container failed to start, e.g., the previous one with this IP is still removed.
+          spdlog::warn("Idle executor container {} with IP {} exited", container.pid, container.ip);
+          ::close(container.fd);
+          container.state = State::STOPPED;
+          container.restart = now + std::chrono::milliseconds(RESTART_DELAY_MS);
+        }
+      }
+
+      _cv.wait_for(lock, std::chrono::milliseconds(LIFECYCLE_PERIOD_MS));
+    }
+
+    // Idle containers exit when their standard input is closed.
+    for(auto & container : _containers) {
+      if(container.state == State::IDLE) {
+        ::close(container.fd);
+        waitpid(container.pid, nullptr, 0);
+        container.state = State::STOPPED;
+      }
+    }
+    spdlog::info("Container pool stopped");
+  }
+
+  pid_t ContainerPool::assign(const std::vector<std::string> & args)
+  {
+    if(!enabled())
+      return -1;
+    int fd = -1;
+    pid_t pid = -1;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for(auto & container : _containers) {
+        if(container.state == State::IDLE) {
+          container.state = State::ASSIGNED;
+          fd = container.fd;
+          pid = container.pid;
+          break;
+        }
+      }
+    }
+    if(pid == -1)
+      return -1;
+
+    // Assigned containers are not touched by the lifecycle thread.
+    bool written = ZygotePool::send_arguments(fd, args);
+    ::close(fd);
+    if(!written) {
+      spdlog::warn("Executor container {} did not accept the allocation, reason {}", pid, strerror(errno));
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      release(pid);
+      return -1;
+    }
+    return pid;
+  }
+
+  void ContainerPool::release(pid_t pid)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for(auto & container : _containers) {
+        if(container.state == State::ASSIGNED && container.pid == pid) {
+          container.state = State::STOPPED;
+          container.pid = -1;
+          container.fd = -1;
+          container.restart = std::chrono::steady_clock::now();
+          break;
+        }
+      }
+    }
+    _cv.notify_one();
+  }
+
+}
@@ -0,0 +1,70 @@
+
+#ifndef __SERVER_EXECUTOR_MANAGER_CONTAINER_POOL_HPP__
+#define __SERVER_EXECUTOR_MANAGER_CONTAINER_POOL_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace rfaas::executor_manager {
+
+  struct DockerSettings;
+
+  // Executor containers started ahead of allocations, one for each IP of the pool.
+  // Each container runs a zygote executor that reads the command line of an allocation
+  // from its standard input. A background thread starts and reaps idle containers,
+  // and restarts containers released by finished executors - poller threads
+  // only hand over the arguments.
+  struct ContainerPool {
+
+    enum class State {
+      STOPPED = 0,
+      IDLE,
+      ASSIGNED
+    };
+
+    struct Container {
+      std::string ip;
+      State state;
+      // PID of the docker client
+      pid_t pid;
+      // Our end of the socket connected to the standard input
+      int fd;
+      std::chrono::steady_clock::time_point restart;
+    };
+
+    static constexpr int LIFECYCLE_PERIOD_MS = 100;
+    // Container with the same IP might not have been removed yet
+    static constexpr int RESTART_DELAY_MS = 1000;
+
+    const DockerSettings & _settings;
+    std::vector<Container> _containers;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _closing;
+    std::thread _thread;
+
+    ContainerPool(const DockerSettings & settings);
+    ~ContainerPool();
+
+    bool enabled() const;
+    void start();
+    void close();
+    // Returns PID of the executor, or -1 when no container is idle.
+    pid_t assign(const std::vector<std::string> & args);
+    // The executor has exited - start a new container with its IP.
+    void release(pid_t pid);
+    void lifecycle();
+  private:
+    void start_container(Container & container);
+  };
+
+}
+
+#endif
@@ -0,0 +1,139 @@
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+#include <dirent.h>
+#include <sched.h>
+
+#include <infiniband/verbs.h>
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/util.hpp>
+
+#include "core_allocator.hpp"
+#include "../common/cpulist.hpp"
+
+namespace rfaas::executor_manager {
+
+  static std::string read_line(const std::string & path)
+  {
+    std::ifstream in{path};
+    std::string line;
+    std::getline(in, line);
+    return line;
+  }
+
+  CoreAllocator::CoreAllocator():
+    _nic_node(-1)
+  {}
+
+  void CoreAllocator::initialize(ibv_device* device)
+  {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    rdmalib::impl::expect_zero(sched_getaffinity(0, sizeof(allowed), &allowed));
+
+    // Kernel reports -1 when the device is not attached to any node
+    if(device) {
+      std::string node = read_line(std::string{device->ibdev_path} + "/device/numa_node");
+      if(!node.empty())
+        _nic_node = std::stoi(node);
+    }
+
+    const std::string nodes_path = "/sys/devices/system/node";
+    DIR* dir = opendir(nodes_path.c_str());
+    if(dir) {
+      dirent* entry;
+      while((entry = readdir(dir))) {
+        if(strncmp(entry->d_name, "node", 4) || !isdigit(entry->d_name[4]))
+          continue;
+        Node node{atoi(entry->d_name + 4), {}};
+        auto cpus = executor::parse_cpulist(
+          read_line(nodes_path + "/" + entry->d_name + "/cpulist")
+        );
+        for(int cpu : cpus)
+          if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+            node.free_cores.push_back(cpu);
+        if(!node.free_cores.empty())
+          _nodes.push_back(std::move(node));
+      }
+      closedir(dir);
+    }
+    // Kernel without NUMA support
+    if(_nodes.empty()) {
+      Node node{0, {}};
+      for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if(CPU_ISSET(cpu, &allowed))
+          node.free_cores.push_back(cpu);
+      _nodes.push_back(std::move(node));
+    }
+
+    std::sort(_nodes.begin(), _nodes.end(),
+      [](const Node & a, const Node & b) { return a.id < b.id; }
+    );
+    std::stable_partition(_nodes.begin(), _nodes.end(),
+      [this](const Node & node) { return node.id == _nic_node; }
+    );
+
+    for(size_t i = 0; i < _nodes.size(); ++i) {
+      std::sort(_nodes[i].free_cores.begin(), _nodes[i].free_cores.end());
+      for(int core : _nodes[i].free_cores) {
+        if(core >= static_cast<int>(_core_nodes.size()))
+          _core_nodes.resize(core + 1, -1);
+        _core_nodes[core] = i;
+      }
+    }
+    spdlog::info(
+      "Core allocator has {} cores on {} NUMA nodes, RDMA device is on node {}",
+      free_cores(), _nodes.size(), _nic_node
+    );
+  }
+
+  std::vector<int> CoreAllocator::allocate(int cores, int & numa_node)
+  {
+    std::vector<int> result;
+    numa_node = -1;
+    if(cores <= 0 || free_cores() < cores)
+      return result;
+
+    // Prefer a single node, starting with the NIC-local one.
+    for(Node & node : _nodes) {
+      if(static_cast<int>(node.free_cores.size()) >= cores) {
+        result.assign(node.free_cores.begin(), node.free_cores.begin() + cores);
+        node.free_cores.erase(node.free_cores.begin(), node.free_cores.begin() + cores);
+        numa_node = node.id;
+        return result;
+      }
+    }
+
+    // FIXME: executor threads spanning nodes share the memory of a single node
+    for(Node & node : _nodes) {
+      int count = std::min<int>(cores - result.size(), node.free_cores.size());
+      result.insert(result.end(), node.free_cores.begin(), node.free_cores.begin() + count);
+      node.free_cores.erase(node.free_cores.begin(), node.free_cores.begin() + count);
+      if(static_cast<int>(result.size()) == cores)
+        break;
+    }
+    return result;
+  }
+
+  void CoreAllocator::release(const std::vector<int> & cores)
+  {
+    for(int core : cores) {
+      auto & free_cores = _nodes[_core_nodes[core]].free_cores;
+      free_cores.insert(std::upper_bound(free_cores.begin(), free_cores.end(), core), core);
+    }
+  }
+
+  int CoreAllocator::free_cores() const
+  {
+    int count = 0;
+    for(const Node & node : _nodes)
+      count += node.free_cores.size();
+    return count;
+  }
+
+}
+
@@ -0,0 +1,42 @@
+
+#ifndef __SERVER_EXECUTOR_MANAGER_CORE_ALLOCATOR_HPP__
+#define __SERVER_EXECUTOR_MANAGER_CORE_ALLOCATOR_HPP__
+
+#include <vector>
+
+struct ibv_device;
+
+namespace rfaas::executor_manager {
+
+  // Assigns disjoint sets of cores to executors.
+  // Cores on the NUMA node of the RDMA NIC are handed out first,
+  // and an allocation stays within a single node whenever possible.
+  // Not thread-safe - poller threads allocate and release cores under the spawn lock of the manager.
+  struct CoreAllocator {
+
+    struct Node {
+      int id;
+      std::vector<int> free_cores;
+    };
+
+    // The NIC-local node is always the first one
+    std::vector<Node> _nodes;
+    // Core -> index in _nodes
+    std::vector<int> _core_nodes;
+    int _nic_node;
+
+    CoreAllocator();
+
+    // Reads the topology from sysfs; uses only cores allowed for the manager.
+    void initialize(ibv_device* device);
+    // Returns an empty set when there are not enough free cores.
+    // NUMA node is -1 when cores come from different nodes.
+    std::vector<int> allocate(int cores, int & numa_node);
+    void release(const std::vector<int> & cores);
+    int free_cores() const;
+  };
+
+}
+
+#endif
+
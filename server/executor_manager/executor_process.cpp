@@ -1,8 +1,12 @@
 
+#include <algorithm>
+#include <cstring>
 #include <tuple>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 
 #include <spdlog/spdlog.h>
@@ -12,6 +16,9 @@
 #include "executor_process.hpp"
 #include "settings.hpp"
 #include "../common.hpp"
+#include "../common/cpulist.hpp"
+#include "zygote.hpp"
+#include "container_pool.hpp"
 
 namespace rfaas::executor_manager {
 
@@ -23,19 +30,44 @@ namespace rfaas::executor_manager {
     delete[] connections; 
   }
 
-  ProcessExecutor::ProcessExecutor(int cores, ProcessExecutor::time_t alloc_begin, pid_t pid):
+  ProcessExecutor::ProcessExecutor(int cores, ProcessExecutor::time_t alloc_begin, pid_t pid, int control_fd):
     ActiveExecutor(cores),
-    _pid(pid)
+    _pid(pid),
+    _pidfd(-1),
+    _control_fd(control_fd)
   {
     _allocation_begin = alloc_begin;
     // FIXME: remove after connection
     _allocation_finished = _allocation_begin;
+#ifdef SYS_pidfd_open
+    _pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    if(_pidfd == -1)
+      SPDLOG_DEBUG("pidfd is not available for executor {}, reason {}", pid, strerror(errno));
+  }
+
+  ProcessExecutor::~ProcessExecutor()
+  {
+    if(_pidfd != -1)
+      close(_pidfd);
+    if(_control_fd != -1)
+      close(_control_fd);
   }
 
   std::tuple<ProcessExecutor::Status,int> ProcessExecutor::check() const
   {
     int status;
-    pid_t return_pid = waitpid(_pid, &status, WNOHANG);
+    int options = WNOHANG;
+    if(_control_fd != -1) {
+      char message;
+      ssize_t ret = recv(_control_fd, &message, sizeof(message), MSG_DONTWAIT);
+      if(ret == sizeof(message) && message == executor::EXECUTOR_IDLE)
+        return std::make_tuple(Status::IDLE, 0);
+      // The socket is closed only by an exiting process.
+      if(ret == 0)
+        options = 0;
+    }
+    pid_t return_pid = waitpid(_pid, &status, options);
     if(!return_pid) {
       return std::make_tuple(Status::RUNNING, 0);
     } else {
@@ -55,40 +87,120 @@ namespace rfaas::executor_manager {
     return static_cast<int>(_pid);
   }
 
+  int ProcessExecutor::exit_fd() const
+  {
+    return _control_fd != -1 ? _control_fd : _pidfd;
+  }
+
+  bool ProcessExecutor::release() const
+  {
+    if(_control_fd == -1)
+      return false;
+    uint32_t message = executor::RELEASE_EXECUTOR;
+    return send(_control_fd, &message, sizeof(message), MSG_NOSIGNAL) == sizeof(message);
+  }
+
+  int ProcessExecutor::detach()
+  {
+    int fd = _control_fd;
+    _control_fd = -1;
+    return fd;
+  }
+
+  std::vector<std::string> ProcessExecutor::arguments(
+    const rdmalib::AllocationRequest & request,
+    const ExecutorSettings & exec,
+    const executor::ManagerConnection & conn,
+    const std::vector<int> & cpus,
+    int numa_node
+  )
+  {
+    std::vector<std::string> args{
+      "-a", std::string{request.listen_address},
+      "-p", std::to_string(request.listen_port),
+      "--polling-mgr", exec.pollers > 0 ? "server" : "thread",
+      "--pollers", std::to_string(std::max(exec.pollers, 1)),
+      "--billing-interval", std::to_string(exec.billing_interval),
+      "-r", std::to_string(exec.repetitions),
+      "-x", std::to_string(exec.recv_buffer_size),
+      "-s", std::to_string(request.input_buf_size),
+      "--input-slots", std::to_string(std::max<int>(request.input_buf_count, 1)),
+      std::string{"--work-stealing="} + (exec.work_stealing ? "true" : "false"),
+      "--pin-threads", cpus.empty() ? "-1" : executor::format_cpulist(cpus),
+      "--numa-node", std::to_string(numa_node),
+      "--page-size", exec.page_size,
+      std::string{"--on-demand-paging="} + (exec.on_demand_paging ? "true" : "false"),
+      "--fast", std::to_string(request.cores),
+      "--warmup-iters", std::to_string(exec.warmup_iters),
+      "--max-inline-data", std::to_string(exec.max_inline_data),
+      "--func-size", std::to_string(request.func_buf_size),
+      "--timeout", std::to_string(request.hot_timeout),
+      "--mgr-address", conn.addr,
+      "--mgr-port", std::to_string(conn.port),
+      "--mgr-secret", std::to_string(conn.secret),
+      "--mgr-buf-addr", std::to_string(conn.r_addr),
+      "--mgr-buf-rkey", std::to_string(conn.r_key)
+    };
+    std::string shared_memory{request.shared_memory, strnlen(request.shared_memory, sizeof(request.shared_memory))};
+    if(!shared_memory.empty()) {
+      args.emplace_back("--shared-memory");
+      args.emplace_back(shared_memory);
+    }
+    return args;
+  }
+
   ProcessExecutor* ProcessExecutor::spawn(
     const rdmalib::AllocationRequest & request,
     const ExecutorSettings & exec,
-    const executor::ManagerConnection & conn
+    const executor::ManagerConnection & conn,
+    const std::vector<int> & cpus,
+    int numa_node,
+    ZygotePool * zygotes,
+    ContainerPool * containers
   )
   {
-    static int counter = 0;
     auto begin = std::chrono::high_resolution_clock::now();
-    //spdlog::info("Child fork begins work on PID {} req {}", mypid, fmt::ptr(&request));
-    std::string client_addr{request.listen_address};
-    std::string client_port = std::to_string(request.listen_port);
-    //spdlog::error("Child fork begins work on PID {} req {}", mypid, fmt::ptr(&request));
-    std::string client_in_size = std::to_string(request.input_buf_size);
-    std::string client_func_size = std::to_string(request.func_buf_size);
-    std::string client_cores = std::to_string(request.cores);
-    std::string client_timeout = std::to_string(request.hot_timeout);
-    //spdlog::error("Child fork begins work on PID {}", mypid);
-    std::string executor_repetitions = std::to_string(exec.repetitions);
-    std::string executor_warmups = std::to_string(exec.warmup_iters);
-    std::string executor_recv_buf = std::to_string(exec.recv_buffer_size);
-    std::string executor_max_inline = std::to_string(exec.max_inline_data);
-    std::string executor_pin_threads;
-    if(exec.pin_threads >= 0)
-      executor_pin_threads = std::to_string(0);//counter++);
-    else
-      executor_pin_threads = std::to_string(exec.pin_threads);
     bool use_docker = exec.docker.use_docker;
+    std::vector<std::string> args = arguments(request, exec, conn, cpus, numa_node);
+
+    // Zygotes have already been started, we only pass the arguments.
+    int mypid = -1;
+    int control_fd = -1;
+    if(zygotes && !use_docker)
+      mypid = zygotes->start(args, exec.reuse_executors ? &control_fd : nullptr);
+    else if(containers && containers->enabled()) {
+      mypid = containers->assign(args);
+      if(mypid == -1)
+        spdlog::warn("No idle executor container, starting a new one");
+    }
+    if(mypid != -1) {
+      auto executor = new ProcessExecutor{request.cores, begin, mypid, control_fd};
+      executor->cpus = cpus;
+      return executor;
+    }
 
-    std::string mgr_port = std::to_string(conn.port);
-    std::string mgr_secret = std::to_string(conn.secret);
-    std::string mgr_buf_addr = std::to_string(conn.r_addr);
-    std::string mgr_buf_rkey = std::to_string(conn.r_key);
+    std::vector<std::string> prefix;
+    if(!use_docker) {
+      prefix.emplace_back("executor");
+    } else {
+      std::string registry_port = std::to_string(exec.docker.registry_port);
+      prefix = {
+        "docker_rdma_sriov", "run",
+        "--rm", "-i",
+        "--net=" + exec.docker.network,
+        "--ip=" + exec.docker.ip,
+        "--volume", exec.docker.volume + ":/opt",
+        exec.docker.registry_ip + ":" + registry_port + "/" + exec.docker.image,
+        "/opt/bin/executor"
+      };
+    }
+    args.insert(args.begin(), prefix.begin(), prefix.end());
+    std::vector<const char*> argv;
+    for(auto & arg : args)
+      argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
 
-    int mypid = fork();
+    mypid = fork();
     if(mypid < 0) {
       spdlog::error("Fork failed! {}", mypid);
     }
@@ -105,84 +217,18 @@ namespace rfaas::executor_manager {
       int fd = open(out_file.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
       dup2(fd, 1);
       dup2(fd, 2);
-      if(!use_docker) {
-        const char * argv[] = {
-          "executor",
-          "-a", client_addr.c_str(),
-          "-p", client_port.c_str(),
-          "--polling-mgr", "thread",
-          "-r", executor_repetitions.c_str(),
-          "-x", executor_recv_buf.c_str(),
-          "-s", client_in_size.c_str(),
-          "--pin-threads", executor_pin_threads.c_str(),
-          "--fast", client_cores.c_str(),
-          "--warmup-iters", executor_warmups.c_str(),
-          "--max-inline-data", executor_max_inline.c_str(),
-          "--func-size", client_func_size.c_str(),
-          "--timeout", client_timeout.c_str(),
-          "--mgr-address", conn.addr.c_str(),
-          "--mgr-port", mgr_port.c_str(),
-          "--mgr-secret", mgr_secret.c_str(),
-          "--mgr-buf-addr", mgr_buf_addr.c_str(),
-          "--mgr-buf-rkey", mgr_buf_rkey.c_str(),
-          nullptr
-        };
-        int ret = execvp(argv[0], const_cast<char**>(&argv[0]));
-        if(ret == -1) {
-          spdlog::error("Executor process failed {}, reason {}", errno, strerror(errno));
-          close(fd);
-          exit(1);
-        }
-      } else {
-        std::string ip_arg = "--ip=" + exec.docker.ip;
-        std::string volume_arg = exec.docker.volume + ":/opt";
-        std::string net_arg = "--net=" + exec.docker.network;
-        std::string registry_port = std::to_string(exec.docker.registry_port);
-        std::string docker_image = exec.docker.registry_ip + ":" + registry_port
-            + "/" + exec.docker.image;
-
-        const char * argv[] = {
-          "docker_rdma_sriov", "run",
-          "--rm", "-i",
-          net_arg.c_str(),
-          ip_arg.c_str(),
-          "--volume", volume_arg.c_str(),
-          docker_image.c_str(),
-          "/opt/bin/executor",
-          "-a", client_addr.c_str(),
-          "-p", client_port.c_str(),
-          "--polling-mgr", "thread",
-          "-r", executor_repetitions.c_str(),
-          "-x", executor_recv_buf.c_str(),
-          "-s", client_in_size.c_str(),
-          "--pin-threads", executor_pin_threads.c_str(),
-          "--fast", client_cores.c_str(),
-          "--warmup-iters", executor_warmups.c_str(),
-          "--max-inline-data", executor_max_inline.c_str(),
-          "--func-size", client_func_size.c_str(),
-          "--timeout", client_timeout.c_str(),
-          "--mgr-address", conn.addr.c_str(),
-          "--mgr-port", mgr_port.c_str(),
-          "--mgr-secret", mgr_secret.c_str(),
-          "--mgr-buf-addr", mgr_buf_addr.c_str(),
-          "--mgr-buf-rkey", mgr_buf_rkey.c_str(),
-          nullptr
-        };
-        int ret = execvp(argv[0], const_cast<char**>(&argv[0]));
-        if(ret == -1) {
-          spdlog::error("Executor process failed {}, reason {}", errno, strerror(errno));
-          close(fd);
-          exit(1);
-        }
-
+      int ret = execvp(argv[0], const_cast<char**>(argv.data()));
+      if(ret == -1) {
+        spdlog::error("Executor process failed {}, reason {}", errno, strerror(errno));
+        close(fd);
+        exit(1);
       }
       //close(fd);
       exit(0);
     }
-    if(counter == 36)
-      counter = 0;
-    return new ProcessExecutor{request.cores, begin, mypid};
+    auto executor = new ProcessExecutor{request.cores, begin, mypid};
+    executor->cpus = cpus;
+    return executor;
   }
 
 }
-
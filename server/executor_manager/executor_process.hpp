@@ -4,6 +4,8 @@
 
 #include <memory>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include <rdmalib/connection.hpp>
 
@@ -20,19 +22,25 @@ namespace executor {
 namespace rfaas::executor_manager {
 
   struct ExecutorSettings;
+  struct ZygotePool;
+  struct ContainerPool;
 
   struct ActiveExecutor {
 
     enum class Status {
       RUNNING,
       FINISHED,
-      FINISHED_FAIL 
+      FINISHED_FAIL,
+      // Finished the allocation and waits for the next one
+      IDLE
     };
     typedef std::chrono::high_resolution_clock::time_point time_t;
     time_t _allocation_begin, _allocation_finished;
     rdmalib::Connection** connections;
     int connections_len;
     int cores;
+    // Cores reserved for the executor; empty when threads are not pinned
+    std::vector<int> cpus;
 
     ActiveExecutor(int cores):
       connections(new rdmalib::Connection*[cores]),
@@ -43,6 +51,12 @@ namespace rfaas::executor_manager {
     virtual ~ActiveExecutor();
     virtual int id() const = 0;
     virtual std::tuple<Status,int> check() const = 0;
+    // Becomes readable when the executor exits; -1 when it has to be polled with check.
+    virtual int exit_fd() const = 0;
+    // Asks the executor to leave the allocation; false when it can't be reused.
+    virtual bool release() const = 0;
+    // Hands over the control socket of a reusable executor, e.g., to the zygote pool.
+    virtual int detach() = 0;
   };
 
   // Ac actual process which can be spawned/is executing
@@ -50,18 +64,38 @@ namespace rfaas::executor_manager {
   struct ProcessExecutor : public ActiveExecutor
   {
     pid_t _pid;
+    // pidfd of the process, not supported before Linux 5.3
+    int _pidfd;
+    // Socket of a reusable executor, readable when it becomes idle or exits
+    int _control_fd;
 
-    ProcessExecutor(int cores, time_t alloc_begin, pid_t pid);
+    ProcessExecutor(int cores, time_t alloc_begin, pid_t pid, int control_fd = -1);
+    ~ProcessExecutor();
 
     // FIXME: kill active executor
-    //~ProcessExecutor();
     //void close();
     int id() const override;
     std::tuple<Status,int> check() const override;
+    int exit_fd() const override;
+    bool release() const override;
+    int detach() override;
+    // Command line of the executor, without the binary
+    static std::vector<std::string> arguments(
+      const rdmalib::AllocationRequest & request,
+      const ExecutorSettings & exec,
+      const executor::ManagerConnection & conn,
+      const std::vector<int> & cpus,
+      int numa_node
+    );
+    // Uses an idle zygote if available
     static ProcessExecutor* spawn(
       const rdmalib::AllocationRequest & request,
       const ExecutorSettings & exec,
-      const executor::ManagerConnection & conn
+      const executor::ManagerConnection & conn,
+      const std::vector<int> & cpus,
+      int numa_node,
+      ZygotePool * zygotes = nullptr,
+      ContainerPool * containers = nullptr
     );
   };
 
@@ -1,9 +1,13 @@
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstring>
 #include <thread>
 
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -11,6 +15,8 @@
 
 #include <rdmalib/connection.hpp>
 #include <rdmalib/allocation.hpp>
+#include <rdmalib/device.hpp>
+#include <rdmalib/util.hpp>
 
 #include "manager.hpp"
 #include "rdmalib/rdmalib.hpp"
@@ -20,23 +26,50 @@ namespace rfaas::executor_manager {
   constexpr int Manager::POLLING_TIMEOUT_MS;
 
   Manager::Manager(Settings & settings, bool skip_rm):
-    _q1(100), _q2(100),
     _ids(0),
+    _accounting(MAX_CLIENTS_ACTIVE),
+    _directory_entry(-1),
     _state(settings.device->ip_address, settings.rdma_device_port,
         settings.device->default_receive_buffer_size, true),
     _settings(settings),
+    _zygotes(settings.exec.docker.use_docker ? 0 : settings.exec.zygotes),
+    _containers(_settings.exec.docker),
     // FIXME: randomly generated
     _secret(0x1234),
     _skip_rm(skip_rm),
     _shutdown(false)
   {
+    _accounting.register_memory(_state.pd());
+    // Without a device, connections use TCP and software queues
+    ibv_context* context = _state.pd() ? _state.pd()->context : nullptr;
+    int receives = SHARD_RECEIVES;
+    if(context) {
+      ibv_device_attr attr;
+      rdmalib::impl::expect_zero(ibv_query_device(context, &attr));
+      receives = std::min({SHARD_RECEIVES, attr.max_srq_wr, attr.max_cqe});
+    }
+    for(int i = 0; i < _settings.poller_threads; ++i)
+      _shards.emplace_back(new PollerShard{i, _state.pd(), receives});
+    _shard_loads.resize(_shards.size());
+    // Probed once here instead of in every executor process.
+    if(_settings.exec.max_inline_data < 0 && context) {
+      _settings.exec.max_inline_data = rdmalib::device::max_inline_data(context);
+      spdlog::info("Executors use {} bytes of inline data", _settings.exec.max_inline_data);
+    }
+
+    if(_settings.exec.pin_threads)
+      _cores.initialize(context ? context->device : nullptr);
+    if(_settings.exec.zygotes > 0 && _settings.exec.docker.use_docker)
+      spdlog::warn("Zygote executors are not supported with Docker.");
+    _zygotes.replenish(true);
+    _containers.start();
     if(!_skip_rm) {
-      _res_mgr_connection = std::move(rdmalib::RDMAActive{
-        settings.resource_manager_address,
-        settings.resource_manager_port,
-        settings.device->default_receive_buffer_size
-      });
-      _res_mgr_connection.allocate();
+      _res_mgr_connection.reset(
+        new rfaas::resource_manager_connection{
+          settings.resource_manager_address,
+          settings.resource_manager_port
+        }
+      );
     }
   }
 
@@ -47,7 +80,6 @@ namespace rfaas::executor_manager {
 
   void Manager::start()
   {
-    rdmalib::RecvBuffer _rcv_buffer{32};
     if(!_skip_rm) {
       spdlog::info(
         "Connecting to resource manager at {}:{} with secret {}.",
@@ -55,28 +87,41 @@ namespace rfaas::executor_manager {
         _settings.resource_manager_port,
         _settings.resource_manager_secret
       );
-      if(!_res_mgr_connection.connect(_settings.resource_manager_secret)) {
+      if(!_res_mgr_connection->connect(_settings.resource_manager_secret)) {
         spdlog::error("Connection to resource manager was not succesful!");
         return;
       }
-      _rcv_buffer.connect(&_res_mgr_connection.connection());
+      // FIXME: managers registered later don't find their entry
+      if(_res_mgr_connection->query_directory()) {
+        const rdmalib::Directory & dir = _res_mgr_connection->read_directory();
+        for(int i = 0; i < dir.size; ++i)
+          if(dir.entries[i].cores && dir.entries[i].port == _settings.rdma_device_port &&
+              !strncmp(dir.entries[i].address, _settings.device->ip_address.c_str(), sizeof(dir.entries[i].address)))
+            _directory_entry = i;
+      }
+      if(_directory_entry == -1)
+        spdlog::warn("Executor manager is not in the directory, free cores are not published");
     }
 
     spdlog::info(
-      "Begin listening at {}:{} and processing events!",
+      "Begin listening at {}:{} and processing events with {} pollers!",
       _settings.device->ip_address,
-      _settings.rdma_device_port
+      _settings.rdma_device_port,
+      _shards.size()
     );
     std::thread listener(&Manager::listen, this);
-    std::thread rdma_poller(&Manager::poll_rdma, this);
+    for(auto & shard : _shards)
+      shard->_thread = std::thread(&Manager::poll_rdma, this, shard->_id);
 
     listener.join();
-    rdma_poller.join(); 
+    for(auto & shard : _shards)
+      shard->_thread.join();
+    _zygotes.close();
+    _containers.close();
   }
 
   void Manager::listen()
   {
-    // FIXME: sleep when there are no clients
     while(!_shutdown.load()) {
 
       bool result = _state.nonblocking_poll_events(POLLING_TIMEOUT_MS);
@@ -84,8 +129,11 @@ namespace rfaas::executor_manager {
         continue;
       spdlog::debug("[Manager-listen] Polled new rdmacm event");
 
+      // QPs of the next client use the queues of its shard.
+      // Executor connections never receive, and they can use any shard.
+      _state.share_queues(_shards[_ids % _shards.size()]->_queues);
       auto [conn, conn_status] = _state.poll_events(
-        false
+        true
       );
       spdlog::debug(
         "[Manager-listen] New rdmacm connection event - connection {}, status {}",
@@ -100,20 +148,26 @@ namespace rfaas::executor_manager {
         spdlog::debug("[Manager-listen] Disconnection on connection {}", fmt::ptr(conn));
         continue;
       }
-      // When client connects, we need to fill the receive queue with work requests before
-      // accepting connection. Otherwise, we could accept before we're ready to receive data.
+      // Receives of clients are already posted to the shared receive queue of the shard.
       else if(conn_status == rdmalib::ConnectionStatus::REQUESTED) {
         spdlog::debug("[Manager-listen] Requested new connection {}", fmt::ptr(conn));
         // FIXME: users sending their ID 
         if(!conn->private_data()) {
+          int slot = _accounting.allocate();
+          if(slot == -1) {
+            spdlog::error("Rejecting a client, all {} accounting records are in use", MAX_CLIENTS_ACTIVE);
+            _state.reject(conn);
+            continue;
+          }
           int pos = _ids++;
-          Client client{conn, _state.pd()};
+          Client client{conn, slot, _accounting.record(slot)};
           client._active = true;
+          // The shard must know the QP before the first request arrives.
+          PollerShard & shard = *_shards[pos % _shards.size()];
+          shard._new_clients.enqueue(std::make_pair(pos, std::move(client)));
           _state.accept(conn);
-          _q2.enqueue(std::make_pair(pos, std::move(client)));    
-
-          SPDLOG_DEBUG("send to another thread\n");
-          atomic_thread_fence(std::memory_order_release);
+          shard.wake();
+          SPDLOG_DEBUG("Client {} handed over to poller {}", pos, shard._id);
         } else
           _state.accept(conn);
         continue;
@@ -127,8 +181,9 @@ namespace rfaas::executor_manager {
           if((private_data & 0xFFFF ) == this->_secret) {
             int client = private_data >> 16;
             SPDLOG_DEBUG("Executor for client {}", client);
-            // FIXME: check it exists
-            _q1.enqueue(std::make_pair( client, conn ));    
+            PollerShard & shard = *_shards[client % _shards.size()];
+            shard._executors.enqueue(std::make_pair( client, conn ));
+            shard.wake();
           } else {
             spdlog::error("New connection's private data that we can't understand: {}", private_data);
           }
@@ -138,132 +193,345 @@ namespace rfaas::executor_manager {
     spdlog::info("Background thread stops waiting for rdmacm events.");
   }
 
-  void Manager::poll_rdma()
+  void Manager::release_executor(PollerShard & shard, ActiveExecutor & executor, bool reuse)
   {
-    // FIXME: sleep when there are no clients
-    bool active_clients = true;
-    while(active_clients && !_shutdown.load()) {
-      {
-        std::pair<int, rdmalib::Connection*>* p1 = _q1.peek();
-        if(p1){
-          int client = p1->first;
-          SPDLOG_DEBUG("Connected executor for client {}", client);
-          int pos = _clients.find(client)->second.executor->connections_len++;
-          _clients.find(client)->second.executor->connections[pos] = p1->second; 
-          _q1.pop();
-        }; 
-        std::pair<int,Client>* p2 = _q2.peek();
-        if(p2){
-          _clients.insert(std::make_pair(p2->first, std::move(p2->second)));
-          SPDLOG_DEBUG("Connected new client id {}", p2->first);
-          _q2.pop();
-        };  
+    if(executor.exit_fd() != -1)
+      shard.unwatch(executor.exit_fd());
+    int control_fd = executor.detach();
+    std::lock_guard<std::mutex> lock{_spawn_mutex};
+    _cores.release(executor.cpus);
+    _containers.release(executor.id());
+    update_directory(executor.cores);
+    if(control_fd != -1) {
+      if(reuse)
+        _zygotes.reuse(executor.id(), control_fd);
+      else {
+        // Executor exits once it finds the socket closed
+        close(control_fd);
+        _zygotes.lost();
       }
+    }
+  }
 
-      atomic_thread_fence(std::memory_order_acquire);
-      std::vector<std::map<int, Client>::iterator> removals;
-      for(auto it = _clients.begin(); it != _clients.end(); ++it) {
+  void Manager::update_directory(int cores)
+  {
+    if(_directory_entry != -1)
+      _res_mgr_connection->add_free_cores(_directory_entry, cores);
+  }
 
-        Client & client = it->second;
-        int i = it->first;
-        auto wcs = client.rcv_buffer.poll(false);
-        if(std::get<1>(wcs)) {
-          SPDLOG_DEBUG(
-            "Received at {}, work completions {}",
-            i, std::get<1>(wcs)
-          );
-          for(int j = 0; j < std::get<1>(wcs); ++j) {
-
-            auto wc = std::get<0>(wcs)[j];
-            if(wc.status != 0)
-              continue;
-            uint64_t id = wc.wr_id;
-            int16_t cores = client.allocation_requests.data()[id].cores;
-            char * client_address = client.allocation_requests.data()[id].listen_address;
-            int client_port = client.allocation_requests.data()[id].listen_port;
-
-            if(cores > 0) {
-              spdlog::info(
-                "Client {} requests executor with {} threads, it should connect to {}:{},"
-                "it should have buffer of size {}, func buffer {}, hot timeout {}",
-                i, client.allocation_requests.data()[id].cores,
-                client.allocation_requests.data()[id].listen_address,
-                client.allocation_requests.data()[id].listen_port,
-                client.allocation_requests.data()[id].input_buf_size,
-                client.allocation_requests.data()[id].func_buf_size,
-                client.allocation_requests.data()[id].hot_timeout
-              );
-              int secret = (i << 16) | (this->_secret & 0xFFFF);
-              uint64_t addr = client.accounting.address(); //+ sizeof(Accounting)*i;
-              // FIXME: Docker
-              auto now = std::chrono::high_resolution_clock::now();
-              client.executor.reset(
-                ProcessExecutor::spawn(
-                  client.allocation_requests.data()[id],
-                  _settings.exec,
-                  {
-                    _settings.device->ip_address,
-                    _settings.rdma_device_port,
-                    secret, addr, client.accounting.rkey()
-                  }
-                )
-              );
-              auto end = std::chrono::high_resolution_clock::now();
-              spdlog::info(
-                "Client {} at {}:{} has executor with {} ID and {} cores, time {} us",
-                i, client_address, client_port, client.executor->id(), cores,
-                std::chrono::duration_cast<std::chrono::microseconds>(end-now).count()
-              );
-            } else {
-              spdlog::info("Client {} disconnects", i);
-              if(client.executor) {
-                auto now = std::chrono::high_resolution_clock::now();
-                client.allocation_time +=
-                  std::chrono::duration_cast<std::chrono::microseconds>(
-                    now - client.executor->_allocation_finished
-                  ).count();
-              }
-              //client.disable(i, _accounting_data.data()[i]);
-              client.disable(i);
-              removals.push_back(it);
-              break;
-            }
-          }
-          //if(client.connection)
-          //  client.connection->poll_wc(rdmalib::QueueType::SEND, false);
+  void Manager::report_load(PollerShard & shard, std::chrono::steady_clock::time_point now)
+  {
+    if(_directory_entry == -1 || !_settings.load_report_interval)
+      return;
+
+    rdmalib::LoadReport load{};
+    load.clients = shard._clients.size();
+    load.requests = shard._allocations;
+    for(auto & [id, client] : shard._clients) {
+      if(client.executor) {
+        ++load.executors;
+        load.allocated_cores += client.executor->cores;
+      }
+      Accounting billing = client.billing();
+      load.hot_polling_time += billing.hot_polling_time;
+      load.execution_time += billing.execution_time;
+    }
+    for(auto & [fd, released] : shard._released) {
+      ++load.executors;
+      load.allocated_cores += released.executor->cores;
+    }
+    shard._allocations = 0;
+
+    std::lock_guard<std::mutex> lock{_spawn_mutex};
+    rdmalib::LoadReport & shard_load = _shard_loads[shard._id];
+    int requests = shard_load.requests;
+    shard_load = load;
+    shard_load.requests += requests;
+    if(now - _last_report < std::chrono::milliseconds{_settings.load_report_interval})
+      return;
+
+    rdmalib::LoadReport report{};
+    for(rdmalib::LoadReport & partial : _shard_loads) {
+      report.clients += partial.clients;
+      report.executors += partial.executors;
+      report.allocated_cores += partial.allocated_cores;
+      report.requests += partial.requests;
+      report.hot_polling_time += partial.hot_polling_time;
+      report.execution_time += partial.execution_time;
+      partial.requests = 0;
+    }
+    _res_mgr_connection->report_load(_directory_entry, report);
+    _last_report = now;
+  }
+
+  void Manager::poll_rdma(int shard_id)
+  {
+    PollerShard & shard = *_shards[shard_id];
+    std::array<epoll_event, PollerShard::MAX_EVENTS> events;
+    auto last_check = std::chrono::steady_clock::now();
+    while(!_shutdown.load()) {
+      shard.receive();
+
+      // Completions arriving between the last poll and the notification request
+      // would not generate an event - we poll once more before going to sleep.
+      bool idle = !poll_clients(shard);
+      if(idle) {
+        shard.notify();
+        idle = !poll_clients(shard);
+      }
+      int count = shard.wait(events.data(), idle ? POLLING_TIMEOUT_MS : 0);
+      for(int i = 0; i < count; ++i) {
+        uint64_t event = events[i].data.u64;
+        if(event == PollerShard::CQ_EVENT || event == PollerShard::HANDOFF_EVENT) {
+          shard.acknowledge(event);
+          continue;
         }
-        if(client.active()) {
-          client.rcv_buffer.refill();
-          if(client.executor) {
-            auto status = client.executor->check();
-            if(std::get<0>(status) != ActiveExecutor::Status::RUNNING) {
-              auto now = std::chrono::high_resolution_clock::now();
-              client.allocation_time +=
-                std::chrono::duration_cast<std::chrono::microseconds>(
-                  now - client.executor->_allocation_finished
-                ).count();
-              // FIXME: update global manager
-              spdlog::info(
-                "Executor at client {} exited, status {}, time allocated {} us, polling {} us, execution {} us",
-                i, std::get<1>(status), client.allocation_time,
-                client.accounting.data()[i].hot_polling_time,
-                client.accounting.data()[i].execution_time
-              );
-              client.executor.reset(nullptr);
-              spdlog::info("Finished cleanup");
-            }
-          }
+        if(event & PollerShard::RELEASED_EVENT) {
+          check_released(shard, static_cast<int>(event & ~PollerShard::RELEASED_EVENT));
+          continue;
+        }
+        auto it = shard._clients.find(static_cast<int>(event));
+        if(it != shard._clients.end())
+          check_executor(shard, it->first, it->second);
+      }
+
+      // Executors without pidfd and leases are checked periodically
+      auto now = std::chrono::steady_clock::now();
+      if(now - last_check >= std::chrono::milliseconds{POLLING_TIMEOUT_MS}) {
+        for(auto & [id, client] : shard._clients) {
+          if(client.executor && client.executor->exit_fd() == -1)
+            check_executor(shard, id, client);
+          if(client.lease_expired(now))
+            reclaim_executor(shard, id, client);
         }
+        report_load(shard, now);
+        last_check = now;
+      }
+    }
+    spdlog::info("Background thread {} stops processing RDMA events.", shard_id);
+    shard._clients.clear();
+  }
+
+  int Manager::poll_clients(PollerShard & shard)
+  {
+    auto [wcs, count] = shard.poll();
+    for(int j = 0; j < count; ++j) {
+
+      ibv_wc & wc = wcs[j];
+      // Failed completions have no opcode, and we send only lease notifications.
+      if(wc.wr_id == PollerShard::EXPIRY_ID)
+        continue;
+      if(wc.status == IBV_WC_SUCCESS && !(wc.opcode & IBV_WC_RECV))
+        continue;
+      // Client can send its request before the listener hands it over.
+      auto qp = shard._qps.find(wc.qp_num);
+      if(qp == shard._qps.end()) {
+        shard.receive();
+        qp = shard._qps.find(wc.qp_num);
       }
-      if(removals.size()) {
-        for(auto it : removals) {
+
+      // Completions flushed after the client disconnected have no client
+      if(qp != shard._qps.end() && wc.status == IBV_WC_SUCCESS) {
+        auto it = shard._clients.find(qp->second);
+        Client & client = it->second;
+        SPDLOG_DEBUG("Received at {}, request {}", it->first, wc.wr_id);
+        if(!process_request(shard, it->first, client, shard.request(wc.wr_id))) {
           spdlog::info("Remove client id {}", it->first);
-          _clients.erase(it);
+          shard._qps.erase(qp);
+          shard._clients.erase(it);
         }
       }
+      shard.repost(wc.wr_id);
+    }
+    shard.post_receives();
+    return count;
+  }
+
+  bool Manager::process_request(PollerShard & shard, int i, Client & client, const rdmalib::AllocationRequest & request)
+  {
+    int16_t cores = request.cores;
+
+    if(cores > 0) {
+      ++shard._allocations;
+      spdlog::info(
+        "Client {} requests executor with {} threads, it should connect to {}:{},"
+        "it should have buffer of size {}, func buffer {}, hot timeout {}",
+        i, request.cores,
+        request.listen_address,
+        request.listen_port,
+        request.input_buf_size,
+        request.func_buf_size,
+        request.hot_timeout
+      );
+      // The previous executor must leave before the next one takes over its billing record
+      // and cores: a reusable one returns to the pool, others are killed. Once it has
+      // finished, check_executor spawns the next one.
+      if(client.executor) {
+        // An expired lease has already reclaimed it
+        if(!client.pending_request && !client.reclaimed && !client.executor->release())
+          kill(client.executor->id(), SIGKILL);
+        client.pending_request = request;
+        return true;
+      }
+      spawn_executor(shard, i, client, request);
+      return true;
+    } else if(cores == 0) {
+      SPDLOG_DEBUG("Client {} renews its lease", i);
+      if(client.executor && !client.reclaimed)
+        client.renew_lease();
+      return true;
+    } else {
+      spdlog::info("Client {} disconnects", i);
+      bool released = false;
+      if(client.executor) {
+        auto now = std::chrono::high_resolution_clock::now();
+        client.allocation_time +=
+          std::chrono::duration_cast<std::chrono::microseconds>(
+            now - client.executor->_allocation_finished
+          ).count();
+        // Reusable executor stops its threads and reports back - no need to kill it.
+        // FIXME: billing of the released executor is reported separately
+        if(client.executor->release()) {
+          int fd = client.executor->exit_fd();
+          shard.unwatch(fd);
+          shard.watch(fd, PollerShard::RELEASED_EVENT | fd);
+          shard._released.emplace(
+            fd, PollerShard::ReleasedExecutor{i, client.accounting_slot, client.current, std::move(client.executor)}
+          );
+          released = true;
+        } else
+          release_executor(shard, *client.executor);
+      }
+      //client.disable(i, _accounting_data.data()[i]);
+      client.disable(i);
+      if(!released)
+        _accounting.release(client.accounting_slot);
+      return false;
+    }
+  }
+
+  void Manager::check_executor(PollerShard & shard, int i, Client & client)
+  {
+    if(!client.executor)
+      return;
+    auto status = client.executor->check();
+    if(std::get<0>(status) == ActiveExecutor::Status::RUNNING)
+      return;
+    bool idle = std::get<0>(status) == ActiveExecutor::Status::IDLE;
+
+    auto now = std::chrono::high_resolution_clock::now();
+    client.allocation_time +=
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        now - client.executor->_allocation_finished
+      ).count();
+    // FIXME: update global manager
+    // The executor waits for its final billing write before exiting or becoming idle.
+    client.collect_billing();
+    spdlog::info(
+      "Executor at client {} {}, status {}, time allocated {} us, polling {} us, execution {} us",
+      i, idle ? "returns to the pool" : "exited", std::get<1>(status), client.allocation_time,
+      client.billed.hot_polling_time,
+      client.billed.execution_time
+    );
+    release_executor(shard, *client.executor, idle);
+    client.executor.reset(nullptr);
+    spdlog::info("Finished cleanup");
+
+    // The client allocated again while the executor was leaving
+    if(client.pending_request) {
+      rdmalib::AllocationRequest request = *client.pending_request;
+      client.pending_request.reset();
+      spawn_executor(shard, i, client, request);
+    }
+  }
+
+  void Manager::spawn_executor(PollerShard & shard, int i, Client & client, const rdmalib::AllocationRequest & request)
+  {
+    int16_t cores = request.cores;
+    const char * client_address = request.listen_address;
+    int client_port = request.listen_port;
+    int secret = (i << 16) | (this->_secret & 0xFFFF);
+    uint64_t addr = _accounting.address(client.accounting_slot);
+    // FIXME: Docker
+    auto now = std::chrono::high_resolution_clock::now();
+    auto end = now;
+    {
+      std::lock_guard<std::mutex> lock{_spawn_mutex};
+      // Dedicated pollers need their own cores
+      int numa_node = -1;
+      std::vector<int> cpus;
+      if(_settings.exec.pin_threads) {
+        cpus = _cores.allocate(cores + std::min<int>(_settings.exec.pollers, cores), numa_node);
+        if(cpus.empty())
+          spdlog::warn("Not enough free cores for client {}, executor threads are not pinned", i);
+      }
+      client.executor.reset(
+        ProcessExecutor::spawn(
+          request,
+          _settings.exec,
+          {
+            _settings.device->ip_address,
+            _settings.rdma_device_port,
+            secret, addr, _accounting.rkey()
+          },
+          cpus, numa_node, &_zygotes, &_containers
+        )
+      );
+      end = std::chrono::high_resolution_clock::now();
+      update_directory(-cores);
+      // Replace the zygote used by the allocation
+      _zygotes.replenish();
     }
-    spdlog::info("Background thread stops processing RDMA events.");
-    _clients.clear();
+    if(client.executor->exit_fd() != -1)
+      shard.watch(client.executor->exit_fd(), i);
+    // Clients can only shorten the lease
+    int lease = _settings.lease_timeout;
+    if(lease > 0 && request.timeout > 0)
+      lease = std::min<int>(lease, request.timeout);
+    client.lease_timeout = std::chrono::seconds{lease};
+    client.renew_lease();
+    spdlog::info(
+      "Client {} at {}:{} has executor with {} ID and {} cores, lease {} s, time {} us",
+      i, client_address, client_port, client.executor->id(), cores, lease,
+      std::chrono::duration_cast<std::chrono::microseconds>(end-now).count()
+    );
+  }
+
+  void Manager::reclaim_executor(PollerShard & shard, int i, Client & client)
+  {
+    spdlog::info(
+      "Lease of client {} expired after {} s without invocations, reclaiming executor {}",
+      i, client.lease_timeout.count(), client.executor->id()
+    );
+    client.reclaimed = true;
+    // Reusable executor stops and returns to the pool; check_executor releases the cores.
+    if(!client.executor->release())
+      kill(client.executor->id(), SIGKILL);
+    shard.send_expiry(*client.connection);
+  }
+
+  void Manager::check_released(PollerShard & shard, int control_fd)
+  {
+    auto it = shard._released.find(control_fd);
+    if(it == shard._released.end())
+      return;
+    PollerShard::ReleasedExecutor & released = it->second;
+    auto status = released.executor->check();
+    if(std::get<0>(status) == ActiveExecutor::Status::RUNNING)
+      return;
+
+    bool idle = std::get<0>(status) == ActiveExecutor::Status::IDLE;
+    Accounting & billing = released.billing;
+    if(!Accounting::read(*_accounting.record(released.accounting_slot), billing))
+      spdlog::warn("Billing record {} stays torn, using its last consistent snapshot", released.accounting_slot);
+    spdlog::info(
+      "Released executor {} of client {} {}, polling {} us, execution {} us",
+      released.executor->id(), released.client, idle ? "returns to the pool" : "exited",
+      billing.hot_polling_time, billing.execution_time
+    );
+    release_executor(shard, *released.executor, idle);
+    _accounting.release(released.accounting_slot);
+    shard._released.erase(it);
   }
 
   //void Manager::poll_rdma()
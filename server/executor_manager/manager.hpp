@@ -8,6 +8,7 @@
 #include <vector>
 #include <mutex>
 #include <map>
+#include <memory>
 
 #include <rdmalib/connection.hpp>
 #include <rdmalib/rdmalib.hpp>
@@ -15,7 +16,13 @@
 #include <rdmalib/buffer.hpp>
 #include <rdmalib/recv_buffer.hpp>
 
+#include <rfaas/connection.hpp>
+
 #include "client.hpp"
+#include "core_allocator.hpp"
+#include "poller_shard.hpp"
+#include "zygote.hpp"
+#include "container_pool.hpp"
 #include "settings.hpp"
 #include "../common.hpp"
 #include "../common/readerwriterqueue.h"
@@ -36,26 +43,33 @@ namespace rfaas::executor_manager {
 
   struct Manager
   {
-    // FIXME: we need a proper data structure that is thread-safe and scales
     //static constexpr int MAX_CLIENTS_ACTIVE = 128;
     static constexpr int MAX_EXECUTORS_ACTIVE = 8;
-    static constexpr int MAX_CLIENTS_ACTIVE = 1024;
+    static constexpr int MAX_CLIENTS_ACTIVE = 16384;
+    // Receives posted at once by a single shard
+    static constexpr int SHARD_RECEIVES = 512;
     static constexpr int POLLING_TIMEOUT_MS = 100;
-    moodycamel::ReaderWriterQueue<std::pair<int, rdmalib::Connection*>> _q1;
-    moodycamel::ReaderWriterQueue<std::pair<int, Client>> _q2;
 
-    std::mutex clients;
-    std::map<int, Client> _clients;
+    // Client i is served by the shard i % shards
+    std::vector<std::unique_ptr<PollerShard>> _shards;
     int _ids;
+    AccountingTable _accounting;
 
-    //std::vector<Client> _clients;
-    //std::atomic<int> _clients_active;
-    rdmalib::RDMAActive _res_mgr_connection;
-    //std::unique_ptr<rdmalib::Connection> _res_mgr_connection;
+    std::unique_ptr<rfaas::resource_manager_connection> _res_mgr_connection;
+    // Our entry in the executor directory of the resource manager, -1 when not registered
+    int _directory_entry;
+    // Latest load of each shard, summed into reports; guarded by the spawn lock
+    std::vector<rdmalib::LoadReport> _shard_loads;
+    std::chrono::steady_clock::time_point _last_report;
 
     rdmalib::RDMAPassive _state;
     //rdmalib::server::ServerStatus _status;
     Settings _settings;
+    // Shards allocate cores and start executors under the lock
+    std::mutex _spawn_mutex;
+    CoreAllocator _cores;
+    ZygotePool _zygotes;
+    ContainerPool _containers;
     //rdmalib::Buffer<Accounting> _accounting_data;
     uint32_t _secret;
     bool _skip_rm;
@@ -65,7 +79,24 @@ namespace rfaas::executor_manager {
 
     void start();
     void listen();
-    void poll_rdma();
+    void poll_rdma(int shard_id);
+    // Returns the number of processed completions.
+    int poll_clients(PollerShard & shard);
+    // Returns false when the client has disconnected.
+    bool process_request(PollerShard & shard, int id, Client & client, const rdmalib::AllocationRequest & request);
+    void check_executor(PollerShard & shard, int id, Client & client);
+    // The previous executor of the client must have finished.
+    void spawn_executor(PollerShard & shard, int id, Client & client, const rdmalib::AllocationRequest & request);
+    void check_released(PollerShard & shard, int control_fd);
+    // Lease has expired - cores return to the pool once the executor finishes.
+    void reclaim_executor(PollerShard & shard, int id, Client & client);
+    // Returns cores and the container of a finished executor.
+    // A reusable executor goes back to the zygote pool, or it's closed.
+    void release_executor(PollerShard & shard, ActiveExecutor & executor, bool reuse = false);
+    // Publishes a change of free cores in the directory; caller holds the spawn lock.
+    void update_directory(int cores);
+    // Shards update their load periodically, and one of them sends the report.
+    void report_load(PollerShard & shard, std::chrono::steady_clock::time_point now);
     void shutdown();
   };
 
@@ -0,0 +1,186 @@
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/util.hpp>
+
+#include "poller_shard.hpp"
+
+namespace rfaas::executor_manager {
+
+  constexpr uint64_t PollerShard::CQ_EVENT;
+  constexpr uint64_t PollerShard::HANDOFF_EVENT;
+  constexpr uint64_t PollerShard::RELEASED_EVENT;
+  constexpr int32_t PollerShard::EXPIRY_ID;
+
+  PollerShard::PollerShard(int id, ibv_pd* pd, int receives):
+    _id(id),
+    _queues(pd, receives, receives),
+    _requests(receives),
+    _reposts(0),
+    _expiry(1),
+    _epoll_fd(-1),
+    _event_fd(-1),
+    _executors(100),
+    _new_clients(100),
+    _allocations(0)
+  {
+    rdmalib::impl::expect_nonnegative(_epoll_fd = epoll_create1(EPOLL_CLOEXEC));
+    rdmalib::impl::expect_nonnegative(_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = CQ_EVENT;
+    rdmalib::impl::expect_zero(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _queues.fd(), &event));
+    event.data.u64 = HANDOFF_EVENT;
+    rdmalib::impl::expect_zero(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &event));
+    notify();
+
+    _requests.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+    for(int i = 0; i < receives; ++i)
+      repost(i);
+    post_receives();
+    *_expiry.data() = rdmalib::AllocationRequest{};
+    _expiry.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+    spdlog::info("Poller shard {} receives {} requests at once", _id, receives);
+  }
+
+  PollerShard::~PollerShard()
+  {
+    _clients.clear();
+    _released.clear();
+    if(_epoll_fd != -1)
+      close(_epoll_fd);
+    if(_event_fd != -1)
+      close(_event_fd);
+  }
+
+  void PollerShard::wake()
+  {
+    uint64_t value = 1;
+    if(write(_event_fd, &value, sizeof(value)) != sizeof(value))
+      spdlog::error("Couldn't wake up poller shard {}, reason {}", _id, strerror(errno));
+  }
+
+  void PollerShard::receive()
+  {
+    while(std::pair<int, Client>* p = _new_clients.peek()) {
+      _qps[p->second.connection->qp_num()] = p->first;
+      _clients.insert(std::make_pair(p->first, std::move(p->second)));
+      SPDLOG_DEBUG("Poller shard {} connected new client id {}", _id, p->first);
+      _new_clients.pop();
+    }
+    while(std::pair<int, rdmalib::Connection*>* p = _executors.peek()) {
+      auto it = _clients.find(p->first);
+      if(it != _clients.end() && it->second.executor) {
+        SPDLOG_DEBUG("Connected executor for client {}", p->first);
+        ActiveExecutor & executor = *it->second.executor;
+        executor.connections[executor.connections_len++] = p->second;
+      } else
+        spdlog::error("Executor connected for client {} without an active executor", p->first);
+      _executors.pop();
+    }
+  }
+
+  int PollerShard::wait(epoll_event* events, int timeout_ms)
+  {
+    int count = epoll_wait(_epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if(count < 0) {
+      if(errno != EINTR)
+        spdlog::error("Poller shard {} failed to wait for events, reason {}", _id, strerror(errno));
+      return 0;
+    }
+    return count;
+  }
+
+  void PollerShard::acknowledge(uint64_t event)
+  {
+    if(event == CQ_EVENT)
+      _queues.acknowledge();
+    else if(event == HANDOFF_EVENT) {
+      uint64_t value;
+      [[maybe_unused]] ssize_t ret = read(_event_fd, &value, sizeof(value));
+    }
+  }
+
+  void PollerShard::notify()
+  {
+    _queues.notify();
+  }
+
+  std::tuple<ibv_wc*, int> PollerShard::poll()
+  {
+    int ret = _queues.poll(WC_BATCH, _wcs.data());
+    if(ret < 0) {
+      spdlog::error("Poller shard {} failed to poll its CQ, return value {}, errno {}", _id, ret, errno);
+      return std::make_tuple(nullptr, 0);
+    }
+    for(int i = 0; i < ret; ++i)
+      if(_wcs[i].status != IBV_WC_SUCCESS)
+        spdlog::error(
+          "Poller shard {} Work Completion {}/{} of QP {} finished with an error {}, {}",
+          _id, i+1, ret, _wcs[i].qp_num, _wcs[i].status, ibv_wc_status_str(_wcs[i].status)
+        );
+    return std::make_tuple(_wcs.data(), ret);
+  }
+
+  const rdmalib::AllocationRequest & PollerShard::request(uint64_t slot) const
+  {
+    return _requests.data()[slot];
+  }
+
+  void PollerShard::repost(uint64_t slot)
+  {
+    if(_reposts == WC_BATCH)
+      post_receives();
+    ibv_sge & sge = _recv_sges[_reposts];
+    sge.addr = _requests.address() + slot * sizeof(rdmalib::AllocationRequest);
+    sge.length = sizeof(rdmalib::AllocationRequest);
+    sge.lkey = _requests.lkey();
+    ibv_recv_wr & wr = _recv_wrs[_reposts];
+    wr.wr_id = slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.next = nullptr;
+    if(_reposts)
+      _recv_wrs[_reposts - 1].next = &wr;
+    ++_reposts;
+  }
+
+  void PollerShard::post_receives()
+  {
+    if(!_reposts)
+      return;
+    ibv_recv_wr* bad = nullptr;
+    int ret = _queues.post_recv(_recv_wrs.data(), &bad);
+    if(ret)
+      spdlog::error("Poller shard {} failed to post {} receives, reason {}", _id, _reposts, strerror(ret));
+    _reposts = 0;
+  }
+
+  void PollerShard::send_expiry(rdmalib::Connection & conn)
+  {
+    // Completion is ignored by the poller
+    conn.post_send(_expiry, EXPIRY_ID);
+  }
+
+  void PollerShard::watch(int fd, uint64_t tag)
+  {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = tag;
+    if(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event))
+      spdlog::error("Poller shard {} can't watch executor with tag {}, reason {}", _id, tag, strerror(errno));
+  }
+
+  void PollerShard::unwatch(int fd)
+  {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+}
+
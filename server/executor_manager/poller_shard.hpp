@@ -0,0 +1,108 @@
+
+#ifndef __SERVER_EXECUTOR_MANAGER_POLLER_SHARD_HPP__
+#define __SERVER_EXECUTOR_MANAGER_POLLER_SHARD_HPP__
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+#include <infiniband/verbs.h>
+#include <sys/epoll.h>
+
+#include <rdmalib/allocation.hpp>
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/shared_queues.hpp>
+
+#include "client.hpp"
+#include "../common/readerwriterqueue.h"
+
+namespace rfaas::executor_manager {
+
+  // Clients served by a single polling thread.
+  // QPs of all clients complete into one CQ with a completion channel, and the thread
+  // sleeps in epoll until it receives completions, executor exits, or new connections.
+  // Allocation requests of all clients arrive through a shared receive queue, into
+  // a single registered slab - the work request ID is the index of a slab entry.
+  // Only the listener enqueues connections, and only the owner thread uses the rest.
+  struct PollerShard {
+
+    static constexpr int MAX_EVENTS = 32;
+    static constexpr int WC_BATCH = 32;
+    // Tags of epoll events; other events carry the client id of an exiting executor,
+    // or the control socket of a released executor.
+    static constexpr uint64_t CQ_EVENT = UINT64_MAX;
+    static constexpr uint64_t HANDOFF_EVENT = UINT64_MAX - 1;
+    static constexpr uint64_t RELEASED_EVENT = 1ull << 32;
+    // Work request ID of lease notifications, the only messages sent to clients
+    static constexpr int32_t EXPIRY_ID = INT32_MAX;
+
+    // Executor of a disconnected client that finishes before returning to the pool.
+    // It keeps the accounting record of the client until its final billing has arrived.
+    struct ReleasedExecutor {
+      int client;
+      int accounting_slot;
+      // Last consistent snapshot of the record
+      Accounting billing;
+      std::unique_ptr<ActiveExecutor> executor;
+    };
+
+    int _id;
+    rdmalib::SharedQueues _queues;
+    rdmalib::Buffer<rdmalib::AllocationRequest> _requests;
+    // Receives reposted after processing the current batch
+    std::array<ibv_recv_wr, WC_BATCH> _recv_wrs;
+    std::array<ibv_sge, WC_BATCH> _recv_sges;
+    int _reposts;
+    // Allocation request with zero cores
+    rdmalib::Buffer<rdmalib::AllocationRequest> _expiry;
+    int _epoll_fd;
+    // Signalled by the listener after it enqueues a connection.
+    int _event_fd;
+    moodycamel::ReaderWriterQueue<std::pair<int, rdmalib::Connection*>> _executors;
+    moodycamel::ReaderWriterQueue<std::pair<int, Client>> _new_clients;
+    std::map<int, Client> _clients;
+    // QP number -> client id
+    std::unordered_map<uint32_t, int> _qps;
+    // Control socket -> executor
+    std::unordered_map<int, ReleasedExecutor> _released;
+    // Allocation requests since the last load report
+    int _allocations;
+    std::array<ibv_wc, WC_BATCH> _wcs;
+    std::thread _thread;
+
+    // The CQ can hold completions of all posted receives.
+    PollerShard(int id, ibv_pd* pd, int receives);
+    ~PollerShard();
+    PollerShard(const PollerShard&) = delete;
+    PollerShard& operator=(const PollerShard&) = delete;
+
+    // Listener only
+    void wake();
+    // Takes all connections handed over by the listener.
+    void receive();
+    // Returns the number of events, at most MAX_EVENTS.
+    int wait(epoll_event* events, int timeout_ms);
+    // Consumes the notification of the completion channel or of the listener.
+    void acknowledge(uint64_t event);
+    // Completions arriving after this call wake up the thread.
+    void notify();
+    std::tuple<ibv_wc*, int> poll();
+    const rdmalib::AllocationRequest & request(uint64_t slot) const;
+    // The request has been processed - its entry can receive again.
+    void repost(uint64_t slot);
+    void post_receives();
+    // Tells the client that its executor is being reclaimed.
+    void send_expiry(rdmalib::Connection & conn);
+    void watch(int fd, uint64_t tag);
+    void unwatch(int fd);
+  };
+
+}
+
+#endif
+
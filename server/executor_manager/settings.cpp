@@ -1,6 +1,8 @@
 
 #include <spdlog/spdlog.h>
 
+#include <rdmalib/buffer.hpp>
+
 #include "settings.hpp"
 
 namespace rfaas::executor_manager {
@@ -19,10 +21,34 @@ namespace rfaas::executor_manager {
       throw std::runtime_error{"Unknown device!"};
     }
     settings.device = dev;
+    if(settings.poller_threads < 1) {
+      spdlog::error("At least one poller thread is required, got {}", settings.poller_threads);
+      throw std::runtime_error{"Incorrect number of poller threads!"};
+    }
+    if(settings.lease_timeout < 0) {
+      spdlog::error("Lease timeout can't be negative, got {}", settings.lease_timeout);
+      throw std::runtime_error{"Incorrect lease timeout!"};
+    }
+    // Activity of executors is visible only in their billing updates
+    if(settings.lease_timeout > 0 && (
+      settings.exec.billing_interval <= 0 || settings.exec.billing_interval >= settings.lease_timeout * 1000
+    )) {
+      spdlog::error(
+        "Leases require billing updates more frequent than the lease timeout, got billing interval {} ms and lease {} s",
+        settings.exec.billing_interval, settings.lease_timeout
+      );
+      throw std::runtime_error{"Incorrect billing interval!"};
+    }
+    if(settings.load_report_interval < 0) {
+      spdlog::error("Load report interval can't be negative, got {}", settings.load_report_interval);
+      throw std::runtime_error{"Incorrect load report interval!"};
+    }
 
     // executor options
     settings.exec.max_inline_data = dev->max_inline_data;
     settings.exec.recv_buffer_size = dev->default_receive_buffer_size;
+    // Fail early on unknown page size
+    rdmalib::page_size(settings.exec.page_size);
 
     return settings;
   }
@@ -8,6 +8,7 @@
 #include <rfaas/devices.hpp>
 
 #include <cereal/details/helpers.hpp>
+#include <cereal/types/vector.hpp>
 
 namespace rfaas::executor_manager {
 
@@ -20,6 +21,8 @@ namespace rfaas::executor_manager {
     std::string volume;
     std::string registry_ip;
     int registry_port;
+    // IPs of pre-started executor containers; empty disables the pool
+    std::vector<std::string> pool_ips;
 
     template <class Archive>
     void load(Archive & ar)
@@ -28,7 +31,8 @@ namespace rfaas::executor_manager {
         CEREAL_NVP(use_docker), CEREAL_NVP(image),
         CEREAL_NVP(network), CEREAL_NVP(ip),
         CEREAL_NVP(volume),
-        CEREAL_NVP(registry_ip), CEREAL_NVP(registry_port)
+        CEREAL_NVP(registry_ip), CEREAL_NVP(registry_port),
+        CEREAL_NVP(pool_ips)
       );
     }
   };
@@ -40,6 +44,19 @@ namespace rfaas::executor_manager {
     int recv_buffer_size;
     int max_inline_data;
     bool pin_threads;
+    bool work_stealing;
+    // Dedicated poller threads; 0 - each thread polls itself
+    int pollers;
+    // Interval of billing updates from the executor, in ms
+    int billing_interval;
+    // Pages of executor buffers: default, thp, 2mb, 1gb
+    std::string page_size;
+    // Input buffers of executors are not pinned; falls back to pinning without device support
+    bool on_demand_paging;
+    // Pre-started executor processes; 0 disables the pool
+    int zygotes;
+    // Executors started from zygotes return to the pool after an allocation
+    bool reuse_executors;
 
     struct DockerSettings docker;
 
@@ -48,7 +65,11 @@ namespace rfaas::executor_manager {
     {
       ar(
         CEREAL_NVP(docker), CEREAL_NVP(repetitions),
-        CEREAL_NVP(warmup_iters), CEREAL_NVP(pin_threads)
+        CEREAL_NVP(warmup_iters), CEREAL_NVP(pin_threads),
+        CEREAL_NVP(work_stealing), CEREAL_NVP(pollers),
+        CEREAL_NVP(billing_interval), CEREAL_NVP(page_size),
+        CEREAL_NVP(on_demand_paging),
+        CEREAL_NVP(zygotes), CEREAL_NVP(reuse_executors)
       );
     }
   };
@@ -60,11 +81,18 @@ namespace rfaas::executor_manager {
     std::string rdma_device;
     int rdma_device_port;
     rfaas::device_data* device;
+    // Threads polling client connections; clients are distributed round-robin
+    int poller_threads;
+    // Default and maximal lease of an executor in seconds; 0 disables expiry.
+    // Otherwise, billing updates must be sent more often than the lease runs out.
+    int lease_timeout;
 
     // resource manager connection
     std::string resource_manager_address;
     int resource_manager_port;
     int resource_manager_secret;
+    // Milliseconds between load reports sent to the resource manager; 0 disables them
+    int load_report_interval;
 
     // Passed to the scheduled executor
     ExecutorSettings exec;
@@ -74,8 +102,9 @@ namespace rfaas::executor_manager {
     {
       ar(
         CEREAL_NVP(rdma_device), CEREAL_NVP(rdma_device_port),
+        CEREAL_NVP(poller_threads), CEREAL_NVP(lease_timeout),
         CEREAL_NVP(resource_manager_address), CEREAL_NVP(resource_manager_port),
-        CEREAL_NVP(resource_manager_secret)
+        CEREAL_NVP(resource_manager_secret), CEREAL_NVP(load_report_interval)
       );
     }
 
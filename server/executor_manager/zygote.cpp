@@ -0,0 +1,142 @@
+
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <spdlog/spdlog.h>
+
+#include "zygote.hpp"
+
+namespace rfaas::executor_manager {
+
+  ZygotePool::ZygotePool(int size):
+    _lent(0),
+    _size(size)
+  {}
+
+  ZygotePool::~ZygotePool()
+  {
+    close();
+  }
+
+  void ZygotePool::close()
+  {
+    for(auto & zygote : _idle) {
+      ::close(zygote.fd);
+      waitpid(zygote.pid, nullptr, 0);
+    }
+    _idle.clear();
+  }
+
+  void ZygotePool::replenish(bool all)
+  {
+    while(static_cast<int>(_idle.size()) + _lent < _size) {
+
+      int fds[2];
+      if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        spdlog::error("Zygote socket creation failed, reason {}", strerror(errno));
+        return;
+      }
+      // Executors started later must not inherit our end.
+      fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+      pid_t pid = fork();
+      if(pid < 0) {
+        spdlog::error("Fork failed! {}", pid);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return;
+      }
+
+      if(pid == 0) {
+        auto out_file = ("executor_" + std::to_string(getpid()));
+        int fd = open(out_file.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        std::string zygote_fd = std::to_string(fds[0]);
+        const char * argv[] = {
+          "executor", "--zygote", zygote_fd.c_str(), nullptr
+        };
+        int ret = execvp(argv[0], const_cast<char**>(&argv[0]));
+        if(ret == -1) {
+          spdlog::error("Executor process failed {}, reason {}", errno, strerror(errno));
+          ::close(fd);
+          exit(1);
+        }
+        exit(0);
+      }
+
+      ::close(fds[0]);
+      _idle.push_back({pid, fds[1]});
+      SPDLOG_DEBUG("Started zygote {}, idle zygotes {}", pid, _idle.size());
+      if(!all)
+        break;
+    }
+  }
+
+  void ZygotePool::reuse(pid_t pid, int fd)
+  {
+    --_lent;
+    _idle.push_back({pid, fd});
+    SPDLOG_DEBUG("Executor {} returned to the pool, idle zygotes {}", pid, _idle.size());
+  }
+
+  void ZygotePool::lost()
+  {
+    --_lent;
+  }
+
+  bool ZygotePool::send_arguments(int fd, const std::vector<std::string> & args)
+  {
+    std::string data;
+    for(size_t i = 0; i < args.size(); ++i) {
+      if(i)
+        data += '\0';
+      data += args[i];
+    }
+    uint32_t len = data.size();
+    // Small message fits into the socket buffer - sends do not block.
+    // A dead zygote must not raise SIGPIPE in the manager.
+    return send(fd, &len, sizeof(len), MSG_NOSIGNAL) == sizeof(len) &&
+      send(fd, data.data(), len, MSG_NOSIGNAL) == static_cast<ssize_t>(len);
+  }
+
+  pid_t ZygotePool::start(const std::vector<std::string> & args, int * control_fd)
+  {
+    while(!_idle.empty()) {
+
+      Zygote zygote = _idle.back();
+      _idle.pop_back();
+
+      // The zygote might have died while waiting.
+      if(waitpid(zygote.pid, nullptr, WNOHANG) != 0) {
+        spdlog::warn("Zygote {} is not alive anymore", zygote.pid);
+        ::close(zygote.fd);
+        continue;
+      }
+
+      bool written = send_arguments(zygote.fd, args);
+      if(!written) {
+        spdlog::warn("Zygote {} did not accept the allocation, reason {}", zygote.pid, strerror(errno));
+        ::close(zygote.fd);
+        kill(zygote.pid, SIGKILL);
+        waitpid(zygote.pid, nullptr, 0);
+        continue;
+      }
+      if(control_fd) {
+        *control_fd = zygote.fd;
+        ++_lent;
+      } else
+        ::close(zygote.fd);
+      return zygote.pid;
+    }
+    return -1;
+  }
+
+}
@@ -0,0 +1,50 @@
+
+#ifndef __SERVER_EXECUTOR_MANAGER_ZYGOTE_HPP__
+#define __SERVER_EXECUTOR_MANAGER_ZYGOTE_HPP__
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace rfaas::executor_manager {
+
+  // Executor processes started ahead of allocations.
+  // A zygote has finished process and RDMA device initialization,
+  // and it waits for the command line of an allocation on a Unix socket.
+  // Not thread-safe - poller threads use the pool under the spawn lock of the manager.
+  struct ZygotePool {
+
+    struct Zygote {
+      pid_t pid;
+      // Our end of the socket pair
+      int fd;
+    };
+
+    std::vector<Zygote> _idle;
+    // Reusable executors running an allocation; they count towards the pool size.
+    int _lent;
+    int _size;
+
+    ZygotePool(int size = 0);
+    ~ZygotePool();
+
+    // Starts a single zygote, or fills the entire pool.
+    // The polling loop replenishes one at a time to avoid stalls.
+    void replenish(bool all = false);
+    // Returns PID of the executor, or -1 when no zygote is available.
+    // With control_fd, our end of the socket stays open and the executor can be reused.
+    pid_t start(const std::vector<std::string> & args, int * control_fd = nullptr);
+    // The executor has finished its allocation and waits on the socket.
+    void reuse(pid_t pid, int fd);
+    // The reusable executor has exited or has been killed.
+    void lost();
+    // Idle zygotes exit when their socket is closed.
+    void close();
+    // Message is a 32-bit length followed by NUL-separated arguments.
+    static bool send_arguments(int fd, const std::vector<std::string> & args);
+  };
+
+}
+
+#endif
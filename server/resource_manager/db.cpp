@@ -1,48 +1,393 @@
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <stdexcept>
 
+#include <infiniband/verbs.h>
 #include <spdlog/spdlog.h>
 
+#include <rdmalib/allocation.hpp>
+
 #include "db.hpp"
 
 namespace rfaas { namespace resource_manager {
 
-  ExecutorDB::ResultCode ExecutorDB::add(const std::string & ip_address, int port, int cores)
+  namespace {
+
+    constexpr int MAX_READERS = 256;
+
+    // Epoch observed by a thread when it pinned a snapshot; zero outside of reads.
+    struct alignas(64) ReaderEpoch
+    {
+      std::atomic<uint64_t> epoch{0};
+      std::atomic<bool> used{false};
+    };
+
+    // Shared by all databases - a reader pinning one of them delays reclamation in others.
+    std::atomic<uint64_t> global_epoch{1};
+    std::array<ReaderEpoch, MAX_READERS> reader_epochs;
+
+    // Claimed by a thread on its first read, and returned when the thread exits.
+    struct ReaderSlot
+    {
+      ReaderEpoch* epoch;
+      int depth;
+
+      ReaderSlot():
+        epoch(nullptr),
+        depth(0)
+      {
+        for(ReaderEpoch & reader : reader_epochs) {
+          bool expected = false;
+          if(reader.used.compare_exchange_strong(expected, true)) {
+            epoch = &reader;
+            return;
+          }
+        }
+        spdlog::error("Executor database supports only {} reader threads", MAX_READERS);
+        throw std::runtime_error{"Too many reader threads!"};
+      }
+
+      ~ReaderSlot()
+      {
+        epoch->used.store(false, std::memory_order_release);
+      }
+    };
+
+    ReaderSlot & reader_slot()
+    {
+      thread_local ReaderSlot slot;
+      return slot;
+    }
+
+    int64_t timestamp()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+      ).count();
+    }
+
+  }
+
+  int ExecutorDB::Snapshot::find(const std::string & ip_address) const
   {
-    // Obtain write access
-    writer_lock_t lock(_mutex);
-    _data._data.emplace_back(ip_address, port, cores);
+    for(size_t i = 0; i < servers.size(); ++i)
+      if(servers[i].cores > 0 && ip_address == servers[i].address)
+        return i;
+    return -1;
+  }
+
+  ExecutorDB::ReadGuard::ReadGuard(const ExecutorDB & db)
+  {
+    ReaderSlot & slot = reader_slot();
+    // Sequentially consistent - the writer either sees our epoch, or we see its snapshot.
+    if(!slot.depth++)
+      slot.epoch->epoch.store(global_epoch.load());
+    _snapshot = db._snapshot.load();
+  }
+
+  ExecutorDB::ReadGuard::~ReadGuard()
+  {
+    ReaderSlot & slot = reader_slot();
+    if(!--slot.depth)
+      slot.epoch->epoch.store(0, std::memory_order_release);
+  }
+
+  ExecutorDB::ExecutorDB(int heartbeat_timeout):
+    _snapshot(new Snapshot{}),
+    _heartbeat_timeout(heartbeat_timeout),
+    _directory(1),
+    _loads(rdmalib::Directory::CAPACITY)
+  {
+    for(int i = 0; i < rdmalib::Directory::CAPACITY; ++i) {
+      _free_cores[i].store(0);
+      _heartbeats[i].store(0);
+    }
+    memset(_directory.data(), 0, sizeof(rdmalib::Directory));
+    memset(_loads.data(), 0, sizeof(rdmalib::LoadReport) * rdmalib::Directory::CAPACITY);
+  }
+
+  ExecutorDB::~ExecutorDB()
+  {
+    // No reader can outlive the database
+    delete _snapshot.load();
+    for(auto & retired : _retired)
+      delete retired.second;
+  }
+
+  void ExecutorDB::register_memory(ibv_pd* pd)
+  {
+    _directory.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC);
+    _loads.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  }
+
+  rdmalib::RemoteBuffer ExecutorDB::directory() const
+  {
+    return rdmalib::RemoteBuffer(_directory.address(), _directory.rkey(), sizeof(rdmalib::Directory));
+  }
+
+  rdmalib::RemoteBuffer ExecutorDB::loads() const
+  {
+    return rdmalib::RemoteBuffer(
+      _loads.address(), _loads.rkey(), sizeof(rdmalib::LoadReport) * rdmalib::Directory::CAPACITY
+    );
+  }
+
+  bool ExecutorDB::load(int idx, rdmalib::LoadReport & report) const
+  {
+    const rdmalib::LoadReport & slot = _loads.data()[idx];
+    uint64_t version_end = slot.version_end;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    memcpy(&report, &slot, sizeof(rdmalib::LoadReport));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.version && slot.version == version_end;
+  }
+
+  std::vector<ExecutorDB::Utilization> ExecutorDB::utilization() const
+  {
+    std::vector<Utilization> result;
+    ReadGuard snapshot{*this};
+    for(size_t i = 0; i < snapshot->servers.size(); ++i) {
+      if(!snapshot->servers[i].cores)
+        continue;
+      Utilization util{snapshot->servers[i], _free_cores[i].load(std::memory_order_relaxed), {}};
+      if(!load(i, util.load))
+        util.load = rdmalib::LoadReport{};
+      result.push_back(util);
+    }
+    return result;
+  }
+
+  void ExecutorDB::publish(int idx, const rfaas::server_data & server)
+  {
+    rdmalib::Directory & dir = *_directory.data();
+    uint64_t version = dir.version + 1;
+    dir.version_end = version;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    rdmalib::DirectoryEntry & entry = dir.entries[idx];
+    entry.free_cores = server.cores;
+    entry.port = server.port;
+    entry.cores = server.cores;
+    memcpy(entry.address, server.address, sizeof(entry.address));
+    dir.size = std::max<int32_t>(dir.size, idx + 1);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    dir.version = version;
+  }
+
+  void ExecutorDB::replace(Snapshot* next)
+  {
+    const Snapshot* previous = _snapshot.exchange(next);
+    // Readers that observe the new epoch can only find the new snapshot.
+    _retired.emplace_back(global_epoch.fetch_add(1), previous);
+
+    uint64_t oldest = UINT64_MAX;
+    for(ReaderEpoch & reader : reader_epochs) {
+      uint64_t epoch = reader.epoch.load();
+      if(epoch)
+        oldest = std::min(oldest, epoch);
+    }
+    auto it = std::remove_if(_retired.begin(), _retired.end(),
+      [oldest](const std::pair<uint64_t, const Snapshot*> & retired) {
+        if(retired.first >= oldest)
+          return false;
+        delete retired.second;
+        return true;
+      }
+    );
+    _retired.erase(it, _retired.end());
+  }
+
+  ExecutorDB::ResultCode ExecutorDB::_add(Snapshot & next, const std::string & ip_address, int port, int cores)
+  {
+    if(cores <= 0 || ip_address.size() >= sizeof(rfaas::server_data::address))
+      return ResultCode::MALFORMED_DATA;
+    if(next.find(ip_address) != -1)
+      return ResultCode::EXECUTOR_EXISTS;
+
+    // Reuse the entry of a removed executor
+    int idx = 0;
+    int size = next.servers.size();
+    while(idx < size && next.servers[idx].cores > 0)
+      ++idx;
+    if(idx == size) {
+      if(size >= rdmalib::Directory::CAPACITY) {
+        spdlog::error("Can't add executor {}:{}, the directory is full", ip_address, port);
+        return ResultCode::DIRECTORY_FULL;
+      }
+      next.servers.emplace_back();
+    }
+    next.servers[idx] = rfaas::server_data{ip_address, port, static_cast<int16_t>(cores)};
+    // Readers of the previous snapshot skip the entry
+    _free_cores[idx].store(cores);
+    _heartbeats[idx].store(timestamp());
+    // FIXME: the previous executor manager of the entry can still report
+    memset(&_loads.data()[idx], 0, sizeof(rdmalib::LoadReport));
+    publish(idx, next.servers[idx]);
     //std::sort(_data._data.begin(), _data._data.end(),
     //    []
     spdlog::debug("Adding new executor with {}:{} address and {} cores", ip_address, port, cores);
     return ResultCode::OK;
   }
 
-  ExecutorDB::ResultCode ExecutorDB::remove(const std::string & ip_addresss)
+  ExecutorDB::ResultCode ExecutorDB::_remove(Snapshot & next, const std::string & ip_address)
   {
-    // Obtain write access
-    writer_lock_t lock(_mutex);
+    int idx = next.find(ip_address);
+    if(idx == -1)
+      return ResultCode::EXECUTOR_DOESNT_EXIST;
+    // FIXME: leases of the executor are not revoked
+    next.servers[idx].cores = 0;
+    _free_cores[idx].store(0);
+    publish(idx, next.servers[idx]);
+    spdlog::debug("Removing executor with {} address", ip_address);
     return ResultCode::OK;
   }
 
-  ExecutorDB::reader_lock_t ExecutorDB::read_lock()
+  ExecutorDB::ResultCode ExecutorDB::add(const std::string & ip_address, int port, int cores)
+  {
+    writer_lock_t lock(_mutex);
+    std::unique_ptr<Snapshot> next{new Snapshot{*_snapshot.load()}};
+    ResultCode ret = _add(*next, ip_address, port, cores);
+    if(ret == ResultCode::OK)
+      replace(next.release());
+    return ret;
+  }
+
+  ExecutorDB::ResultCode ExecutorDB::remove(const std::string & ip_address)
+  {
+    writer_lock_t lock(_mutex);
+    std::unique_ptr<Snapshot> next{new Snapshot{*_snapshot.load()}};
+    ResultCode ret = _remove(*next, ip_address);
+    if(ret == ResultCode::OK)
+      replace(next.release());
+    return ret;
+  }
+
+  int ExecutorDB::add(const std::vector<rfaas::server_data> & executors)
+  {
+    int failed = 0;
+    writer_lock_t lock(_mutex);
+    std::unique_ptr<Snapshot> next{new Snapshot{*_snapshot.load()}};
+    for(const rfaas::server_data & executor : executors)
+      failed += _add(*next, executor.address, executor.port, executor.cores) != ResultCode::OK;
+    replace(next.release());
+    return failed;
+  }
+
+  int ExecutorDB::remove(const std::vector<std::string> & ip_addresses)
+  {
+    int failed = 0;
+    writer_lock_t lock(_mutex);
+    std::unique_ptr<Snapshot> next{new Snapshot{*_snapshot.load()}};
+    for(const std::string & ip_address : ip_addresses)
+      failed += _remove(*next, ip_address) != ResultCode::OK;
+    replace(next.release());
+    return failed;
+  }
+
+  std::vector<std::string> ExecutorDB::heartbeat(const std::vector<std::string> & ip_addresses)
+  {
+    std::vector<std::string> unknown;
+    int64_t now = timestamp();
+    ReadGuard snapshot{*this};
+    for(const std::string & ip_address : ip_addresses) {
+      int idx = snapshot->find(ip_address);
+      if(idx != -1)
+        _heartbeats[idx].store(now, std::memory_order_relaxed);
+      else
+        unknown.push_back(ip_address);
+    }
+    return unknown;
+  }
+
+  bool ExecutorDB::lease(int cores, rdmalib::LeaseResponse & lease)
+  {
+    ReadGuard snapshot{*this};
+    const std::vector<rfaas::server_data> & servers = snapshot->servers;
+    int64_t now = timestamp();
+    int64_t timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(_heartbeat_timeout).count();
+
+    // Retry when another lease took the cores first
+    int selected;
+    while(true) {
+      selected = -1;
+      int selected_cores = 0, selected_leases = 0;
+      for(size_t i = 0; i < servers.size(); ++i) {
+        if(!servers[i].cores)
+          continue;
+        if(timeout && now - _heartbeats[i].load(std::memory_order_relaxed) > timeout)
+          continue;
+        int leases = _free_cores[i].load(std::memory_order_relaxed);
+        int free_cores = leases;
+        rdmalib::LoadReport report;
+        if(load(i, report))
+          free_cores = std::min(free_cores, servers[i].cores - report.allocated_cores);
+        if(free_cores >= cores && free_cores > selected_cores) {
+          selected = i;
+          selected_cores = free_cores;
+          selected_leases = leases;
+        }
+      }
+      if(selected == -1)
+        return false;
+      if(_free_cores[selected].compare_exchange_weak(selected_leases, selected_leases - cores))
+        break;
+    }
+
+    const rfaas::server_data & server = servers[selected];
+    lease.cores = cores;
+    lease.port = server.port;
+    strncpy(lease.address, server.address, sizeof(lease.address));
+    return true;
+  }
+
+  void ExecutorDB::release(const std::string & ip_address, int cores)
   {
-    return reader_lock_t(_mutex);
+    ReadGuard snapshot{*this};
+    int idx = snapshot->find(ip_address);
+    if(idx == -1)
+      return;
+    // FIXME: a release racing with removal can return cores to the next executor in this entry
+    int total = snapshot->servers[idx].cores;
+    int free_cores = _free_cores[idx].load(std::memory_order_relaxed);
+    while(!_free_cores[idx].compare_exchange_weak(free_cores, std::min(free_cores + cores, total)))
+      ;
   }
 
   void ExecutorDB::read(const std::string & path)
   {
     writer_lock_t lock{_mutex};
     std::ifstream in_db{path};
-    _data.read(in_db);
+    rfaas::servers data;
+    data.read(in_db);
+    if(data._data.size() > rdmalib::Directory::CAPACITY) {
+      spdlog::error("Directory holds only {} executors, got {}", rdmalib::Directory::CAPACITY, data._data.size());
+      data._data.resize(rdmalib::Directory::CAPACITY);
+    }
+    std::unique_ptr<Snapshot> next{new Snapshot{}};
+    next->servers = std::move(data._data);
+    int64_t now = timestamp();
+    for(size_t i = 0; i < next->servers.size(); ++i) {
+      _free_cores[i].store(next->servers[i].cores);
+      _heartbeats[i].store(now);
+      publish(i, next->servers[i]);
+    }
+    replace(next.release());
   }
 
   void ExecutorDB::write(const std::string & path)
   {
-    reader_lock_t lock{_mutex};
+    ReadGuard snapshot{*this};
     std::ofstream out{path};
-    _data.write(out);
+    rfaas::servers registered;
+    for(const rfaas::server_data & executor : snapshot->servers)
+      if(executor.cores > 0)
+        registered._data.push_back(executor);
+    registered.write(out);
   }
 
 }}
-
@@ -2,23 +2,73 @@
 #ifndef __RFAAS_RESOURCE_MANAGER_DB_HPP__
 #define __RFAAS_RESOURCE_MANAGER_DB_HPP__
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <iostream>
-#include <shared_mutex>
-#include <thread>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <rdmalib/allocation.hpp>
+#include <rdmalib/buffer.hpp>
 
 #include <rfaas/resources.hpp>
 
+struct ibv_pd;
+
 namespace rfaas { namespace resource_manager {
 
+  // Readers never lock the database - they use an immutable snapshot of executors.
+  // Writers are serialized, publish a modified copy, and free the previous snapshot
+  // once no reader can hold it (epoch-based reclamation).
+  // Free cores and heartbeats change on every lease, and they're kept outside snapshots,
+  // indexed like the executors. An executor keeps its index until it's removed.
   struct ExecutorDB
   {
+    struct Snapshot
+    {
+      // Removed executors leave an entry with zero cores, reused by the next one.
+      std::vector<rfaas::server_data> servers;
+
+      // Index of a registered executor, or -1
+      int find(const std::string & ip_address) const;
+    };
+
+    // Pins the current snapshot. Guards can nest, but they must not leave their thread.
+    struct ReadGuard
+    {
+      const Snapshot* _snapshot;
+
+      ReadGuard(const ExecutorDB & db);
+      ~ReadGuard();
+      ReadGuard(const ReadGuard&) = delete;
+      ReadGuard& operator=(const ReadGuard&) = delete;
+
+      const Snapshot* operator->() const
+      {
+        return _snapshot;
+      }
+    };
+
   private:
-    typedef std::shared_lock<std::shared_mutex> reader_lock_t;
-    typedef std::unique_lock<std::shared_mutex> writer_lock_t;
-    // Store the data on executors
-    rfaas::servers _data;
-    // Reader-writer lock
-    std::shared_mutex _mutex;
+    typedef std::unique_lock<std::mutex> writer_lock_t;
+    std::atomic<const Snapshot*> _snapshot;
+    // Replaced snapshots with the epoch of their replacement
+    std::vector<std::pair<uint64_t, const Snapshot*>> _retired;
+    // Cores not leased to clients
+    std::array<std::atomic<int>, rdmalib::Directory::CAPACITY> _free_cores;
+    // Time of the last heartbeat in steady clock nanoseconds; registration counts as a heartbeat
+    std::array<std::atomic<int64_t>, rdmalib::Directory::CAPACITY> _heartbeats;
+    // Executors without a heartbeat don't receive leases; zero disables it
+    std::chrono::seconds _heartbeat_timeout;
+    // Registered copy of servers, read by clients and executor managers with RDMA.
+    // Entries have the same order as servers.
+    rdmalib::Buffer<rdmalib::Directory> _directory;
+    // Written by executor managers with RDMA, in the order of servers
+    rdmalib::Buffer<rdmalib::LoadReport> _loads;
+    // Serializes writers
+    std::mutex _mutex;
 
   public:
     enum class ResultCode
@@ -26,13 +76,54 @@ namespace rfaas { namespace resource_manager {
       OK = 0,
       EXECUTOR_EXISTS = 1,
       EXECUTOR_DOESNT_EXIST = 2,
-      MALFORMED_DATA = 3
+      MALFORMED_DATA = 3,
+      DIRECTORY_FULL = 4
+    };
+
+    // Utilization of an executor manager, as seen by the resource manager
+    struct Utilization
+    {
+      rfaas::server_data server;
+      // Cores not leased to clients
+      int free_cores;
+      // Zero version when the manager hasn't reported yet
+      rdmalib::LoadReport load;
     };
 
+    ExecutorDB(int heartbeat_timeout = 0);
+    ~ExecutorDB();
+    ExecutorDB(const ExecutorDB&) = delete;
+    ExecutorDB& operator=(const ExecutorDB&) = delete;
+
+    void register_memory(ibv_pd* pd);
+    rdmalib::RemoteBuffer directory() const;
+    rdmalib::RemoteBuffer loads() const;
+    // Registered executors with their last complete load report
+    std::vector<Utilization> utilization() const;
 
     ResultCode add(const std::string & ip_address, int port, int cores);
     ResultCode remove(const std::string & ip_address);
-    reader_lock_t read_lock();
+    // Bulk updates publish a single snapshot.
+    // Return the number of entries that failed.
+    int add(const std::vector<rfaas::server_data> & executors);
+    int remove(const std::vector<std::string> & ip_addresses);
+    // Returns addresses that are not registered - they should register again.
+    std::vector<std::string> heartbeat(const std::vector<std::string> & ip_addresses);
+
+    // Picks the executor manager with most free cores; false when none has enough.
+    // Cores allocated by clients that bypass leases are known from load reports.
+    // Safe to call concurrently with updates and other leases.
+    bool lease(int cores, rdmalib::LeaseResponse & lease);
+    void release(const std::string & ip_address, int cores);
+  private:
+    // Caller holds the writer lock
+    ResultCode _add(Snapshot & next, const std::string & ip_address, int port, int cores);
+    ResultCode _remove(Snapshot & next, const std::string & ip_address);
+    void publish(int idx, const rfaas::server_data & server);
+    void replace(Snapshot* next);
+    // False when the report is being written right now, or it was never written
+    bool load(int idx, rdmalib::LoadReport & report) const;
+  public:
 
     void read(const std::string &);
     void write(const std::string &);
@@ -54,6 +54,97 @@ namespace rfaas::resource_manager {
         response.send(Pistache::Http::Code::Bad_Request);
       }
 
+    } else if(req.resource() == "/add_batch") {
+
+      // {"executors": [{"ip_address": ..., "port": ..., "cores": ...}, ...]}
+      if(!(document.IsObject() && document.HasMember("executors") && document["executors"].IsArray())) {
+        response.send(Pistache::Http::Code::Bad_Request, "Malformed Input");
+        return;
+      }
+
+      std::vector<rfaas::server_data> executors;
+      for(auto & executor : document["executors"].GetArray()) {
+        if(
+            !(executor.IsObject()) ||
+            !(executor.HasMember("ip_address")  && executor["ip_address"].IsString()) ||
+            !(executor.HasMember("port")        && executor["port"].IsInt()) ||
+            !(executor.HasMember("cores")       && executor["cores"].IsInt()) ||
+            executor["ip_address"].GetStringLength() >= sizeof(rfaas::server_data::address)
+        ) {
+          response.send(Pistache::Http::Code::Bad_Request, "Malformed Input");
+          return;
+        }
+        executors.emplace_back(
+          executor["ip_address"].GetString(), executor["port"].GetInt(), executor["cores"].GetInt()
+        );
+      }
+
+      int failed = _database.add(executors);
+      if(!failed) {
+        response.send(Pistache::Http::Code::Ok, "Sucess");
+      } else {
+        response.send(Pistache::Http::Code::Internal_Server_Error, "Failed " + std::to_string(failed));
+      }
+
+    } else if(req.resource() == "/remove_batch" || req.resource() == "/heartbeat") {
+
+      // {"executors": [ip_address, ...]}
+      if(!(document.IsObject() && document.HasMember("executors") && document["executors"].IsArray())) {
+        response.send(Pistache::Http::Code::Bad_Request, "Malformed Input");
+        return;
+      }
+
+      std::vector<std::string> executors;
+      for(auto & executor : document["executors"].GetArray()) {
+        if(!executor.IsString()) {
+          response.send(Pistache::Http::Code::Bad_Request, "Malformed Input");
+          return;
+        }
+        executors.emplace_back(executor.GetString());
+      }
+
+      if(req.resource() == "/remove_batch") {
+        int failed = _database.remove(executors);
+        if(!failed) {
+          response.send(Pistache::Http::Code::Ok);
+        } else {
+          response.send(Pistache::Http::Code::Bad_Request, "Failed " + std::to_string(failed));
+        }
+      } else {
+        // Unknown executors have to register again
+        std::string unknown = "{\"unknown\": [";
+        bool first = true;
+        for(const std::string & executor : _database.heartbeat(executors)) {
+          unknown += (first ? "\"" : ", \"") + executor + "\"";
+          first = false;
+        }
+        unknown += "]}";
+        response.send(Pistache::Http::Code::Ok, unknown);
+      }
+
+    } else if(req.resource() == "/load") {
+
+      // Executors without a load report have zero version
+      std::string load = "{\"executors\": [";
+      bool first = true;
+      for(const ExecutorDB::Utilization & util : _database.utilization()) {
+        load += std::string{first ? "" : ", "} +
+          "{\"ip_address\": \"" + util.server.address + "\"" +
+          ", \"port\": " + std::to_string(util.server.port) +
+          ", \"cores\": " + std::to_string(util.server.cores) +
+          ", \"free_cores\": " + std::to_string(util.free_cores) +
+          ", \"version\": " + std::to_string(util.load.version) +
+          ", \"clients\": " + std::to_string(util.load.clients) +
+          ", \"executors\": " + std::to_string(util.load.executors) +
+          ", \"allocated_cores\": " + std::to_string(util.load.allocated_cores) +
+          ", \"requests\": " + std::to_string(util.load.requests) +
+          ", \"hot_polling_time\": " + std::to_string(util.load.hot_polling_time) +
+          ", \"execution_time\": " + std::to_string(util.load.execution_time) + "}";
+        first = false;
+      }
+      load += "]}";
+      response.send(Pistache::Http::Code::Ok, load);
+
     } else {
       response.send(Pistache::Http::Code::Not_Found, "Operation not supported");
     }
@@ -66,7 +157,8 @@ namespace rfaas::resource_manager {
       "[HTTPServer] Initialize on adddress {} and port {}",
       settings.http_network_address, settings.http_network_port
     );
-    auto opts = Pistache::Http::Endpoint::options().threads(1);
+    spdlog::info("[HTTPServer] Serving requests with {} threads", settings.http_threads);
+    auto opts = Pistache::Http::Endpoint::options().threads(settings.http_threads);
     _server.init(opts);
     _server.setHandler(Pistache::Http::make_handler<HTTPHandler>(db));
   }
@@ -1,25 +1,49 @@
 
+#include <cstring>
 #include <stdexcept>
 
+#include <poll.h>
+
 #include <spdlog/spdlog.h>
 
+#include <rdmalib/util.hpp>
+
 #include "manager.hpp"
 #include "rdmalib/connection.hpp"
 
 namespace rfaas::resource_manager {
 
   constexpr int Manager::POLLING_TIMEOUT_MS;
+  constexpr int Manager::RECEIVES;
+  constexpr int Manager::BATCH;
 
   Manager::Manager(Settings & settings):
+    _executor_data(settings.heartbeat_timeout),
     _executors_output_path(),
     _state(settings.device->ip_address, settings.rdma_device_port,
         settings.device->default_receive_buffer_size, true,
         settings.device->max_inline_data),
     _shutdown(false),
+    // Each request can have its response in flight
+    _queues(_state.pd(), 2 * RECEIVES, RECEIVES),
+    _requests(RECEIVES),
+    _responses(RECEIVES),
+    _directory_info(1),
+    _lease_id(0),
     _http_server(_executor_data, settings)
   {
-
-
+    _requests.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _responses.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    _executor_data.register_memory(_state.pd());
+    rdmalib::RemoteBuffer directory = _executor_data.directory();
+    rdmalib::RemoteBuffer loads = _executor_data.loads();
+    *_directory_info.data() = rdmalib::DirectoryInformation{
+      {directory.addr, directory.rkey}, {loads.addr, loads.rkey}
+    };
+    _directory_info.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    for(int i = 0; i < RECEIVES; ++i)
+      post_receive(i);
+    _state.share_queues(_queues);
   }
 
   void Manager::start()
@@ -46,46 +70,202 @@ namespace rfaas::resource_manager {
       if(!result)
         continue;
 
+      // All QPs share our CQ and receive queue
       auto [conn, conn_status] = _state.poll_events(
-        false
+        true
       );
       if(conn == nullptr){
         spdlog::error("Failed connection creation");
         continue;
       }
       if(conn_status == rdmalib::ConnectionStatus::DISCONNECTED) {
-        // FIXME: handle disconnect
         spdlog::debug("[Manager-listen] Disconnection on connection {}", fmt::ptr(conn));
-        continue;
+        _rdma_queue.enqueue(std::make_pair(conn, conn_status));
       } else if(conn_status == rdmalib::ConnectionStatus::REQUESTED) {
+        // The client can send its first request as soon as we accept,
+        // before we see the connection established.
+        SPDLOG_DEBUG("[Manager] Listen thread: accepting new client");
+        _rdma_queue.enqueue(std::make_pair(conn, conn_status));
         _state.accept(conn);
       } else if(conn_status == rdmalib::ConnectionStatus::ESTABLISHED) {
-        // Accept client connection and push
         SPDLOG_DEBUG("[Manager] Listen thread: connected new client");
-        _rdma_queue.enqueue(conn);
       }
     }
     spdlog::info("Background thread stops waiting for rdmacm events");
   }
 
-  // For each connection in the queue, add it to the vector of connections
+  // Serve lease requests of all connections, a batch of completions at a time
   void Manager::process_rdma()
   {
-    std::vector<rdmalib::Connection*> vec;
+    bool notified = false;
     while(!_shutdown.load()) {
-      rdmalib::Connection* conn;
-      if(_rdma_queue.wait_dequeue_timed(conn, std::chrono::milliseconds(POLLING_TIMEOUT_MS))) {
-        spdlog::debug("[Manager] connected new client/executor");
-        vec.push_back(conn);
+      receive_connections();
+      int count = _queues.poll(BATCH, _wcs.data());
+      if(count < 0) {
+        spdlog::error("Failed to poll the CQ, return value {}, errno {}", count, errno);
+        continue;
+      }
+      if(count > 0) {
+        process_requests(count);
+        notified = false;
+        continue;
       }
+      // Completions arriving before the notification request would not generate an event,
+      // we poll once more before going to sleep.
+      if(!notified) {
+        _queues.notify();
+        notified = true;
+        continue;
+      }
+      if(wait_events())
+        notified = false;
     }
 
-    for(rdmalib::Connection* conn : vec)
+    for(auto & [qp_num, conn] : _connections)
       delete conn;
+    _connections.clear();
 
     spdlog::info("Background thread stops processing rdmacm events");
   }
 
+  void Manager::receive_connections()
+  {
+    std::pair<rdmalib::Connection*, rdmalib::ConnectionStatus> event;
+    while(_rdma_queue.try_dequeue(event)) {
+      rdmalib::Connection* conn = event.first;
+      if(event.second == rdmalib::ConnectionStatus::REQUESTED) {
+        spdlog::debug("[Manager] connected new client/executor");
+        _connections[conn->qp_num()] = conn;
+        continue;
+      }
+
+      // Leases of a disconnected client return to executor managers
+      for(auto it = _leases.begin(); it != _leases.end();) {
+        if(it->second.client == conn) {
+          _executor_data.release(it->second.address, it->second.cores);
+          it = _leases.erase(it);
+        } else
+          ++it;
+      }
+      for(auto it = _connections.begin(); it != _connections.end(); ++it)
+        if(it->second == conn) {
+          _connections.erase(it);
+          break;
+        }
+      delete conn;
+    }
+  }
+
+  void Manager::process_requests(int count)
+  {
+    std::array<std::pair<int, rdmalib::Connection*>, BATCH> requests;
+    int requests_count = 0;
+    for(int i = 0; i < count; ++i) {
+      ibv_wc & wc = _wcs[i];
+      int slot = wc.wr_id;
+      // Failed completions have no opcode
+      if(wc.status != IBV_WC_SUCCESS) {
+        spdlog::error(
+          "Work completion of QP {} finished with an error {}, {}",
+          wc.qp_num, wc.status, ibv_wc_status_str(wc.status)
+        );
+        post_receive(slot);
+        continue;
+      }
+      // The response has been sent
+      if(!(wc.opcode & IBV_WC_RECV)) {
+        post_receive(slot);
+        continue;
+      }
+      // The listener hands the connection over before accepting it
+      auto it = _connections.find(wc.qp_num);
+      if(it == _connections.end()) {
+        receive_connections();
+        it = _connections.find(wc.qp_num);
+      }
+      if(it == _connections.end()) {
+        post_receive(slot);
+        continue;
+      }
+      requests[requests_count++] = std::make_pair(slot, it->second);
+    }
+    if(!requests_count)
+      return;
+
+    // Leases don't lock the database, and HTTP updates don't delay them
+    for(int i = 0; i < requests_count; ++i) {
+      auto [slot, conn] = requests[i];
+      const rdmalib::LeaseRequest & request = _requests.data()[slot];
+      rdmalib::LeaseResponse & response = _responses.data()[slot];
+      if(request.cores > 0) {
+        if(_executor_data.lease(request.cores, response)) {
+          response.lease_id = ++_lease_id;
+          _leases.emplace(
+            response.lease_id,
+            Lease{
+              std::string{response.address, strnlen(response.address, sizeof(response.address))},
+              response.cores, conn
+            }
+          );
+          SPDLOG_DEBUG("Lease {} of {} cores at {}:{}", response.lease_id, response.cores, response.address, response.port);
+        } else {
+          spdlog::info("No executor manager has {} free cores", request.cores);
+          response = rdmalib::LeaseResponse{};
+        }
+      } else if(request.cores < 0) {
+        SPDLOG_DEBUG("Send location of the executor directory");
+      } else {
+        auto lease = _leases.find(request.lease_id);
+        if(lease != _leases.end() && lease->second.client == conn) {
+          SPDLOG_DEBUG("Release lease {}", request.lease_id);
+          _executor_data.release(lease->second.address, lease->second.cores);
+          _leases.erase(lease);
+        }
+        // Releases are not acknowledged
+        requests[i].second = nullptr;
+      }
+    }
+
+    for(int i = 0; i < requests_count; ++i) {
+      auto [slot, conn] = requests[i];
+      if(!conn) {
+        post_receive(slot);
+        continue;
+      }
+      rdmalib::ScatterGatherElement sge;
+      if(_requests.data()[slot].cores < 0)
+        sge.add(_directory_info, sizeof(rdmalib::DirectoryInformation), 0);
+      else
+        sge.add(_responses, sizeof(rdmalib::LeaseResponse), slot * sizeof(rdmalib::LeaseResponse));
+      if(conn->post_send(sge, slot) == -1)
+        post_receive(slot);
+    }
+  }
+
+  void Manager::post_receive(int slot)
+  {
+    ibv_sge sge;
+    sge.addr = _requests.address() + slot * sizeof(rdmalib::LeaseRequest);
+    sge.length = sizeof(rdmalib::LeaseRequest);
+    sge.lkey = _requests.lkey();
+    ibv_recv_wr wr{}, *bad = nullptr;
+    wr.wr_id = slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    int ret = _queues.post_recv(&wr, &bad);
+    if(ret)
+      spdlog::error("Failed to post receive {}, reason {}", slot, strerror(ret));
+  }
+
+  bool Manager::wait_events()
+  {
+    pollfd fd{_queues.fd(), POLLIN, 0};
+    if(poll(&fd, 1, POLLING_TIMEOUT_MS) <= 0)
+      return false;
+    _queues.acknowledge();
+    return true;
+  }
+
   void Manager::shutdown()
   {
     _shutdown.store(true);
@@ -2,6 +2,7 @@
 #ifndef __RFAAS_RESOURCE_MANAGER__
 #define __RFAAS_RESOURCE_MANAGER__
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
@@ -9,7 +10,9 @@
 #include <mutex>
 #include <map>
 #include <optional>
+#include <unordered_map>
 
+#include <rdmalib/allocation.hpp>
 #include <rdmalib/connection.hpp>
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/server.hpp>
@@ -23,10 +26,6 @@
 #include "http.hpp"
 #include "settings.hpp"
 
-namespace rdmalib {
-  struct AllocationRequest;
-}
-
 namespace rfaas::resource_manager {
 
   struct Options {
@@ -38,6 +37,13 @@ namespace rfaas::resource_manager {
   };
   Options opts(int, char**);
 
+  struct Lease
+  {
+    std::string address;
+    int cores;
+    rdmalib::Connection* client;
+  };
+
   struct Manager
   {
     //moodycamel::ReaderWriterQueue<std::pair<int,Client>> _q2;
@@ -50,11 +56,27 @@ namespace rfaas::resource_manager {
 
     // Handling RDMA connections with clients and executor managers
     moodycamel::BlockingReaderWriterQueue<
-      rdmalib::Connection*
+      std::pair<rdmalib::Connection*, rdmalib::ConnectionStatus>
     > _rdma_queue;
     rdmalib::RDMAPassive _state;
     std::atomic<bool> _shutdown;
 
+    // Lease requests of all connections arrive through a shared receive queue into
+    // a single slab. The response uses the entry of the request, and the receive
+    // is posted again once the response has been sent.
+    static constexpr int RECEIVES = 256;
+    static constexpr int BATCH = 32;
+    rdmalib::SharedQueues _queues;
+    rdmalib::Buffer<rdmalib::LeaseRequest> _requests;
+    rdmalib::Buffer<rdmalib::LeaseResponse> _responses;
+    // Location of the executor directory, sent on request
+    rdmalib::Buffer<rdmalib::DirectoryInformation> _directory_info;
+    std::array<ibv_wc, BATCH> _wcs;
+    // Owned by the RDMA processing thread
+    std::unordered_map<uint32_t, rdmalib::Connection*> _connections;
+    std::unordered_map<uint32_t, Lease> _leases;
+    uint32_t _lease_id;
+
     // Handling HTTP events
     HTTPServer _http_server;
 
@@ -72,6 +94,12 @@ namespace rfaas::resource_manager {
 
     void listen_rdma();
     void process_rdma();
+    // Takes connections and disconnections handed over by the listener.
+    void receive_connections();
+    void process_requests(int count);
+    void post_receive(int slot);
+    // Sleeps until new completions arrive; false on timeout.
+    bool wait_events();
   };
 
 }
@@ -18,6 +18,15 @@ namespace rfaas::resource_manager {
       throw std::runtime_error{"Unknown device!"};
     }
     settings.device = dev;
+
+    if(settings.http_threads < 1) {
+      spdlog::error("Number of HTTP threads must be positive, got {}", settings.http_threads);
+      throw std::runtime_error{"Incorrect number of HTTP threads!"};
+    }
+    if(settings.heartbeat_timeout < 0) {
+      spdlog::error("Heartbeat timeout can't be negative, got {}", settings.heartbeat_timeout);
+      throw std::runtime_error{"Incorrect heartbeat timeout!"};
+    }
     return settings;
   }
 
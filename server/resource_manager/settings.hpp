@@ -21,13 +21,17 @@ namespace rfaas::resource_manager {
     
     std::string http_network_address;
     uint16_t http_network_port;
+    int http_threads;
+    // Seconds without a heartbeat after which an executor receives no leases; zero disables
+    int heartbeat_timeout;
 
     template <class Archive>
     void load(Archive & ar )
     {
       ar(
         CEREAL_NVP(rdma_device), CEREAL_NVP(rdma_device_port),
-        CEREAL_NVP(http_network_address), CEREAL_NVP(http_network_port)
+        CEREAL_NVP(http_network_address), CEREAL_NVP(http_network_port),
+        CEREAL_NVP(http_threads), CEREAL_NVP(heartbeat_timeout)
       );
     }
 